@@ -46,6 +46,8 @@ enum {
     ATS_BAN_PLAYER,
     ATS_MUTE_PLAYER,
     ATS_RESET_SETTINGS,
+    ATS_GET_LOCK_PROFILE,
+    ATS_GET_NET_STATS,
 
     NUMBER_OF_ATS
 };
@@ -70,6 +72,8 @@ enum {
     STA_PLAYER_PING,
     STA_ADMIN_MESSAGE,
     STA_PLAYER_IP,
+    STA_LOCK_PROFILE,                   //one line of the lock contention profile <string line>
+    STA_NET_STATS,                      //counters of packets from unconnected addresses <string line>
 
     NUMBER_OF_STA
 };
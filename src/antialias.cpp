@@ -23,6 +23,10 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstring>
+#include "function_utility.h"
+#include "mutex.h"
+#include "thread.h"
 #include "world.h"
 
 #include "antialias_internal.h"
@@ -35,6 +39,77 @@ using std::max;
 using std::pair;
 using std::swap;
 
+/* The renderer writes memory bitmaps directly, as Allegro would in solid mode, so that rooms can be rendered in a
+ * background thread without depending on the global drawing mode. Other bitmaps are written through Allegro, in
+ * which case the caller must have solid mode set.
+ */
+
+// rows are clipped like hline does; returns false if nothing of [x0, x1[ on row y is left
+static inline bool clipSpan(BITMAP* b, int& x0, int& x1, int y) throw () {
+    if (b->clip) {
+        if (y < b->ct || y >= b->cb)
+            return false;
+        x0 = max(x0, b->cl);
+        x1 = min(x1, b->cr);
+    }
+    return x0 < x1;
+}
+
+static void solidSpan(BITMAP* b, int x0, int x1, int y, int color) throw () {  // fills [x0, x1[ on row y
+    if (!is_memory_bitmap(b)) {
+        hline(b, x0, y, x1 - 1, color);
+        return;
+    }
+    if (!clipSpan(b, x0, x1, y))
+        return;
+    switch (bitmap_color_depth(b)) {
+    /*break;*/ case 8:
+            memset(b->line[y] + x0, color, x1 - x0);
+        break; case 15: case 16: {
+            uint16_t* const row = reinterpret_cast<uint16_t*>(b->line[y]);
+            std::fill(row + x0, row + x1, static_cast<uint16_t>(color));
+        }
+        break; case 24:
+            for (int x = x0; x < x1; ++x)
+                _putpixel24(b, x, y, color);
+        break; case 32: {
+            uint32_t* const row = reinterpret_cast<uint32_t*>(b->line[y]);
+            std::fill(row + x0, row + x1, static_cast<uint32_t>(color));
+        }
+        break; default: numAssert(0, bitmap_color_depth(b));
+    }
+}
+
+// the mask Allegro's drawing_mode uses for a pattern dimension: the largest power of two not greater than size, less one
+static int patternMask(int size) throw () {
+    int m = 1;
+    while (m < size)
+        m <<= 1;
+    if (m > size)
+        m >>= 1;
+    return m - 1;
+}
+
+// fills [x0, x1[ on row y like hline in DRAW_MODE_COPY_PATTERN with anchor (tx0, ty0)
+static void patternSpan(BITMAP* b, int x0, int x1, int y, BITMAP* tex, int tx0, int ty0) throw () {
+    if (!is_memory_bitmap(b) || !is_memory_bitmap(tex) || bitmap_color_depth(tex) != bitmap_color_depth(b)) {
+        drawing_mode(DRAW_MODE_COPY_PATTERN, tex, tx0, ty0);
+        hline(b, x0, y, x1 - 1, 0);
+        solid_mode();
+        return;
+    }
+    if (!clipSpan(b, x0, x1, y))
+        return;
+    const int xMask = patternMask(tex->w), bytesPerPixel = (bitmap_color_depth(b) + 7) / 8;
+    const unsigned char* const src = tex->line[(y - ty0) & patternMask(tex->h)];
+    unsigned char* const dst = b->line[y];
+    for (int x = x0; x < x1; ) {
+        const int sx = (x - tx0) & xMask, n = min(x1 - x, xMask + 1 - sx);
+        memcpy(dst + x * bytesPerPixel, src + sx * bytesPerPixel, n * bytesPerPixel);
+        x += n;
+    }
+}
+
 double CurveFunction::operator()(double y) const throw () {
     numAssert3(r2 - (y - cy)*(y - cy) >= 0, r2 * 1000., y * 1000., cy * 1000.);
     return cx + sqrt(r2 - (y - cy)*(y - cy)) * sideMul;
@@ -215,22 +290,44 @@ void renderLine(double y0, double y1, const BorderFunctionBase& fl, const Border
     }
 }
 
+/* Only rows [row0, row1[ are drawn, so that a scene can be split to bands rendered independently. The texturizers
+ * compute their position on a row from y alone in setLine, so the rows of the element above the band are skipped
+ * by starting at the first row of the band, with exactly the same pixels as a single pass.
+ */
 template<class Texturizer>
-void renderBlock(double y0, double y1, const BorderFunctionBase& fl, const BorderFunctionBase& fr, Texturizer& tex) throw () {
-    tex.setLine(static_cast<int>(floor(y0)));
+void renderBlock(double y0, double y1, const BorderFunctionBase& fl, const BorderFunctionBase& fr, Texturizer& tex, int row0, int row1) throw () {
+    int row = static_cast<int>(floor(y0));
+    if (row >= row1 || static_cast<int>(floor(y1)) < row0)
+        return;
     if (ceil(y0) >= y1) {
-        if (y1 > y0)
+        if (y1 > y0 && row >= row0) {
+            tex.setLine(row);
             renderLine(y0, y1, fl, fr, tex);
+        }
         return;
     }
-    renderLine(y0, ceil(y0), fl, fr, tex);
-    tex.nextLine();
+    const bool startsAbove = row < row0;
+    if (!startsAbove) {
+        tex.setLine(row);
+        renderLine(y0, ceil(y0), fl, fr, tex);
+        tex.nextLine();
+    }
+    ++row;
+    y0 = ceil(y0);
+    if (startsAbove) {
+        y0 += row0 - row;
+        row = row0;
+        tex.setLine(row);
+    }
     const double y1f = floor(y1);
-    for (y0 = ceil(y0); y0 < y1f; ++y0) {
+    for (; y0 < y1f; ++y0, ++row) {
+        if (row >= row1)
+            return;
         renderLine(y0, y0 + 1, fl, fr, tex);
         tex.nextLine();
     }
-    renderLine(y1f, y1, fl, fr, tex);
+    if (row < row1)
+        renderLine(y1f, y1, fl, fr, tex);
 }
 
 DrawElement::DrawElement(BorderFunctionBase* flp, BorderFunctionBase* frp, double y0_, double y1_, vector<int> tex) throw () :
@@ -723,7 +820,7 @@ list<DrawElement> assembleScene(const vector<ObjectSource>& objects) throw () {
 void PartialPixelSegment::draw(BITMAP* buf, int y) const throw () {
     for (size_t i = 0; i < pixels.size(); ++i)
         if (pixels[i].draw())
-            putpixel(buf, startx + i, y, pixels[i].flexColor());
+            solidSpan(buf, startx + i, startx + i + 1, y, pixels[i].flexColor());
 }
 
 void Texturizer::render(const vector<int>& textures, const DrawElement* elp) throw () {
@@ -734,11 +831,11 @@ void Texturizer::render(const vector<int>& textures, const DrawElement* elp) thr
         switch (texTab[texid].type()) {
         /*break;*/ case TextureData::T_solid: {
                 SolidTexturizer tex(*this, data.s);
-                renderBlock(elp->getY0(), elp->getY1(), elp->getLeft(), elp->getRight(), tex);
+                renderBlock(elp->getY0(), elp->getY1(), elp->getLeft(), elp->getRight(), tex, row0 - by0, row1 - by0);
             }
             break; case TextureData::T_texture: {
                 TextureTexturizer tex(*this, data.t);
-                renderBlock(elp->getY0(), elp->getY1(), elp->getLeft(), elp->getRight(), tex);
+                renderBlock(elp->getY0(), elp->getY1(), elp->getLeft(), elp->getRight(), tex, row0 - by0, row1 - by0);
             }
             break; case TextureData::T_flagmarker: default: nAssert(0);
         }
@@ -757,7 +854,7 @@ void Texturizer::render(const vector<int>& textures, const DrawElement* elp) thr
                 break; default: nAssert(0);
             }
         }
-        renderBlock(elp->getY0(), elp->getY1(), elp->getLeft(), elp->getRight(), tex);
+        renderBlock(elp->getY0(), elp->getY1(), elp->getLeft(), elp->getRight(), tex, row0 - by0, row1 - by0);
     }
 }
 
@@ -829,7 +926,7 @@ inline void Texturizer::putPix(int color, int alpha) throw () {
 }
 
 void Texturizer::finalize() throw () {
-    for (int y = 0; y < buf->h; ++y) {
+    for (int y = row0; y < row1; ++y) {
         list<PartialPixelSegment>& row = partials[y];
         for (list<PartialPixelSegment>::const_iterator si = row.begin(); si != row.end(); ++si)
             si->draw(buf, y);
@@ -848,7 +945,7 @@ void SolidTexturizer::putPix(double alpha) throw () {
 void SolidTexturizer::putSpan(int x0, int x1, double alpha) throw () { // fills the range [x0,x1[
     nAssert(x0 < x1);   // empty spans aren't tolerated
     if (alpha >= .999)
-        hline(host.getBuf(), x0 + host.getbx0(), host.getby(), x1 + host.getbx0() - 1, color);
+        solidSpan(host.getBuf(), x0 + host.getbx0(), x1 + host.getbx0(), host.getby(), color);
     else {
         startPixSpan(x0);
         const int iAlpha = static_cast<int>(ldexp(alpha, PartialPixelSegment::scale));
@@ -891,9 +988,7 @@ void TextureTexturizer::nextLine() throw () {
 void TextureTexturizer::putSpan(int x0, int x1, double alpha) throw () {   // fills the range [x0,x1[
     nAssert(x0 < x1);   // empty spans aren't tolerated
     if (alpha >= .999) {
-        drawing_mode(DRAW_MODE_COPY_PATTERN, tex, tx0, ty0);
-        hline(host.getBuf(), x0 + host.getbx0(), host.getby(), x1 + host.getbx0() - 1, 0);
-        solid_mode();
+        patternSpan(host.getBuf(), x0 + host.getbx0(), x1 + host.getbx0(), host.getby(), tex, tx0, ty0);
     }
     else {
         startPixSpan(x0);
@@ -1308,3 +1403,120 @@ void SceneAntialiaser::render(Texturizer& tex) const throw () {
     for (list<DrawElement>::const_iterator ei = drawEls.begin(); ei != drawEls.end(); ++ei)
         tex.render(ei->getAllTextures(), &*ei);
 }
+
+static const int bandsPerThread = 4;    // bands are taken in turn, so that threads that get the busier rows don't hold the rest up
+static const int minBandHeight = 16;    // lower than this isn't worth the overhead of a band
+
+/// The bands of one scene, taken in turn by the threads rendering it.
+class BandRenderWorkers::Scene : private NoCopying {
+public:
+    Scene(const list<DrawElement>& elements_, BITMAP* buffer_, int x0_, int y0_, const vector<TextureData>& textures_, int bands_) throw () :
+        elements(elements_), buffer(buffer_), x0(x0_), y0(y0_), textures(textures_), bands(bands_), next(0), mutex("BandRenderWorkers::Scene::mutex") { }
+
+    /// Render bands until there are none left.
+    void work() throw () {
+        for (;;) {
+            int band;
+            {
+                Lock ml(mutex);
+                if (next == bands)
+                    return;
+                band = next++;
+            }
+            Texturizer tex(buffer, x0, y0, textures, buffer->h * band / bands, buffer->h * (band + 1) / bands);
+            for (list<DrawElement>::const_iterator ei = elements.begin(); ei != elements.end(); ++ei)
+                tex.render(ei->getAllTextures(), &*ei);
+            tex.finalize();
+        }
+    }
+
+    const list<DrawElement>& elements;
+    BITMAP* buffer;
+    int x0, y0;
+    const vector<TextureData>& textures;
+    int bands;
+    int next;   // the first band not yet taken
+    Mutex mutex;
+};
+
+BandRenderWorkers::BandRenderWorkers() throw () :
+    started(0),
+    quitFlag(false),
+    scene(0),
+    generation(0),
+    allowed(0),
+    joined(0),
+    active(0),
+    wakeup("BandRenderWorkers::wakeup"),
+    done("BandRenderWorkers::done"),
+    mutex("BandRenderWorkers::mutex"),
+    runMutex("BandRenderWorkers::runMutex")
+{ }
+
+BandRenderWorkers::~BandRenderWorkers() throw () {
+    {
+        Lock ml(mutex);
+        quitFlag = true;
+        wakeup.broadcast();
+    }
+    for (int i = 0; i < started; ++i)
+        threads[i].join();
+}
+
+void BandRenderWorkers::run(Scene& s, int helpers) throw () {
+    nAssert(helpers >= 0 && helpers <= maxHelpers);
+    Lock rl(runMutex);  // one scene at a time
+    {
+        Lock ml(mutex);
+        for (; started < helpers; ++started)
+            threads[started].start_assert("BandRenderWorkers::threadMain", RedirectToMemFun0<BandRenderWorkers, void>(this, &BandRenderWorkers::threadMain), Thread::getCallerPriority());
+        scene = &s;
+        allowed = helpers;
+        joined = 0;
+        ++generation;
+        wakeup.broadcast();
+    }
+    s.work();   // help with the work rather than just wait
+    Lock ml(mutex);
+    scene = 0;  // the workers that haven't joined yet would find no bands left
+    while (active)
+        done.wait(mutex);
+}
+
+void BandRenderWorkers::threadMain() throw () {
+    Lock ml(mutex);
+    unsigned seen = generation - 1; // started by run for the current scene
+    for (;;) {
+        while (!quitFlag && generation == seen)
+            wakeup.wait(mutex);
+        if (quitFlag)
+            return;
+        seen = generation;
+        if (!scene || joined == allowed)
+            continue;
+        Scene* const s = scene;
+        ++joined;
+        ++active;
+        {
+            Unlock mu(mutex);
+            s->work();
+        }
+        if (--active == 0)
+            done.signal();
+    }
+}
+
+void SceneAntialiaser::renderBanded(BITMAP* buffer, int x0, int y0, const vector<TextureData>& textures, int threads, BandRenderWorkers& workers) const throw () {
+    if (!is_memory_bitmap(buffer))  // drawn through Allegro, which isn't thread safe
+        threads = 1;
+    threads = max(1, min(min(threads, BandRenderWorkers::maxHelpers + 1), buffer->h / (bandsPerThread * minBandHeight)));
+    if (threads == 1) {
+        Texturizer tex(buffer, x0, y0, textures);
+        render(tex);
+        tex.finalize();
+        return;
+    }
+    const list<DrawElement> drawEls = assembleScene(objects);
+    BandRenderWorkers::Scene scene(drawEls, buffer, x0, y0, textures, threads * bandsPerThread);
+    workers.run(scene, threads - 1);
+}
@@ -27,7 +27,9 @@
 #include <vector>
 #include <list>
 #include "incalleg.h"
+#include "mutex.h"
 #include "nassert.h"
+#include "thread.h"
 #include "utility.h"
 
 // // // // internal definitions
@@ -173,8 +175,9 @@ class Texturizer {
 public:
     // caution: because of Allegro's limitations, textures used as non-overlays must have their width and height a power of two; this is not checked!
     // also, textures (overlay or not) may not be used in areas where x < tex.x0 || y < tex.y0 ; by selecting x0 and y0 < 0 you can avoid this problem
-    Texturizer(BITMAP* buffer, int x0, int y0, const std::vector<TextureData>& textures) throw ()
-                    : buf(buffer), bx0(x0), by0(y0), texTab(textures), partials(buffer->h) { }
+    // only the buffer rows [firstRow, endRow[ are drawn; by default all of them
+    Texturizer(BITMAP* buffer, int x0, int y0, const std::vector<TextureData>& textures, int firstRow = 0, int endRow = -1) throw ()
+                    : buf(buffer), bx0(x0), by0(y0), row0(firstRow), row1(endRow < 0 ? buffer->h : endRow), texTab(textures), partials(buffer->h) { }
 
     void render(const std::vector<int>& textures, const DrawElement* elp) throw ();
     void finalize() throw ();    // draws all buffered pixels (use only when no longer drawing)
@@ -196,6 +199,7 @@ private:
     BITMAP* buf;
     int bx, by; // active pixel in buf
     int bx0, by0;   // buffer pixel offset
+    int row0, row1; // the band of buffer rows drawn
 
     const std::vector<TextureData>& texTab;
 
@@ -205,6 +209,35 @@ private:
     int spanEnd;    // when we must move to the next segment to continue adding pixels
 };
 
+/** Threads helping SceneAntialiaser::renderBanded, kept between scenes so that a render doesn't start and join threads.
+ * The threads are started as they're first needed, and only one scene is rendered at a time.
+ */
+class BandRenderWorkers : private NoCopying {
+public:
+    static const int maxHelpers = 3;
+
+    class Scene;
+
+    BandRenderWorkers() throw ();
+    ~BandRenderWorkers() throw ();
+
+    void run(Scene& scene, int helpers) throw ();   ///< render scene with the calling thread and helpers workers, returning when it's done
+
+private:
+    void threadMain() throw ();
+
+    Thread threads[maxHelpers];
+    int started;
+    bool quitFlag;
+    Scene* scene;       // the scene being rendered, or 0 when it's no longer open for workers to join
+    unsigned generation;    // incremented with each scene
+    int allowed, joined;    // how many workers may join the current scene, and how many have
+    int active;         // how many workers are rendering
+    ConditionVariable wakeup, done;
+    Mutex mutex;
+    Mutex runMutex;
+};
+
 class SceneAntialiaser : private NoCopying {
 public:
     SceneAntialiaser() throw () { }
@@ -229,6 +262,11 @@ public:
     void clipFrom(int base) throw () { clip(base); }
 
     void render(Texturizer& tex) const throw ();
+    /** Render to buffer like render(Texturizer(buffer, x0, y0, textures)) followed by finalize, splitting the rows to
+     * bands drawn by the calling thread and up to threads - 1 threads of workers. The result is identical to a single
+     * pass. Only memory bitmaps are drawn by several threads.
+     */
+    void renderBanded(BITMAP* buffer, int x0, int y0, const std::vector<TextureData>& textures, int threads, BandRenderWorkers& workers) const throw ();
 
 private:
     void createClipFns() throw ();
@@ -326,7 +326,7 @@ ConstDataBlockRef BinaryDataBlockReader::getBlock(unsigned length) throw (ReadOu
 ConstDataBlockRef BinaryDataBlockReader::getBlockUpTo(unsigned length) throw () {
     if (pos + length > dataLength)
         length = dataLength - pos;
-    pos = dataLength;
+    pos += length;
     return ConstDataBlockRef(data + pos - length, length);
 }
 
@@ -124,6 +124,8 @@ protected:
     void reserve(unsigned capacityRequired) throw () { if (capacityRequired > capacity) reallocate(capacityRequired); }
     virtual void reallocate(unsigned capacityRequired) throw () { numAssert2(0, capacity, capacityRequired); }
 
+    template<bool Checked> friend class FastBinaryWriter;
+
 public:
     BinaryWriter(void* buffer, unsigned bufSize) throw () : data(static_cast<uint8_t*>(buffer)), capacity(bufSize), pos(0) { }
     BinaryWriter(DataBlockRef block) throw () : data(static_cast<uint8_t*>(block.data())), capacity(block.size()), pos(0) { }
@@ -0,0 +1,145 @@
+/*
+ *  bitaccess.h
+ *
+ *  Copyright (C) 2008 - Niko Ritari
+ *
+ *  This file is part of Outgun.
+ *
+ *  Outgun is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Outgun is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Outgun; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef BITACCESS_H_INC
+#define BITACCESS_H_INC
+
+#include "binaryaccess.h"
+#include "nassert.h"
+#include "utility.h"
+
+/** Bit-level writer on top of a byte writer.
+ * Bits are stored most significant first. ByteWriter can be anything with an U8 method, typically a BinaryWriter
+ * or a FastBinaryWriter. The last byte is padded with zero bits by flush(), which must be called before the byte
+ * writer is used directly again.
+ */
+template<class ByteWriter> class BitWriter : private NoCopying {
+public:
+    BitWriter(ByteWriter& target) throw () : out(target), acc(0), nAcc(0) { }
+    ~BitWriter() throw () { nAssert(nAcc == 0); }  // flush() forgotten
+
+    void write(uint32_t value, unsigned bits) throw () {
+        numAssert(bits <= 32, bits);
+        numAssert2(bits == 32 || value >> bits == 0, value, bits);
+        acc = acc << bits | value;
+        nAcc += bits;
+        while (nAcc >= 8) {
+            nAcc -= 8;
+            out.U8(static_cast<uint8_t>(acc >> nAcc));
+        }
+        acc &= (1 << nAcc) - 1;
+    }
+    void flush() throw () {
+        if (nAcc)
+            write(0, 8 - nAcc);
+    }
+
+private:
+    ByteWriter& out;
+    uint64_t acc;   // the low nAcc bits are pending
+    unsigned nAcc;  // always < 8 between calls
+};
+
+/// Bit-level reader of data written by a BitWriter.
+class BitReader {
+public:
+    BitReader(ConstDataBlockRef block) throw () : data(static_cast<const uint8_t*>(block.data())), sizeBits(block.size() * 8), pos(0) { }
+
+    uint32_t read(unsigned bits) throw (BinaryReader::ReadOutside) {
+        numAssert(bits <= 32, bits);
+        if (bits > sizeBits - pos)
+            throw BinaryReader::ReadOutside();
+        uint32_t value = 0;
+        while (bits) {
+            const unsigned avail = 8 - (pos & 7), take = avail < bits ? avail : bits;
+            const unsigned chunk = (data[pos >> 3] >> (avail - take)) & ((1 << take) - 1);
+            value = static_cast<uint32_t>((uint64_t(value) << take) | chunk);
+            pos += take;
+            bits -= take;
+        }
+        return value;
+    }
+    unsigned bytesUsed() const throw () { return (pos + 7) / 8; }
+
+private:
+    const uint8_t* data;
+    unsigned sizeBits;
+    unsigned pos;
+};
+
+/// The integer a real value in [minValue, maxValue] (bounded if not) is linearly quantized to with the given number of bits.
+inline uint32_t quantize(double value, double minValue, double maxValue, unsigned bits) throw () {
+    numAssert(bits >= 1 && bits < 32, bits);
+    const uint32_t levels = (uint32_t(1) << bits) - 1;
+    return static_cast<uint32_t>((bound(value, minValue, maxValue) - minValue) * (levels / (maxValue - minValue)) + .5);
+}
+
+inline double dequantize(uint32_t q, double minValue, double maxValue, unsigned bits) throw () {
+    const uint32_t levels = (uint32_t(1) << bits) - 1;
+    return minValue + q * ((maxValue - minValue) / levels);
+}
+
+/* Coders for declarative record descriptions.
+ *
+ * A record is described once as a function template taking the coder and the record by reference, e.g.
+ *   template<class Coder> void codeThing(Coder& c, Thing& t) { c.field(t.kind, 3); if (c.flag(t.moving)) c.quantized(t.speed, 0., 10., 6); }
+ * Called with a BitEncoder, it writes the record; called with a BitDecoder, it fills in the record. Fields that
+ * aren't coded because of a condition keep their values, so records should be initialized to the defaults.
+ * A description may code a record relative to a baseline known to both ends by calling baseline() first and then
+ * coding only the fields that differ; the decoder starts from a copy of the baseline.
+ */
+
+template<class ByteWriter> class BitEncoder {
+public:
+    BitEncoder(ByteWriter& target) throw () : w(target) { }
+
+    template<class T> void field(const T& value, unsigned bits) throw () { w.write(static_cast<uint32_t>(value), bits); }
+    bool flag(const bool& value) throw () { w.write(value, 1); return value; }
+    /// A real value in [minValue, maxValue] (bounded if not) linearly quantized to the given number of bits.
+    void quantized(const double& value, double minValue, double maxValue, unsigned bits) throw () { w.write(quantize(value, minValue, maxValue, bits), bits); }
+    /// Start coding a record relative to base. Nothing is written; the record description codes the differences.
+    template<class T> void baseline(const T&, const T&) throw () { }
+
+    void flush() throw () { w.flush(); }
+
+private:
+    BitWriter<ByteWriter> w;
+};
+
+class BitDecoder {
+public:
+    BitDecoder(ConstDataBlockRef block) throw () : r(block) { }
+
+    template<class T> void field(T& value, unsigned bits) throw (BinaryReader::ReadOutside) { value = static_cast<T>(r.read(bits)); }
+    bool flag(bool& value) throw (BinaryReader::ReadOutside) { value = r.read(1) != 0; return value; }
+    void quantized(double& value, double minValue, double maxValue, unsigned bits) throw (BinaryReader::ReadOutside) { value = dequantize(r.read(bits), minValue, maxValue, bits); }
+    template<class T> void baseline(T& value, const T& base) throw () { value = base; }
+
+    void flush() throw () { }   // padding is skipped with the rest of the data
+    unsigned bytesUsed() const throw () { return r.bytesUsed(); }
+
+private:
+    BitReader r;
+};
+
+#endif
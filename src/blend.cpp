@@ -0,0 +1,285 @@
+/*
+ *  blend.cpp
+ *
+ *  Copyright (C) 2008 - Niko Ritari
+ *
+ *  This file is part of Outgun.
+ *
+ *  Outgun is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Outgun is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Outgun; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "blend.h"
+
+/* Allegro's blenders interpolate packed channel fields with unsigned arithmetic, but the result per channel works out
+ * to d + floor((s - d) * n / scale), where scale is 256 (32) and n the 32-bit (16-bit) weight. It's computed here as
+ * (d * (scale - n) + s * n) / scale, which stays non-negative and fits in 16 bits.
+ * One quirk: the 32-bit blenders add the unmasked destination pixel to the red and blue fields, so the green byte of
+ * the destination is added below red and may carry into it.
+ */
+
+static const uint32_t maskColor32 = 0xFF00FF;   // MASK_COLOR_32
+
+static inline unsigned weight32(unsigned a) throw () { return a ? a + 1 : 0; }
+static inline unsigned weight16(unsigned a) throw () { return (a + 1) / 8; }  // also 0 for 0
+
+static inline uint32_t blend32(uint32_t d, uint32_t s, unsigned n) throw () { // returns the alpha byte cleared
+    const unsigned m = 256 - n;
+    const uint32_t r = (((d >> 16) & 0xFF) * m + ((s >> 16) & 0xFF) * n + ((d >> 8) & 0xFF)) >> 8;
+    const uint32_t g = (((d >>  8) & 0xFF) * m + ((s >>  8) & 0xFF) * n) >> 8;
+    const uint32_t b = (( d        & 0xFF) * m + ( s        & 0xFF) * n) >> 8;
+    return r << 16 | g << 8 | b;
+}
+
+static inline uint16_t blend16(uint16_t d, uint16_t s, unsigned n) throw () {
+    const unsigned m = 32 - n;
+    const unsigned r = ((d >> 11)       * m + (s >> 11)       * n) >> 5;
+    const unsigned g = (((d >> 5) & 63) * m + ((s >> 5) & 63) * n) >> 5;
+    const unsigned b = ((d & 31)        * m + (s & 31)        * n) >> 5;
+    return static_cast<uint16_t>(r << 11 | g << 5 | b);
+}
+
+static inline uint16_t to16(uint32_t c) throw () {
+    return static_cast<uint16_t>(((c >> 19) & 31) << 11 | ((c >> 10) & 63) << 5 | ((c >> 3) & 31));
+}
+
+#ifdef __SSE2__
+
+// per 16-bit lane: (d * (scale - n) + s * n + carry) >> shift
+static inline __m128i lerp16(__m128i d, __m128i s, __m128i n, __m128i scale, int shift, __m128i carry = _mm_setzero_si128()) throw () {
+    return _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(d, _mm_sub_epi16(scale, n)), _mm_mullo_epi16(s, n)), carry), shift);
+}
+
+/// The green channels of unpacked 32-bit pixels moved to the red lanes, others cleared.
+static inline __m128i greenToRed(__m128i d) throw () {
+    return _mm_and_si128(_mm_slli_epi64(d, 16), _mm_set_epi16(0, -1, 0, 0, 0, -1, 0, 0));
+}
+
+/// The 32-bit blend of 4 pixels with n given per pixel in 32-bit lanes; the alpha bytes are interpolated too.
+static inline __m128i blend32x4(__m128i d, __m128i s, __m128i n32) throw () {
+    const __m128i zero = _mm_setzero_si128(), scale = _mm_set1_epi16(256);
+    const __m128i nn = _mm_or_si128(n32, _mm_slli_epi32(n32, 16));    // n in both halves, so that unpacking gives it to all 4 channels
+    const __m128i dlo = _mm_unpacklo_epi8(d, zero), dhi = _mm_unpackhi_epi8(d, zero);
+    const __m128i lo = lerp16(dlo, _mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi32(nn, nn), scale, 8, greenToRed(dlo));
+    const __m128i hi = lerp16(dhi, _mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi32(nn, nn), scale, 8, greenToRed(dhi));
+    return _mm_packus_epi16(lo, hi);
+}
+
+/// The 16-bit blend of 8 pixels with n given per pixel in 16-bit lanes.
+static inline __m128i blend16x8(__m128i d, __m128i s, __m128i n) throw () {
+    const __m128i scale = _mm_set1_epi16(32), m6 = _mm_set1_epi16(63), m5 = _mm_set1_epi16(31);
+    const __m128i r = lerp16(_mm_srli_epi16(d, 11), _mm_srli_epi16(s, 11), n, scale, 5);
+    const __m128i g = lerp16(_mm_and_si128(_mm_srli_epi16(d, 5), m6), _mm_and_si128(_mm_srli_epi16(s, 5), m6), n, scale, 5);
+    const __m128i b = lerp16(_mm_and_si128(d, m5), _mm_and_si128(s, m5), n, scale, 5);
+    return _mm_or_si128(_mm_or_si128(_mm_slli_epi16(r, 11), _mm_slli_epi16(g, 5)), b);
+}
+
+/// weight32 of 32-bit lanes.
+static inline __m128i weight32x4(__m128i a) throw () {
+    return _mm_add_epi32(_mm_add_epi32(a, _mm_set1_epi32(1)), _mm_cmpeq_epi32(a, _mm_setzero_si128()));   // the comparison gives -1 for 0
+}
+
+/// 4 32-bit pixels converted to 16-bit lanes of the low half.
+static inline __m128i to16x4(__m128i c) throw () {
+    const __m128i r = _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(c, 19), _mm_set1_epi32(31)), 11);
+    const __m128i g = _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(c, 10), _mm_set1_epi32(63)), 5);
+    const __m128i b = _mm_and_si128(_mm_srli_epi32(c, 3), _mm_set1_epi32(31));
+    const __m128i c16 = _mm_or_si128(_mm_or_si128(r, g), b);
+    // no unsigned 32 -> 16 pack in SSE2: bias to the signed range and back
+    const __m128i bias32 = _mm_set1_epi32(0x8000);
+    return _mm_xor_si128(_mm_packs_epi32(_mm_sub_epi32(c16, bias32), bias32), _mm_set1_epi16(-0x8000));
+}
+
+#endif
+
+#ifdef __AVX2__
+
+static inline __m256i lerp16(__m256i d, __m256i s, __m256i n, __m256i scale, int shift, __m256i carry = _mm256_setzero_si256()) throw () {
+    return _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(d, _mm256_sub_epi16(scale, n)), _mm256_mullo_epi16(s, n)), carry), shift);
+}
+
+static inline __m256i greenToRed(__m256i d) throw () {
+    return _mm256_and_si256(_mm256_slli_epi64(d, 16), _mm256_set_epi16(0, -1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0));
+}
+
+// the unpack and pack instructions work within 128-bit halves, so the pixel order is kept just like in the SSE2 version
+static inline __m256i blend32x8(__m256i d, __m256i s, __m256i n32) throw () {
+    const __m256i zero = _mm256_setzero_si256(), scale = _mm256_set1_epi16(256);
+    const __m256i nn = _mm256_or_si256(n32, _mm256_slli_epi32(n32, 16));
+    const __m256i dlo = _mm256_unpacklo_epi8(d, zero), dhi = _mm256_unpackhi_epi8(d, zero);
+    const __m256i lo = lerp16(dlo, _mm256_unpacklo_epi8(s, zero), _mm256_unpacklo_epi32(nn, nn), scale, 8, greenToRed(dlo));
+    const __m256i hi = lerp16(dhi, _mm256_unpackhi_epi8(s, zero), _mm256_unpackhi_epi32(nn, nn), scale, 8, greenToRed(dhi));
+    return _mm256_packus_epi16(lo, hi);
+}
+
+static inline __m256i blend16x16(__m256i d, __m256i s, __m256i n) throw () {
+    const __m256i scale = _mm256_set1_epi16(32), m6 = _mm256_set1_epi16(63), m5 = _mm256_set1_epi16(31);
+    const __m256i r = lerp16(_mm256_srli_epi16(d, 11), _mm256_srli_epi16(s, 11), n, scale, 5);
+    const __m256i g = lerp16(_mm256_and_si256(_mm256_srli_epi16(d, 5), m6), _mm256_and_si256(_mm256_srli_epi16(s, 5), m6), n, scale, 5);
+    const __m256i b = lerp16(_mm256_and_si256(d, m5), _mm256_and_si256(s, m5), n, scale, 5);
+    return _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi16(r, 11), _mm256_slli_epi16(g, 5)), b);
+}
+
+static inline __m256i weight32x8(__m256i a) throw () {
+    return _mm256_add_epi32(_mm256_add_epi32(a, _mm256_set1_epi32(1)), _mm256_cmpeq_epi32(a, _mm256_setzero_si256()));
+}
+
+/// 8 32-bit pixels converted to 16-bit pixels in the low 128 bits.
+static inline __m128i to16x8(__m256i c) throw () {
+    const __m256i r = _mm256_slli_epi32(_mm256_and_si256(_mm256_srli_epi32(c, 19), _mm256_set1_epi32(31)), 11);
+    const __m256i g = _mm256_slli_epi32(_mm256_and_si256(_mm256_srli_epi32(c, 10), _mm256_set1_epi32(63)), 5);
+    const __m256i b = _mm256_and_si256(_mm256_srli_epi32(c, 3), _mm256_set1_epi32(31));
+    const __m256i c16 = _mm256_or_si256(_mm256_or_si256(r, g), b);
+    return _mm_packus_epi32(_mm256_castsi256_si128(c16), _mm256_extracti128_si256(c16, 1));
+}
+
+#endif
+
+void overlaySpan16(uint16_t* dst, const uint8_t* alpha, unsigned n, uint16_t color) throw () {
+    unsigned i = 0;
+    #ifdef __AVX2__
+    const __m256i s256 = _mm256_set1_epi16(static_cast<short>(color));
+    for (; i + 16 <= n; i += 16) {
+        __m256i* const p = reinterpret_cast<__m256i*>(dst + i);
+        const __m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(alpha + i)));
+        const __m256i w = _mm256_srli_epi16(_mm256_add_epi16(a, _mm256_set1_epi16(1)), 3);
+        _mm256_storeu_si256(p, blend16x16(_mm256_loadu_si256(p), s256, w));
+    }
+    #endif
+    #ifdef __SSE2__
+    const __m128i s128 = _mm_set1_epi16(static_cast<short>(color));
+    for (; i + 8 <= n; i += 8) {
+        __m128i* const p = reinterpret_cast<__m128i*>(dst + i);
+        const __m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(alpha + i)), _mm_setzero_si128());
+        const __m128i w = _mm_srli_epi16(_mm_add_epi16(a, _mm_set1_epi16(1)), 3);
+        _mm_storeu_si128(p, blend16x8(_mm_loadu_si128(p), s128, w));
+    }
+    #endif
+    for (; i < n; ++i)
+        if (alpha[i])
+            dst[i] = blend16(dst[i], color, weight16(alpha[i]));
+}
+
+void overlaySpan32(uint32_t* dst, const uint8_t* alpha, unsigned n, uint32_t color) throw () {
+    unsigned i = 0;
+    #ifdef __AVX2__
+    const __m256i s256 = _mm256_set1_epi32(static_cast<int>(color)), rgb256 = _mm256_set1_epi32(0xFFFFFF);
+    for (; i + 8 <= n; i += 8) {
+        __m256i* const p = reinterpret_cast<__m256i*>(dst + i);
+        const __m256i a = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(alpha + i)));
+        const __m256i d = _mm256_loadu_si256(p);
+        const __m256i blended = _mm256_and_si256(blend32x8(d, s256, weight32x8(a)), rgb256);
+        _mm256_storeu_si256(p, _mm256_blendv_epi8(blended, d, _mm256_cmpeq_epi32(a, _mm256_setzero_si256())));
+    }
+    #endif
+    #ifdef __SSE2__
+    const __m128i s128 = _mm_set1_epi32(static_cast<int>(color)), rgb128 = _mm_set1_epi32(0xFFFFFF), zero = _mm_setzero_si128();
+    for (; i + 4 <= n; i += 4) {
+        __m128i* const p = reinterpret_cast<__m128i*>(dst + i);
+        uint32_t a4 = 0;
+        for (int j = 3; j >= 0; --j)
+            a4 = a4 << 8 | alpha[i + j];
+        const __m128i a = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(static_cast<int>(a4)), zero), zero);
+        const __m128i d = _mm_loadu_si128(p);
+        const __m128i blended = _mm_and_si128(blend32x4(d, s128, weight32x4(a)), rgb128);
+        const __m128i keep = _mm_cmpeq_epi32(a, zero);
+        _mm_storeu_si128(p, _mm_or_si128(_mm_and_si128(keep, d), _mm_andnot_si128(keep, blended)));
+    }
+    #endif
+    for (; i < n; ++i)
+        if (alpha[i])
+            dst[i] = blend32(dst[i], color, weight32(alpha[i]));
+}
+
+void alphaSpan16(uint16_t* dst, const uint32_t* src, unsigned n) throw () {
+    unsigned i = 0;
+    #ifdef __AVX2__
+    for (; i + 16 <= n; i += 16) {
+        __m128i* const p = reinterpret_cast<__m128i*>(dst + i);
+        for (int half = 0; half < 2; ++half) {
+            const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 8 * half));
+            const __m128i a = _mm_packus_epi32(_mm256_castsi256_si128(_mm256_srli_epi32(s, 24)), _mm256_extracti128_si256(_mm256_srli_epi32(s, 24), 1));
+            const __m256i isMask = _mm256_cmpeq_epi32(s, _mm256_set1_epi32(maskColor32));
+            const __m128i keep = _mm_packs_epi32(_mm256_castsi256_si128(isMask), _mm256_extracti128_si256(isMask, 1));
+            const __m128i w = _mm_srli_epi16(_mm_add_epi16(a, _mm_set1_epi16(1)), 3);
+            const __m128i d = _mm_loadu_si128(p + half);
+            const __m128i blended = blend16x8(d, to16x8(s), w);
+            _mm_storeu_si128(p + half, _mm_or_si128(_mm_and_si128(keep, d), _mm_andnot_si128(keep, blended)));
+        }
+    }
+    #endif
+    #ifdef __SSE2__
+    const __m128i mask128 = _mm_set1_epi32(maskColor32);
+    for (; i + 8 <= n; i += 8) {
+        __m128i* const p = reinterpret_cast<__m128i*>(dst + i);
+        const __m128i s0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        const __m128i s1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 4));
+        const __m128i a = _mm_packs_epi32(_mm_srli_epi32(s0, 24), _mm_srli_epi32(s1, 24));
+        const __m128i keep = _mm_packs_epi32(_mm_cmpeq_epi32(s0, mask128), _mm_cmpeq_epi32(s1, mask128));
+        const __m128i w = _mm_srli_epi16(_mm_add_epi16(a, _mm_set1_epi16(1)), 3);
+        const __m128i s = _mm_unpacklo_epi64(to16x4(s0), to16x4(s1));
+        const __m128i d = _mm_loadu_si128(p);
+        _mm_storeu_si128(p, _mm_or_si128(_mm_and_si128(keep, d), _mm_andnot_si128(keep, blend16x8(d, s, w))));
+    }
+    #endif
+    for (; i < n; ++i)
+        if (src[i] != maskColor32)
+            dst[i] = blend16(dst[i], to16(src[i]), weight16(src[i] >> 24));
+}
+
+void alphaSpan32(uint32_t* dst, const uint32_t* src, unsigned n) throw () {
+    unsigned i = 0;
+    #ifdef __AVX2__
+    const __m256i mask256 = _mm256_set1_epi32(maskColor32), rgb256 = _mm256_set1_epi32(0xFFFFFF);
+    for (; i + 8 <= n; i += 8) {
+        __m256i* const p = reinterpret_cast<__m256i*>(dst + i);
+        const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        const __m256i d = _mm256_loadu_si256(p);
+        const __m256i blended = _mm256_and_si256(blend32x8(d, s, weight32x8(_mm256_srli_epi32(s, 24))), rgb256);
+        _mm256_storeu_si256(p, _mm256_blendv_epi8(blended, d, _mm256_cmpeq_epi32(s, mask256)));
+    }
+    #endif
+    #ifdef __SSE2__
+    const __m128i mask128 = _mm_set1_epi32(maskColor32), rgb128 = _mm_set1_epi32(0xFFFFFF);
+    for (; i + 4 <= n; i += 4) {
+        __m128i* const p = reinterpret_cast<__m128i*>(dst + i);
+        const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        const __m128i d = _mm_loadu_si128(p);
+        const __m128i blended = _mm_and_si128(blend32x4(d, s, weight32x4(_mm_srli_epi32(s, 24))), rgb128);
+        const __m128i keep = _mm_cmpeq_epi32(s, mask128);
+        _mm_storeu_si128(p, _mm_or_si128(_mm_and_si128(keep, d), _mm_andnot_si128(keep, blended)));
+    }
+    #endif
+    for (; i < n; ++i)
+        if (src[i] != maskColor32)
+            dst[i] = blend32(dst[i], src[i], weight32(src[i] >> 24));
+}
+
+const char* blendKernelName() throw () {
+    #if defined(__AVX2__)
+    return "AVX2";
+    #elif defined(__SSE2__)
+    return "SSE2";
+    #else
+    return "scalar";
+    #endif
+}
@@ -0,0 +1,49 @@
+/*
+ *  blend.h
+ *
+ *  Copyright (C) 2008 - Niko Ritari
+ *
+ *  This file is part of Outgun.
+ *
+ *  Outgun is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Outgun is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Outgun; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef BLEND_H_INC
+#define BLEND_H_INC
+
+#include <stdint.h>
+
+/* Span kernels for the blending the sprite builders and alpha sprite draws do, on rows of 16-bit (5:6:5) and
+ * 32-bit (8:8:8, alpha in the top byte) pixels. The results are exactly those of Allegro's trans and alpha blenders
+ * (_blender_trans16, _blender_trans24, _blender_alpha16 and _blender_alpha32), including the alpha byte of 32-bit
+ * pixels being cleared where a pixel is blended. 16-bit pixels may be either RGB or BGR; in 32-bit source pixels of
+ * the 16-bit alpha blend red must be in the third byte, matching the 16-bit destination's top field.
+ *
+ * The kernels use AVX2 and SSE2 when the compiler targets them, and plain C++ otherwise and for the span tails.
+ */
+
+/// Blend color over dst[0..n-1] with the opacity alpha[i] per pixel, as putpixel in DRAW_MODE_TRANS with set_trans_blender(0, 0, 0, alpha[i]).
+void overlaySpan16(uint16_t* dst, const uint8_t* alpha, unsigned n, uint16_t color) throw ();
+void overlaySpan32(uint32_t* dst, const uint8_t* alpha, unsigned n, uint32_t color) throw ();
+
+/// Blend the 32-bit pixels src[0..n-1] over dst by their alpha, as draw_trans_sprite with set_alpha_blender; pixels equal to MASK_COLOR_32 are skipped.
+void alphaSpan16(uint16_t* dst, const uint32_t* src, unsigned n) throw ();
+void alphaSpan32(uint32_t* dst, const uint32_t* src, unsigned n) throw ();
+
+/// The instruction set the kernels were compiled for: "AVX2", "SSE2" or "scalar".
+const char* blendKernelName() throw ();
+
+#endif
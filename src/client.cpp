@@ -39,10 +39,13 @@
 #include "commont.h"
 #include "debug.h"
 #include "debugconfig.h" // for LOG_MESSAGE_TRAFFIC
+#include "fastbinary.h"
+#include "framecodec.h"
 #include "language.h"
 #include "names.h"
 #include "nassert.h"
 #include "network.h"
+#include "phasetimer.h"
 #include "platform.h"
 #include "protocol.h"
 #include "timer.h"
@@ -81,6 +84,9 @@ using std::vector;
 
 const int PASSBUFFER = 32;  //size of password file
 
+// the drawing buffer of Client::benchmark
+const int benchmarkScreenWidth = 1024, benchmarkScreenHeight = 768, benchmarkColorDepth = 32;
+
 #ifdef ROOM_CHANGE_BENCHMARK
 int benchmarkRuns = 0;
 #endif
@@ -579,10 +585,12 @@ Client::Client(const ClientExternalSettings& config, const ServerExternalSetting
     #ifndef DEDICATED_SERVER_ONLY
     refreshStatus(RS_none),
     password_file(wheregamedir + "config" + directory_separator + "passwd"),
-    graphics(log),
+    graphics(log, config.lowerPriority),
     screenshot(false),
     replaying(false),
+    replay_seeking(false),
     visible_rooms(1),
+    renderTimer(0),
     spectating(false),
     #endif
     mapChanged(false),
@@ -834,8 +842,15 @@ bool Client::start() throw () {
     MCF_antialiasChange();
     visible_rooms = menu.options.graphics.visibleRoomsPlay();
     MCF_transpChange();
+    MCF_spriteAnglesChange();
     MCF_statsBgChange();
-    if (!screenModeChange())
+    if (!extConfig.benchmarkReplay.empty()) {
+        if (!graphics.init_headless(benchmarkScreenWidth, benchmarkScreenHeight, benchmarkColorDepth)) {
+            log.error(_("Couldn't create the drawing buffer for the benchmark."));
+            return false;
+        }
+    }
+    else if (!screenModeChange())
         return false;
     MCF_gfxThemeChange();
     MCF_fontChange();
@@ -860,7 +875,7 @@ bool Client::start() throw () {
     // message highlighting
     load_highlight_texts();
 
-    if (menu.options.game.autoGetServerList())
+    if (menu.options.game.autoGetServerList() && extConfig.benchmarkReplay.empty())
         MCF_updateServers();
     #endif
 
@@ -1197,6 +1212,8 @@ void Client::client_connected(ConstDataBlockRef data) throw () {   // call with
     fx.frame = -1;
     fx.skipped = true;
     fx.physics = PhysicalSettings(); // to be filled later by a message
+    frameHistory.release();
+    baselineRequestFrame = 0;
 
     if (botmode) {
         bot_send_frame(ClientControls());
@@ -1733,8 +1750,7 @@ void Client::refreshGunDir() throw () {
 
 #endif // DEDICATED_SERVER_ONLY
 
-void Client::readMinimapPlayerPosition(BinaryReader& reader, int pid) throw () {
-    const uint8_t whox = reader.U8(), whoy = reader.U8();
+void Client::applyMinimapPlayerPosition(int pid, uint8_t whox, uint8_t whoy) throw () {
     if (pid == me || fx.player[pid].onscreen)
         return;
     const double oldx = fx.player[pid].roomx * plw + fx.player[pid].lx;
@@ -1760,7 +1776,7 @@ void Client::readMinimapPlayerPosition(BinaryReader& reader, int pid) throw () {
 }
 
 bool Client::process_live_frame_data(ConstDataBlockRef data) throw () { // returns false if an error occured that requires disconnecting
-    BinaryDataBlockReader read(data);
+    FastBinaryReader<true> read(data);
 
     const uint32_t svframe = read.U32();    //server's frame
 
@@ -1833,12 +1849,40 @@ bool Client::process_live_frame_data(ConstDataBlockRef data) throw () { // retur
         fx.player[me].oldy = fx.player[me].roomy;
     }
 
-    const uint32_t players_onscreen = read.U32();
+    FrameBody fb;
+    if (protocolExtensions >= 1) {
+        const FrameBody* baseline = 0;
+        if (protocolExtensions >= 2) {
+            const uint8_t baselineAge = read.U8();
+            if (baselineAge != 0) {
+                baseline = frameHistory.findFrame(svframe - baselineAge);
+                if (!baseline) {   // can happen when frames arrive out of order; ask for full frames if it persists
+                    if (svframe - baselineRequestFrame >= FrameHistory::size) {
+                        BinaryBuffer<256> msg;
+                        msg.U8(data_frame_baseline_missing);
+                        client->send_message(msg);
+                        baselineRequestFrame = svframe;
+                    }
+                    return true;
+                }
+            }
+        }
+        try {
+            BitDecoder decoder(read.unreadPart());
+            codeFrameBody(decoder, fb, maxplayers, baseline);
+        } catch (BinaryReader::ReadOutside&) {
+            log.error("Truncated frame data from the server");
+            return false;
+        }
+        if (protocolExtensions >= 2)
+            frameHistory.store(svframe, 0, fb);
+    }
+    else
+        read_legacy_frame_body(read, fb);
 
-    //decode players_onscreen and update player data
+    //update player data of the players on screen
     for (int i = 0; i < maxplayers; i++) {
-        //decode players_onscreen: sets if "player" record is there to be read
-        if (players_onscreen & (1 << i))
+        if (fb.playersOnscreen & (1 << i))
             fx.player[i].onscreen = true;
         else {
             fx.player[i].onscreen = false;
@@ -1846,53 +1890,36 @@ bool Client::process_live_frame_data(ConstDataBlockRef data) throw () { // retur
         }
 
         ClientPlayer& h = fx.player[i];
+        const FramePlayerRecord& r = fb.player[i];
 
         h.roomx = fx.player[me].roomx;  //same screen since it's on the "players on same screen" vector
         h.roomy = fx.player[me].roomy;
-
-        {
-            const uint8_t xLowBits = read.U8(), yLowBits = read.U8(), highBits = read.U8();
-            h.lx = ((highBits & 0x0F) << 8 | xLowBits) * (plw / double(0xFFF));
-            h.ly = ((highBits & 0xF0) << 4 | yLowBits) * (plh / double(0xFFF));
-        }
-
-        if (protocolExtensions < 0) {
+        h.lx = r.lx;
+        h.ly = r.ly;
+
+        h.dead = r.dead;
+        h.item_deathbringer = r.deathbringer;
+        h.deathbringer_affected = r.deathbringerAffected;
+        h.item_shield = r.shield;
+        h.item_turbo = r.turbo;
+        h.item_power = r.power;
+
+        if (h.dead && protocolExtensions >= 0)  // speed isn't sent for dead players
+            h.sx = h.sy = 0;
+        else {
             typedef SignedByteFloat<3, -2> SpeedType;   // exponent from -2 to +6, with 4 significant bits -> epsilon = .25, max representable 32 * 31 = enough :)
-            h.sx = SpeedType::toDouble(read.U8());
-            h.sy = SpeedType::toDouble(read.U8());
+            h.sx = SpeedType::toDouble(r.speedX);
+            h.sy = SpeedType::toDouble(r.speedY);
         }
 
-        const uint8_t extra = read.U8();
-        h.dead = (extra & 1) != 0;
-        h.item_deathbringer = (extra & 2) != 0;
-        h.deathbringer_affected = (extra & 4) != 0;
-        h.item_shield = (extra & 8) != 0;
-        h.item_turbo = (extra & 16) != 0;
-        h.item_power = (extra & 32) != 0;
-        const bool preciseGundir = (extra & 64) != 0;
-
-        if (protocolExtensions >= 0) {
-            if (h.dead)
-                h.sx = h.sy = 0;
-            else {
-                typedef SignedByteFloat<3, -2> SpeedType;   // exponent from -2 to +6, with 4 significant bits -> epsilon = .25, max representable 32 * 31 = enough :)
-                h.sx = SpeedType::toDouble(read.U8());
-                h.sy = SpeedType::toDouble(read.U8());
-            }
-        }
+        h.controls.fromNetwork(r.controls, true);
 
-        const uint8_t ccb = read.U8();
-        h.controls.fromNetwork(ccb, true);
-
-        if (preciseGundir)
-            h.gundir.fromNetworkLongForm(((ccb >> 5) << 8) | read.U8());
+        if (r.preciseGundir)
+            h.gundir.fromNetworkLongForm(r.gundir);
         else
-            h.gundir.fromNetworkShortForm(ccb >> 5);
+            h.gundir.fromNetworkShortForm(r.gundir);
 
-        if (protocolExtensions < 0 || !h.dead)
-            h.visibility = read.U8();
-        else
-            h.visibility = 255;
+        h.visibility = r.visibility;
 
         if (i == me) {
             if (!h.item_turbo)
@@ -1907,14 +1934,76 @@ bool Client::process_live_frame_data(ConstDataBlockRef data) throw () { // retur
             h.posUpdated = svframe;
     }
 
+    for (int pid = 0; pid < MAX_PLAYERS; ++pid)
+        if (fb.minimap.players & (uint32_t(1) << pid))
+            applyMinimapPlayerPosition(pid, fb.minimap.x[pid], fb.minimap.y[pid]);
+
+    fx.player[me].health = fb.health8 + extraHealth;
+    fx.player[me].energy = fb.energy8 + extraEnergy;
+
+    if (fb.pingSent)
+        fx.player[svframe % maxplayers].ping = max<int16_t>(static_cast<int16_t>(fb.ping), 0); // Server versions up to 1.0.3 using a multicore processor can send negative pings.
+
+    return true;
+}
+
+/// Read the byte-aligned frame body used by servers with protocol extensions level 0 or unextended.
+void Client::read_legacy_frame_body(FastBinaryReader<true>& read, FrameBody& fb) throw () {
+    fb.playersOnscreen = read.U32();
+
+    for (int i = 0; i < maxplayers; i++) {
+        if (!(fb.playersOnscreen & (1 << i)))
+            continue;
+
+        FramePlayerRecord& r = fb.player[i];
+
+        {
+            const uint8_t xLowBits = read.U8(), yLowBits = read.U8(), highBits = read.U8();
+            r.lx = ((highBits & 0x0F) << 8 | xLowBits) * (plw / double(0xFFF));
+            r.ly = ((highBits & 0xF0) << 4 | yLowBits) * (plh / double(0xFFF));
+        }
+
+        if (protocolExtensions < 0) {
+            r.speedX = read.U8();
+            r.speedY = read.U8();
+        }
+
+        const uint8_t extra = read.U8();
+        r.dead = (extra & 1) != 0;
+        r.deathbringer = (extra & 2) != 0;
+        r.deathbringerAffected = (extra & 4) != 0;
+        r.shield = (extra & 8) != 0;
+        r.turbo = (extra & 16) != 0;
+        r.power = (extra & 32) != 0;
+        r.preciseGundir = (extra & 64) != 0;
+
+        if (protocolExtensions >= 0 && !r.dead) {
+            r.speedX = read.U8();
+            r.speedY = read.U8();
+        }
+
+        const uint8_t ccb = read.U8();
+        r.controls = ccb & 31;
+
+        if (r.preciseGundir)
+            r.gundir = ((ccb >> 5) << 8) | read.U8();
+        else
+            r.gundir = ccb >> 5;
+
+        if (protocolExtensions < 0 || !r.dead)
+            r.visibility = read.U8();
+    }
+
     // see servnet.cpp for a short documentation of the minimap player position protocol
     if (protocolExtensions < 0) {
-        uint8_t pid = read.U8();
-        if (pid < MAX_PLAYERS)
-            readMinimapPlayerPosition(read, pid);
-        pid = read.U8();
-        if (pid < MAX_PLAYERS)
-            readMinimapPlayerPosition(read, pid);
+        for (int round = 0; round < 2; ++round) {
+            const uint8_t pid = read.U8();
+            if (pid < MAX_PLAYERS) {
+                fb.minimap.players |= uint32_t(1) << pid;
+                fb.minimap.x[pid] = read.U8();
+                fb.minimap.y[pid] = read.U8();
+            }
+        }
     }
     else {
         const uint8_t mmByte = read.U8();
@@ -1924,22 +2013,25 @@ bool Client::process_live_frame_data(ConstDataBlockRef data) throw () { // retur
         for (int i = 0, rotPpos = 3; i < extraBytes; ++i, rotPpos += 8)
             rotP |= read.U8() << rotPpos;
         for (int pid = pos; rotP; pid = (pid + 1) % 32, rotP >>= 1)
-            if (rotP & 1)
-                readMinimapPlayerPosition(read, pid);
+            if (rotP & 1) {
+                fb.minimap.players |= uint32_t(1) << pid;
+                fb.minimap.x[pid] = read.U8();
+                fb.minimap.y[pid] = read.U8();
+            }
     }
 
-    fx.player[me].health = read.U8() + extraHealth;
-    fx.player[me].energy = read.U8() + extraEnergy;
-
-    if (read.hasMore())
-        fx.player[svframe % maxplayers].ping = max<int16_t>(read.S16(), 0); // Server versions up to 1.0.3 using a multicore processor can send negative pings.
+    fb.health8 = read.U8();
+    fb.energy8 = read.U8();
 
-    return true;
+    if (read.hasMore()) {
+        fb.pingSent = true;
+        fb.ping = read.U16();
+    }
 }
 
 #ifndef DEDICATED_SERVER_ONLY
 int Client::process_replay_frame_data(ConstDataBlockRef data) throw () { // returns number of bytes read - not necessarily all of data
-    BinaryDataBlockReader read(data);
+    FastBinaryReader<true> read(data);
 
     const uint32_t svframe = read.U32(static_cast<unsigned>(fx.frame) + 1, uint32_t(-1));    //server's frame
 
@@ -3427,43 +3519,171 @@ void Client::refreshThread() throw () {
     refreshStatus = refresh_all_servers() ? RS_none : RS_failed;
 }
 
-class TempPingData {    // internal to Client::refresh_all_servers
-    double st[4];   // send time
-    int rc;         // count of received packets
-    double rt;      // sum of pings (for averaging)
+static const unsigned serverQueryWindow = 64;   // how many servers are queried at a time when refreshing the list
 
+/** Pipelined serverinfo queries; internal to Client::refresh_all_servers.
+ * Each distinct address is a target, shared by all list entries with that address. At most window targets have
+ * a query outstanding at a time, and the rest wait in order. A target is queried again as soon as it replies,
+ * until it has replied samplesWanted times, or after probeTimeout without a reply; it's given up after maxTries
+ * queries. Replies are matched to targets by a hash of the source address, and each reply is timed against the
+ * query it echoes, so duplicated and late replies don't skew the ping.
+ */
+class ServerQuerier {
 public:
-    TempPingData() throw () : rc(0), rt(0) { }
-    void send(int pack) throw () { g_timeCounter.refresh(); st[pack] = get_time(); }
-    void receive(int pack) throw () { g_timeCounter.refresh(); ++rc; rt += get_time() - st[pack]; }
-    int received() const throw () { return rc; }
-    int ping() const throw () { return static_cast<int>(1000 * rt / rc); }
-};
+    static const int maxTries = 4;
+    static const int samplesWanted = 3;
+    static const double probeTimeout;
+
+    ServerQuerier(unsigned window_) throw () : window(window_), nextStart(0) { nAssert(window > 0); }
+
+    void add(ServerListEntry* entry) throw () {
+        int& slot = findSlot(entry->address());
+        if (slot == -1) {
+            slot = targets.size();
+            targets.push_back(Target(entry->address()));
+            if (targets.size() * 2 > table.size())
+                rehash();
+        }
+        targets[slot].entries.push_back(entry);
+    }
+    bool finished() const throw () { return nextStart == targets.size() && active.empty(); }
+
+    /// Send the queries that are due at time now.
+    void sendQueries(Network::UDPSocket& sock, double now) throw () {
+        for (unsigned ai = 0; ai < active.size(); ) {
+            Target& t = targets[active[ai]];
+            if (now < t.deadline)
+                ++ai;
+            else if (t.tries < maxTries && t.samples < samplesWanted) {
+                send(sock, active[ai], now);
+                ++ai;
+            }
+            else {
+                active[ai] = active.back();
+                active.pop_back();
+            }
+        }
+        while (active.size() < window && nextStart < targets.size()) {
+            active.push_back(nextStart);
+            send(sock, nextStart++, now);
+        }
+    }
 
-bool Client::refresh_all_servers() throw () {
-    refreshStatus = RS_contacting;
+    /** Process a received packet. Returns the index of the target it updated, or -1 if it wasn't a valid reply.
+     * The reply is used as the target's info, and the next query is made due.
+     */
+    int receive(const Network::Address& source, ConstDataBlockRef data, double now) throw () {
+        BinaryDataBlockReader msg(data);
+        if (data.size() < 10 || msg.U32() != 0 || msg.U32() != 200)
+            return -1;
+        const uint8_t index = msg.U8(); // echoed low bits of the target number
+        const uint8_t tryNr = msg.U8(); // echoed query number
+        const int ti = findSlot(source);
+        if (ti == -1)
+            return -1;
+        Target& t = targets[ti];
+        if (index != static_cast<uint8_t>(ti) || tryNr >= t.tries || t.replied & (1 << tryNr))
+            return -1;
+        t.replied |= 1 << tryNr;
+        ++t.samples;
+        t.rttSum += now - t.sendTime[tryNr];
+        t.info = msg.str();
+        t.deadline = now;
+        return ti;
+    }
+
+    /// Copy the results of target ti to its entries; call with the server list locked.
+    void update(int ti) const throw () {
+        const Target& t = targets[ti];
+        for (vector<ServerListEntry*>::const_iterator ei = t.entries.begin(); ei != t.entries.end(); ++ei) {
+            if (t.samples) {
+                (*ei)->info = t.info;
+                (*ei)->ping = static_cast<int>(1000 * t.rttSum / t.samples);
+            }
+            (*ei)->noresponse = t.samples == 0;
+        }
+    }
+    unsigned size() const throw () { return targets.size(); }
 
-    serverListMutex.lock();
+private:
+    struct Target {
+        Network::Address address;
+        vector<ServerListEntry*> entries;
+        double sendTime[maxTries];
+        double deadline;
+        double rttSum;
+        int tries, samples;
+        unsigned replied;   // bit mask of the tries that have been replied to
+        string info;
+
+        Target(const Network::Address& addr) throw () : address(addr), deadline(0), rttSum(0), tries(0), samples(0), replied(0) { }
+    };
+
+    void send(Network::UDPSocket& sock, int ti, double now) throw () {
+        Target& t = targets[ti];
+        BinaryBuffer<32> msg;
+        msg.U32(0);         //special packet
+        msg.U32(200);       //serverinfo request
+        msg.U8(static_cast<uint8_t>(ti));   //echoed back; checked to weed out stray packets
+        msg.U8(t.tries);    //packet number
+        try {
+            sock.write(t.address, msg);
+        } catch (Network::Error&) { } // retried after the timeout like a lost packet
+        t.sendTime[t.tries++] = now;
+        t.deadline = now + probeTimeout;
+    }
+
+    static uint32_t hash(const Network::Address& addr) throw () { // FNV-1a
+        const string str = addr.toString();
+        uint32_t h = 2166136261u;
+        for (string::const_iterator ci = str.begin(); ci != str.end(); ++ci)
+            h = (h ^ static_cast<uint8_t>(*ci)) * 16777619u;
+        return h;
+    }
+    int& findSlot(const Network::Address& addr) throw () {  // the table slot of addr, or the empty slot where it would go
+        if (table.empty())
+            table.resize(16, -1);
+        for (unsigned si = hash(addr);; ++si) {
+            int& slot = table[si & (table.size() - 1)];
+            if (slot == -1 || targets[slot].address == addr)
+                return slot;
+        }
+    }
+    void rehash() throw () {
+        vector<int>(table.size() * 2, -1).swap(table);
+        for (unsigned ti = 0; ti < targets.size(); ++ti)
+            findSlot(targets[ti].address) = ti;
+    }
+
+    const unsigned window;
+    vector<Target> targets;
+    vector<int> table;      // open addressed hash table of indices to targets; at most half full
+    vector<int> active;     // targets with a query outstanding or due
+    unsigned nextStart;     // the next target to start querying
+};
 
-    vector<ServerListEntry*> servers;
-    for (vector<ServerListEntry>::iterator si = gamespy.begin(); si != gamespy.end(); ++si)
-        servers.push_back(&*si);
-    if (!menu.connect.favorites())
-        for (vector<ServerListEntry>::iterator si = mgamespy.begin(); si != mgamespy.end(); ++si)
-            servers.push_back(&*si);
+const double ServerQuerier::probeTimeout = .5;
 
-    const int nServers = static_cast<int>(servers.size());
-    vector<TempPingData> tempd(nServers);
-    int pending = nServers;         // count of valid entries still waiting for a response
+bool Client::refresh_all_servers() throw () {
+    refreshStatus = RS_contacting;
 
-    for (int i = 0; i < nServers; i++) {
-        servers[i]->refreshed = true;
-        servers[i]->ping = 0;
+    ServerQuerier querier(serverQueryWindow);
+    {
+        Lock ml(serverListMutex);
+        for (vector<ServerListEntry>::iterator si = gamespy.begin(); si != gamespy.end(); ++si) {
+            si->refreshed = true;
+            si->ping = 0;
+            querier.add(&*si);
+        }
+        if (!menu.connect.favorites())
+            for (vector<ServerListEntry>::iterator si = mgamespy.begin(); si != mgamespy.end(); ++si) {
+                si->refreshed = true;
+                si->ping = 0;
+                querier.add(&*si);
+            }
     }
 
-    serverListMutex.unlock();
-
-    if (pending == 0)
+    if (querier.size() == 0)
         return true;
 
     Network::UDPSocket sock(true);
@@ -3474,84 +3694,47 @@ bool Client::refresh_all_servers() throw () {
         return false;
     }
 
-    for (int round = 0; round < 20; round++) {  // each round takes .1 seconds
+    vector<int> updated;
+    while (!querier.finished()) {
         if (abortThreads) {
             log("Refreshing servers aborted: client exiting.");
             return false;
         }
 
-        if (round < 4) {    // on first 4 rounds, packets are sent to each server
-            Lock ml(serverListMutex);
-            for (int i = 0; i < nServers; i++) {
-                BinaryBuffer<512> msg;
-                msg.U32(0);         //special packet
-                msg.U32(200);       //serverinfo request
-                msg.U8(i);        //connect entry (am I lazy or what)
-                msg.U8(round);        //packet number
-
-                try {
-                    sock.write(servers[i]->address(), msg);
-                    tempd[i].send(round);
-                } catch (Network::Error&) { } //#fix: report?
+        g_timeCounter.refresh();
+        querier.sendQueries(sock, get_time());
+
+        for (;;) {  // continue while there are new packets
+            char buffer[512];
+            Network::UDPSocket::ReadResult result;
+            try {
+                result = sock.read(buffer, 512);
+            } catch (Network::Error&) {
+                break; //#fix: report?
             }
+            if (result.length <= 0)
+                break;
+            g_timeCounter.refresh();
+            const int target = querier.receive(result.source, ConstDataBlockRef(buffer, result.length), get_time());
+            if (target != -1)
+                updated.push_back(target);
         }
 
-        if (pending == 0)
-            break;
-
-        // parse received responses
-        for (int subRound = 0; subRound < 20; subRound++) {
-            platSleep(5);
-
-            for (;;) {  // continue while there are new packets
-                char buffer[512];
-                Network::UDPSocket::ReadResult result;
-                try {
-                    result = sock.read(buffer, 512);
-                } catch (Network::Error&) {
-                    break; //#fix: report?
-                }
-                if (result.length == 0)
-                    break;
-                if (result.length < 10)
-                    continue;
-
-                BinaryDataBlockReader msg(buffer, result.length);
-
-                const uint32_t dw1 = msg.U32(), dw2 = msg.U32();
-                if (dw1 != 0 || dw2 != 200)
-                    continue;
-
-                const uint8_t index = msg.U8(); // entry number echoed by the server
-                const uint8_t pack = msg.U8();  // packet #
-
-                if (index >= nServers || pack >= 4 || pack > round)  // don't have to worry about < 0 because they're unsigned
-                    continue;
-
-                Lock ml(serverListMutex);
-
-                if (result.source != servers[index]->address())
-                    continue;
-
-                servers[index]->info = msg.str();
-
-                if (tempd[index].received() == 0)   // first reply -> server has changed to being valid
-                    pending--;
-
-                tempd[index].receive(pack);
-                servers[index]->ping = tempd[index].ping();
-
-                servers[index]->noresponse = false;  // set here in advance so that the main thread will already show it
-            }
+        if (updated.empty())
+            platSleep(2);
+        else {  // results are shown as soon as they arrive, without locking the list for every one
+            Lock ml(serverListMutex);
+            for (vector<int>::const_iterator ti = updated.begin(); ti != updated.end(); ++ti)
+                querier.update(*ti);
+            updated.clear();
         }
     }
 
     // mark those that got no responses
     {
         Lock ml(serverListMutex);
-        for (int i = 0; i < nServers; i++)
-            if (tempd[i].received() == 0)
-                servers[i]->noresponse = true;
+        for (unsigned ti = 0; ti < querier.size(); ++ti)
+            querier.update(ti);
     }
 
     return true;
@@ -3909,6 +4092,23 @@ void Client::handleGameKeypress(int sc, int ch, bool withControl, bool alt_seque
         return;
     }
 
+    if (replaying && !spectating && replay_first_frame_loaded) {
+        const int pos = static_cast<int>(fx.frame) - replay_start_frame;
+        if (isdigit(ch) && replay_length > 0) { // jump to n tenths of the replay; 0 is the start
+            seek_replay(replay_length * (ch - '0') / 10);
+            return;
+        }
+        if (withControl)
+            switch (sc) {
+            /*break;*/ case KEY_HOME:  seek_replay(0);          return;
+                break; case KEY_LEFT:  seek_replay(pos - 100);  return;
+                break; case KEY_RIGHT: seek_replay(pos + 100);  return;
+                break; case KEY_UP:    seek_replay(pos - 600);  return;
+                break; case KEY_DOWN:  seek_replay(pos + 600);  return;
+                break; default: ;
+            }
+    }
+
     switch (sc) {   // Allow these keys to be used also for typing text.
     /*break;*/ case KEY_MINUS_PAD:
         if (!replaying && !withControl)
@@ -4148,6 +4348,7 @@ void Client::loop(volatile bool* quitFlag, bool firstTimeSplash) throw () {
             {
                 Lock ml(frameMutex);
                 handlePendingThreadMessages();
+                replay_seeking = false;
 
                 if (GlobalDisplaySwitchHook::readAndClear() && menu.options.screenMode.flipping())
                     graphics.videoMemoryCorrupted();
@@ -4198,119 +4399,7 @@ void Client::loop(volatile bool* quitFlag, bool firstTimeSplash) throw () {
 
         if (gameshow && (replaying || me >= 0)) {
             Lock ml(frameMutex);
-
-            ClientPhysicsCallbacks cb(*this);
-            if (replaying)
-                fd.extrapolate(fx, cb, -1, controlHistory, 0, 0, replaySubFrame);
-            else if (menu.options.game.lagPrediction()) {
-                const double lagWanted = 2. * (1. - menu.options.game.lagPredictionAmount() / 10.); // lagPredictionAmount() is in range [0, 10]
-                double timeDelta = max<double>(0., averageLag - lagWanted) + (get_time() - frameReceiveTime) * 10.;
-                uint8_t firstFrame, lastFrame;
-                if (clFrameSent == clFrameWorld)
-                    firstFrame = lastFrame = clFrameWorld;
-                else {
-                    firstFrame = lastFrame = clFrameWorld + 1;
-                    while (lastFrame != clFrameSent && timeDelta > 1.) {
-                        ++lastFrame;
-                        timeDelta -= 1.;
-                    }
-                }
-                if (timeDelta > 3.)
-                    timeDelta = 3.;
-                if (!fx.player[me].dead) {
-                    if (fx.physics.allowFreeTurning && menu.options.controls.aimMode() != Menu_controls::AM_8way)
-                        fx.player[me].gundir = gunDir;
-                    else
-                        for (uint8_t controlFrame = lastFrame; controlFrame != clFrameWorld; --controlFrame) {
-                            if (controlHistory[controlFrame].isStrafe())
-                                continue;
-                            const int dir = controlHistory[controlFrame].getDirection();
-                            if (dir != -1) {
-                                fx.player[me].gundir.from8way(dir);
-                                break;
-                            }
-                        }
-                }
-                fd.extrapolate(fx, cb, me, controlHistory, firstFrame, lastFrame, timeDelta);
-            }
-            else {
-                if (fx.physics.allowFreeTurning && !fx.player[me].dead && menu.options.controls.aimMode() != Menu_controls::AM_8way)
-                    fx.player[me].gundir = gunDir;
-                double timeDelta = (get_time() - frameReceiveTime) * 10.;
-                fd.extrapolate(fx, cb, me, controlHistory, clFrameWorld, clFrameWorld, timeDelta);
-            }
-
-            if (mapChanged) {
-                mapChanged = false;
-                if (current_map < int(maps.size()))
-                    maps[current_map].update(fx.map);
-                graphics.mapChanged();
-                if (replaying)
-                    visible_rooms = menu.options.graphics.visibleRoomsReplay();
-                else
-                    visible_rooms = menu.options.graphics.visibleRoomsPlay();
-                if (visible_rooms > fx.map.w && visible_rooms > fx.map.h)
-                    visible_rooms = max(fx.map.w, fx.map.h);
-                if (replaying) {
-                    const int team = rand() % 2;
-                    replayTopLeftRoom = pair<int, int>();
-                    if (!fx.map.tinfo[team].flags.empty()) {
-                        const WorldCoords& pos = fx.map.tinfo[team].flags[rand() % fx.map.tinfo[team].flags.size()];
-                        replayTopLeftRoom = pair<int, int>(max(0, pos.px + 1 - static_cast<int>(visible_rooms)), max(0, pos.py + 1 - static_cast<int>(visible_rooms)));
-                    }
-                    else if (!fx.map.wild_flags.empty()) {
-                        const WorldCoords& pos = fx.map.wild_flags[rand() % fx.map.wild_flags.size()];
-                        replayTopLeftRoom = pair<int, int>(max(0, pos.px + 1 - static_cast<int>(visible_rooms)), max(0, pos.py + 1 - static_cast<int>(visible_rooms)));
-                    }
-                }
-
-                mapWrapsX = mapWrapsY = false;
-                static const int testSkip = PLAYER_RADIUS / 2;
-                for (int side = 0; side < 2; ++side) {
-                    for (int rx = 0; rx < fx.map.w && !mapWrapsY; ++rx) {
-                        const int ry = side ? fx.map.h - 1 : 0;
-                        const int ly = side ? plh : 0;
-                        for (int lx = 0; lx < plw; lx += testSkip)
-                            if (!fx.map.fall_on_wall(rx, ry, lx, ly, PLAYER_RADIUS)) {
-                                mapWrapsY = true;
-                                break;
-                            }
-                    }
-                    for (int ry = 0; ry < fx.map.h && !mapWrapsX; ++ry) {
-                        const int rx = side ? fx.map.w - 1 : 0;
-                        const int lx = side ? plw : 0;
-                        for (int ly = 0; ly < plh; ly += testSkip)
-                            if (!fx.map.fall_on_wall(rx, ry, lx, ly, PLAYER_RADIUS)) {
-                                mapWrapsX = true;
-                                break;
-                            }
-                    }
-                }
-            }
-
-            if (graphics.needRedrawMap())
-                graphics.update_minimap_background(fx.map);
-
-            refreshGunDir();
-
-            // update carried flags' positions
-            for (int t = 0; t < 3; t++) {
-                const vector<Flag>& flags = t == 2 ? fx.wild_flags : fx.teams[t].flags();
-                int f = 0;
-                for (vector<Flag>::const_iterator fi = flags.begin(); fi != flags.end(); ++fi, ++f) {
-                    if (!fi->carried())
-                        continue;
-                    const ClientPlayer& pl = fx.player[fi->carrier()];
-                    const WorldCoords pos = playerPos(fi->carrier());
-                    nAssert(pos.px >= 0 && pos.py >= 0);
-                    if (!pl.used || pos.px >= fx.map.w || pos.py >= fx.map.h)
-                        continue;
-                    if (t < 2)
-                        fx.teams[t].move_flag(f, pos);
-                    else
-                        fx.wild_flags[f].move(pos);
-                }
-            }
+            prepare_game_frame();
 
             graphics.startDraw();
             draw_game_frame();
@@ -4350,6 +4439,66 @@ void Client::loop(volatile bool* quitFlag, bool firstTimeSplash) throw () {
     //client exit cleanup: done at stop wich needs to be called after loop
 }
 
+/* Play the replay as fast as possible, drawing each server frame a few times with the positions extrapolated like
+ * in normal replay, to a memory bitmap that is never shown. The time of each drawn frame is divided between the
+ * RenderPhase phases, and the percentiles are written to the log at the end. Frames where the game isn't shown
+ * (before the map is loaded, and between maps) are drawn but not timed.
+ */
+void Client::benchmark(volatile bool* quitFlag) throw () {
+    static const int framesPerServerFrame = 3;
+
+    openMenus.clear();
+    menusel = menu_none;
+    gameshow = false;
+    replaying = false;
+    spectating = false;
+    g_timeCounter.refresh();
+    start_replay(extConfig.benchmarkReplay);
+    if (!replaying)
+        return;
+
+    vector<string> phaseNames(RP_count);
+    phaseNames[RP_background] = "background";
+    phaseNames[RP_sprites]    = "sprites";
+    phaseNames[RP_effects]    = "effects";
+    phaseNames[RP_minimap]    = "minimap";
+    phaseNames[RP_hud]        = "hud";
+    PhaseTimer timer(phaseNames);
+    renderTimer = &timer;
+    graphics.setDirectRoomDrawing();    // the room disk cache would make the results depend on earlier runs, and prerendering on thread timing
+
+    log("Rendering benchmark of %s at %d%d%d", extConfig.benchmarkReplay.c_str(), benchmarkScreenWidth, benchmarkScreenHeight, benchmarkColorDepth);
+    while (replaying && !replay_stopped && !*quitFlag) {
+        const istream::pos_type pos = replay.tellg();
+        continue_replay();
+        if (!replaying || replay.tellg() == pos)    // the end of a replay whose length isn't recorded
+            break;
+        for (int subFrame = 0; subFrame < framesPerServerFrame; ++subFrame) {
+            Lock ml(frameMutex);
+            handlePendingThreadMessages();
+            g_timeCounter.refresh();
+            replaySubFrame = static_cast<double>(subFrame) / framesPerServerFrame;
+            prepare_game_frame();
+            graphics.startDraw();
+            const bool timed = map_ready && gameover_plaque == NEXTMAP_NONE && !fx.skipped;
+            if (timed)
+                timer.startFrame(RP_background);
+            draw_game_frame();
+            if (timed)
+                timer.endFrame();
+            graphics.endDraw();
+        }
+    }
+    renderTimer = 0;
+    if (replaying)
+        stop_replay();
+
+    timer.report(log);
+    const EffectPoolCounters fxc = graphics.effect_counters();
+    log("Effects: %u created, %u dropped for lack of room, peak %u alive.", fxc.created, fxc.dropped, fxc.peak);
+    extConfig.statusOutput(_("Rendering benchmark: $1 frames; the times are in the client log.", itoa(timer.frames())));
+}
+
 void Client::start_replay(const std::string& filename) throw () {
     disconnect_command();
     stop_replay();
@@ -4360,6 +4509,8 @@ void Client::start_replay(const std::string& filename) throw () {
         log.error(_("Could not open replay file $1.", filename.c_str()));
     else if (!start_replay(replay))
         replay.close();
+    else
+        load_replay_index();
 }
 
 bool Client::start_replay(istream& replay) throw () {
@@ -4372,7 +4523,7 @@ bool Client::start_replay(istream& replay) throw () {
         return false;
     }
 
-    unsigned replay_version = read.U32();
+    replay_version = read.U32();
     log("Replay version: %u", replay_version);
     if (replay_version > REPLAY_VERSION) {   // incompatible replay
         log.error(_("This is a newer replay version ($1).", itoa(replay_version)));
@@ -4381,6 +4532,8 @@ bool Client::start_replay(istream& replay) throw () {
 
     replay_length = read.U32();
     replay_first_frame_loaded = false;
+    replay_keyframes.clear();
+    replay_data_end = 0;
 
     hostname = read.str();
     string caption;
@@ -4393,6 +4546,16 @@ bool Client::start_replay(istream& replay) throw () {
     setMaxPlayers(read.U32());
     read.str(); // ignore map name
 
+    replay_encoding = replay_encoding_raw;
+    if (replay_version >= REPLAY_ENCODING_VERSION) {
+        replay_encoding = read.U8();
+        if (replay_encoding > replay_encoding_last) {
+            log.error(_("Unknown replay encoding ($1).", itoa(replay_encoding)));
+            return false;
+        }
+    }
+    replay_decoder.reset();
+
     replaying = true;
     replay_rate = 1;
     replay_paused = false;
@@ -4467,15 +4630,195 @@ void Client::continue_replay(istream& in) throw () {
     const istream::pos_type pos = in.tellg();
     BinaryStreamReader read(in);
     try {
-        process_incoming_data(read.block(read.U32()));
+        uint32_t length;
+        while ((length = read.U32()) & REPLAY_KEYFRAME_FLAG)
+            read.block(length & ~REPLAY_KEYFRAME_FLAG);   // keyframes are only needed when seeking
+        if (replay_data_end == 0 || read.getPosition() + length <= replay_data_end) {
+            const ConstDataBlockRef record = read.block(length);
+            if (replay_encoding == replay_encoding_raw)
+                process_incoming_data(record);
+            else {
+                replay_frame_data.clear();
+                if (!replay_decoder.decompress(record, replay_frame_data)) {
+                    log.error(_("Format error in replay file."));
+                    stop_replay();
+                    return;
+                }
+                process_incoming_data(replay_frame_data);
+            }
+            return;
+        }
+    } catch (BinaryReader::ReadOutside) { }
+    in.clear();
+    in.seekg(pos);
+    if (replay_length > 0)
+        replay_stopped = true;
+    else if (replay_rate > 1)
+        replay_rate = 1;
+}
+
+/* Read the keyframe index from the end of the replay file.
+ * If there is no index because the recording was interrupted, find the keyframes by scanning the file.
+ */
+void Client::load_replay_index() throw () {
+    replay_keyframes.clear();
+    replay_data_end = 0;
+    if (replay_version < 1)
+        return;
+
+    BinaryStreamReader read(replay);
+    const unsigned start = read.getPosition();
+    try {
+        replay.seekg(-8, ios::end);
+        const unsigned indexPos = read.U32();
+        if (read.U32() == REPLAY_INDEX_MARKER) {
+            read.setPosition(indexPos);
+            for (unsigned n = read.U32(); n > 0; --n) {
+                const unsigned frame = read.U32();
+                replay_keyframes.push_back(pair<unsigned, unsigned>(frame, read.U32()));
+            }
+            replay_data_end = indexPos;
+        }
     } catch (BinaryReader::ReadOutside) {
-        in.clear();
-        in.seekg(pos);
-        if (replay_length > 0)
-            replay_stopped = true;
-        else if (replay_rate > 1)
-            replay_rate = 1;
+        replay_keyframes.clear();
     }
+    if (replay_data_end == 0) {
+        read.setPosition(start);
+        try {
+            for (;;) {
+                const unsigned pos = read.getPosition();
+                const uint32_t length = read.U32();
+                if (length & REPLAY_KEYFRAME_FLAG) {
+                    const unsigned frame = read.U32();
+                    replay_keyframes.push_back(pair<unsigned, unsigned>(frame, pos));
+                    read.setPosition(pos + 4 + (length & ~REPLAY_KEYFRAME_FLAG));
+                }
+                else
+                    read.setPosition(pos + 4 + length);
+            }
+        } catch (BinaryReader::ReadOutside) { }
+        if (!replay_keyframes.empty()) { // the last one might be incomplete
+            read.setPosition(replay_keyframes.back().second);
+            try {
+                read.block(read.U32() & ~REPLAY_KEYFRAME_FLAG);
+            } catch (BinaryReader::ReadOutside) {
+                replay_keyframes.pop_back();
+            }
+        }
+    }
+    read.setPosition(start);
+    log("Replay index: %lu keyframes.", static_cast<long unsigned>(replay_keyframes.size()));
+}
+
+// Replace the dynamic game state with the keyframe at offset, and position the replay after it.
+bool Client::load_replay_keyframe(unsigned offset) throw () {
+    BinaryStreamReader read(replay);
+    const unsigned oldPos = read.getPosition();
+    read.setPosition(offset);
+    unsigned frame = 0;
+    ExpandingBinaryBuffer messages;
+    bool valid = false;
+    try {
+        const uint32_t length = read.U32();
+        if (length & REPLAY_KEYFRAME_FLAG) {
+            frame = read.U32();
+            const ConstDataBlockRef data = read.block((length & ~REPLAY_KEYFRAME_FLAG) - 4);
+            if (replay_encoding == replay_encoding_raw) {
+                messages.block(data);
+                valid = true;
+            }
+            else
+                valid = Decompressor().decompress(data, messages);
+        }
+    } catch (BinaryReader::ReadOutside) { }
+    if (!valid) {
+        read.setPosition(oldPos);
+        return false;
+    }
+    replay_decoder.reset(); // the frame stream is restartable after each keyframe
+
+    Lock ml(frameMutex);
+
+    for (int i = 0; i < 2; i++) {
+        fx.teams[i].clear_stats();
+        fx.teams[i].remove_flags();
+    }
+    fx.wild_flags.clear();
+    remove_flags = 0;
+    for (int i = 0; i < MAX_PLAYERS; i++)
+        fx.player[i].clear(false, i, "", i / TSIZE);
+    players_sb.clear();
+    fx.reset();
+    fd.reset();
+    fx.frame = frame;
+    fd.frame = frame;
+    chatbuffer.clear();
+    graphics.clear_fx();
+
+    BinaryDataBlockReader keyframe(messages);
+    try {
+        while (valid && keyframe.hasMore())
+            valid = process_message(keyframe.block(keyframe.U32()));
+    } catch (BinaryReader::ReadOutside) {
+        valid = false;
+    }
+    if (!valid) {
+        log.error(_("Format error in replay file."));
+        stop_replay();
+    }
+    return valid;
+}
+
+/* Move to the given frame. Jumps to the closest keyframe before the target if the replay has them and it's closer
+ * than the current position, and then plays frames silently until the target is reached. Without keyframes, going
+ * backwards means starting over.
+ */
+void Client::seek_replay(int frame) throw () {
+    if (!replaying || spectating || !replay_first_frame_loaded)
+        return;
+    const int target = replay_start_frame + max(0, frame);
+    if (target == fx.frame)
+        return;
+
+    vector<pair<unsigned, unsigned> >::const_iterator key = upper_bound(replay_keyframes.begin(), replay_keyframes.end(), pair<unsigned, unsigned>(target, ~0u));
+    bool useKey = key != replay_keyframes.begin();
+    if (useKey)
+        --key;
+    if (useKey && (target < fx.frame || static_cast<int>(key->first) > fx.frame))
+        useKey = load_replay_keyframe(key->second);
+    else
+        useKey = false;
+    if (!replaying)
+        return;
+    if (!useKey && target < fx.frame) {
+        const double rate = replay_rate;
+        const bool paused = replay_paused;
+        const pair<int, int> topLeft = replayTopLeftRoom;
+        const vector<pair<unsigned, unsigned> > keyframes = replay_keyframes;
+        const unsigned dataEnd = replay_data_end;
+        replay.clear();
+        replay.seekg(0);
+        if (!start_replay(replay)) {
+            stop_replay();
+            return;
+        }
+        replay_rate = rate;
+        replay_paused = paused;
+        replayTopLeftRoom = topLeft;
+        replay_keyframes = keyframes;
+        replay_data_end = dataEnd;
+    }
+
+    replay_seeking = true;  // reset after the queued sounds have been handled
+    replay_stopped = false;
+    while (replaying && !replay_stopped && (fx.frame < target || !replay_first_frame_loaded)) {
+        const double prevFrame = fx.frame;
+        continue_replay();
+        if (fx.frame == prevFrame)
+            break;
+    }
+    replaySubFrame = 0;
+    replayTime = get_time();
 }
 
 void Client::stop_replay() throw () {
@@ -4516,7 +4859,11 @@ void Client::start_spectating(const Network::Address& address) throw () {
         request.U32dyn8(REPLAY_VERSION);
         request.str(string()); // username
         request.str(string()); // password
-        request.U32dyn8(0); // no extension data
+        BinaryBuffer<16> extensions;
+        extensions.U32dyn8(0); // games back: start from the current game
+        extensions.U8(1 << replay_encoding_deflate);   // accepted stream encodings
+        request.U32dyn8(extensions.size());
+        request.block(extensions);
 
         spectate_socket.persistentWrite(request, 500, 5);
         log("Init data sent to the relay (%u bytes).", request.size());
@@ -4774,7 +5121,7 @@ void Client::remove_useless_flags() throw () {
 void Client::play_sound(int sample) throw () {
     int freq = 1000;
     if (replaying) {
-        if (replay_rate > 10)
+        if (replay_rate > 10 || replay_seeking)
             return;
         freq = int(freq * replay_rate);
     }
@@ -4836,6 +5183,126 @@ pair<int, int> Client::topLeftRoom() const throw () {
 }
 
 //draw the whole game screen
+void Client::prepare_game_frame() throw () {  // call with frameMutex locked
+    ClientPhysicsCallbacks cb(*this);
+    if (replaying)
+        fd.extrapolate(fx, cb, -1, controlHistory, 0, 0, replaySubFrame);
+    else if (menu.options.game.lagPrediction()) {
+        const double lagWanted = 2. * (1. - menu.options.game.lagPredictionAmount() / 10.); // lagPredictionAmount() is in range [0, 10]
+        double timeDelta = max<double>(0., averageLag - lagWanted) + (get_time() - frameReceiveTime) * 10.;
+        uint8_t firstFrame, lastFrame;
+        if (clFrameSent == clFrameWorld)
+            firstFrame = lastFrame = clFrameWorld;
+        else {
+            firstFrame = lastFrame = clFrameWorld + 1;
+            while (lastFrame != clFrameSent && timeDelta > 1.) {
+                ++lastFrame;
+                timeDelta -= 1.;
+            }
+        }
+        if (timeDelta > 3.)
+            timeDelta = 3.;
+        if (!fx.player[me].dead) {
+            if (fx.physics.allowFreeTurning && menu.options.controls.aimMode() != Menu_controls::AM_8way)
+                fx.player[me].gundir = gunDir;
+            else
+                for (uint8_t controlFrame = lastFrame; controlFrame != clFrameWorld; --controlFrame) {
+                    if (controlHistory[controlFrame].isStrafe())
+                        continue;
+                    const int dir = controlHistory[controlFrame].getDirection();
+                    if (dir != -1) {
+                        fx.player[me].gundir.from8way(dir);
+                        break;
+                    }
+                }
+        }
+        fd.extrapolate(fx, cb, me, controlHistory, firstFrame, lastFrame, timeDelta);
+    }
+    else {
+        if (fx.physics.allowFreeTurning && !fx.player[me].dead && menu.options.controls.aimMode() != Menu_controls::AM_8way)
+            fx.player[me].gundir = gunDir;
+        double timeDelta = (get_time() - frameReceiveTime) * 10.;
+        fd.extrapolate(fx, cb, me, controlHistory, clFrameWorld, clFrameWorld, timeDelta);
+    }
+
+    if (mapChanged) {
+        mapChanged = false;
+        if (current_map < int(maps.size()))
+            maps[current_map].update(fx.map);
+        graphics.mapChanged();
+        if (replaying)
+            visible_rooms = menu.options.graphics.visibleRoomsReplay();
+        else
+            visible_rooms = menu.options.graphics.visibleRoomsPlay();
+        if (visible_rooms > fx.map.w && visible_rooms > fx.map.h)
+            visible_rooms = max(fx.map.w, fx.map.h);
+        if (replaying) {
+            const int team = rand() % 2;
+            replayTopLeftRoom = pair<int, int>();
+            if (!fx.map.tinfo[team].flags.empty()) {
+                const WorldCoords& pos = fx.map.tinfo[team].flags[rand() % fx.map.tinfo[team].flags.size()];
+                replayTopLeftRoom = pair<int, int>(max(0, pos.px + 1 - static_cast<int>(visible_rooms)), max(0, pos.py + 1 - static_cast<int>(visible_rooms)));
+            }
+            else if (!fx.map.wild_flags.empty()) {
+                const WorldCoords& pos = fx.map.wild_flags[rand() % fx.map.wild_flags.size()];
+                replayTopLeftRoom = pair<int, int>(max(0, pos.px + 1 - static_cast<int>(visible_rooms)), max(0, pos.py + 1 - static_cast<int>(visible_rooms)));
+            }
+        }
+
+        mapWrapsX = mapWrapsY = false;
+        static const int testSkip = PLAYER_RADIUS / 2;
+        for (int side = 0; side < 2; ++side) {
+            for (int rx = 0; rx < fx.map.w && !mapWrapsY; ++rx) {
+                const int ry = side ? fx.map.h - 1 : 0;
+                const int ly = side ? plh : 0;
+                for (int lx = 0; lx < plw; lx += testSkip)
+                    if (!fx.map.fall_on_wall(rx, ry, lx, ly, PLAYER_RADIUS)) {
+                        mapWrapsY = true;
+                        break;
+                    }
+            }
+            for (int ry = 0; ry < fx.map.h && !mapWrapsX; ++ry) {
+                const int rx = side ? fx.map.w - 1 : 0;
+                const int lx = side ? plw : 0;
+                for (int ly = 0; ly < plh; ly += testSkip)
+                    if (!fx.map.fall_on_wall(rx, ry, lx, ly, PLAYER_RADIUS)) {
+                        mapWrapsX = true;
+                        break;
+                    }
+            }
+        }
+    }
+
+    if (graphics.needRedrawMap())
+        graphics.update_minimap_background(fx.map);
+
+    refreshGunDir();
+
+    // update carried flags' positions
+    for (int t = 0; t < 3; t++) {
+        const vector<Flag>& flags = t == 2 ? fx.wild_flags : fx.teams[t].flags();
+        int f = 0;
+        for (vector<Flag>::const_iterator fi = flags.begin(); fi != flags.end(); ++fi, ++f) {
+            if (!fi->carried())
+                continue;
+            const ClientPlayer& pl = fx.player[fi->carrier()];
+            const WorldCoords pos = playerPos(fi->carrier());
+            nAssert(pos.px >= 0 && pos.py >= 0);
+            if (!pl.used || pos.px >= fx.map.w || pos.py >= fx.map.h)
+                continue;
+            if (t < 2)
+                fx.teams[t].move_flag(f, pos);
+            else
+                fx.wild_flags[f].move(pos);
+        }
+    }
+}
+
+void Client::renderPhase(RenderPhase phase) throw () {
+    if (renderTimer)
+        renderTimer->phase(phase);
+}
+
 void Client::draw_game_frame() throw () {    // call with frameMutex locked
     // hide stuff if frame skipped
     const bool hide_game = !map_ready || gameover_plaque != NEXTMAP_NONE || fx.skipped || !replaying && me < 0;
@@ -4876,9 +5343,21 @@ void Client::draw_game_frame() throw () {    // call with frameMutex locked
                                  viewTopLeft(),
                                  menu.options.graphics.contTextures(),
                                  menu.options.graphics.mapInfoMode());
+        if (me >= 0) {
+            const ClientPlayer& pl = fd.player[me];
+            graphics.prerender_rooms(fx.map, WorldCoords(pl.roomx, pl.roomy, pl.lx, pl.ly), pl.sx, pl.sy, fx.physics.max_run_speed,
+                                     menu.options.graphics.contTextures(), menu.options.graphics.mapInfoMode());
+        }
+        else {  // follow the center of the view
+            const WorldCoords topLeft = viewTopLeft();
+            const WorldCoords center(topLeft.px, topLeft.py, topLeft.x + graphics.get_visible_rooms_x() * plw / 2, topLeft.y + graphics.get_visible_rooms_y() * plh / 2);
+            graphics.prerender_rooms(fx.map, center, 0, 0, fx.physics.max_run_speed, menu.options.graphics.contTextures(), menu.options.graphics.mapInfoMode());
+        }
         draw_playfield();
+        renderPhase(RP_minimap);
         draw_map(roomVis);
     }
+    renderPhase(RP_hud);
 
     graphics.draw_scoreboard(players_sb, fx.teams, maxplayers, key[KEY_TAB], menu.options.game.underlineMasterAuth(), menu.options.game.underlineServerAuth());
 
@@ -5065,6 +5544,7 @@ void Client::draw_playfield() throw () {
     const double time = fd.frame / 10;
     const bool live = !replaying || !replay_paused && !replay_stopped;
 
+    renderPhase(RP_sprites);
     graphics.startPlayfieldDraw();
 
     // draw dead players
@@ -5156,6 +5636,7 @@ void Client::draw_playfield() throw () {
         }
     }
 
+    renderPhase(RP_effects);
     for (int i = 0; i < maxplayers; i++)
         if (player_on_screen_exact(i) && fx.player[i].item_deathbringer)
             graphics.draw_deathbringer_carrier_effect(playerPos(i), calculatePlayerAlpha(i));
@@ -5171,6 +5652,7 @@ void Client::draw_playfield() throw () {
     for (list<DeathbringerExplosion>::const_iterator dbi = fx.deathbringerExplosions().begin(); dbi != fx.deathbringerExplosions().end(); ++dbi)
         graphics.draw_deathbringer(*dbi, fd.frame);
     #endif
+    renderPhase(RP_sprites);
 
     if (menu.options.graphics.showNeighborMarkers(replaying, visible_rooms)) {
         // neighbor markers: disappeared flags first
@@ -5419,6 +5901,7 @@ void Client::initMenus() throw () {
     menu.options.graphics.visibleRoomsReplay.setHook(new MCB::N<Slider,         &Client::MCF_visibleRoomsReplayChange>(this));
     menu.options.graphics.antialiasing      .setHook(new MCB::N<Checkbox,       &Client::MCF_antialiasChange         >(this));
     menu.options.graphics.minTransp         .setHook(new MCB::N<Checkbox,       &Client::MCF_transpChange            >(this));
+    menu.options.graphics.spriteAngles      .setHook(new MCB::N<Slider,         &Client::MCF_spriteAnglesChange      >(this));
     menu.options.graphics.statsBgAlpha      .setHook(new MCB::N<Slider,         &Client::MCF_statsBgChange           >(this));
 
     menu.options.sounds.menu        .setOpenHook(new MCB::N<Menu,           &Client::MCF_prepareSndMenu         >(this));
@@ -5700,6 +6183,10 @@ void Client::MCF_transpChange() throw () {
     graphics.set_min_transp(menu.options.graphics.minTransp());
 }
 
+void Client::MCF_spriteAnglesChange() throw () {
+    graphics.set_sprite_rotation_steps(menu.options.graphics.spriteAngles());
+}
+
 void Client::MCF_statsBgChange() throw () {
     graphics.set_stats_alpha(menu.options.graphics.statsBgAlpha());
 }
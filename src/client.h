@@ -39,6 +39,8 @@
 #endif
 
 #include "client_interface.h"
+#include "compress.h"
+#include "framecodec.h"
 #include "function_utility.h"
 #include "gameserver_interface.h"
 #include "log.h"
@@ -47,6 +49,8 @@
 #include "world.h"
 
 class BinaryReader;
+class PhaseTimer;
+template<bool Checked> class FastBinaryReader;
 
 #ifndef DEDICATED_SERVER_ONLY
 //server record
@@ -260,6 +264,8 @@ class Client : public ClientInterface {
     std::string servermap;  //last map command from server
 
     int protocolExtensions; // -1 means unextended protocol, 0 up are extension version numbers (<= PROTOCOL_EXTENSIONS_VERSION)
+    FrameHistory frameHistory;  // received frame bodies, for delta decoding (protocol extensions level 2 and up)
+    uint32_t baselineRequestFrame;  // the frame when data_frame_baseline_missing was last sent
 
     std::deque<ThreadMessage*> messageQueue;    // access with frameMutex locked; delete the object when removing from the queue
 
@@ -470,9 +476,20 @@ class Client : public ClientInterface {
     bool replay_first_frame_loaded;
     unsigned replay_start_frame;
     unsigned replay_length;
+    unsigned replay_version;
+    unsigned replay_encoding;
+    Decompressor replay_decoder;
+    ExpandingBinaryBuffer replay_frame_data;    // decoded frame
+    std::vector<std::pair<unsigned, unsigned> > replay_keyframes;  // frame number, file offset
+    unsigned replay_data_end;   // file offset of the keyframe index; 0 if there is none
+    bool replay_seeking;        // mute sounds generated while skipping frames
     std::pair<int, int> replayTopLeftRoom;
     double visible_rooms;
 
+    enum RenderPhase { RP_background, RP_sprites, RP_effects, RP_minimap, RP_hud, RP_count };
+    PhaseTimer* renderTimer;    // set by benchmark
+    void renderPhase(RenderPhase phase) throw ();
+
     bool spectating;
     Network::TCPSocket spectate_socket;
     bool spectate_data_received;
@@ -539,6 +556,7 @@ class Client : public ClientInterface {
     void MCF_visibleRoomsReplayChange() throw ();
     void MCF_antialiasChange() throw ();
     void MCF_transpChange() throw ();
+    void MCF_spriteAnglesChange() throw ();
     void MCF_statsBgChange() throw ();
     void MCF_prepareScrModeMenu() throw ();
     void MCF_prepareDrawScrModeMenu() throw ();
@@ -627,7 +645,8 @@ class Client : public ClientInterface {
     void send_frame(bool newFrame, bool forceSend) throw ();
     #endif
     void bot_send_frame(ClientControls controls) throw ();
-    void readMinimapPlayerPosition(BinaryReader& reader, int pid) throw ();
+    void applyMinimapPlayerPosition(int pid, uint8_t whox, uint8_t whoy) throw ();
+    void read_legacy_frame_body(FastBinaryReader<true>& read, FrameBody& fb) throw ();
     bool process_live_frame_data(ConstDataBlockRef data) throw (); // returns false if an error occured that requires disconnecting
     #ifndef DEDICATED_SERVER_ONLY
     int process_replay_frame_data(ConstDataBlockRef data) throw (); // returns number of bytes read - not necessarily all of data
@@ -680,6 +699,7 @@ class Client : public ClientInterface {
 
     typedef Graphics::VisibilityMap VisibilityMap;
 
+    void prepare_game_frame() throw ();
     void draw_game_frame() throw ();
     void draw_map(const VisibilityMap& roomVis) throw ();
     void draw_playfield() throw ();
@@ -703,6 +723,9 @@ class Client : public ClientInterface {
     bool start_replay(std::istream& in) throw ();
     void continue_replay() throw ();
     void continue_replay(std::istream& in) throw ();
+    void load_replay_index() throw ();
+    bool load_replay_keyframe(unsigned offset) throw ();
+    void seek_replay(int frame) throw (); // frame is relative to the start of the replay
     void stop_replay() throw ();
     void start_spectating(const Network::Address& address) throw ();
     void continue_spectating() throw ();
@@ -725,6 +748,7 @@ public:
     bool start() throw ();
     #ifndef DEDICATED_SERVER_ONLY
     void loop(volatile bool* quitFlag, bool firstTimeSplash) throw ();
+    void benchmark(volatile bool* quitFlag) throw ();
     void language_selection_start(volatile bool* quitFlag) throw ();
     #endif
     void stop() throw ();
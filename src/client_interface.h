@@ -49,6 +49,7 @@ public:
     std::string autoPlay;
     std::string autoReplay;
     std::string autoSpectate;
+    std::string benchmarkReplay;    // draw this replay without a display and report the drawing times, instead of running the client
 
     typedef HookFunctionHolder1<void, const std::string&> StatusOutputFnT;
     StatusOutputFnT statusOutput;
@@ -68,6 +69,7 @@ public:
     virtual bool start() throw () = 0;
     #ifndef DEDICATED_SERVER_ONLY
     virtual void loop(volatile bool* quitFlag, bool firstTimeSplash) throw () = 0;
+    virtual void benchmark(volatile bool* quitFlag) throw () = 0;    // use instead of loop when benchmarkReplay is set
     virtual void language_selection_start(volatile bool* quitFlag) throw () = 0;
     #endif
     virtual void stop() throw () = 0;
@@ -497,6 +497,7 @@ Menu_graphics::Menu_graphics() throw () :
 
     antialiasing         (_("Antialiasing"), true),
     minTransp            (_("Less transparency effects"), false),
+    spriteAngles         (_("Sprite rotation angles"), false, 8, 256, 64, 8, true),
     contTextures         (_("Continuous textures between rooms"), true),
     minimapPlayers       (_("Disappeared players on minimap")),
     highlightReturnedFlag(_("Highlight returned and dropped flags"), true),
@@ -547,6 +548,7 @@ void Menu_graphics::initialize(MenuHookable<Menu>::HookFunctionT* opener, Settin
     add.space();
     add(&antialiasing);
     add(&minTransp,              CCS_MinTransp);
+    add(&spriteAngles,           CCS_SpriteRotationSteps);
     add(&contTextures,           CCS_ContinuousTextures);
     add(&minimapPlayers,         CCS_MinimapPlayers);
     add(&highlightReturnedFlag,  CCS_HighlightReturnedFlag);
@@ -100,6 +100,7 @@ enum ClientCfgSetting {
     CCS_OldFlagPositions,
     CCS_Colours,
     CCS_UseThemeColours,
+    CCS_SpriteRotationSteps,
     CCS_EndOfCommands
 };
 
@@ -298,6 +299,7 @@ public:
     Checkbox            scroll;
     Checkbox            antialiasing;
     Checkbox            minTransp;
+    Slider              spriteAngles;
     Checkbox            contTextures;
     Select<MinimapPlayerMode> minimapPlayers;
     Checkbox            highlightReturnedFlag;
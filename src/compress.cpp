@@ -0,0 +1,98 @@
+/*
+ *  compress.cpp
+ *
+ *  Copyright (C) 2008 - Niko Ritari
+ *
+ *  This file is part of Outgun.
+ *
+ *  Outgun is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Outgun is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Outgun; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <zlib.h>
+
+#include "nassert.h"
+
+#include "compress.h"
+
+static const unsigned chunkSize = 4096;
+static const int windowBits = -15; // raw deflate data; the data is always framed by our own length fields
+
+Compressor::Compressor() throw () : stream(new z_stream) {
+    stream->zalloc = Z_NULL;
+    stream->zfree = Z_NULL;
+    stream->opaque = Z_NULL;
+    const int ret = deflateInit2(stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY);
+    numAssert(ret == Z_OK, ret);
+}
+
+Compressor::~Compressor() throw () {
+    deflateEnd(stream);
+    delete stream;
+}
+
+void Compressor::compress(ConstDataBlockRef data, ExpandingBinaryBuffer& out, bool restartPoint) throw () {
+    stream->next_in = const_cast<Bytef*>(static_cast<const Bytef*>(data.data()));
+    stream->avail_in = data.size();
+    do {    // with a flush, deflate is done when it doesn't fill the output buffer
+        const unsigned start = out.size();
+        out.setPosition(start + chunkSize);
+        stream->next_out = out.accessData() + start;
+        stream->avail_out = chunkSize;
+        const int ret = deflate(stream, restartPoint ? Z_FULL_FLUSH : Z_SYNC_FLUSH);
+        numAssert(ret == Z_OK || ret == Z_BUF_ERROR, ret);
+        out.setPosition(start + chunkSize - stream->avail_out);
+    } while (stream->avail_out == 0);
+}
+
+void Compressor::reset() throw () {
+    deflateReset(stream);
+}
+
+Decompressor::Decompressor() throw () : stream(new z_stream) {
+    stream->zalloc = Z_NULL;
+    stream->zfree = Z_NULL;
+    stream->opaque = Z_NULL;
+    stream->next_in = Z_NULL;
+    stream->avail_in = 0;
+    const int ret = inflateInit2(stream, windowBits);
+    numAssert(ret == Z_OK, ret);
+}
+
+Decompressor::~Decompressor() throw () {
+    inflateEnd(stream);
+    delete stream;
+}
+
+bool Decompressor::decompress(ConstDataBlockRef data, ExpandingBinaryBuffer& out) throw () {
+    stream->next_in = const_cast<Bytef*>(static_cast<const Bytef*>(data.data()));
+    stream->avail_in = data.size();
+    for (;;) {
+        const unsigned start = out.size();
+        out.setPosition(start + chunkSize);
+        stream->next_out = out.accessData() + start;
+        stream->avail_out = chunkSize;
+        const int ret = inflate(stream, Z_SYNC_FLUSH);
+        out.setPosition(start + chunkSize - stream->avail_out);
+        if (ret != Z_OK && ret != Z_BUF_ERROR)  // Z_STREAM_END is an error too because Compressor never finishes the stream
+            return false;
+        if (stream->avail_out != 0)
+            return stream->avail_in == 0;
+    }
+}
+
+void Decompressor::reset() throw () {
+    inflateReset(stream);
+}
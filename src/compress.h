@@ -0,0 +1,62 @@
+/*
+ *  compress.h
+ *
+ *  Copyright (C) 2008 - Niko Ritari
+ *
+ *  This file is part of Outgun.
+ *
+ *  Outgun is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Outgun is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Outgun; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef COMPRESS_H_INC
+#define COMPRESS_H_INC
+
+#include "binaryaccess.h"
+#include "utility.h"
+
+struct z_stream_s;
+
+/** Streaming deflate compression of replay and relay data.
+ * Every call to compress() flushes the output, so that the compressed data of each frame can be decoded as soon as
+ * it has been received. A restart point additionally makes the following data independent of everything before it,
+ * so that a newly created or reset Decompressor can start decoding from there (used for seeking).
+ */
+class Compressor : private NoCopying {
+public:
+    Compressor() throw ();
+    ~Compressor() throw ();
+
+    void compress(ConstDataBlockRef data, ExpandingBinaryBuffer& out, bool restartPoint = false) throw ();
+    void reset() throw ();
+
+private:
+    z_stream_s* stream;
+};
+
+class Decompressor : private NoCopying {
+public:
+    Decompressor() throw ();
+    ~Decompressor() throw ();
+
+    /// Decode data produced by one or more Compressor::compress calls. Returns false if the data is corrupt.
+    bool decompress(ConstDataBlockRef data, ExpandingBinaryBuffer& out) throw ();
+    void reset() throw ();
+
+private:
+    z_stream_s* stream;
+};
+
+#endif
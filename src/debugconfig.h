@@ -42,6 +42,11 @@ static const bool LOG_CONDVAR_ACTIONS = false;
 
 #endif
 
+// Make named Mutexes collect contention statistics when g_lockProfiling is set (by -lockprofile); see LockProfileState in mutex.h.
+// The overhead with profiling off is one test per lock, so this is normally left defined.
+#define LOCK_PROFILING
+extern bool g_lockProfiling;
+
 // Flush ./threadlog.bin on every write to ensure everything is written in the event of a crash.
 static const bool FLUSH_THREAD_LOG = false;
 
@@ -0,0 +1,99 @@
+/*
+ *  effectpool.h
+ *
+ *  Copyright (C) 2008 - Niko Ritari
+ *
+ *  This file is part of Outgun.
+ *
+ *  Outgun is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Outgun is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Outgun; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+
+#ifndef EFFECTPOOL_H_INC
+#define EFFECTPOOL_H_INC
+
+#include "nassert.h"
+
+/// Allocation statistics of an EffectPool.
+struct EffectPoolCounters {
+    unsigned created;   // effects added
+    unsigned dropped;   // effects removed before expiring to make room for new ones
+    unsigned expired;   // effects removed after their lifetime
+    unsigned peak;      // largest number of effects alive at once
+
+    EffectPoolCounters() throw () : created(0), dropped(0), expired(0), peak(0) { }
+    void add(const EffectPoolCounters& o) throw () { created += o.created; dropped += o.dropped; expired += o.expired; peak += o.peak; }
+};
+
+/** Fixed-capacity pool of one kind of timed effect.
+ * The start times and the effect data are kept in separate contiguous arrays, used as a ring in creation order.
+ * All effects of a pool have the same lifetime, so they expire in the order they were created, from the front. To keep
+ * that true when the creation times given aren't in order, an effect is never started before the newest one.
+ * Overflow policy: when the pool is full, adding an effect drops the oldest one, which is the closest to fading out
+ * anyway. Nothing is allocated after construction. capacity must be a power of two.
+ */
+template<class Data, unsigned capacity> class EffectPool {
+public:
+    EffectPool() throw () : first(0), count(0) { }
+
+    /// Add an effect starting at time, or at the start of the newest effect if that's later; fill in the returned data.
+    Data& add(double time) throw () {
+        ++stats.created;
+        if (count) {
+            const double newest = startTime[(first + count - 1) & mask];
+            if (time < newest)
+                time = newest;
+        }
+        if (count == capacity) {
+            first = (first + 1) & mask;
+            --count;
+            ++stats.dropped;
+        }
+        const unsigned i = (first + count) & mask;
+        if (++count > stats.peak)
+            stats.peak = count;
+        startTime[i] = time;
+        return entries[i];
+    }
+    /// Remove the effects that have lived longer than lifetime at time now.
+    void expire(double now, double lifetime) throw () {
+        while (count && now - startTime[first] > lifetime) {
+            first = (first + 1) & mask;
+            --count;
+            ++stats.expired;
+        }
+    }
+    void clear() throw () { first = count = 0; }
+
+    // the effects are indexed 0 (the oldest) to size() - 1
+    unsigned size() const throw () { return count; }
+    double time(unsigned i) const throw () { return startTime[(first + i) & mask]; }
+    const Data& operator[](unsigned i) const throw () { return entries[(first + i) & mask]; }
+
+    const EffectPoolCounters& counters() const throw () { return stats; }
+
+private:
+    static const unsigned mask = capacity - 1;
+    STATIC_ASSERT(capacity != 0 && (capacity & mask) == 0);
+
+    double startTime[capacity];
+    Data entries[capacity];
+    unsigned first; // index of the oldest effect
+    unsigned count;
+    EffectPoolCounters stats;
+};
+
+#endif
@@ -28,29 +28,53 @@
 
 #include "world.h"
 
+#include "effectpool.h"
+
 // client side effects
 
-enum FX_TYPE {
-    FX_GUN_EXPLOSION,
-    FX_TURBO,
-    FX_WALL_EXPLOSION,
-    FX_POWER_WALL_EXPLOSION,
-    FX_DEATHCARRIER_SMOKE
+struct ExplosionEffect {
+    WorldCoords pos;
+    int team;
 };
 
-struct GraphicsEffect {
-    FX_TYPE type;       // type of fx
+struct SmokeEffect {
     WorldCoords pos;
-    double time;        // start time
+    float alpha;  // [0, 1]
+};
 
-    int team;
+struct TurboEffect {
+    WorldCoords pos;
     float alpha;  // [0, 1]
-    // for turbo effect
     int col1, col2;
     GunDirection gundir;
+};
+
+/// All the client side effects, each kind in its own pool; see EffectPool for the overflow policy.
+struct EffectStore {
+    // lifetimes in seconds
+    static const double gunExplosionTime, wallExplosionTime, powerWallExplosionTime, smokeTime, turboTime;
+
+    EffectPool<ExplosionEffect, 256> gunExplosions, wallExplosions, powerWallExplosions;
+    EffectPool<SmokeEffect, 512> smoke;   // deathbringer carriers leave several puffs per frame
+    EffectPool<TurboEffect, 256> turbo;
 
-    GraphicsEffect(FX_TYPE type_, const WorldCoords& pos_, double time_, int team_, float alpha_ = 0, int col1_ = 0, int col2_ = 0, GunDirection gundir_ = GunDirection()) throw ()
-        : type(type_), pos(pos_), time(time_), team(team_), alpha(alpha_), col1(col1_), col2(col2_), gundir(gundir_) { }
+    void clear() throw () {
+        gunExplosions.clear();
+        wallExplosions.clear();
+        powerWallExplosions.clear();
+        smoke.clear();
+        turbo.clear();
+    }
+    /// Sum of the counters of all pools (peak being the sum of the peaks).
+    EffectPoolCounters counters() const throw () {
+        EffectPoolCounters c;
+        c.add(gunExplosions.counters());
+        c.add(wallExplosions.counters());
+        c.add(powerWallExplosions.counters());
+        c.add(smoke.counters());
+        c.add(turbo.counters());
+        return c;
+    }
 };
 
 #endif // EFFECTS_H_INC
@@ -0,0 +1,259 @@
+/*
+ *  fastbinary.h
+ *
+ *  Copyright (C) 2008 - Niko Ritari
+ *
+ *  This file is part of Outgun.
+ *
+ *  Outgun is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Outgun is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Outgun; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef FASTBINARY_H_INC
+#define FASTBINARY_H_INC
+
+#include <cstring>
+#include <string>
+
+#include "binaryaccess.h"
+#include "nassert.h"
+#include "utility.h"
+
+/* Inline binary access for contiguous buffers.
+ *
+ * FastBinaryReader and FastBinaryWriter produce and accept exactly the same data as BinaryReader and BinaryWriter,
+ * but nothing is virtual and everything is in the header, so that the compiler can inline whole runs of fields.
+ * Use them for the per-frame encoders and decoders; elsewhere the regular classes are just as good.
+ *
+ * With Checked == true, every field is bounds checked like with the regular classes: the reader throws
+ * BinaryReader::ReadOutside and the writer expands its target (or asserts if it can't).
+ * With Checked == false, there are no per-field checks (except with EXTRA_DEBUG, as assertions). Instead, the
+ * caller must make sure the space is there with one require() (reader) or reserve() (writer) call covering a run
+ * of fields. Only use the unchecked reader on untrusted data after such a require().
+ */
+
+template<bool Checked> class FastBinaryReader {
+public:
+    typedef BinaryReader::ReadOutside ReadOutside;
+    typedef BinaryReader::DataOutOfRange DataOutOfRange;
+
+    FastBinaryReader(const void* data, unsigned size) throw () : begin(static_cast<const uint8_t*>(data)), p(begin), end(begin + size) { }
+    FastBinaryReader(ConstDataBlockRef block) throw () : begin(static_cast<const uint8_t*>(block.data())), p(begin), end(begin + block.size()) { }
+
+    /// Throw unless at least n more bytes are available. Needed before every run of unchecked reads.
+    void require(unsigned n) const throw (ReadOutside) { if (static_cast<unsigned>(end - p) < n) throw ReadOutside(); }
+
+    bool hasMore() const throw () { return p < end; }
+    unsigned remaining() const throw () { return end - p; }
+    unsigned getPosition() const throw () { return p - begin; }
+    void setPosition(unsigned position) throw () { p = begin + position; }
+    ConstDataBlockRef unreadPart() const throw () { return ConstDataBlockRef(p, end - p); }
+
+     uint8_t U8 () throw (ReadOutside) { check(1); return *p++; }
+      int8_t S8 () throw (ReadOutside) { return static_cast<int8_t >(U8 ()); }
+    uint16_t U16() throw (ReadOutside) { check(2); p += 2; return uint16_t(p[-2]) << 8 | p[-1]; }
+     int16_t S16() throw (ReadOutside) { return static_cast<int16_t>(U16()); }
+    uint32_t U24() throw (ReadOutside) { check(3); p += 3; return uint32_t(p[-3]) << 16 | uint32_t(p[-2]) << 8 | p[-1]; }
+     int32_t S24() throw (ReadOutside) { return static_cast<int32_t>(U24() ^ 0x800000) - 0x800000; }
+    uint32_t U32() throw (ReadOutside) { check(4); p += 4; return uint32_t(p[-4]) << 24 | uint32_t(p[-3]) << 16 | uint32_t(p[-2]) << 8 | p[-1]; }
+     int32_t S32() throw (ReadOutside) { return static_cast<int32_t>(U32()); }
+    uint64_t U64() throw (ReadOutside) { const uint64_t high = U32(); return high << 32 | U32(); }
+     int64_t S64() throw (ReadOutside) { return static_cast<int64_t>(U64()); }
+
+    // see binaryaccess.cpp for the encoding
+    uint32_t U32dyn8() throw (ReadOutside) {
+        const uint8_t b0 = U8();
+        if      (b0 < 0xF0) return          b0;
+        else if (b0 < 0xFC) return uint32_t(b0 & 0x0F) <<  8 | U8();
+        else if (b0 < 0xFE) return uint32_t(b0 & 0x01) << 16 | U16();
+        else if (b0 < 0xFF) return                             U24();
+        else                return                             U32();
+    }
+     int32_t S32dyn8 () throw (ReadOutside) { return decodeSignedDynamic(U32dyn8()); }
+    uint32_t U32dyn16() throw (ReadOutside) {
+        const uint16_t d0 = U16();
+        if      (d0 < 0xC000) return          d0;
+        else if (d0 < 0xE000) return uint32_t(d0 & 0x1FFF) <<  8 | U8();
+        else if (d0 < 0xFF00) return uint32_t(d0 & 0x1FFF) << 16 | U16();
+        else                  return uint32_t(d0         ) << 24 | U24();
+    }
+     int32_t S32dyn16() throw (ReadOutside) { return decodeSignedDynamic(U32dyn16()); }
+
+    float flt() throw (ReadOutside) {
+        STATIC_ASSERT(sizeof(uint32_t) == sizeof(float));
+        union { uint32_t i; float f; } conversionHack;
+        conversionHack.i = U32();
+        return conversionHack.f;
+    }
+    double dbl() throw (ReadOutside) {
+        STATIC_ASSERT(sizeof(uint64_t) == sizeof(double));
+        union { uint64_t i; double d; } conversionHack;
+        conversionHack.i = U64();
+        return conversionHack.d;
+    }
+
+     uint8_t U8 ( uint8_t minBound,  uint8_t maxBound) throw (ReadOutside, DataOutOfRange) { return bounded(U8 (), minBound, maxBound); }
+      int8_t S8 (  int8_t minBound,   int8_t maxBound) throw (ReadOutside, DataOutOfRange) { return bounded(S8 (), minBound, maxBound); }
+    uint16_t U16(uint16_t minBound, uint16_t maxBound) throw (ReadOutside, DataOutOfRange) { return bounded(U16(), minBound, maxBound); }
+     int16_t S16( int16_t minBound,  int16_t maxBound) throw (ReadOutside, DataOutOfRange) { return bounded(S16(), minBound, maxBound); }
+    uint32_t U24(uint32_t minBound, uint32_t maxBound) throw (ReadOutside, DataOutOfRange) { return bounded(U24(), minBound, maxBound); }
+     int32_t S24( int32_t minBound,  int32_t maxBound) throw (ReadOutside, DataOutOfRange) { return bounded(S24(), minBound, maxBound); }
+    uint32_t U32(uint32_t minBound, uint32_t maxBound) throw (ReadOutside, DataOutOfRange) { return bounded(U32(), minBound, maxBound); }
+     int32_t S32( int32_t minBound,  int32_t maxBound) throw (ReadOutside, DataOutOfRange) { return bounded(S32(), minBound, maxBound); }
+
+    std::string constLengthStr(unsigned length) throw (ReadOutside) {
+        const ConstDataBlockRef data = block(length);
+        return std::string(static_cast<const char*>(data.data()), length);
+    }
+    std::string str() throw (ReadOutside) {
+        const uint8_t* const start = p;
+        while (p < end && *p != 0)
+            ++p;
+        if (p == end)
+            throw ReadOutside(); // the terminator is required even with Checked == false, because the length isn't known beforehand
+        return std::string(reinterpret_cast<const char*>(start), p++ - start);
+    }
+
+    ConstDataBlockRef block(unsigned length) throw (ReadOutside) { check(length); p += length; return ConstDataBlockRef(p - length, length); }
+    void block(DataBlockRef buffer) throw (ReadOutside) { memcpy(buffer.data(), block(buffer.size()).data(), buffer.size()); }
+
+private:
+    const uint8_t* begin;
+    const uint8_t* p;
+    const uint8_t* end;
+
+    void check(unsigned n) const throw (ReadOutside) {
+        if (Checked)
+            require(n);
+        #ifdef EXTRA_DEBUG
+        else
+            numAssert2(static_cast<unsigned>(end - p) >= n, end - p, n);
+        #endif
+    }
+    template<class T> static T bounded(T value, T minBound, T maxBound) throw (DataOutOfRange) {
+        if (value < minBound || value > maxBound)
+            throw DataOutOfRange();
+        return value;
+    }
+    static int32_t decodeSignedDynamic(uint32_t value) throw () { return int32_t((value >> 1) ^ (0xFFFFFFFF * (value & 1))); }
+};
+
+/** Inline writer appending to a BinaryWriter's buffer.
+ * The position of the target is only updated by commit() and the destructor; don't use the target in between.
+ */
+template<bool Checked> class FastBinaryWriter : private NoCopying {
+public:
+    FastBinaryWriter(BinaryWriter& target_) throw () : target(target_) { load(); }
+    ~FastBinaryWriter() throw () { commit(); }
+
+    /// Make room for at least n more bytes. Needed before every run of unchecked writes.
+    void reserve(unsigned n) throw () {
+        commit();
+        target.reserve(target.pos + n);
+        load();
+    }
+    void commit() throw () { target.pos = p - target.data; }
+
+    unsigned getPosition() const throw () { return p - target.data; }
+    void setPosition(unsigned position) throw () { numAssert2(position <= target.capacity, position, target.capacity); p = target.data + position; }
+
+    void uncheckedU8 ( uint8_t wData) throw () { check(1); *p++ = wData; }
+    void uncheckedS8 (  int8_t wData) throw () { uncheckedU8 (static_cast< uint8_t>(wData)); }
+    void uncheckedU16(uint16_t wData) throw () { check(2); p[0] = wData >> 8; p[1] = wData; p += 2; }
+    void uncheckedS16( int16_t wData) throw () { uncheckedU16(static_cast<uint16_t>(wData)); }
+    void uncheckedU24(uint32_t wData) throw () { check(3); p[0] = wData >> 16; p[1] = wData >> 8; p[2] = wData; p += 3; }
+    void uncheckedS24( int32_t wData) throw () { uncheckedU24(static_cast<uint32_t>(wData)); }
+    void uncheckedU32(uint32_t wData) throw () { check(4); p[0] = wData >> 24; p[1] = wData >> 16; p[2] = wData >> 8; p[3] = wData; p += 4; }
+    void uncheckedS32( int32_t wData) throw () { uncheckedU32(static_cast<uint32_t>(wData)); }
+
+    // the data is verified (asserted) to be within range, like with BinaryWriter
+    void U8 (unsigned wData) throw () { numAssert(wData <= 0xFF      , wData); uncheckedU8 (wData); }
+    void S8 (  signed wData) throw () { numAssert(wData >= -0x80     && wData <= 0x7F      , wData); uncheckedS8 (wData); }
+    void U16(unsigned wData) throw () { numAssert(wData <= 0xFFFF    , wData); uncheckedU16(wData); }
+    void S16(  signed wData) throw () { numAssert(wData >= -0x8000   && wData <= 0x7FFF    , wData); uncheckedS16(wData); }
+    void U24(unsigned wData) throw () { numAssert(wData <= 0xFFFFFF  , wData); uncheckedU24(wData); }
+    void S24(  signed wData) throw () { numAssert(wData >= -0x800000 && wData <= 0x7FFFFF  , wData); uncheckedS24(wData); }
+    void U32(unsigned wData) throw () { uncheckedU32(wData); }
+    void S32(  signed wData) throw () { uncheckedS32(wData); }
+    void U64(uint64_t wData) throw () { uncheckedU32(static_cast<uint32_t>(wData >> 32)); uncheckedU32(static_cast<uint32_t>(wData)); }
+    void S64( int64_t wData) throw () { U64(static_cast<uint64_t>(wData)); }
+
+    // see binaryaccess.cpp for the encoding
+    void U32dyn8(uint32_t wData) throw () {
+        if      (wData <      0xF0) uncheckedU8 (             wData);
+        else if (wData <     0xC00) uncheckedU16(0xF000     | wData);
+        else if (wData <=  0x1FFFF) uncheckedU24(0xFC0000   | wData);
+        else if (wData <= 0xFFFFFF) uncheckedU32(0xFE000000 | wData);
+        else {
+            uncheckedU8(0xFF);
+            uncheckedU32(wData);
+        }
+    }
+    void S32dyn8 ( int32_t wData) throw () { U32dyn8 (encodeSignedDynamic(wData)); }
+    void U32dyn16(uint32_t wData) throw () {
+        if      (wData <      0xC000) uncheckedU16(             wData);
+        else if (wData <=   0x1FFFFF) uncheckedU24(0xC00000   | wData);
+        else if (wData <  0x1F000000) uncheckedU32(0xE0000000 | wData);
+        else {
+            uncheckedU8(0xFF);
+            uncheckedU32(wData);
+        }
+    }
+    void S32dyn16( int32_t wData) throw () { U32dyn16(encodeSignedDynamic(wData)); }
+
+    void flt(float wData) throw () {
+        STATIC_ASSERT(sizeof(uint32_t) == sizeof(float));
+        union { uint32_t i; float f; } conversionHack;
+        conversionHack.f = wData;
+        uncheckedU32(conversionHack.i);
+    }
+    void dbl(double wData) throw () {
+        STATIC_ASSERT(sizeof(uint64_t) == sizeof(double));
+        union { uint64_t i; double d; } conversionHack;
+        conversionHack.d = wData;
+        U64(conversionHack.i);
+    }
+
+    void str(const std::string& wData) throw () {
+        nAssert(wData.find_first_of('\0') == std::string::npos);
+        block(ConstDataBlockRef(wData.data(), wData.length()));
+        uncheckedU8(0);
+    }
+    void block(ConstDataBlockRef wData) throw () {
+        check(wData.size());
+        memcpy(p, wData.data(), wData.size());
+        p += wData.size();
+    }
+
+private:
+    BinaryWriter& target;
+    uint8_t* p;
+    uint8_t* end;
+
+    void load() throw () { p = target.data + target.pos; end = target.data + target.capacity; }
+    void check(unsigned n) throw () {
+        if (Checked) {
+            if (static_cast<unsigned>(end - p) < n)
+                reserve(n);
+        }
+        #ifdef EXTRA_DEBUG
+        else
+            numAssert2(static_cast<unsigned>(end - p) >= n, end - p, n);
+        #endif
+    }
+    static uint32_t encodeSignedDynamic(int32_t value) throw () { return uint32_t(uint32_t(value) << 1) ^ (0xFFFFFFFF * (uint32_t(value) >> 31)); }
+};
+
+#endif
@@ -0,0 +1,212 @@
+/*
+ *  framecodec.h
+ *
+ *  Copyright (C) 2008 - Niko Ritari
+ *
+ *  This file is part of Outgun.
+ *
+ *  Outgun is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Outgun is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Outgun; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef FRAMECODEC_H_INC
+#define FRAMECODEC_H_INC
+
+#include <vector>
+
+#include "bitaccess.h"
+#include "commont.h"
+
+/* Schema of the bit-packed per-recipient frame body (protocol extensions level 1 and up).
+ *
+ * The body follows the room coordinates of the recipient. It's described once by the code* templates below,
+ * which are instantiated with a BitEncoder on the server and a BitDecoder on the client; the body is padded to
+ * a whole byte at the end. The older byte-aligned formats are documented in ServerNetworking::broadcast_frame.
+ *
+ * From level 2 on, the body is preceded by a byte telling how many frames back the baseline frame is, 0 meaning
+ * none. Players that were on screen in the baseline are coded as differences to their record in it.
+ */
+
+/// A player on the recipient's screen.
+struct FramePlayerRecord {
+    static const unsigned positionBits = 12;
+
+    double lx, ly;
+    bool dead, deathbringer, deathbringerAffected, shield, turbo, power;
+    bool preciseGundir;
+    uint8_t speedX, speedY; // SignedByteFloat<3, -2>
+    uint8_t controls;       // ClientControls::toNetwork(true)
+    uint16_t gundir;        // GunDirection long form if preciseGundir, short form otherwise
+    uint8_t visibility;
+    // the server leaves speed, controls and visibility of dead players at the defaults, so that they match the decoded record
+
+    FramePlayerRecord() throw () : lx(0), ly(0), dead(false), deathbringer(false), deathbringerAffected(false), shield(false), turbo(false), power(false),
+        preciseGundir(false), speedX(0), speedY(0), controls(0), gundir(0), visibility(255) { }
+};
+
+/// Minimap positions of players outside the recipient's screen.
+struct FrameMinimapRecord {
+    uint32_t players;   // bit mask of the players whose position follows
+    uint8_t x[MAX_PLAYERS], y[MAX_PLAYERS]; // map position scaled to 255 / map size per room
+
+    FrameMinimapRecord() throw () : players(0) { }
+};
+
+struct FrameBody {
+    uint32_t playersOnscreen;
+    FramePlayerRecord player[MAX_PLAYERS];
+    FrameMinimapRecord minimap;
+    uint8_t health8, energy8;   // the ninth bits are in the frame header
+    bool pingSent;
+    uint16_t ping;              // of player frame % maxplayers
+
+    FrameBody() throw () : playersOnscreen(0), health8(0), energy8(0), pingSent(false), ping(0) { }
+};
+
+// Record is the const record type when encoding, and non-const when decoding.
+
+template<class Coder, class Record> void codeFramePlayer(Coder& c, Record& r) {
+    c.quantized(r.lx, 0., plw, FramePlayerRecord::positionBits);
+    c.quantized(r.ly, 0., plh, FramePlayerRecord::positionBits);
+    c.flag(r.dead);
+    c.flag(r.deathbringer);
+    c.flag(r.deathbringerAffected);
+    c.flag(r.shield);
+    c.flag(r.turbo);
+    c.flag(r.power);
+    c.flag(r.preciseGundir);
+    if (!r.dead) {  // dead players have no speed, controls or visibility
+        c.field(r.speedX, 8);
+        c.field(r.speedY, 8);
+        c.field(r.controls, 5);
+        c.field(r.visibility, 8);
+    }
+    c.field(r.gundir, r.preciseGundir ? 11 : 3);
+}
+
+template<class Coder, class Record> void codeFrameMinimap(Coder& c, Record& r, int maxplayers) {
+    c.field(r.players, maxplayers);
+    for (int i = 0; i < maxplayers; ++i)
+        if (r.players & (uint32_t(1) << i)) {
+            c.field(r.x[i], 8);
+            c.field(r.y[i], 8);
+        }
+}
+
+/// Player record relative to the same player's record in the baseline frame.
+template<class Coder, class Record> void codeFramePlayerDelta(Coder& c, Record& r, const FramePlayerRecord& base) {
+    c.baseline(r, base);
+    static const unsigned pb = FramePlayerRecord::positionBits;
+    bool moved = quantize(r.lx, 0., plw, pb) != quantize(base.lx, 0., plw, pb) || quantize(r.ly, 0., plh, pb) != quantize(base.ly, 0., plh, pb);
+    if (c.flag(moved)) {
+        c.quantized(r.lx, 0., plw, pb);
+        c.quantized(r.ly, 0., plh, pb);
+    }
+    bool stateChanged = r.dead != base.dead || r.deathbringer != base.deathbringer || r.deathbringerAffected != base.deathbringerAffected ||
+                        r.shield != base.shield || r.turbo != base.turbo || r.power != base.power || r.preciseGundir != base.preciseGundir;
+    if (c.flag(stateChanged)) {
+        c.flag(r.dead);
+        c.flag(r.deathbringer);
+        c.flag(r.deathbringerAffected);
+        c.flag(r.shield);
+        c.flag(r.turbo);
+        c.flag(r.power);
+        c.flag(r.preciseGundir);
+    }
+    bool motionChanged = r.speedX != base.speedX || r.speedY != base.speedY || r.controls != base.controls;
+    if (c.flag(motionChanged)) {
+        c.field(r.speedX, 8);
+        c.field(r.speedY, 8);
+        c.field(r.controls, 5);
+    }
+    bool visibilityChanged = r.visibility != base.visibility;
+    if (c.flag(visibilityChanged))
+        c.field(r.visibility, 8);
+    bool turned = r.gundir != base.gundir || r.preciseGundir != base.preciseGundir;
+    if (c.flag(turned))
+        c.field(r.gundir, r.preciseGundir ? 11 : 3);
+}
+
+/// The body after the baseline byte; base is the baseline frame or 0 if there's none.
+template<class Coder, class Record> void codeFrameBody(Coder& c, Record& r, int maxplayers, const FrameBody* base = 0) {
+    c.field(r.playersOnscreen, maxplayers);
+    for (int i = 0; i < maxplayers; ++i)
+        if (r.playersOnscreen & (uint32_t(1) << i)) {
+            if (base && (base->playersOnscreen & (uint32_t(1) << i)))
+                codeFramePlayerDelta(c, r.player[i], base->player[i]);
+            else
+                codeFramePlayer(c, r.player[i]);
+        }
+    codeFrameMinimap(c, r.minimap, maxplayers);
+    c.field(r.health8, 8);
+    c.field(r.energy8, 8);
+    if (c.flag(r.pingSent))
+        c.field(r.ping, 16);
+    c.flush();
+}
+
+/** Recent frame bodies of one connection, for use as delta baselines.
+ * The server keeps the bodies it has sent with the packet ids they were sent in, and the client those it has
+ * received. Entries are stored by frame number, so the oldest usable baseline is size - 1 frames back.
+ */
+class FrameHistory {
+public:
+    static const unsigned size = 16;
+
+    void clear() throw () {
+        for (std::vector<Entry>::iterator ei = entries.begin(); ei != entries.end(); ++ei)
+            ei->used = false;
+    }
+    void release() throw () { std::vector<Entry>().swap(entries); }   // clear and free the memory
+    /// Store the body of frame; returns the stored copy.
+    const FrameBody& store(uint32_t frame, uint32_t packetId, const FrameBody& body) throw () {
+        if (entries.empty())
+            entries.resize(size);   // allocated only for connections that use it
+        Entry& e = entries[frame % size];
+        e.used = true;
+        e.frame = frame;
+        e.packetId = packetId;
+        e.body = body;
+        return e.body;
+    }
+    /// The body of frame, or 0 if it isn't stored.
+    const FrameBody* findFrame(uint32_t frame) const throw () {
+        if (entries.empty())
+            return 0;
+        const Entry& e = entries[frame % size];
+        return e.used && e.frame == frame ? &e.body : 0;
+    }
+    /// The body sent in packet packetId, or 0 if it isn't stored; its frame number is returned in frame.
+    const FrameBody* findPacket(uint32_t packetId, uint32_t& frame) const throw () {
+        for (std::vector<Entry>::const_iterator ei = entries.begin(); ei != entries.end(); ++ei)
+            if (ei->used && ei->packetId == packetId) {
+                frame = ei->frame;
+                return &ei->body;
+            }
+        return 0;
+    }
+
+private:
+    struct Entry {
+        bool used;
+        uint32_t frame, packetId;
+        FrameBody body;
+        Entry() throw () : used(false), frame(0), packetId(0) { }
+    };
+
+    std::vector<Entry> entries;
+};
+
+#endif
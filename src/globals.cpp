@@ -25,6 +25,7 @@
 #include "commont.h"
 #include "debug.h"
 #include "debugconfig.h"
+#include "mapindex.h"
 #include "mutex.h"
 #include "protocol.h"
 
@@ -39,6 +40,7 @@ volatile bool g_exitFlag;
 AutoBugReporting g_autoBugReporting = ABR_disabled;
 bool g_leetnetLog = false;
 bool g_leetnetDataLog = false;
+bool g_lockProfiling = false;
 
 // from protocol.h
 const std::string GAME_STRING = "Outgun";
@@ -51,3 +53,5 @@ ThreadLog g_threadLog; // from debug.h
 // Mutexes and ConditionVariables depend on the above
 Mutex g_threadRandomSeedMutex("g_threadRandomSeedMutex"); // from thread.cpp
 Mutex nlOpenMutex("network.cpp:nlOpenMutex"); // from network.cpp
+Mutex g_sharedMessageMutex("rudp.cpp:g_sharedMessageMutex", false); // from leetnet/rudp.cpp
+MapIndex g_serverMapIndex; // from mapindex.h
@@ -28,10 +28,12 @@
 #include <sstream>
 
 #include <cmath>
+#include <cstring>
 
 #include "antialias.h"
+#include "blend.h"
 #include "commont.h"
-#include "effects.h"
+#include "function_utility.h"
 #include "language.h"
 #include "platform.h"
 #include "sounds.h"
@@ -51,6 +53,8 @@ static const bool SWITCH_PAUSE_CLIENT = false;
 
 static const int GUNPOINT_RADIUS = 28;
 
+static const int ROOM_RENDER_THREADS = 4;   // for rooms drawn while the player waits
+
 using std::ifstream;
 using std::istringstream;
 using std::left;
@@ -73,9 +77,9 @@ const string Graphics::save_extension = ".png";
 const string Graphics::save_extension = ".pcx";
 #endif
 
-Graphics::Graphics(LogSet logs) throw () :
+Graphics::Graphics(LogSet logs, int backgroundThreadPriority) throw () :
     roomLayout          (*this),
-    background          (*this),
+    background          (*this, backgroundThreadPriority),
     show_chat_messages  (true),
     show_scoreboard     (true),
     show_minimap        (true),
@@ -117,7 +121,7 @@ bool Graphics::init(int width, int height, int depth, bool windowed, bool flippi
     if (page_flipping) {
         vidpage1   = create_video_bitmap(SCREEN_W, SCREEN_H);
         vidpage2   = create_video_bitmap(SCREEN_W, SCREEN_H);
-        if (!vidpage1 || !vidpage2 || !background.allocate(true, backgroundPages)) {
+        if (!vidpage1 || !vidpage2 || !background.allocate(true, backgroundPages, SCREEN_W, SCREEN_H)) {
             log("Not enough video memory. Can't use page flipping.");
             // free those that _were_ allocated
             vidpage1.free();
@@ -130,11 +134,32 @@ bool Graphics::init(int width, int height, int depth, bool windowed, bool flippi
     else {
         backbuf = create_bitmap(SCREEN_W, SCREEN_H);
         nAssert(backbuf);
-        const bool result = background.allocate(false, backgroundPages);
+        const bool result = background.allocate(false, backgroundPages, SCREEN_W, SCREEN_H);
         nAssert(result);
         drawbuf = backbuf;
     }
 
+    init_buffer_contents();
+    return true;
+}
+
+bool Graphics::init_headless(int width, int height, int depth) throw () {
+    unload_bitmaps();
+    set_color_depth(depth);
+    page_flipping = false;
+    backbuf = create_bitmap(width, height);
+    if (!backbuf || !background.allocate(false, 8, width, height)) {
+        backbuf.free();
+        return false;
+    }
+    drawbuf = backbuf;
+    log("Drawing to a %d%d%d memory bitmap without a display.", width, height, depth);
+
+    init_buffer_contents();
+    return true;
+}
+
+void Graphics::init_buffer_contents() throw () {
     setColors();
 
     make_layout();
@@ -143,32 +168,30 @@ bool Graphics::init(int width, int height, int depth, bool windowed, bool flippi
     load_background();
     needReloadPlayfieldPictures = true;
     mapNeedsRedraw = true;
-
-    return true;
 }
 
 void Graphics::make_layout() throw () {
     if (!show_minimap && !show_scoreboard)
-        scr_mul = static_cast<double>(SCREEN_W) / plw;
+        scr_mul = static_cast<double>(drawbuf->w) / plw;
     else
-        scr_mul = static_cast<double>(SCREEN_W) / 640;
+        scr_mul = static_cast<double>(drawbuf->w) / 640;
 
     // Room background
     const int bottombar_h = 3 * (text_height(font) + 2) + 5;
-    if (SCREEN_H < scr_mul * plh + bottombar_h + text_height(font))          // the window is too low for playground and one line for messages
-        scr_mul = static_cast<double>(SCREEN_H - bottombar_h - text_height(font)) / plh;
+    if (drawbuf->h < scr_mul * plh + bottombar_h + text_height(font))          // the window is too low for playground and one line for messages
+        scr_mul = static_cast<double>(drawbuf->h - bottombar_h - text_height(font)) / plh;
     if (!show_minimap && !show_scoreboard)
-        playfield_x = (SCREEN_W - scale(plw)) / 2;
+        playfield_x = (drawbuf->w - scale(plw)) / 2;
     else
         playfield_x = 0;
-    playfield_y = SCREEN_H - scale(plh) - bottombar_h;
+    playfield_y = drawbuf->h - scale(plh) - bottombar_h;
     playfield_w = static_cast<int>(ceil(scr_mul * plw));
     playfield_h = static_cast<int>(ceil(scr_mul * plh));
 
     // Minimap
     minimap_w = minimap_h = 0; // to be determined when the map is drawn
-    minimap_place_w = SCREEN_W - playfield_w - 4; // 4 for left and right margin
-    minimap_place_x = SCREEN_W - minimap_place_w - 2;
+    minimap_place_w = drawbuf->w - playfield_w - 4; // 4 for left and right margin
+    minimap_place_x = drawbuf->w - minimap_place_w - 2;
     if (minimap_place_x > text_length(font, "M") * 80) {  // check if minimap fits to the right of chat messages
         minimap_place_y = 4;
         minimap_place_h = scale(100) + playfield_y - 4;
@@ -177,7 +200,7 @@ void Graphics::make_layout() throw () {
         minimap_place_y = playfield_y;
         minimap_place_h = scale(100);
     }
-    const int extra_space = SCREEN_H - 450 - (minimap_place_y + minimap_place_h);   // 450 = scoreboard max height + FPS line
+    const int extra_space = drawbuf->h - 450 - (minimap_place_y + minimap_place_h);   // 450 = scoreboard max height + FPS line
     if (extra_space > 0)
         minimap_place_h += extra_space;
     minibg.free();
@@ -188,9 +211,9 @@ void Graphics::make_layout() throw () {
 
     // Scoreboard
     scoreboard_x1 = playfield_x + playfield_w;
-    scoreboard_x2 = SCREEN_W - 1;
+    scoreboard_x2 = drawbuf->w - 1;
     scoreboard_y1 = minimap_place_y + minimap_place_h;
-    scoreboard_y2 = SCREEN_H - 1;
+    scoreboard_y2 = drawbuf->h - 1;
 
     // Bottom bar
     indicators_y = playfield_y + playfield_h + 5;
@@ -293,6 +316,7 @@ void Graphics::draw_screen(bool acquireWithFlipping) throw () {
 }
 
 void Graphics::setColors() throw () {
+    roomGraphicsChanged();  // first, to stop the background drawing of rooms before the colours change
     colour.init(colour_file);
 
     reset_playground_colors();
@@ -336,20 +360,19 @@ void Graphics::setColors() throw () {
     teamdcol[0] = colour[Colour::team_red_dark];
     teamdcol[1] = colour[Colour::team_blue_dark];
 
-    roomGraphicsChanged();
     mapNeedsRedraw = true;
 }
 
 void Graphics::reset_playground_colors() throw () {
+    roomGraphicsChanged();
     groundCol = colour[Colour::ground];
     wallCol   = colour[Colour::wall];
-    roomGraphicsChanged();
 }
 
 void Graphics::random_playground_colors() throw () {
+    roomGraphicsChanged();
     groundCol = Colour(rand() % 256, rand() % 256, rand() % 256);
     wallCol   = Colour(rand() % 256, rand() % 256, rand() % 256);
-    roomGraphicsChanged();
 }
 
 int Graphics::chat_lines() const throw () {
@@ -486,107 +509,130 @@ void Graphics::draw_background(const Map& map, const VisibilityMap& roomVis, con
     background.draw_playfield_background(drawbuf, map, roomVis, continuousTextures, mapInfoMode);
 }
 
-void Graphics::drawRoomBackground(BITMAP* roombg, const Map& map, int roomx, int roomy, int texRoomX, int texRoomY, bool mapInfoMode) throw () {
-    const Room& room = map.room[roomx][roomy];
+void Graphics::prerender_rooms(const Map& map, const WorldCoords& focus, double speedX, double speedY, double runSpeed, bool continuousTextures, bool mapInfoMode) throw () {
+    background.prerender(map, focus, speedX, speedY, runSpeed, continuousTextures, mapInfoMode);
+}
 
-    // the room at top left is textured like it's the room at coordinates (texRoomX,texRoomY)
-    // this means moving the texture offsetting origin to the top left of room (0,0)
-    const int texOffsetBaseX = - texRoomX * roombg->w;
-    const int texOffsetBaseY = - texRoomY * roombg->h;
+Graphics::RoomDrawData::RoomDrawData(const Map& map, int roomx, int roomy) throw () : room(map.room[roomx][roomy]) {
+    for (int team = 0; team < 2; ++team)
+        for (vector<WorldRect>::const_iterator ri = map.tinfo[team].respawn.begin(); ri != map.tinfo[team].respawn.end(); ++ri)
+            if (ri->px == roomx && ri->py == roomy)
+                respawn[team].push_back(*ri);
+    for (int team = 0; team < 3; ++team) {
+        const vector<WorldCoords>& tflags = (team == 2 ? map.wild_flags : map.tinfo[team].flags);
+        for (vector<WorldCoords>::const_iterator fi = tflags.begin(); fi != tflags.end(); ++fi)
+            if (fi->px == roomx && fi->py == roomy)
+                flags[team].push_back(*fi);
+    }
+}
 
-    if (antialiasing) {
-        // we want to fill roombg, but there's the chance that its size is not exactly 4:3
-        // we want to fill both directions to the fullest and clip away the excess in one direction (if any), taking the same amount from both sides
-        const double fillingScaleX = (roombg->w - .02) / plw; // -.02 because to be safe with the limits we clip .01 pixels from all sides
-        const double fillingScaleY = (roombg->h - .02) / plh;
-        const double scale = max(fillingScaleX, fillingScaleY);
-        const double x0 = (roombg->w - scale * plw) / 2., y0 = (roombg->h - scale * plh) / 2.;
+void Graphics::drawRoomAntialiased(BITMAP* roombg, const RoomDrawData& data, int texOffsetBaseX, int texOffsetBaseY, bool mapInfoMode, int threads) const throw () {
+    // we want to fill roombg, but there's the chance that its size is not exactly 4:3
+    // we want to fill both directions to the fullest and clip away the excess in one direction (if any), taking the same amount from both sides
+    const double fillingScaleX = (roombg->w - .02) / plw; // -.02 because to be safe with the limits we clip .01 pixels from all sides
+    const double fillingScaleY = (roombg->h - .02) / plh;
+    const double scale = max(fillingScaleX, fillingScaleY);
+    const double x0 = (roombg->w - scale * plw) / 2., y0 = (roombg->h - scale * plh) / 2.;
 
-        SceneAntialiaser scene;
-        vector<TextureData> textures;
+    SceneAntialiaser scene;
+    vector<TextureData> textures;
 
-        // add ground/floor
-        scene.setScaling(x0, y0, scale);
-        scene.addRectangle(0, 0, plw, plh, 0);
-        for (vector<WallBase*>::const_iterator wi = room.readGround().begin(); wi != room.readGround().end(); ++wi)
-            scene.addWall(*wi, (*wi)->texture());
+    // add ground/floor
+    scene.setScaling(x0, y0, scale);
+    scene.addRectangle(0, 0, plw, plh, 0);
+    for (vector<WallBase*>::const_iterator wi = data.room.readGround().begin(); wi != data.room.readGround().end(); ++wi)
+        scene.addWall(*wi, (*wi)->texture());
 
-        TextureData backupTexture;
-        TextureData td;
-        if (floor_texture.front())
-            backupTexture.setTexture(floor_texture.front(), texOffsetBaseX, texOffsetBaseY);
-        else
-            backupTexture.setSolid(groundCol);
-        for (vector<Bitmap>::const_iterator ti = floor_texture.begin(); ti != floor_texture.end(); ++ti) {
-            if (*ti) { td.setTexture(*ti, texOffsetBaseX, texOffsetBaseY); textures.push_back(td); }
-            else textures.push_back(backupTexture);
-        }
+    TextureData backupTexture;
+    TextureData td;
+    if (floor_texture.front())
+        backupTexture.setTexture(floor_texture.front(), texOffsetBaseX, texOffsetBaseY);
+    else
+        backupTexture.setSolid(groundCol);
+    for (vector<Bitmap>::const_iterator ti = floor_texture.begin(); ti != floor_texture.end(); ++ti) {
+        if (*ti) { td.setTexture(*ti, texOffsetBaseX, texOffsetBaseY); textures.push_back(td); }
+        else textures.push_back(backupTexture);
+    }
 
-        // add respawn areas as overlays
-        if (mapInfoMode) {
-            for (int team = 0; team < 2; ++team) {
-                for (vector<WorldRect>::const_iterator ri = map.tinfo[team].respawn.begin(); ri != map.tinfo[team].respawn.end(); ++ri)
-                    if (ri->px == roomx && ri->py == roomy)
-                        scene.addRectangle(ri->x1 - PLAYER_RADIUS, ri->y1 - PLAYER_RADIUS,
-                                           ri->x2 + PLAYER_RADIUS, ri->y2 + PLAYER_RADIUS, textures.size(), true);
-                td.setSolid(teamcol[team], 120);
-                textures.push_back(td);
-            }
+    // add respawn areas as overlays
+    if (mapInfoMode) {
+        for (int team = 0; team < 2; ++team) {
+            for (vector<WorldRect>::const_iterator ri = data.respawn[team].begin(); ri != data.respawn[team].end(); ++ri)
+                scene.addRectangle(ri->x1 - PLAYER_RADIUS, ri->y1 - PLAYER_RADIUS,
+                                   ri->x2 + PLAYER_RADIUS, ri->y2 + PLAYER_RADIUS, textures.size(), true);
+            td.setSolid(teamcol[team], 120);
+            textures.push_back(td);
         }
+    }
 
-        // add flag markers as overlays
-        const double fr = flagpos_radius;
-        for (int team = 0; team < 3; ++team) {
-            const vector<WorldCoords>& tflags = (team == 2 ? map.wild_flags : map.tinfo[team].flags);
-            for (vector<WorldCoords>::const_iterator fi = tflags.begin(); fi != tflags.end(); ++fi) {
-                if (fi->px != roomx || fi->py != roomy)
-                    continue;
-                scene.addRectangle(fi->x - fr, fi->y - fr, fi->x + fr, fi->y + fr, textures.size(), true);
-                td.setFlagmarker(teamcol[team],
-                                 x0 + fi->x * scale,
-                                 y0 + fi->y * scale,
-                                 flagpos_radius * scale);
-                textures.push_back(td);
-            }
+    // add flag markers as overlays
+    const double fr = flagpos_radius;
+    for (int team = 0; team < 3; ++team) {
+        for (vector<WorldCoords>::const_iterator fi = data.flags[team].begin(); fi != data.flags[team].end(); ++fi) {
+            scene.addRectangle(fi->x - fr, fi->y - fr, fi->x + fr, fi->y + fr, textures.size(), true);
+            td.setFlagmarker(teamcol[team],
+                             x0 + fi->x * scale,
+                             y0 + fi->y * scale,
+                             flagpos_radius * scale);
+            textures.push_back(td);
         }
+    }
 
-        // add room boundaries
-        scene.setScaling(0, 0, 1);
-        {
-            const double x0 = 0, x1 = roombg->w, y0 = 0, y1 = roombg->h;
-            const double bw = .5; // boundary width in pixels
-            scene.addRectangle(x0     , y0     , x1     , x0 + bw, textures.size());
-            scene.addRectangle(x0     , y1 - bw, x1     , y1     , textures.size());
-            scene.addRectangle(x0     , y0     , x0 + bw, y1     , textures.size());
-            scene.addRectangle(x1 - bw, y0     , x1     , y1     , textures.size());
-        }
-        td.setSolid(colour[Colour::room_border]);
-        textures.push_back(td);
-
-        // add walls
-        scene.setScaling(x0, y0, scale);
-        for (vector<WallBase*>::const_iterator wi = room.readWalls().begin(); wi != room.readWalls().end(); ++wi)
-            scene.addWall(*wi, (*wi)->texture() + textures.size());
-
-        if (wall_texture.front())
-            backupTexture.setTexture(wall_texture.front(), texOffsetBaseX, texOffsetBaseY);
-        else
-            backupTexture.setSolid(wallCol);
-        for (vector<Bitmap>::const_iterator ti = wall_texture.begin(); ti != wall_texture.end(); ++ti) {
-            if (*ti) { td.setTexture(*ti, texOffsetBaseX, texOffsetBaseY); textures.push_back(td); }
-            else textures.push_back(backupTexture);
-        }
+    // add room boundaries
+    scene.setScaling(0, 0, 1);
+    {
+        const double x0 = 0, x1 = roombg->w, y0 = 0, y1 = roombg->h;
+        const double bw = .5; // boundary width in pixels
+        scene.addRectangle(x0     , y0     , x1     , x0 + bw, textures.size());
+        scene.addRectangle(x0     , y1 - bw, x1     , y1     , textures.size());
+        scene.addRectangle(x0     , y0     , x0 + bw, y1     , textures.size());
+        scene.addRectangle(x1 - bw, y0     , x1     , y1     , textures.size());
+    }
+    td.setSolid(colour[Colour::room_border]);
+    textures.push_back(td);
 
-        // clip
-        scene.setScaling(0, 0, 1);
-        scene.setClipping(.01, .01, roombg->w - .01, roombg->h - .01);
-        scene.clipAll();
+    // add walls
+    scene.setScaling(x0, y0, scale);
+    for (vector<WallBase*>::const_iterator wi = data.room.readWalls().begin(); wi != data.room.readWalls().end(); ++wi)
+        scene.addWall(*wi, (*wi)->texture() + textures.size());
 
-        // draw
-        Texturizer tex(roombg, 0, 0, textures);
-        scene.render(tex);
-        tex.finalize();
+    if (wall_texture.front())
+        backupTexture.setTexture(wall_texture.front(), texOffsetBaseX, texOffsetBaseY);
+    else
+        backupTexture.setSolid(wallCol);
+    for (vector<Bitmap>::const_iterator ti = wall_texture.begin(); ti != wall_texture.end(); ++ti) {
+        if (*ti) { td.setTexture(*ti, texOffsetBaseX, texOffsetBaseY); textures.push_back(td); }
+        else textures.push_back(backupTexture);
     }
+
+    // clip
+    scene.setScaling(0, 0, 1);
+    scene.setClipping(.01, .01, roombg->w - .01, roombg->h - .01);
+    scene.clipAll();
+
+    // draw
+    scene.renderBanded(roombg, 0, 0, textures, threads, bandWorkers);
+}
+
+uint64_t Graphics::roomDiskKey(const Map& map, int roomx, int roomy, int texOffsetBaseX, int texOffsetBaseY, int w, int h) const throw () {
+    RoomKeyHasher key = themeKey;
+    key.add(map.crc).add(map.w).add(map.h).add(map.title).add(map.author);
+    key.add(roomx).add(roomy).add(texOffsetBaseX).add(texOffsetBaseY).add(w).add(h);
+    key.add(get_color_depth()).add(makecol(255, 0, 0)).add(makecol(0, 255, 0)).add(makecol(0, 0, 255));  // the pixel format
+    key.add(groundCol).add(wallCol).add(colour[Colour::room_border]).add(teamcol[0]).add(teamcol[1]).add(teamcol[2]);
+    return key.value();
+}
+
+void Graphics::drawRoomBackground(BITMAP* roombg, const Map& map, int roomx, int roomy, int texRoomX, int texRoomY, bool mapInfoMode) throw () {
+    const Room& room = map.room[roomx][roomy];
+
+    // the room at top left is textured like it's the room at coordinates (texRoomX,texRoomY)
+    // this means moving the texture offsetting origin to the top left of room (0,0)
+    const int texOffsetBaseX = - texRoomX * roombg->w;
+    const int texOffsetBaseY = - texRoomY * roombg->h;
+
+    if (antialiasing)
+        drawRoomAntialiased(roombg, RoomDrawData(map, roomx, roomy), texOffsetBaseX, texOffsetBaseY, mapInfoMode, ROOM_RENDER_THREADS);
     else {
         const double fillingScaleX = double(roombg->w) / plw;
         const double fillingScaleY = double(roombg->h) / plh;
@@ -1279,7 +1325,7 @@ void Graphics::draw_player(const WorldCoords& pos, int team, int colorId, GunDir
             if (alpha < 255)
                 rotate_trans_sprite(drawbuf, sprite, x, y, gundir.toFixed(), alpha);
             else
-                rotate_sprite(drawbuf, sprite, x - sprite->w / 2, y - sprite->h / 2, gundir.toFixed());
+                rotate_masked_sprite(drawbuf, sprite, x, y, gundir.toFixed());
         }
         else {
             set_trans_mode(alpha);
@@ -1350,33 +1396,107 @@ void Graphics::set_alpha_channel(BITMAP* bitmap, BITMAP* alpha) throw () {
     solid_mode();
 }
 
-void Graphics::rotate_trans_sprite(BITMAP* bmp, BITMAP* sprite, int x, int y, fixed angle, int alpha) throw () { // x,y are destination coords of the sprite center
+void RotatedSpriteCache::setAngleSteps(int steps) throw () {
+    nAssert(steps > 0);
+    if (steps != angleSteps) {
+        clear();
+        angleSteps = steps;
+    }
+}
+
+BITMAP* RotatedSpriteCache::get(BITMAP* sprite, fixed angle) throw () {
     nAssert(sprite);
     nAssert(sprite->w == sprite->h);    // if otherwise, would have to use max(sprite->w, sprite->h) below, and use more complex coords in rotate
+    // a full circle is 256 in fixed, i.e. 1 << 24
+    const int step = static_cast<int>(((static_cast<int64_t>(angle & 0xFFFFFF) * angleSteps) + (1 << 23)) >> 24) % angleSteps;
+    vector<BITMAP*>& rotations = cache[sprite];
+    if (rotations.empty())
+        rotations.resize(angleSteps, 0);
+    if (rotations[step]) {
+        ++hits;
+        return rotations[step];
+    }
+    ++misses;
     // make room so that rotating won't clip the corners off
     const int size = sprite->h + sprite->h / 2;
-    Bitmap buffer = create_bitmap(size, size);
+    const unsigned newBytes = size * size * ((bitmap_color_depth(sprite) + 7) / 8);
+    if (bytes + newBytes > maxBytes && bytes) {
+        clear();
+        return get(sprite, angle);
+    }
+    BITMAP* buffer = create_bitmap_ex(bitmap_color_depth(sprite), size, size);
     nAssert(buffer);
     clear_to_color(buffer, bitmap_mask_color(buffer));
-    rotate_sprite(buffer, sprite, sprite->h / 4, sprite->h / 4, angle);
+    rotate_sprite(buffer, sprite, sprite->h / 4, sprite->h / 4, static_cast<fixed>((static_cast<int64_t>(step) << 24) / angleSteps));
+    bytes += newBytes;
+    rotations[step] = buffer;
+    return buffer;
+}
+
+void RotatedSpriteCache::clear() throw () {
+    for (CacheT::iterator ci = cache.begin(); ci != cache.end(); ++ci)
+        for (vector<BITMAP*>::iterator ri = ci->second.begin(); ri != ci->second.end(); ++ri)
+            if (*ri)
+                destroy_bitmap(*ri);
+    cache.clear();
+    bytes = hits = misses = 0;
+}
+
+string RotatedSpriteCache::statistics() const throw () {
+    ostringstream ost;
+    ost << cache.size() << " sprites at " << angleSteps << " angles, " << misses << " rotations, " << (bytes + 1023) / 1024 << " kB, "
+        << (hits + misses ? 100 * static_cast<uint64_t>(hits) / (hits + misses) : 0) << "% hits";
+    return ost.str();
+}
+
+void Graphics::rotate_masked_sprite(BITMAP* bmp, BITMAP* sprite, int x, int y, fixed angle) throw () {
+    BITMAP* const buffer = spriteCache.get(sprite, angle);
+    draw_sprite(bmp, buffer, x - buffer->w / 2, y - buffer->h / 2);
+}
+
+void Graphics::rotate_trans_sprite(BITMAP* bmp, BITMAP* sprite, int x, int y, fixed angle, int alpha) throw () {
+    BITMAP* const buffer = spriteCache.get(sprite, angle);
     set_trans_mode(alpha);
     draw_trans_sprite(bmp, buffer, x - buffer->w / 2, y - buffer->h / 2);
     solid_mode();
 }
 
-void Graphics::rotate_alpha_sprite(BITMAP* bmp, BITMAP* sprite, int x, int y, fixed angle) throw () {    // x,y are destination coords of the sprite center
+void Graphics::rotate_alpha_sprite(BITMAP* bmp, BITMAP* sprite, int x, int y, fixed angle) throw () {
     nAssert(bitmap_color_depth(sprite) == 32);
-    nAssert(sprite->w == sprite->h);    // if otherwise, would have to use max(sprite->w, sprite->h) below, and use more complex coords in rotate
-    // make room so that rotating won't clip the corners off
-    const int size = sprite->h + sprite->h / 2;
-    Bitmap buffer = create_bitmap_ex(32, size, size);
-    nAssert(buffer);
-    clear_to_color(buffer, bitmap_mask_color(buffer));
-    rotate_sprite(buffer, sprite, sprite->h / 4, sprite->h / 4, angle);
-    drawing_mode(DRAW_MODE_TRANS, 0, 0, 0);
-    set_alpha_blender();
-    draw_trans_sprite(bmp, buffer, x - buffer->w / 2, y - buffer->h / 2);
-    solid_mode();
+    BITMAP* const buffer = spriteCache.get(sprite, angle);
+    draw_alpha_sprite(bmp, buffer, x - buffer->w / 2, y - buffer->h / 2);
+}
+
+void Graphics::draw_alpha_sprite(BITMAP* bmp, BITMAP* sprite, int x, int y) throw () {
+    nAssert(bitmap_color_depth(sprite) == 32);
+    const int depth = bitmap_color_depth(bmp);
+    // the 16-bit span kernel converts the source pixels assuming the usual component order
+    const bool spanFormat = (depth == 32 && _rgb_a_shift_32 == 24) ||
+                            (depth == 16 && _rgb_r_shift_16 == 11 && _rgb_g_shift_16 == 5 && _rgb_b_shift_16 == 0 &&
+                                            _rgb_r_shift_32 == 16 && _rgb_g_shift_32 == 8 && _rgb_b_shift_32 == 0 && _rgb_a_shift_32 == 24);
+    if (!spanFormat || !is_memory_bitmap(bmp) || !is_memory_bitmap(sprite)) {
+        drawing_mode(DRAW_MODE_TRANS, 0, 0, 0);
+        set_alpha_blender();
+        draw_trans_sprite(bmp, sprite, x, y);
+        solid_mode();
+        return;
+    }
+    int sx = 0, sy = 0, w = sprite->w, h = sprite->h;
+    if (bmp->clip) {
+        if (x < bmp->cl) { sx = bmp->cl - x; w -= sx; x = bmp->cl; }
+        if (y < bmp->ct) { sy = bmp->ct - y; h -= sy; y = bmp->ct; }
+        w = min(w, bmp->cr - x);
+        h = min(h, bmp->cb - y);
+    }
+    if (w <= 0 || h <= 0)
+        return;
+    for (int row = 0; row < h; ++row) {
+        const uint32_t* const src = reinterpret_cast<const uint32_t*>(sprite->line[sy + row]) + sx;
+        if (depth == 32)
+            alphaSpan32(reinterpret_cast<uint32_t*>(bmp->line[y + row]) + x, src, w);
+        else
+            alphaSpan16(reinterpret_cast<uint16_t*>(bmp->line[y + row]) + x, src, w);
+    }
 }
 
 void Graphics::draw_player_dead(const ClientPlayer& player, double respawn_delay) throw () {
@@ -1535,14 +1655,10 @@ void Graphics::draw_deathbringer_carrier_effect(const WorldCoords& pos, int alph
             }
         solid_mode();
     }
-    drawing_mode(DRAW_MODE_TRANS, 0, 0, 0);
-    set_alpha_blender();
-
     ScaledCoordSet sc(pos, this);
     while (sc.next())
-        draw_trans_sprite(drawbuf, buffer, sc.x() - db_effect->w / 2, sc.y() - db_effect->h / 2);
+        draw_alpha_sprite(drawbuf, buffer, sc.x() - db_effect->w / 2, sc.y() - db_effect->h / 2);
 
-    solid_mode();
     if (buffer != db_effect)
         destroy_bitmap(buffer);
 }
@@ -1568,7 +1684,7 @@ void Graphics::draw_shield(const WorldCoords& pos, int r, bool live, int alpha,
             if (alpha < 255)
                 rotate_trans_sprite(drawbuf, sprite, x, y, direction.toFixed(), alpha);
             else
-                rotate_sprite(drawbuf, sprite, x - sprite->w / 2, y - sprite->h / 2, direction.toFixed());
+                rotate_masked_sprite(drawbuf, sprite, x, y, direction.toFixed());
             continue;
         }
         else {
@@ -1604,7 +1720,7 @@ void Graphics::draw_rocket(const Rocket& rocket, bool shadow, double time) throw
     while (sc.next()) {
         const int x = sc.x(), y = sc.y();
         if (sprite)
-            rotate_sprite(drawbuf, sprite, x - sprite->w / 2, y - sprite->h / 2, rocket.direction.toFixed());
+            rotate_masked_sprite(drawbuf, sprite, x, y, rocket.direction.toFixed());
         else if (rocket.power) {
             //draw rocket shadow
             if (shadow)
@@ -1892,17 +2008,17 @@ void Graphics::team_statistics(const Team* teams) throw () {
     const FONT* stfont = font;
     const int total_captures = static_cast<int>(teams[0].captures().size() + teams[1].captures().size());
     int line_height = text_height(stfont) + 4;
-    if (20 * line_height > SCREEN_H) {
-        line_height = SCREEN_H / 20;
+    if (20 * line_height > drawbuf->h) {
+        line_height = drawbuf->h / 20;
         if (line_height < text_height(stfont) && text_height(default_font) < text_height(stfont)) {
             stfont = default_font;
             line_height = min(line_height, text_height(stfont) + 4);
         }
     }
     const int w = 43 * text_length(stfont, "M") + 6;
-    const int h = min<int>(SCREEN_H, (20 + total_captures) * line_height);
-    const int mx = SCREEN_W / 2;
-    const int my = SCREEN_H / 2;
+    const int h = min<int>(drawbuf->h, (20 + total_captures) * line_height);
+    const int mx = drawbuf->w / 2;
+    const int my = drawbuf->h / 2;
     const int x1 = mx - w / 2;
     const int y1 = my - h / 2;
     const int x2 = mx + w / 2;
@@ -2017,17 +2133,17 @@ void Graphics::draw_statistics(const vector<ClientPlayer*>& players, int page, i
     const int num_lines = maxplayers + 3 + 2 * 3;
     const FONT* stfont;
     // stats screen works only with monospace font
-    if (text_length(font, "i") != text_length(font, "M") || 67 * text_length(font, "M") > SCREEN_W ||
-                                                            num_lines * text_height(font) > SCREEN_H)
+    if (text_length(font, "i") != text_length(font, "M") || 67 * text_length(font, "M") > drawbuf->w ||
+                                                            num_lines * text_height(font) > drawbuf->h)
         stfont = default_font;
     else
         stfont = font;
-    const int line_h = min(text_height(stfont) + 4, SCREEN_H / num_lines);   // Preferred line height is 12 with default font.
+    const int line_h = min(text_height(stfont) + 4, drawbuf->h / num_lines);   // Preferred line height is 12 with default font.
     const int h = num_lines * line_h;
     const int w = 67 * text_length(stfont, "M") + 4;
     const int x_margin = 22;
-    const int mx = SCREEN_W / 2;
-    const int my = SCREEN_H / 2;
+    const int mx = drawbuf->w / 2;
+    const int my = drawbuf->h / 2;
     const int x1 = mx - w / 2;
     const int y1 = my - h / 2;
     const int x2 = mx + w / 2;
@@ -2191,7 +2307,7 @@ void Graphics::debug_panel(const vector<ClientPlayer>& players, int me, int bpsi
 
 void Graphics::draw_fps(double fps) throw () {
     const string text = _("FPS:$1", itoa_w((int)fps, 3));
-    print_text_border_check_bg(text, SCREEN_W - 2 - text_length(font, text), SCREEN_H - text_height(font) - 2, colour[Colour::fps], colour[Colour::text_border], -1);
+    print_text_border_check_bg(text, drawbuf->w - 2 - text_length(font, text), drawbuf->h - text_height(font) - 2, colour[Colour::fps], colour[Colour::text_border], -1);
 }
 
 void Graphics::map_list(const vector< pair<const MapInfo*, int> >& maps, MapListSortKey sortedBy, int current, int own_vote, const string& edit_vote) throw () {
@@ -2201,18 +2317,18 @@ void Graphics::map_list(const vector< pair<const MapInfo*, int> >& maps, MapList
     else
         mlfont = font;
     const int line_height = text_height(mlfont) + 4;
-    const int w = min(SCREEN_W, 67 * text_length(mlfont, "M") + 4);
+    const int w = min(drawbuf->w, 67 * text_length(mlfont, "M") + 4);
     const int extra_space = 10 * line_height;
     int h = map_list_size * line_height + extra_space;
-    if (h > SCREEN_H) {
-        h = SCREEN_H;
+    if (h > drawbuf->h) {
+        h = drawbuf->h;
         map_list_size = (h - extra_space) / line_height;
     }
-    const int mx = SCREEN_W / 2;
-    const int my = SCREEN_H / 2;
+    const int mx = drawbuf->w / 2;
+    const int my = drawbuf->h / 2;
     const int x1 = max(0, mx - w / 2);
     const int y1 = my - h / 2;
-    const int x2 = min(SCREEN_W, mx + w / 2);
+    const int x2 = min(drawbuf->w, mx + w / 2);
     const int y2 = my + h / 2;
     const int x_left = x1 + 30;
 
@@ -2366,7 +2482,7 @@ void Graphics::draw_bar(int x, const string& caption, int value, int c100, int c
     const string val_str = itoa_w(value, 3);
     const int width = scale(100);
     const int bar_y1 = y + 3 * text_height(font) / 2;
-    const int bar_y2 = SCREEN_H - 5;
+    const int bar_y2 = drawbuf->h - 5;
 
     const int val_x = max(x + text_length(font, caption) + text_length(font, " "), x + width - text_length(font, val_str));
     print_text_border_check_bg(val_str, val_x, y, colour[Colour::bar_text], colour[Colour::text_border], -1);
@@ -2599,19 +2715,29 @@ bool Graphics::save_screenshot(const string& filename) const throw () {
 
 // client side effects
 
+const double EffectStore::gunExplosionTime = .4;
+const double EffectStore::wallExplosionTime = .2;
+const double EffectStore::powerWallExplosionTime = .2;
+const double EffectStore::smokeTime = .6;
+const double EffectStore::turboTime = .3;
+
 //clear clientside fx's
 void Graphics::clear_fx() throw () {
-    cfx.clear();
+    effects.clear();
 }
 
 //create rocket explosion fx
 void Graphics::create_wallexplo(const WorldCoords& pos, int team, double time) throw () {
-    cfx.push_back(GraphicsEffect(FX_WALL_EXPLOSION, pos, time, team));
+    ExplosionEffect& e = effects.wallExplosions.add(time);
+    e.pos = pos;
+    e.team = team;
 }
 
 //create power rocket explosion fx
 void Graphics::create_powerwallexplo(const WorldCoords& pos, int team, double time) throw () {
-    cfx.push_back(GraphicsEffect(FX_POWER_WALL_EXPLOSION, pos, time, team));
+    ExplosionEffect& e = effects.powerWallExplosions.add(time);
+    e.pos = pos;
+    e.team = team;
 }
 
 //create deathbringer carrier trail fx
@@ -2624,87 +2750,70 @@ void Graphics::create_deathcarrier(WorldCoords pos, int alpha, double time, bool
         pos.x += rand() % 40 - 20;
         pos.y += rand() % 40;
     }
-    cfx.push_back(GraphicsEffect(FX_DEATHCARRIER_SMOKE, pos, time, -1 /* no team */, alpha / 255., colour[Colour::deathbringer_smoke]));
+    SmokeEffect& e = effects.smoke.add(time);
+    e.pos = pos;
+    e.alpha = alpha / 255.;
 }
 
 void Graphics::create_turbofx(const WorldCoords& pos, int col1, int col2, GunDirection gundir, int alpha, double time) throw () {
-    cfx.push_back(GraphicsEffect(FX_TURBO, pos, time, -1 /* team not used */, alpha / 255., col1, col2, gundir));
+    TurboEffect& e = effects.turbo.add(time);
+    e.pos = pos;
+    e.alpha = alpha / 255.;
+    e.col1 = col1;
+    e.col2 = col2;
+    e.gundir = gundir;
 }
 
 //create explosion fx
 void Graphics::create_gunexplo(const WorldCoords& pos, int team, double time) throw () {
-    cfx.push_back(GraphicsEffect(FX_GUN_EXPLOSION, pos, time, team));
+    ExplosionEffect& e = effects.gunExplosions.add(time);
+    e.pos = pos;
+    e.team = team;
 }
 
-void Graphics::draw_effects(double time) throw () {
-    for (list<GraphicsEffect>::iterator fx = cfx.begin(); fx != cfx.end(); ) {
-        if (!roomLayout.on_screen(fx->pos.px, fx->pos.py)) {
-            ++fx;
+/// Draw the explosions of a pool that are on screen, each as rings growing by speed pixels per second.
+template<class Pool> void Graphics::draw_explosions(const Pool& pool, double time, int rings, double speed) throw () {
+    for (unsigned i = 0; i < pool.size(); ++i) {
+        const ExplosionEffect& fx = pool[i];
+        if (!roomLayout.on_screen(fx.pos.px, fx.pos.py))
             continue;
+        const double delta = time - pool.time(i);
+        for (int e = 0; e < rings; e++) {
+            const int rad = 4 + e + static_cast<int>(delta * speed);
+            draw_gun_explosion(fx.pos, rad, fx.team);
         }
-        const double delta = time - fx->time;
-        switch (fx->type) {
-        /*break;*/ case FX_GUN_EXPLOSION:
-                if (delta > 0.4)
-                    fx = cfx.erase(fx);
-                else {
-                    for (int e = 0; e < 3; e++) {
-                        const int rad = 4 + e + static_cast<int>(delta * 40);
-                        draw_gun_explosion(fx->pos, rad, fx->team);
-                    }
-                    ++fx;
-                }
-            break; case FX_TURBO:      // turbo effect, draw another time in another function
-                ++fx;
-            break; case FX_WALL_EXPLOSION:
-                if (delta > 0.2)
-                    fx = cfx.erase(fx);
-                else {
-                    for (int e = 0; e < 2; e++) {
-                        const int rad = 4 + e + static_cast<int>(delta * 40);
-                        draw_gun_explosion(fx->pos, rad, fx->team);
-                    }
-                    ++fx;
-                }
-            break; case FX_POWER_WALL_EXPLOSION:
-                if (delta > 0.2)
-                    fx = cfx.erase(fx);
-                else {
-                    for (int e = 0; e < 3; e++) {
-                        const int rad = 4 + e + static_cast<int>(delta * 60);
-                        draw_gun_explosion(fx->pos, rad, fx->team);
-                    }
-                    ++fx;
-                }
-            break; case FX_DEATHCARRIER_SMOKE:
-                if (delta > 0.6)
-                    fx = cfx.erase(fx);
-                else {
-                    draw_deathbringer_smoke(fx->pos, delta, fx->alpha);
-                    ++fx;
-                }
-            break; default:
-                nAssert(0);
-        }
+    }
+}
+
+// Expired effects are removed whether they're on screen or not; those off screen would never be drawn anyway.
+
+void Graphics::draw_effects(double time) throw () {
+    effects.gunExplosions.expire(time, EffectStore::gunExplosionTime);
+    effects.wallExplosions.expire(time, EffectStore::wallExplosionTime);
+    effects.powerWallExplosions.expire(time, EffectStore::powerWallExplosionTime);
+    effects.smoke.expire(time, EffectStore::smokeTime);
+
+    draw_explosions(effects.gunExplosions, time, 3, 40);
+    draw_explosions(effects.wallExplosions, time, 2, 40);
+    draw_explosions(effects.powerWallExplosions, time, 3, 60);
+    for (unsigned i = 0; i < effects.smoke.size(); ++i) {
+        const SmokeEffect& fx = effects.smoke[i];
+        if (roomLayout.on_screen(fx.pos.px, fx.pos.py))
+            draw_deathbringer_smoke(fx.pos, time - effects.smoke.time(i), fx.alpha);
     }
 }
 
 void Graphics::draw_turbofx(double time) throw () {
+    effects.turbo.expire(time, EffectStore::turboTime);
     if (min_transp)
         return;
-    for (list<GraphicsEffect>::iterator fx = cfx.begin(); fx != cfx.end(); ) {
-        if (!roomLayout.on_screen(fx->pos.px, fx->pos.py) || fx->type != FX_TURBO) {
-            ++fx;
+    for (unsigned i = 0; i < effects.turbo.size(); ++i) {
+        const TurboEffect& fx = effects.turbo[i];
+        if (!roomLayout.on_screen(fx.pos.px, fx.pos.py))
             continue;
-        }
-        const double delta = time - fx->time;
-        if (delta > 0.3)
-            fx = cfx.erase(fx);
-        else {
-            const int alpha = static_cast<int>(fx->alpha * (90 - delta * 300));
-            draw_player(fx->pos, fx->col1, fx->col2, fx->gundir, time, false, alpha, time);
-            ++fx;
-        }
+        const double delta = time - effects.turbo.time(i);
+        const int alpha = static_cast<int>(fx.alpha * (90 - delta * 300));
+        draw_player(fx.pos, fx.col1, fx.col2, fx.gundir, time, false, alpha, time);
     }
 }
 
@@ -2724,6 +2833,32 @@ bool Graphics::save_map_picture(const string& filename, const Map& map) throw ()
     return !save_bitmap(filename.c_str(), buffer, pal);
 }
 
+bool Graphics::benchmark_room_rendering(const Map& map, int w, int h, int threads, double& serialTime, double& bandedTime) throw () {
+    if (floor_texture.empty())  // no theme selected
+        load_generic_pictures();
+    Bitmap serial = create_bitmap(w, h), banded = create_bitmap(w, h);
+    nAssert(serial && banded);
+    const int rowBytes = w * ((bitmap_color_depth(serial) + 7) / 8);
+    bool same = true;
+    for (int ry = 0; ry < map.h; ++ry)
+        for (int rx = 0; rx < map.w; ++rx) {
+            const RoomDrawData data(map, rx, ry);
+            const double t0 = g_systemTimer->read();
+            drawRoomAntialiased(serial, data, -rx * w, -ry * h, false, 1);
+            const double t1 = g_systemTimer->read();
+            drawRoomAntialiased(banded, data, -rx * w, -ry * h, false, threads);
+            const double t2 = g_systemTimer->read();
+            serialTime += t1 - t0;
+            bandedTime += t2 - t1;
+            for (int y = 0; y < h; ++y)
+                if (memcmp(serial->line[y], banded->line[y], rowBytes)) {
+                    same = false;
+                    break;
+                }
+        }
+    return same;
+}
+
 void Graphics::make_db_effect() throw () {
     db_effect.free();
     const int size = max(1, 2 * pf_scale(2 * PLAYER_RADIUS));
@@ -2832,10 +2967,16 @@ void Graphics::select_theme(const string& theme_dir, const string& bg_dir, bool
 void Graphics::load_generic_pictures() throw () {
     floor_texture.resize(8);
     wall_texture.resize(8);
-    if (theme_path.empty())
-        return;
-    load_floor_textures(theme_path);
-    load_wall_textures (theme_path);
+    if (!theme_path.empty()) {
+        load_floor_textures(theme_path);
+        load_wall_textures (theme_path);
+    }
+    themeKey = RoomKeyHasher();
+    themeKey.add(theme_path);
+    for (vector<Bitmap>::const_iterator ti = floor_texture.begin(); ti != floor_texture.end(); ++ti)
+        themeKey.add(*ti);
+    for (vector<Bitmap>::const_iterator ti = wall_texture.begin(); ti != wall_texture.end(); ++ti)
+        themeKey.add(*ti);
 }
 
 void Graphics::load_playfield_pictures() throw () {
@@ -2947,9 +3088,19 @@ void Graphics::overlayColor(BITMAP* bmp, BITMAP* alpha, int color) throw () {
         return;
     nAssert(bmp);
     nAssert(alpha->w == bmp->w && alpha->h == bmp->h);
+    const int depth = bitmap_color_depth(bmp);
+    if ((depth == 16 || depth == 32) && bitmap_color_depth(alpha) == 8 && is_memory_bitmap(bmp) && is_memory_bitmap(alpha)) {
+        for (int y = 0; y < bmp->h; y++) {
+            if (depth == 32)
+                overlaySpan32(reinterpret_cast<uint32_t*>(bmp->line[y]), alpha->line[y], bmp->w, color);
+            else
+                overlaySpan16(reinterpret_cast<uint16_t*>(bmp->line[y]), alpha->line[y], bmp->w, static_cast<uint16_t>(color));
+        }
+        return;
+    }
     drawing_mode(DRAW_MODE_TRANS, 0, 0, 0);
     for (int y = 0; y < bmp->h; y++)
-        for (int x = 0; x < bmp->h; x++) {
+        for (int x = 0; x < bmp->w; x++) {
             const int a = _getpixel(alpha, x, y);
             if (a) {
                 set_trans_blender(0, 0, 0, a);
@@ -3073,11 +3224,15 @@ BITMAP* Graphics::scale_alpha_sprite(const string& filename, int x, int y) const
 }
 
 void Graphics::unload_generic_pictures() throw () {
+    roomGraphicsChanged();  // the textures are used by the background drawing of rooms
     unload_floor_textures();
     unload_wall_textures();
 }
 
 void Graphics::unload_playfield_pictures() throw () {
+    if (spriteCache.used())
+        log("Rotated sprite cache: %s", spriteCache.statistics().c_str());
+    spriteCache.clear();
     unload_player_sprites();
     unload_shield_sprites();
     unload_dead_sprites();
@@ -3321,7 +3476,7 @@ public:
         typedef list<Section> SectionList;
         SectionList unmasked;
 
-        YSegment(int y0_, int y1_) throw () : y0(y0_), y1(y1_) { unmasked.push_back(Section(0, SCREEN_W - 1)); }
+        YSegment(int y0_, int y1_, int w) throw () : y0(y0_), y1(y1_) { unmasked.push_back(Section(0, w - 1)); }
         YSegment(int y0_, int y1_, const SectionList& unmasked_) throw () : y0(y0_), y1(y1_), unmasked(unmasked_) { }
 
         void addMask(int y0, int y1) throw () {
@@ -3346,11 +3501,12 @@ public:
     };
     typedef list<YSegment> SegList;
     SegList ySeg;
+    int w, h;   // of the whole area
 
-    BackgroundMasker() throw () { ySeg.push_back(YSegment(0, SCREEN_H - 1)); }
+    BackgroundMasker(int w_, int h_) throw () : w(w_), h(h_) { ySeg.push_back(YSegment(0, h - 1, w)); }
 
     void addMask(int x0, int y0, int x1, int y1) throw () {
-        nAssert(x0 <= x1 && y0 <= y1 && x0 >= 0 && y0 >= 0 && x1 < SCREEN_W && y1 < SCREEN_H);
+        nAssert(x0 <= x1 && y0 <= y1 && x0 >= 0 && y0 >= 0 && x1 < w && y1 < h);
         SegList::iterator i = ySeg.begin();
         while (i->y1 < y0) // skip segments before the mask
             ++i;
@@ -3398,11 +3554,18 @@ static void tileBlit(BITMAP* target, int x1, int y1, int x2, int y2, BITMAP* tex
     }
 }
 
+Graphics::BackgroundManager::BackgroundManager(Graphics& host, int prerenderPriority) throw () :
+    g(host),
+    diskCache(wheregamedir + "roomcache", diskCacheSize),
+    prerenderer(host, diskCache, prerenderPriority),
+    directDrawing(false)
+{ }
+
 void Graphics::BackgroundManager::draw_background(BITMAP* drawbuf, bool draw_map, bool reserve_playfield) throw () {
     const int pfx0 = g.roomLayout.x0(), pfy0 = g.roomLayout.y0(), pfxm = g.roomLayout.xMax(), pfym = g.roomLayout.yMax();
 
     // calculate the area that needs to be filled with background (what ever is not fully drawn in the rest of the method or in draw_playfield_background if reserve_playfield is set)
-    BackgroundMasker bkMask;
+    BackgroundMasker bkMask(drawbuf->w, drawbuf->h);
     if (reserve_playfield)
         bkMask.addMask(pfx0, pfy0, pfxm, pfym);
     if (draw_map)
@@ -3549,6 +3712,8 @@ void Graphics::BackgroundManager::draw_playfield_background(BITMAP* drawbuf, con
     }
     previousRoom0x = topLeft.px; previousRoom0y = topLeft.py; previousXrooms = xRooms; previousYrooms = yRooms;
 
+    adoptPrerenderedRooms();
+
     const int pfx0 = g.roomLayout.x0(), pfy0 = g.roomLayout.y0(), pfxm = g.roomLayout.xMax(), pfym = g.roomLayout.yMax();
 
     TemporaryClipRect clipRestorer(drawbuf, pfx0, pfy0, pfxm, pfym, false);
@@ -3563,16 +3728,82 @@ void Graphics::BackgroundManager::draw_playfield_background(BITMAP* drawbuf, con
     }
 }
 
-bool Graphics::BackgroundManager::allocate(bool videoMemory, int cachePages) throw () {
+bool Graphics::BackgroundManager::allocate(bool videoMemory, int cachePages, int pageWidth, int pageHeight) throw () {
     nAssert(cachePages > 0);
     if (videoMemory)
-        roomCacheBitmap = create_video_bitmap(SCREEN_W, cachePages * SCREEN_H);
+        roomCacheBitmap = create_video_bitmap(pageWidth, cachePages * pageHeight);
     else
-        roomCacheBitmap = create_bitmap(SCREEN_W, cachePages * SCREEN_H);
+        roomCacheBitmap = create_bitmap(pageWidth, cachePages * pageHeight);
     return !!roomCacheBitmap;
 }
 
-void Graphics::BackgroundManager::cacheRoom(const Map& map, int roomx, int roomy, bool continuousTextures, bool mapInfoMode) throw () {
+void Graphics::BackgroundManager::prerender(const Map& map, const WorldCoords& focus, double speedX, double speedY, double runSpeed, bool continuousTextures, bool mapInfoMode) throw () {
+    static const unsigned maxPrerenderedRooms = 8;
+
+    if (!g.antialiasing || mapInfoMode || directDrawing || DISABLE_ROOM_CACHE || roomCache.empty() || continuousTextures != previousContinuousTextures || mapInfoMode != previousMapInfoMode)
+        return;
+    if (int(roomCacheIndex.size()) != map.w || int(roomCacheIndex.front().size()) != map.h)
+        return;
+
+    unsigned freeEntries = 0;
+    for (vector<CachedRoomGfx>::const_iterator ci = roomCache.begin(); ci != roomCache.end(); ++ci)
+        if (!ci->locked)
+            ++freeEntries;
+    const unsigned nRooms = min(maxPrerenderedRooms, freeEntries);
+    if (nRooms == 0 || prerenderer.size() >= nRooms)
+        return;
+
+    // rank the rooms around the view by the time it would take focus to reach them: the distance divided by the speed
+    // towards the room, with a fraction of the running speed added so that the closest rooms win when standing still
+    const double fx = ((focus.px - previousRoom0x + map.w) % map.w) * plw + focus.x;
+    const double fy = ((focus.py - previousRoom0y + map.h) % map.h) * plh + focus.y;
+    const double baseSpeed = max(.25 * runSpeed, .01);
+    vector<pair<double, pair<int, int> > > candidates;
+    for (int dx = -1; dx <= previousXrooms; ++dx)
+        for (int dy = -1; dy <= previousYrooms; ++dy) {
+            if (dx >= 0 && dx < previousXrooms && dy >= 0 && dy < previousYrooms)
+                continue;
+            const pair<int, int> room((previousRoom0x + dx + map.w) % map.w, (previousRoom0y + dy + map.h) % map.h);
+            if (inView(room.first, room.second))
+                continue;
+            bool duplicate = false; // on small maps the ring wraps onto itself
+            for (vector<pair<double, pair<int, int> > >::const_iterator ci = candidates.begin(); ci != candidates.end(); ++ci)
+                if (ci->second == room)
+                    duplicate = true;
+            if (duplicate)
+                continue;
+            const double ex = bound<double>(fx, dx * plw, (dx + 1) * plw) - fx;   // from focus to the closest point of the room
+            const double ey = bound<double>(fy, dy * plh, (dy + 1) * plh) - fy;
+            const double dist = sqrt(ex * ex + ey * ey);
+            const double approach = dist > 0 ? max(0., (speedX * ex + speedY * ey) / dist) : 0;
+            candidates.push_back(std::make_pair(dist / (approach + baseSpeed), room));
+        }
+    sort(candidates.begin(), candidates.end());
+    // only the best ones that fit in the cache together, so that they don't push each other out
+    if (candidates.size() > nRooms)
+        candidates.resize(nRooms);
+
+    const int room_w = g.roomLayout.roomWidth(), room_h = g.roomLayout.roomHeight();
+    const bool makeFogged = roomCache.front().hasFoggedArea() && (bitmap_color_depth(g.drawbuf) == 16 || bitmap_color_depth(g.drawbuf) == 32);
+    for (vector<pair<double, pair<int, int> > >::const_iterator ci = candidates.begin(); ci != candidates.end() && prerenderer.size() < nRooms; ++ci) {
+        const int roomx = ci->second.first, roomy = ci->second.second;
+        if (roomCacheIndex[roomx][roomy] || prerenderer.has(roomx, roomy))
+            continue;
+        const int texOffsetX = continuousTextures ? -roomx * room_w : 0, texOffsetY = continuousTextures ? -roomy * room_h : 0;
+        RoomPrerenderer::Job* job = new RoomPrerenderer::Job(map, roomx, roomy, texOffsetX, texOffsetY, g.roomDiskKey(map, roomx, roomy, texOffsetX, texOffsetY, room_w, room_h));
+        job->base = create_bitmap(room_w, room_h);
+        if (makeFogged)
+            job->fogged = create_bitmap(room_w, room_h);
+        if (!job->base || (makeFogged && !job->fogged)) {
+            delete job;
+            return;
+        }
+        clear_bitmap(job->base);
+        prerenderer.request(job);
+    }
+}
+
+Graphics::BackgroundManager::CachedRoomGfx* Graphics::BackgroundManager::reclaimCacheEntry(int roomx, int roomy) throw () {
     vector<CachedRoomGfx>::iterator ci, oldest;
     unsigned oldestTime = cacheTimestamp + 1;
     for (ci = roomCache.begin(); ci != roomCache.end() && ci->used(); ++ci)
@@ -3581,19 +3812,67 @@ void Graphics::BackgroundManager::cacheRoom(const Map& map, int roomx, int roomy
             oldest = ci;
         }
     if (ci == roomCache.end()) { // no unused entries were found
-        nAssert(oldestTime <= cacheTimestamp);
+        if (oldestTime > cacheTimestamp)
+            return 0;
         ci = oldest;
     }
     if (roomCacheIndex[ci->x()][ci->y()] == &*ci)
         roomCacheIndex[ci->x()][ci->y()] = 0;
     roomCacheIndex[roomx][roomy] = &*ci;
-    BitmapRegion& area = ci->getAreaForWriting(roomx, roomy); // this locks the room, so we don't need to update lastUse yet
+    return &*ci;
+}
+
+bool Graphics::BackgroundManager::inView(int roomx, int roomy) const throw () {
+    const int mapw = roomCacheIndex.size(), maph = roomCacheIndex.front().size();
+    return (roomx - previousRoom0x + mapw) % mapw < previousXrooms && (roomy - previousRoom0y + maph) % maph < previousYrooms;
+}
+
+void Graphics::BackgroundManager::adoptPrerenderedRooms() throw () {
+    while (RoomPrerenderer::Job* job = prerenderer.take()) {
+        if (job->roomx < int(roomCacheIndex.size()) && job->roomy < int(roomCacheIndex.front().size()) && !roomCacheIndex[job->roomx][job->roomy] &&
+                job->base->w == g.roomLayout.roomWidth() && job->base->h == g.roomLayout.roomHeight()) {
+            CachedRoomGfx* entry = reclaimCacheEntry(job->roomx, job->roomy);
+            if (entry) {
+                BitmapRegion& area = entry->getAreaForWriting(job->roomx, job->roomy);
+                blit(job->base, area.b, 0, 0, area.x0, area.y0, area.w, area.h);
+                if (job->fogged)
+                    entry->setFogged(job->fogged);
+                entry->locked = inView(job->roomx, job->roomy);
+                if (!entry->locked)
+                    entry->lastUse = cacheTimestamp;
+            }
+        }
+        delete job;
+    }
+}
+
+void Graphics::BackgroundManager::cacheRoom(const Map& map, int roomx, int roomy, bool continuousTextures, bool mapInfoMode) throw () {
+    CachedRoomGfx* entry = reclaimCacheEntry(roomx, roomy);
+    nAssert(entry);
+    BitmapRegion& area = entry->getAreaForWriting(roomx, roomy); // this locks the room, so we don't need to update lastUse yet
+    if (g.antialiasing && !mapInfoMode && !directDrawing && drawRoomThroughDisk(area, map, roomx, roomy, continuousTextures))
+        return;
     Bitmap roombg = create_sub_bitmap(area.b, area.x0, area.y0, area.w, area.h);
     acquire_bitmap(roombg);
     g.drawRoomBackground(roombg, map, roomx, roomy, continuousTextures ? roomx : 0, continuousTextures ? roomy : 0, mapInfoMode);
     release_bitmap(roombg);
 }
 
+bool Graphics::BackgroundManager::drawRoomThroughDisk(const BitmapRegion& area, const Map& map, int roomx, int roomy, bool continuousTextures) throw () {
+    Bitmap roombg = create_bitmap(area.w, area.h);
+    if (!roombg)
+        return false;
+    const int texRoomX = continuousTextures ? roomx : 0, texRoomY = continuousTextures ? roomy : 0;
+    const uint64_t key = g.roomDiskKey(map, roomx, roomy, -texRoomX * area.w, -texRoomY * area.h, area.w, area.h);
+    if (!diskCache.load(key, roombg)) {
+        clear_bitmap(roombg);
+        g.drawRoomBackground(roombg, map, roomx, roomy, texRoomX, texRoomY, false);
+        diskCache.store(key, roombg);
+    }
+    blit(roombg, area.b, 0, 0, area.x0, area.y0, area.w, area.h);
+    return true;
+}
+
 void Graphics::BackgroundManager::drawRoom(const Map& map, int roomx, int roomy, bool continuousTextures, bool mapInfoMode, bool fogged, BITMAP* target, int tx0, int ty0) throw () {
     if (!roomCacheIndex[roomx][roomy])
         cacheRoom(map, roomx, roomy, continuousTextures, mapInfoMode);
@@ -3622,6 +3901,13 @@ void Graphics::BackgroundManager::CachedRoomGfx::generateFogged(BITMAP* target,
     }
 }
 
+void Graphics::BackgroundManager::CachedRoomGfx::setFogged(BITMAP* source) throw () {
+    if (!foggedArea.b)
+        return;
+    blit(source, foggedArea.b, 0, 0, foggedArea.x0, foggedArea.y0, foggedArea.w, foggedArea.h);
+    foggedGenerated = true;
+}
+
 void Graphics::BackgroundManager::CachedRoomGfx::drawFogged(BITMAP* target, int tx0, int ty0) const throw () {
     nAssert(baseGenerated);
     if (foggedGenerated)
@@ -3634,3 +3920,124 @@ void Graphics::BackgroundManager::CachedRoomGfx::drawFogged(BITMAP* target, int
         foggedArea.blitTo(target, tx0, ty0);
     }
 }
+
+Graphics::BackgroundManager::RoomPrerenderer::RoomPrerenderer(const Graphics& host, RoomDiskCache& diskCache, int threadPriority) throw () :
+    g(host),
+    disk(diskCache),
+    priority(threadPriority),
+    quitFlag(false),
+    working(0),
+    serial(0),
+    wakeup("Graphics::BackgroundManager::RoomPrerenderer::wakeup"),
+    workDone("Graphics::BackgroundManager::RoomPrerenderer::workDone"),
+    mutex("Graphics::BackgroundManager::RoomPrerenderer::mutex")
+{ }
+
+Graphics::BackgroundManager::RoomPrerenderer::~RoomPrerenderer() throw () {
+    if (thread.isRunning()) {
+        {
+            Lock ml(mutex);
+            quitFlag = true;
+            wakeup.signal();
+        }
+        thread.join();
+    }
+    cancel();
+}
+
+void Graphics::BackgroundManager::RoomPrerenderer::request(Job* job) throw () {
+    Lock ml(mutex);
+    if (!thread.isRunning()) {
+        quitFlag = false;
+        thread.start_assert("Graphics::BackgroundManager::RoomPrerenderer::threadMain",
+                            RedirectToMemFun0<RoomPrerenderer, void>(this, &RoomPrerenderer::threadMain),
+                            priority);
+    }
+    job->serial = serial;
+    queue.push_back(job);
+    wakeup.signal();
+}
+
+void Graphics::BackgroundManager::RoomPrerenderer::cancel() throw () {
+    Lock ml(mutex);
+    ++serial;
+    while (working)
+        workDone.wait(mutex);
+    for (std::deque<Job*>::iterator ji = queue.begin(); ji != queue.end(); ++ji)
+        delete *ji;
+    for (std::deque<Job*>::iterator ji = finished.begin(); ji != finished.end(); ++ji)
+        delete *ji;
+    queue.clear();
+    finished.clear();
+}
+
+Graphics::BackgroundManager::RoomPrerenderer::Job* Graphics::BackgroundManager::RoomPrerenderer::take() throw () {
+    Lock ml(mutex);
+    while (!finished.empty()) {
+        Job* job = finished.front();
+        finished.pop_front();
+        if (job->serial == serial)
+            return job;
+        delete job;
+    }
+    return 0;
+}
+
+bool Graphics::BackgroundManager::RoomPrerenderer::has(int roomx, int roomy) throw () {
+    Lock ml(mutex);
+    if (working && working->roomx == roomx && working->roomy == roomy)
+        return true;
+    for (std::deque<Job*>::const_iterator ji = queue.begin(); ji != queue.end(); ++ji)
+        if ((*ji)->roomx == roomx && (*ji)->roomy == roomy)
+            return true;
+    for (std::deque<Job*>::const_iterator ji = finished.begin(); ji != finished.end(); ++ji)
+        if ((*ji)->roomx == roomx && (*ji)->roomy == roomy)
+            return true;
+    return false;
+}
+
+unsigned Graphics::BackgroundManager::RoomPrerenderer::size() throw () {
+    Lock ml(mutex);
+    return queue.size() + finished.size() + (working ? 1 : 0);
+}
+
+void Graphics::BackgroundManager::RoomPrerenderer::threadMain() throw () {
+    Lock ml(mutex);
+    for (;;) {
+        while (!quitFlag && queue.empty())
+            wakeup.wait(mutex);
+        if (quitFlag)
+            break;
+        working = queue.front();
+        queue.pop_front();
+        {
+            Unlock mu(mutex);
+            draw(*working);
+        }
+        finished.push_back(working);    // the bitmaps are freed by the caller of take or cancel, not in this thread
+        working = 0;
+        workDone.broadcast();
+    }
+}
+
+void Graphics::BackgroundManager::RoomPrerenderer::draw(Job& job) const throw () {
+    BITMAP* base = job.base;
+    if (!disk.load(job.diskKey, base)) {
+        g.drawRoomAntialiased(base, job.data, job.texOffsetX, job.texOffsetY, false, 1); // in the background, one thread is enough
+        disk.store(job.diskKey, base);
+    }
+    BITMAP* fogged = job.fogged;
+    if (!fogged)
+        return;
+    // like CachedRoomGfx::generateFogged, without the global drawing mode
+    const int fogColor = g.colour[Colour::playfield_fog];
+    const vector<uint8_t> alpha(base->w, playfieldFogOfWarAlpha);
+    const bool wide = bitmap_color_depth(base) == 32;
+    for (int y = 0; y < base->h; ++y) {
+        memcpy(fogged->line[y], base->line[y], base->w * (wide ? 4 : 2));
+        if (wide)
+            overlaySpan32(reinterpret_cast<uint32_t*>(fogged->line[y]), &alpha[0], base->w, fogColor);
+        else
+            overlaySpan16(reinterpret_cast<uint16_t*>(fogged->line[y]), &alpha[0], base->w, static_cast<uint16_t>(fogColor));
+    }
+}
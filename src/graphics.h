@@ -27,12 +27,18 @@
 #define GRAPHICS_H_INC
 
 #include <string>
+#include <deque>
 #include <list>
+#include <map>
 #include <vector>
 
+#include "antialias.h"
 #include "colour.h"
+#include "effects.h"
 #include "incalleg.h"
 #include "mutex.h"
+#include "roomcache.h"
+#include "thread.h"
 #include "utility.h"
 #include "world.h"
 
@@ -46,7 +52,6 @@ class TriWall;
 class CircWall;
 class ClientPlayer;
 class Sounds;
-class GraphicsEffect;
 class Team;
 class Flag;
 class Powerup;
@@ -90,6 +95,36 @@ public:
     ~TemporaryClipRect() throw ();
 };
 
+/** Sprites rotated in advance to a fixed number of angles, so that drawing a rotated sprite is a plain blit.
+ * Each sprite is rotated to an angle the first time it's asked for at that angle. Sprites are identified by their
+ * address, so the cache must be cleared whenever they're freed.
+ */
+class RotatedSpriteCache : private NoCopying {
+public:
+    RotatedSpriteCache() throw () : angleSteps(64), bytes(0), hits(0), misses(0) { }
+    ~RotatedSpriteCache() throw () { clear(); }
+
+    void setAngleSteps(int steps) throw (); // clears the cache if the number changes
+
+    /** Get sprite rotated to the nearest cached angle. The result is 1.5 times the size of sprite, to leave room for
+     * the corners, with the sprite centered and the rest in the mask colour. sprite must be square.
+     */
+    BITMAP* get(BITMAP* sprite, fixed angle) throw ();
+
+    void clear() throw ();
+    bool used() const throw () { return !cache.empty(); }
+    std::string statistics() const throw ();    // memory use and hit rate since the last clear()
+
+private:
+    static const unsigned maxBytes = 32 << 20;  // exceeding this clears the cache
+
+    typedef std::map<BITMAP*, std::vector<BITMAP*> > CacheT;    // sprite -> rotations by angle step, 0 if not made yet
+    CacheT cache;
+    int angleSteps;
+    unsigned bytes;
+    unsigned hits, misses;
+};
+
 enum MapListSortKey { MLSK_Number, MLSK_Votes, MLSK_Title, MLSK_Size, MLSK_Author, MLSK_Favorite, MLSK_COUNT };
 
 class Message {
@@ -127,18 +162,25 @@ public:
 
     static const std::string save_extension; // file extension like ".pcx", depending on configured libraries (and potentially selectable by user in the future)
 
-    Graphics(LogSet logs) throw ();
+    Graphics(LogSet logs, int backgroundThreadPriority = 0) throw ();
     ~Graphics() throw ();
 
     bool depthAvailable(int depth) const throw ();
     std::vector<ScreenMode> getResolutions(int depth, bool forceTryIfNothing = true) const throw (); // returns a sorted list of unique resolutions
     bool init(int width, int height, int depth, bool windowed, bool flipping) throw ();
+    /// Draw to a memory bitmap without setting a video mode; draw_screen must not be called.
+    bool init_headless(int width, int height, int depth) throw ();
     void videoMemoryCorrupted() throw ();    // call this when that happens with page flipping
 
     void setRoomLayout(const Map& map, double visible_rooms, bool repeatMap) throw (); // call before any playfield draw operation, including the playfield version of draw_background
     typedef std::vector<std::vector<uint8_t> > VisibilityMap;
     void draw_background(bool map_ready) throw ();
     void draw_background(const Map& map, const VisibilityMap& roomVis, const WorldCoords& topLeft, bool continuousTextures, bool mapInfoMode) throw ();
+    /** Queue the rooms around the view for drawing in a background thread, so that scrolling to them doesn't stall a frame.
+     * focus is the followed player (or the view center) moving at (speedX, speedY); the rooms are drawn in the order of the
+     * estimated time to reach them, with runSpeed as the base rate. Call after the playfield version of draw_background.
+     */
+    void prerender_rooms(const Map& map, const WorldCoords& focus, double speedX, double speedY, double runSpeed, bool continuousTextures, bool mapInfoMode) throw ();
 
     void startDraw() throw ();   // call startDraw before any drawing operations are done and endDraw when done, before drawScreen
     void endDraw() throw ();
@@ -223,6 +265,7 @@ public:
     void draw_turbofx(double time) throw ();
 
     void clear_fx() throw ();
+    EffectPoolCounters effect_counters() const throw () { return effects.counters(); }
 
     void create_wallexplo(const WorldCoords& pos, int team, double time) throw ();
     void create_powerwallexplo(const WorldCoords& pos, int team, double time) throw ();
@@ -231,6 +274,10 @@ public:
     void create_gunexplo(const WorldCoords& pos, int team, double time) throw ();
 
     bool save_map_picture(const std::string& filename, const Map& map) throw ();
+    /** Draw every room of map antialiased to a w  h memory bitmap with one thread and then with threads threads, adding the
+     * seconds taken to serialTime and bandedTime. Returns false if the results differ.
+     */
+    bool benchmark_room_rendering(const Map& map, int w, int h, int threads, double& serialTime, double& bandedTime) throw ();
 
     void search_themes(LineReceiver& dst_theme, LineReceiver& dst_bg, LineReceiver& dst_colours) const throw ();
     void select_theme(const std::string& name, const std::string& bg_dir, bool use_theme_bg, const std::string& colour_dir, bool use_theme_colours) throw ();
@@ -242,6 +289,8 @@ public:
 
     void set_min_transp(bool enable) throw () { min_transp = enable; }
 
+    void set_sprite_rotation_steps(int steps) throw () { spriteCache.setAngleSteps(steps); }
+
     int player_color(int index) const throw () { nAssert(index >= 0 && index <= MAX_PLAYERS / 2); return col[index]; }
 
     // How many lines fit on the chat area and screen.
@@ -277,8 +326,26 @@ private:
     void update_minimap_background(BITMAP* buffer, const Map& map, bool save_map_pic = false) throw ();
 
     void roomGraphicsChanged() throw () { background.invalidateRoomCache(); }
+    /// Draw each room when it's first needed, without the room disk cache or prerendering, so that the time taken doesn't depend on earlier runs or thread timing.
+    void setDirectRoomDrawing() throw () { background.setDirectDrawing(); }
+
+    template<class Pool> void draw_explosions(const Pool& pool, double time, int rings, double speed) throw ();
+
+    /// What the antialiased drawing of a room needs from the map; a copy, so that the room can be drawn while the map changes.
+    struct RoomDrawData {
+        Room room;
+        std::vector<WorldRect> respawn[2];      // those in the room
+        std::vector<WorldCoords> flags[3];      // those in the room; [2] are the wild flags
+
+        RoomDrawData(const Map& map, int roomx, int roomy) throw ();
+    };
 
     void drawRoomBackground(BITMAP* roombg, const Map& map, int roomx, int roomy, int texRoomX, int texRoomY, bool mapInfoMode) throw ();
+    // only writes roombg directly if it's a memory bitmap, and is therefore safe to call from another thread in that case
+    // a memory bitmap is split to row bands rendered by up to threads threads
+    void drawRoomAntialiased(BITMAP* roombg, const RoomDrawData& data, int texOffsetBaseX, int texOffsetBaseY, bool mapInfoMode, int threads) const throw ();
+    // the RoomDiskCache key of an antialiased room of size w  h, outside map info mode
+    uint64_t roomDiskKey(const Map& map, int roomx, int roomy, int texOffsetBaseX, int texOffsetBaseY, int w, int h) const throw ();
 
     void draw_room_ground(BITMAP* buffer, const Room& room, int x, int y, int texOffsetBaseX, int texOffsetBaseY, double scale) throw ();
     void draw_room_walls(BITMAP* buffer, const Room& room, int x, int y, int texOffsetBaseX, int texOffsetBaseY, double scale) throw ();
@@ -329,6 +396,7 @@ private:
     BITMAP* load_bitmap(const std::string& file) const throw ();
 
     void load_background() throw ();
+    void init_buffer_contents() throw ();   // the part of init common to init_headless, after drawbuf has been created
     void load_generic_pictures() throw ();
     void load_playfield_pictures() throw ();
     void reload_playfield_pictures() throw ();
@@ -348,8 +416,11 @@ private:
     BITMAP* scale_sprite(const std::string& filename, int x, int y) const throw ();
     BITMAP* scale_alpha_sprite(const std::string& filename, int x, int y) const throw ();
     static void set_alpha_channel(BITMAP* bitmap, BITMAP* alpha) throw ();
-    static void rotate_trans_sprite(BITMAP* bmp, BITMAP* sprite, int x, int y, fixed angle, int alpha) throw (); // x,y are destination coords of the sprite center
-    static void rotate_alpha_sprite(BITMAP* bmp, BITMAP* sprite, int x, int y, fixed angle) throw ();    // x,y are destination coords of the sprite center
+    // x,y are destination coords of the sprite center in the rotate_* functions; the rotated sprites come from spriteCache
+    void rotate_masked_sprite(BITMAP* bmp, BITMAP* sprite, int x, int y, fixed angle) throw ();
+    void rotate_trans_sprite(BITMAP* bmp, BITMAP* sprite, int x, int y, fixed angle, int alpha) throw ();
+    void rotate_alpha_sprite(BITMAP* bmp, BITMAP* sprite, int x, int y, fixed angle) throw ();
+    static void draw_alpha_sprite(BITMAP* bmp, BITMAP* sprite, int x, int y) throw ();  // a 32-bit sprite with alpha; as draw_trans_sprite with set_alpha_blender
     static int colorTo32(int color) throw () { return makecol32(getr(color), getg(color), getb(color)); }
     static void overlayColor(BITMAP* bmp, BITMAP* alpha, int color) throw ();    // alpha must be an 8-bit bitmap; give the color in same format as bmp
     static void combine_sprite(BITMAP* sprite, BITMAP* common, BITMAP* team, BITMAP* personal, int tcol, int pcol) throw (); // give the colors in same format as sprite
@@ -445,20 +516,26 @@ private:
 
     class BackgroundManager {
     public:
-        BackgroundManager(Graphics& host) throw () : g(host) { }
+        BackgroundManager(Graphics& host, int prerenderPriority) throw ();
 
         void draw_background(BITMAP* drawbuf, bool draw_map, bool reserve_playfield) throw ();
         void draw_playfield_background(BITMAP* drawbuf, const Map& map, const VisibilityMap& roomVis, bool continuousTextures, bool mapInfoMode) throw ();
+        void prerender(const Map& map, const WorldCoords& focus, double speedX, double speedY, double runSpeed, bool continuousTextures, bool mapInfoMode) throw ();
 
-        void invalidateRoomCache() throw () { roomCache.clear(); roomCacheIndex.clear(); roomCacheMemoryBitmap.free(); cacheTimestamp = 0; }
+        void invalidateRoomCache() throw () { prerenderer.cancel(); roomCache.clear(); roomCacheIndex.clear(); roomCacheMemoryBitmap.free(); cacheTimestamp = 0; }
+        void setDirectDrawing() throw () { directDrawing = true; invalidateRoomCache(); }
 
-        bool allocate(bool videoMemory, int cachePages) throw ();
+        bool allocate(bool videoMemory, int cachePages, int pageWidth, int pageHeight) throw ();
         void free() throw () { roomCacheBitmap.free(); invalidateRoomCache(); }
 
     private:
         void allocateRoomCache(int room_w, int room_h, int minRooms, int maxRooms) throw ();
 
+        class CachedRoomGfx;
+        CachedRoomGfx* reclaimCacheEntry(int roomx, int roomy) throw ();   // returns 0 if all entries are locked
         void cacheRoom(const Map& map, int roomx, int roomy, bool continuousTextures, bool mapInfoMode) throw ();
+        bool inView(int roomx, int roomy) const throw ();   // as of the last draw_playfield_background
+        void adoptPrerenderedRooms() throw ();
         void drawRoom(const Map& map, int roomx, int roomy, bool continuousTextures, bool mapInfoMode, bool fogged, BITMAP* target, int tx0, int ty0) throw ();
 
         struct BitmapRegion {
@@ -471,6 +548,11 @@ private:
             void blitTo(BITMAP* target, int tx0, int ty0) const throw ();
         };
 
+        static const uint32_t diskCacheSize = 64 * 1024 * 1024;
+
+        // draw an antialiased room through a memory bitmap, taking it from diskCache if it's there; returns false if area must be drawn normally
+        bool drawRoomThroughDisk(const BitmapRegion& area, const Map& map, int roomx, int roomy, bool continuousTextures) throw ();
+
         class CachedRoomGfx {
             int roomx, roomy;
             BitmapRegion baseArea;
@@ -491,6 +573,7 @@ private:
                     fogColor(fogColor_), locked(false), lastUse(0) { nAssert(baseArea.w == foggedArea.w && baseArea.h == foggedArea.h || !foggedArea.b); }
 
             bool used() const throw () { return baseGenerated; }
+            bool hasFoggedArea() const throw () { return foggedArea.b; }
             int x() const throw () { return roomx; }
             int y() const throw () { return roomy; }
 
@@ -499,6 +582,51 @@ private:
             void drawUnfogged(BITMAP* target, int tx0, int ty0) const throw () { nAssert(baseGenerated); baseArea.blitTo(target, tx0, ty0); }
             void drawFogged  (BITMAP* target, int tx0, int ty0) const throw ();
             const BitmapRegion& fogged() const throw ();
+            void setFogged(BITMAP* source) throw ();    // use a ready fogged version of the room, if there's space for one
+        };
+
+        /** Draws rooms in a low priority thread, for the render thread to copy into the cache.
+         * Only antialiased rooms outside map info mode are drawn here, because that drawing writes memory bitmaps without
+         * Allegro's global drawing state. A job owns copies of what it needs, except the textures and colors of Graphics;
+         * invalidating the room cache cancels the jobs, waiting for the one being drawn, before they may change.
+         */
+        class RoomPrerenderer : private NoCopying {
+        public:
+            struct Job : private NoCopying {
+                int roomx, roomy;
+                int texOffsetX, texOffsetY;
+                RoomDrawData data;
+                uint64_t diskKey;
+                Bitmap base, fogged;    // the fogged version is made only if fogged is allocated
+                unsigned serial;
+
+                Job(const Map& map, int roomx_, int roomy_, int texOffsetX_, int texOffsetY_, uint64_t diskKey_) throw () :
+                    roomx(roomx_), roomy(roomy_), texOffsetX(texOffsetX_), texOffsetY(texOffsetY_), data(map, roomx_, roomy_), diskKey(diskKey_), serial(0) { }
+            };
+
+            RoomPrerenderer(const Graphics& host, RoomDiskCache& diskCache, int threadPriority) throw ();
+            ~RoomPrerenderer() throw ();
+
+            void request(Job* job) throw ();    // takes the ownership of job
+            void cancel() throw ();             // drops the queued and finished jobs, waiting for the one being drawn
+            Job* take() throw ();               // a finished job for the caller to own, or 0 if there are none
+            bool has(int roomx, int roomy) throw ();    // a job for the room is queued, being drawn or finished
+            unsigned size() throw ();           // number of jobs queued, being drawn or finished
+
+        private:
+            void threadMain() throw ();
+            void draw(Job& job) const throw ();
+
+            const Graphics& g;
+            RoomDiskCache& disk;
+            int priority;
+            Thread thread;
+            bool quitFlag;
+            std::deque<Job*> queue, finished;
+            Job* working;
+            unsigned serial;    // increased by cancel; finished jobs of an older serial are discarded
+            ConditionVariable wakeup, workDone;
+            Mutex mutex;
         };
 
         std::vector<CachedRoomGfx> roomCache;
@@ -511,8 +639,13 @@ private:
 
         bool previousContinuousTextures, previousMapInfoMode;
         int previousRoom0x, previousRoom0y, previousXrooms, previousYrooms;
+
+        RoomDiskCache diskCache;    // of antialiased rooms outside map info mode
+        RoomPrerenderer prerenderer;
+        bool directDrawing; // rooms are always drawn when needed, without diskCache and prerenderer
     };
 
+    mutable BandRenderWorkers bandWorkers;  // for drawRoomAntialiased
     BackgroundManager background;
 
     std::vector<std::string> file_extensions;
@@ -578,14 +711,17 @@ private:
 
     int team_captures_start;
 
-    std::list<GraphicsEffect> cfx;
+    EffectStore effects;
 
     std::string theme_path;
+    RoomKeyHasher themeKey; // of the floor and wall textures
     std::string bg_path;
     std::string colour_file;
 
     bool antialiasing;
 
+    RotatedSpriteCache spriteCache; // of the sprites of players, shields, dead players and rockets
+
     int stats_alpha;
 
     int teamcol[3];
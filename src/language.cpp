@@ -33,20 +33,104 @@
 #include "language.h"
 
 using std::ifstream;
-using std::map;
 using std::string;
+using std::vector;
 
 Language language;
 
+unsigned Language::hashKey(const string& key) throw () {   // FNV-1a
+    unsigned h = 2166136261u;
+    for (string::const_iterator ci = key.begin(); ci != key.end(); ++ci)
+        h = (h ^ static_cast<unsigned char>(*ci)) * 16777619u;
+    return h;
+}
+
+void Language::parseTemplate(Phrase& phrase) throw () {
+    const string& text = phrase.text;
+    Segment seg;
+    seg.start = 0;
+    for (string::size_type pos = 0; (pos = text.find('$', pos)) != string::npos; ) {
+        if (pos + 1 < text.length() && text[pos + 1] >= '1' && text[pos + 1] <= '5') {
+            seg.length = pos - seg.start;
+            seg.arg = text[pos + 1] - '1';
+            phrase.segments.push_back(seg);
+            seg.start = pos + 2;
+            pos += 2;
+        }
+        else
+            ++pos;
+    }
+    seg.length = text.length() - seg.start;
+    seg.arg = -1;
+    phrase.segments.push_back(seg);
+}
+
+void Language::formatUnparsed(string& out, const string& text, const string* const* args, int nArgs) throw () {
+    string::size_type start = 0;
+    for (string::size_type pos = 0; (pos = text.find('$', pos)) != string::npos; ) {
+        const int arg = pos + 1 < text.length() ? text[pos + 1] - '1' : -1;
+        if (arg >= 0 && arg < nArgs) {
+            out.append(text, start, pos - start);
+            out += *args[arg];
+            start = pos + 2;
+            pos += 2;
+        }
+        else
+            ++pos;
+    }
+    out.append(text, start, string::npos);
+}
+
+const Language::Phrase* Language::find(const string& key) const throw () {
+    if (phrases.empty())
+        return 0;
+    const unsigned hash = hashKey(key), mask = table.size() - 1;
+    for (unsigned i = hash & mask; table[i] != -1; i = (i + 1) & mask) {
+        const Phrase& p = phrases[table[i]];
+        if (p.hash == hash && p.key == key)
+            return &p;
+    }
+    return 0;
+}
+
+void Language::add(const string& key, const string& text) throw () {
+    Phrase p;
+    p.hash = hashKey(key);
+    p.key = key;
+    p.text = text;
+    parseTemplate(p);
+    phrases.push_back(p);
+}
+
+void Language::clear() throw () {
+    phrases.clear();
+    table.clear();
+}
+
 string Language::get_text(const string& text) const throw () {
-    const map<string, string>::const_iterator translation = texts.find(text);
-    if (translation == texts.end())
-        return text;
-    return translation->second;
+    const Phrase* const phrase = find(text);
+    return phrase ? phrase->text : text;
+}
+
+void Language::format(string& out, const string& text, const string* const* args, int nArgs) const throw () {
+    const Phrase* const phrase = find(text);
+    if (!phrase) {
+        formatUnparsed(out, text, args, nArgs);
+        return;
+    }
+    for (vector<Segment>::const_iterator si = phrase->segments.begin(); si != phrase->segments.end(); ++si) {
+        out.append(phrase->text, si->start, si->length);
+        if (si->arg == -1)
+            break;
+        if (si->arg < nArgs)
+            out += *args[si->arg];
+        else
+            out.append(phrase->text, si->start + si->length, 2); // leave the placeholder
+    }
 }
 
 bool Language::load(const string& lang, LogSet& log) throw () {
-    texts.clear();
+    clear();
     lang_code = "en";
     loc = "C";
     if (lang == lang_code)  // English - no need to load the same phrases as in the code.
@@ -75,14 +159,26 @@ bool Language::load(const string& lang, LogSet& log) throw () {
         if (key == "locale")
             loc = value;
         else
-            texts[key] = value;
+            add(key, value);
     }
     if (def || transl) {
         log.error("Language file for '" + lang + "' is invalid, maybe for another version of Outgun. " +
                   translname + " contains " + (transl ? "more" : "less") + " phrases than " + defname + ". Continuing without translation.");
-        texts.clear();
+        clear();
         return false;
     }
+    // build the hash table at most half full; a later duplicate key replaces the earlier one like it did when the phrases were kept in a map
+    unsigned size = 16;
+    while (size < phrases.size() * 2)
+        size *= 2;
+    table.assign(size, -1);
+    for (int pi = 0; pi < static_cast<int>(phrases.size()); ++pi) {
+        const unsigned mask = size - 1;
+        unsigned i = phrases[pi].hash & mask;
+        while (table[i] != -1 && phrases[table[i]].key != phrases[pi].key)
+            i = (i + 1) & mask;
+        table[i] = pi;
+    }
     lang_code = lang;
     log("Language '%s' loaded", lang.c_str());
     return true;
@@ -92,19 +188,61 @@ string _(const string& text) throw () {
     return language.get_text(text);
 }
 
-string _(string text, const string& t1, const string& t2, const string& t3, const string& t4, const string& t5) throw () {
-    text = _(text);
-    const int nReplacements = 5;
-    const string* const replacement[nReplacements] = { &t1, &t2, &t3, &t4, &t5 };
-    string::size_type pos = 0;
-    while ((pos = text.find('$', pos)) != string::npos) {
-        if (pos + 1 == string::npos)
-            break;
-        const int val = atoi(text.substr(pos + 1, 1)) - 1;
-        if (val >= 0 && val < nReplacements) {
-            text.replace(pos, 2, *replacement[val]);
-            pos += replacement[val]->length();
-        }
-    }
-    return text;
+string _(const string& text, const string& t1) throw () {
+    string s;
+    append_translation(s, text, t1);
+    return s;
+}
+
+string _(const string& text, const string& t1, const string& t2) throw () {
+    string s;
+    append_translation(s, text, t1, t2);
+    return s;
+}
+
+string _(const string& text, const string& t1, const string& t2, const string& t3) throw () {
+    string s;
+    append_translation(s, text, t1, t2, t3);
+    return s;
+}
+
+string _(const string& text, const string& t1, const string& t2, const string& t3, const string& t4) throw () {
+    string s;
+    append_translation(s, text, t1, t2, t3, t4);
+    return s;
+}
+
+string _(const string& text, const string& t1, const string& t2, const string& t3, const string& t4, const string& t5) throw () {
+    string s;
+    append_translation(s, text, t1, t2, t3, t4, t5);
+    return s;
+}
+
+void append_translation(string& out, const string& text) throw () {
+    language.format(out, text, 0, 0);
+}
+
+void append_translation(string& out, const string& text, const string& t1) throw () {
+    const string* const args[] = { &t1 };
+    language.format(out, text, args, 1);
+}
+
+void append_translation(string& out, const string& text, const string& t1, const string& t2) throw () {
+    const string* const args[] = { &t1, &t2 };
+    language.format(out, text, args, 2);
+}
+
+void append_translation(string& out, const string& text, const string& t1, const string& t2, const string& t3) throw () {
+    const string* const args[] = { &t1, &t2, &t3 };
+    language.format(out, text, args, 3);
+}
+
+void append_translation(string& out, const string& text, const string& t1, const string& t2, const string& t3, const string& t4) throw () {
+    const string* const args[] = { &t1, &t2, &t3, &t4 };
+    language.format(out, text, args, 4);
+}
+
+void append_translation(string& out, const string& text, const string& t1, const string& t2, const string& t3, const string& t4, const string& t5) throw () {
+    const string* const args[] = { &t1, &t2, &t3, &t4, &t5 };
+    language.format(out, text, args, 5);
 }
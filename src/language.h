@@ -25,10 +25,14 @@
 #define LANGUAGE_H_INC
 
 #include <string>
-#include <map>
+#include <vector>
 
 class LogSet;
 
+/** Translation catalog.
+ * The phrases are stored in an open addressing hash table when the language is loaded, and each translation is
+ * split at its $1...$5 placeholders at the same time, so that formatting is a single pass of appends.
+ */
 class Language {
 public:
     Language() throw () : lang_code("en"), loc("C") { }
@@ -37,12 +41,34 @@ public:
     bool load(const std::string& lang, LogSet& log) throw ();
 
     std::string get_text(const std::string& text) const throw ();
+    /// Append the translation of text to out, replacing $n with *args[n - 1] for n <= nArgs; other placeholders are left as is.
+    void format(std::string& out, const std::string& text, const std::string* const* args, int nArgs) const throw ();
     std::string code() const throw () { return lang_code; }
 
     std::string locale() const throw () { return loc; }
 
 private:
-    std::map<std::string, std::string> texts;
+    struct Segment {    // literal text followed by a placeholder
+        unsigned start, length;
+        int arg;        // 0-based index of the placeholder, or -1 for none (the last segment)
+    };
+
+    struct Phrase {
+        unsigned hash;
+        std::string key, text;
+        std::vector<Segment> segments;
+    };
+
+    static unsigned hashKey(const std::string& key) throw ();
+    static void parseTemplate(Phrase& phrase) throw ();
+    static void formatUnparsed(std::string& out, const std::string& text, const std::string* const* args, int nArgs) throw ();
+
+    const Phrase* find(const std::string& key) const throw ();
+    void add(const std::string& key, const std::string& text) throw ();
+    void clear() throw ();
+
+    std::vector<Phrase> phrases;
+    std::vector<int> table; // indices to phrases, -1 for empty; the size is a power of two
     std::string lang_code;
     std::string loc;
 };
@@ -52,10 +78,18 @@ extern Language language;
 std::string _(const std::string& text) throw ();
 
 // Get translation and replace $1...$5 with t1...t5.
-std::string _(std::string text, const std::string& t1,
-                                const std::string& t2 = "$2",
-                                const std::string& t3 = "$3",
-                                const std::string& t4 = "$4",
-                                const std::string& t5 = "$5") throw ();
+std::string _(const std::string& text, const std::string& t1) throw ();
+std::string _(const std::string& text, const std::string& t1, const std::string& t2) throw ();
+std::string _(const std::string& text, const std::string& t1, const std::string& t2, const std::string& t3) throw ();
+std::string _(const std::string& text, const std::string& t1, const std::string& t2, const std::string& t3, const std::string& t4) throw ();
+std::string _(const std::string& text, const std::string& t1, const std::string& t2, const std::string& t3, const std::string& t4, const std::string& t5) throw ();
+
+// The same, appending to out rather than returning a new string.
+void append_translation(std::string& out, const std::string& text) throw ();
+void append_translation(std::string& out, const std::string& text, const std::string& t1) throw ();
+void append_translation(std::string& out, const std::string& text, const std::string& t1, const std::string& t2) throw ();
+void append_translation(std::string& out, const std::string& text, const std::string& t1, const std::string& t2, const std::string& t3) throw ();
+void append_translation(std::string& out, const std::string& text, const std::string& t1, const std::string& t2, const std::string& t3, const std::string& t4) throw ();
+void append_translation(std::string& out, const std::string& text, const std::string& t1, const std::string& t2, const std::string& t3, const std::string& t4, const std::string& t5) throw ();
 
 #endif
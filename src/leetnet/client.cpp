@@ -130,6 +130,8 @@ public:
     volatile bool   want_connect;           //yes/no
     volatile int    connect_status;     //0=not connected 1=trying disconnection 2=trying connection 2=connected
     int tries_left;             //tries left
+    bool have_cookie;           //the server has challenged us with connect_cookie, which must be included in the connection request
+    uint32_t connect_cookie;
     int connect_threads_running;    // half-witted thread-safety protection; flawed but better than nothing - must recode a lot
 
     bool            started_disconnection;      //if disconnection was started by the client
@@ -435,6 +437,7 @@ public:
         //trying. this should be the FIRST THING!
         int old_status = connect_status;
         connect_status = 2;
+        have_cookie = false;
 
         log("start_connect()");
 
@@ -622,6 +625,14 @@ DLOG_Scope s("CPIDg");
                     connect_status = 3;
                 }
             }
+            // the server wants proof that we receive packets at our address before committing a slot: repeat the request with the cookie
+            else if (code == 5) {
+                if (connect_status == 2) {
+                    connect_cookie = read.U32();
+                    have_cookie = true;
+                    send_hello();
+                }
+            }
             // connection rejected
             else if (code == 4) {
 
@@ -696,10 +707,22 @@ DLOG_Scope s("CPIDg");
             return true;
         }
 
-        //send the packet
+        send_hello();
+
+        //keep trying
+        return false;
+    }
+
+    //send a "want to connect" packet
+    void send_hello() throw () {
         ExpandingBinaryBuffer msg;
         msg.U32(0); //special packet
-        msg.U32(1); //want to connect
+        if (have_cookie) {
+            msg.U32(6); //want to connect, with the server's cookie
+            msg.U32(connect_cookie);
+        }
+        else
+            msg.U32(1); //want to connect
         msg.U32(LEETNET_VERSION);     // LEETNET protocol/build version - must match server's
 
         //custom data?
@@ -707,9 +730,6 @@ DLOG_Scope s("CPIDg");
         msg.block(connect_data);
 
         sendRawPacket(msg);  // FIXME: deal with send erros?
-
-        //keep trying
-        return false;
     }
 
     //called by reader thread to check for quit condition
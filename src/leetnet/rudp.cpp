@@ -39,6 +39,46 @@
 
 #include "rudp.h"
 
+extern Mutex g_sharedMessageMutex;
+
+SharedMessage::SharedMessage(ConstDataBlockRef data) throw () {
+    payload = static_cast<Payload*>(operator new(sizeof(Payload) + data.size()));
+    payload->refs = 1;
+    payload->size = data.size();
+    memcpy(payload + 1, data.data(), data.size());
+}
+
+SharedMessage::SharedMessage(const SharedMessage& source) throw () : payload(source.payload) {
+    acquire();
+}
+
+SharedMessage& SharedMessage::operator=(const SharedMessage& source) throw () {
+    source.acquire();   // first, in case source refers to the same payload
+    release();
+    payload = source.payload;
+    return *this;
+}
+
+void SharedMessage::acquire() const throw () {
+    if (payload) {
+        Lock ml(g_sharedMessageMutex);
+        ++payload->refs;
+    }
+}
+
+void SharedMessage::release() throw () {
+    if (!payload)
+        return;
+    bool last;
+    {
+        Lock ml(g_sharedMessageMutex);
+        last = --payload->refs == 0;
+    }
+    if (last)
+        operator delete(payload);
+    payload = 0;
+}
+
 // buffer size limitations (stupid hardcoded but works)
 //
 
@@ -76,19 +116,19 @@
 class msgrec {
     int id_;            // the message id, -1 = unused
     uint32_t sent;       // id of first packet that sent this message
-    DataBlock message_;   // the message's contents
+    SharedMessage message_;   // the message's contents
 
 public:
     msgrec() throw () { clear(); }
 
-    void clear() throw () { id_ = -1; message_ = DataBlock(); }
-    void set(int id, ConstDataBlockRef data) throw () { nAssert(!used()); sent = 0; id_ = id; message_ = data; }
+    void clear() throw () { id_ = -1; message_ = SharedMessage(); }
+    void set(int id, const SharedMessage& msg) throw () { nAssert(!used()); sent = 0; id_ = id; message_ = msg; }
     void send(uint32_t frame) throw () { nAssert(frame != 0); if (sent == 0) sent = frame; else nAssert(sent < frame); }
 
     bool used() const throw () { return id_ != -1; }
     bool sentBefore(uint32_t id) const throw () { return sent != 0 && sent <= id; } // sent == 0 means not sent at all
     int id() const throw () { return id_; }
-    ConstDataBlockRef message() const throw () { return message_; }
+    ConstDataBlockRef message() const throw () { return message_.data(); }
     int msgSize() const throw () { return message_.size(); }
 };
 
@@ -124,6 +164,9 @@ public:
     // the last packet received, to be acked
     uint32_t ack;
 
+    // the newest of our packets acked by the remote
+    uint32_t newest_remote_ack;
+
     uint32_t nextPortChange; // at which client frame if there's still zero ack, a port change is attempted; 0 means disabled
 
     //the UDP packet set
@@ -153,12 +196,10 @@ public:
 
     #ifdef EXTRA_RELIABLE_STORAGE
     uint32_t reliable_size;  // total size of reliable messages in reliable[], plus 6 bytes extra for each
-    std::queue<DataBlock*> extra_reliables;
+    std::queue<SharedMessage> extra_reliables;
     void erase_extra_reliables() throw () {
-        while (!extra_reliables.empty()) {
-            delete extra_reliables.front();
+        while (!extra_reliables.empty())
             extra_reliables.pop();
-        }
     }
     bool can_add_reliable(uint32_t msgsize) const throw () { return reliable_size==0 || reliable_size + msgsize < MAX_PACKET_SIZE; }
     #endif
@@ -189,6 +230,7 @@ public:
         idgen_reliable_send = 1;
         idgen_packet_send = 1;
         ack = 0;
+        newest_remote_ack = 0;
         reliable_count = 0;
         nextPortChange = 0;
 
@@ -401,6 +443,8 @@ DLOG_Scope s("UPIP");
         const char* const unreliable = udp_data + read.getPosition();
 
         ack = packet_id;
+        if (packet_ack > newest_remote_ack)
+            newest_remote_ack = packet_ack;
 
         //(3) for every reliable message in the buffer, check if it was acked by
         //    this incoming data. if yes, delete it from the buffer (id = -1 and clear buffers)
@@ -418,26 +462,22 @@ DLOG_Scope s("UPIP");
                 reliable_size -= reliable[i].msgSize() + 6;
                 reliable[i].clear();
                 // check if there's a message on the extra queue that can be sent now
-                if (!extra_reliables.empty() && can_add_reliable(extra_reliables.front()->size())) {
-                    DataBlock* msg = extra_reliables.front();
+                if (!extra_reliables.empty() && can_add_reliable(extra_reliables.front().size())) {
+                    reliable[i].set(idgen_reliable_send++, extra_reliables.front());
                     extra_reliables.pop();
-                    reliable[i].set(idgen_reliable_send++, *msg);
-                    delete msg;
                     reliable_size += reliable[i].msgSize() + 6;
                     if (reliable_count < MAXMSG &&
                             !extra_reliables.empty() &&
-                            can_add_reliable(extra_reliables.front()->size()))
+                            can_add_reliable(extra_reliables.front().size()))
                     {
                         for (int rel = 0; rel < MAXMSG; ++rel)  // fill empty spots from queue while possible
                             if (!reliable[rel].used()) {
-                                DataBlock* msg = extra_reliables.front();
+                                reliable[rel].set(idgen_reliable_send++, extra_reliables.front());
                                 extra_reliables.pop();
-                                reliable[rel].set(idgen_reliable_send++, *msg);
-                                delete msg;
                                 reliable_size += reliable[rel].msgSize() + 6;
                                 if (++reliable_count == MAXMSG ||
                                         extra_reliables.empty() ||
-                                        !can_add_reliable(extra_reliables.front()->size()))
+                                        !can_add_reliable(extra_reliables.front().size()))
                                     break;
                             }
                     }
@@ -459,21 +499,25 @@ DLOG_Scope s("UPIP");
 
     // append reliable message to the packet buffer
     virtual int writer(ConstDataBlockRef data) throw () {
+        return writer(SharedMessage(data));
+    }
+
+    virtual int writer(const SharedMessage& msg) throw () {
 DLOG_Scope s("UWR");
-        nAssert(data.size() <= MAX_MESSAGE_SIZE);
+        nAssert(msg.size() <= MAX_MESSAGE_SIZE);
 
         relmsg_mutex.lock();
         #ifdef EXTRA_RELIABLE_STORAGE
-        if (reliable_count<MAXMSG && can_add_reliable(data.size()) && extra_reliables.empty())
+        if (reliable_count<MAXMSG && can_add_reliable(msg.size()) && extra_reliables.empty())
         #endif
         {
             //find slot in reliable
             //
             for (int i=0; i<MAXMSG; i++)
                 if (!reliable[i].used()) {
-                    reliable[i].set(idgen_reliable_send++, data);
+                    reliable[i].set(idgen_reliable_send++, msg);
                     reliable_count++;                                               // another one
-                    reliable_size += data.size() + 6;
+                    reliable_size += msg.size() + 6;
                     relmsg_mutex.unlock();
                     return 1;                       //ok
                 }
@@ -484,7 +528,7 @@ DLOG_Scope s("UWR");
 
         // can't add to the standard send buffer
         #ifdef EXTRA_RELIABLE_STORAGE
-        extra_reliables.push(new DataBlock(data));
+        extra_reliables.push(msg);
         relmsg_mutex.unlock();
         return 1;
         #else
@@ -493,6 +537,8 @@ DLOG_Scope s("UWR");
         #endif
     }
 
+    virtual uint32_t remote_ack() const throw () { return newest_remote_ack; }
+
     // append unreliable data to the packet buffer
     //virtual int write(data_c* data) {
     virtual int write(ConstDataBlockRef data) throw () {
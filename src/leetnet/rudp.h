@@ -32,6 +32,40 @@
 
 #include "../network.h"
 
+/*
+
+    SharedMessage
+
+    an immutable reliable message that can be queued to several stations without copying it for each.
+    copies of a SharedMessage refer to the same data, which is freed with the last copy. the reference
+    count is protected by one mutex common to all messages, because stations release their copies from
+    their own threads when the messages are acked
+
+ */
+
+class SharedMessage {
+public:
+    SharedMessage() throw () : payload(0) { }
+    explicit SharedMessage(ConstDataBlockRef data) throw ();
+    SharedMessage(const SharedMessage& source) throw ();
+    ~SharedMessage() throw () { release(); }
+    SharedMessage& operator=(const SharedMessage& source) throw ();
+
+    ConstDataBlockRef data() const throw () { return payload ? ConstDataBlockRef(payload + 1, payload->size) : ConstDataBlockRef(0, 0); }
+    unsigned size() const throw () { return payload ? payload->size : 0; }
+
+private:
+    struct Payload {
+        unsigned refs;
+        unsigned size;
+        // followed by the data
+    };
+    Payload* payload;
+
+    void acquire() const throw ();
+    void release() throw ();
+};
+
 /*
 
     station_c
@@ -98,11 +132,16 @@ public:
     // append reliable message to the queue. this will be sent as many times as needed until
     // it's acknowledged by the other side.
     virtual int writer(ConstDataBlockRef data) throw () = 0;
+    // the same for a message that may also be queued to other stations; only a reference is stored
+    virtual int writer(const SharedMessage& msg) throw () = 0;
 
     // appends unreliable data to the packet buffer. all these calls are collapsed and the
     // unreliable data is sent as a big chunk when send_packet() is called (see below).
     virtual int write(ConstDataBlockRef data) throw () = 0;
 
+    // the newest of our packet ids the remote has reported receiving, 0 if none
+    virtual uint32_t remote_ack() const throw () = 0;
+
     // flush the packet buffers as an UDP packet to the remote address, returns "id"
     // for the assigned packet id. this call resets the unreliable data buffer (see
     // write() above).
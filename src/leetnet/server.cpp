@@ -56,6 +56,46 @@ using namespace GNE;
 // change this to meet your needs
 #define  MAX_CLIENTS 32
 
+/* Protection of the master thread against floods of packets from unknown addresses.
+ *
+ * Special packets are limited by a token bucket chosen by a hash of the source IP; IPs that hash to the same bucket
+ * share it, so that a flood from varying addresses can't get a fresh burst for every new address. Serverinfo
+ * replies are also limited in total. Connection requests with a valid cookie are exempt from the source limit,
+ * so that a flood that drains the buckets can't keep challenged clients out.
+ * A connection request (0,1) normally gets a client slot directly, but when they come in faster than
+ * helloRate in total, further requests are answered with a cookie challenge (0,5,cookie) instead. The client
+ * repeats its request with the cookie (0,6,cookie,...), which proves that it receives packets sent to its
+ * address, before a slot and a socket are committed. The cookie is a keyed hash of the address and the time,
+ * so nothing is stored for the challenged requests. Clients older than cookies can't connect while the server
+ * is challenging.
+ */
+static const double sourceRate = 10, sourceBurst = 20;          // packets per second from one IP
+static const double serverinfoRate = 200, serverinfoBurst = 400;
+static const double helloRate = 5, helloBurst = 10;             // connection requests accepted without a cookie
+static const int sourceBuckets = 256;
+static const double cookieLifetime = 16;    // seconds; a cookie is valid for one to two times this
+
+class TokenBucket {
+    double tokens, lastTime;
+
+public:
+    TokenBucket() throw () : tokens(-1), lastTime(0) { }  // starts full on the first take()
+    bool take(double time, double rate, double burst) throw () {
+        tokens = tokens < 0 ? burst : std::min(burst, tokens + (time - lastTime) * rate);
+        lastTime = time;
+        if (tokens < 1)
+            return false;
+        tokens -= 1;
+        return true;
+    }
+};
+
+static uint32_t hashString(const std::string& str, uint32_t h = 2166136261u) throw () { // FNV-1a
+    for (std::string::const_iterator ci = str.begin(); ci != str.end(); ++ci)
+        h = (h ^ static_cast<uint8_t>(*ci)) * 16777619u;
+    return h;
+}
+
 class server_ci;
 
 // client record struct for server
@@ -143,8 +183,16 @@ public:
 
     int minLocalPort, maxLocalPort;
 
-    //serverinfo buffer
-    char                    serverinfo[2048];
+    //serverinfo reply, 0,200,0,0,<serverinfo>; the two zero bytes are replaced by those in the query
+    DataBlock               serverinfoReply;
+    std::string             serverinfo;
+    Mutex                   serverinfoMutex;
+
+    // flood protection; accessed only by the master thread, except that stats is read by get_query_stats
+    TokenBucket             sourceBucket[sourceBuckets];   // by hash of the IP; colliding IPs share one
+    TokenBucket             serverinfoBucket, helloBucket;
+    uint32_t                cookieSecret;
+    ServerQueryStats        stats;
 
     // UDP reader thread
     Thread                  reader_thread;
@@ -200,9 +248,21 @@ public:
 
     //set serverinfo string
     virtual void set_server_info(const char *info) throw () {
-        strcpy(serverinfo, info);
+        Lock ml(serverinfoMutex);
+        if (serverinfo == info)
+            return;
+        serverinfo = info;
+        ExpandingBinaryBuffer msg;
+        msg.U32(0);
+        msg.U32(200);
+        msg.U8(0);
+        msg.U8(0);
+        msg.str(serverinfo);
+        serverinfoReply = msg;
     }
 
+    virtual ServerQueryStats get_query_stats() const throw () { return stats; }
+
     //start up the server at given port
     virtual int start(int port) throw () {
         //if not stopped, quit
@@ -413,7 +473,7 @@ public:
     }
 
         //send frame method - when broadcast_frame doesn't quite cut it
-    virtual int send_frame(int client_id, ConstDataBlockRef data) throw () {
+    virtual uint32_t send_frame(int client_id, ConstDataBlockRef data) throw () {
         if (!client[client_id].used)
             return 0;   // client not used (?)
 
@@ -436,8 +496,13 @@ public:
         client[client_id].station->send_packet(packet_id, 0);   // flush the packet
         #endif
 
-        //ok
-        return 1;
+        return packet_id;
+    }
+
+    virtual uint32_t get_client_acked_packet(int client_id) const throw () {
+        if (!client[client_id].used)
+            return 0;
+        return client[client_id].station->remote_ack();
     }
 
     //sends the given reliable message to the given client. reliable = heavy, do not use for frequent
@@ -455,6 +520,21 @@ public:
         return 1;
     }
 
+    virtual int send_message(int client_id, const SharedMessage& msg) throw () {
+        client[client_id].station->writer(msg);
+        return 1;
+    }
+
+    virtual int multicast_message(uint32_t client_mask, ConstDataBlockRef data) throw () {
+        if (client_mask == 0)
+            return 1;
+        const SharedMessage msg(data);
+        for (int i = 0; i < MAX_CLIENTS; i++)
+            if (client_mask & (uint32_t(1) << i))
+                client[i].station->writer(msg);
+        return 1;
+    }
+
 
     //broadcasts the given reliable message to all active clients. for lazy people :-) like me :-))
     /* disabled in Outgun to prevent problems
@@ -637,24 +717,42 @@ public:
             return 1;
         }
 
+        const double now = get_time();
+        std::string ip = remoteaddr.toString();
+        ip.erase(std::min(ip.find(':'), ip.length()));
+        if (smsgid == 6) {  // checking the cookie needs no state, so it's done before the source limit
+            const uint32_t cookie = read.U32();
+            if (cookie != connectCookie(remoteaddr, now) && cookie != connectCookie(remoteaddr, now - cookieLifetime)) {
+                ++stats.cookiesRejected;
+                return 1;
+            }
+        }
+        else if (!sourceBucket[hashString(ip) % sourceBuckets].take(now, sourceRate, sourceBurst)) {
+            ++stats.rateLimited;
+            return 1;
+        }
+
         //serverinfo request : answer
         if (smsgid == 200) {
             const uint8_t a = read.U8(); //clientside gamespy entry (lazyness)
             const uint8_t b = read.U8(); //packet try #
 
-            ExpandingBinaryBuffer msg;
-            msg.U32(0);
-            msg.U32(200);
-            msg.U8(a);
-            msg.U8(b);
-            msg.str(serverinfo);
+            if (!serverinfoBucket.take(now, serverinfoRate, serverinfoBurst)) {
+                ++stats.rateLimited;
+                return 1;
+            }
             //send
+            Lock ml(serverinfoMutex);
+            uint8_t* const reply = static_cast<uint8_t*>(serverinfoReply.data());
+            reply[8] = a;
+            reply[9] = b;
             try {
                 log("SENDING REPLY TO CLIENT AT %s", remoteaddr.toString().c_str());
-                servsock.write(remoteaddr, msg);
+                servsock.write(remoteaddr, serverinfoReply);
             } catch (Network::Error&) {
                 return 0;
             }
+            ++stats.serverinfoReplies;
             return 1;
         }
 
@@ -675,11 +773,25 @@ public:
 
         // se aqui nao for pedido de conexao, nao aceita
         //
-        if (smsgid != 1) {  //"hello! I want to connect!"
+        if (smsgid != 1 && smsgid != 6) {  //"hello! I want to connect!" without or with a cookie
             log(" NOT HELLO PACKET");
             return 1;
         }
 
+        if (smsgid == 1 && !helloBucket.take(now, helloRate, helloBurst)) {  // a cookie has been checked above
+            BinaryBuffer<32> msg;
+            msg.U32(0);             //"special packet"
+            msg.U32(5);             //"repeat with this cookie"
+            msg.U32(connectCookie(remoteaddr, now));
+            try {
+                servsock.write(remoteaddr, msg);
+            } catch (Network::Error&) {
+                return 0;
+            }
+            ++stats.cookiesSent;
+            return 1;
+        }
+
         //nao eh de client conhecido - verifica server full
         //"server full" reply message
         if (num_clients >= MAX_CLIENTS) {
@@ -751,6 +863,7 @@ public:
 
                 // mais um jogador
                 num_clients++;
+                ++stats.slotsAllocated;
                 log("NEW CLIENT %i  (total=%i)", i, num_clients);
 
                 //set packet & slap slave
@@ -778,6 +891,11 @@ public:
         return 0;
     }
 
+    uint32_t connectCookie(const Network::Address& addr, double time) const throw () {
+        const uint32_t period = static_cast<uint32_t>(time / cookieLifetime);
+        return hashString(addr.toString(), (2166136261u ^ cookieSecret) * 16777619u ^ period);
+    }
+
     //HACK (a better one): called by reader thread to do some thinking for the server
     void server_think() throw () {
         //FIXME: THIS (was) JUST PLAIN WASTE OF CPU!
@@ -890,6 +1008,7 @@ public:
                 }
                 break;
             case 1:
+            case 6: // with a cookie, checked already by process_incoming_datagram
 
                 //connection request discard if:
                 //      client knows he is connected
@@ -904,7 +1023,8 @@ public:
                     ServerHelloResult res;
                     res.accepted = false;
                     res.customDataLength = 0;
-                    helloCallback(customp, cid, ConstDataBlockRef(&data[16], len-16), &res);
+                    const int customStart = code == 6 ? 20 : 16;  // skip 0,code,[cookie,]version,length
+                    helloCallback(customp, cid, ConstDataBlockRef(&data[customStart], len - customStart), &res);
                     log("client %i CONNECTION (II)", cid);
                     if (res.accepted) {
                         //connected!
@@ -1122,7 +1242,8 @@ public:
         datalogMutex("server_ci::datalogMutex"),
         #endif
         minLocalPort(minLocalPort_),
-        maxLocalPort(maxLocalPort_)
+        maxLocalPort(maxLocalPort_),
+        serverinfoMutex("server_ci::serverinfoMutex")
     {
         #ifdef LEETNET_DATA_LOG
         if (g_leetnetDataLog)
@@ -1131,7 +1252,8 @@ public:
             datalog = 0;
         #endif
 
-        strcpy(serverinfo, "default serverinfo");
+        set_server_info("default serverinfo");
+        cookieSecret = (static_cast<uint32_t>(rand()) << 16) ^ static_cast<uint32_t>(rand()) ^ static_cast<uint32_t>(get_time() * 1e6);
 
         //it's true...
         server_stopped = true;
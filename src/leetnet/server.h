@@ -29,6 +29,7 @@
 #define _server_h_
 
 #include "../network.h"
+#include "rudp.h"   // for SharedMessage
 
 struct ServerHelloResult {
     bool accepted;
@@ -37,6 +38,17 @@ struct ServerHelloResult {
     int customStoredData; // returned to connectedCallback when the player finally gets through
 };
 
+// counters of the packets from addresses that aren't connected clients
+struct ServerQueryStats {
+    uint32_t serverinfoReplies;     // server browser queries answered
+    uint32_t rateLimited;           // packets dropped because their source, or all sources together, exceeded the allowed rate
+    uint32_t cookiesSent;           // connection attempts answered with a cookie challenge
+    uint32_t cookiesRejected;       // connection attempts with a wrong or expired cookie
+    uint32_t slotsAllocated;        // connection attempts given a client slot
+
+    ServerQueryStats() throw () : serverinfoReplies(0), rateLimited(0), cookiesSent(0), cookiesRejected(0), slotsAllocated(0) { }
+};
+
 // server class interface
 class server_c {
 public:
@@ -90,13 +102,22 @@ public:
     virtual int broadcast_frame(ConstDataBlockRef data) throw () = 0;
 
     //send frame method - when broadcast_frame doesn't quite cut it
-    virtual int send_frame(int client_id, ConstDataBlockRef data) throw () = 0;
+    //returns the id of the packet the frame was sent in, or 0 if the client isn't connected
+    virtual uint32_t send_frame(int client_id, ConstDataBlockRef data) throw () = 0;
+
+    //the newest packet id sent to the client that the client has reported receiving, 0 if none
+    virtual uint32_t get_client_acked_packet(int client_id) const throw () = 0;
 
     //sends the given reliable message to the given client. reliable = heavy, do not use for frequent
     //world update data. use for gamestate changes, talk messages and other stuff the client can't miss, or
     //stuff he can even miss but it's better if he doesn't and the message is so infrequent and small that
     //it's worth it.
     virtual int send_message(int client_id, ConstDataBlockRef data) throw () = 0;
+    virtual int send_message(int client_id, const SharedMessage& msg) throw () = 0;
+
+    //sends the given reliable message to each client whose bit is set in client_mask. the data is copied
+    //once, and the clients' queues share it
+    virtual int multicast_message(uint32_t client_mask, ConstDataBlockRef data) throw () = 0;
 
     //broadcasts the given reliable message to all active clients. for lazy people :-) like me :-))
 // disabled in Outgun to prevent problems    virtual int broadcast_message(const char* data, int length) = 0;
@@ -114,6 +135,8 @@ public:
     virtual int get_socket_stat(Network::Socket::StatisticType stat) throw () = 0;
 
     virtual Network::Address get_client_address(int client_id) const throw () = 0;
+
+    virtual ServerQueryStats get_query_stats() const throw () = 0;
 };
 
 
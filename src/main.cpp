@@ -34,6 +34,7 @@
 #include "gameserver_interface.h"
 #include "log.h"
 #include "language.h"
+#include "mutex.h"
 #include "network.h"
 #include "platform.h"
 #include "protocol.h"
@@ -51,6 +52,7 @@
 # include "client_interface.h"
 # include "colour.h"
 # include "mappic.h"
+# include "roombench.h"
 #endif
 
 using std::ifstream;
@@ -429,6 +431,22 @@ static void innerMain(int argc, const char* argv[], LogSet& log, MemoryLog& memo
             }
             return;
         }
+        else if (!strcmp(argv[i], "-roombench")) {
+            if (i != 1 || argc > 3)
+                log.error(_("$1 can't be combined with other command line options.", argv[i]));
+            const string theme = argc == 3 ? argv[2] : "";
+
+            if (memoryErrorLog.size() != acceptedErrorCount)    // no point in continuing if there were errors
+                return;
+
+            set_window_title(_("Outgun - Room rendering benchmark").c_str());
+            RoomBench bench(log);
+            if (bench.run(theme))
+                messageBox("Outgun", _("Room rendering benchmark finished; the results are in the log."));
+            else
+                log.error(_("Room rendering benchmark: Parallel rendering gave different results."));
+            return;
+        }
         else if (!strcmp(argv[i], "-colour-file")) {
             if (argc != 2)
                 log.error(_("$1 can't be combined with other command line options.", argv[i]));
@@ -452,6 +470,14 @@ static void innerMain(int argc, const char* argv[], LogSet& log, MemoryLog& memo
             else
                 log.error(_("-replay must be followed by a filename."));
         }
+        else if (!strcmp(argv[i], "-renderbench")) {
+            if (++i < argc) {
+                clientCfg.benchmarkReplay = argv[i];
+                clientCfg.nosound = true;
+            }
+            else
+                log.error(_("-renderbench must be followed by a filename."));
+        }
         else if (!strcmp(argv[i], "-spectate")) {
             if (++i < argc)
                 clientCfg.autoSpectate = argv[i];
@@ -461,6 +487,8 @@ static void innerMain(int argc, const char* argv[], LogSet& log, MemoryLog& memo
         #endif
         else if (!strcmp(argv[i], "-suppressmessages"))
             g_allowBlockingMessages = false;
+        else if (!strcmp(argv[i], "-lockprofile"))
+            g_lockProfiling = true;
         else if (!strcmp(argv[i], "-debug")) {
             if (++i < argc) {
                 int level = strtol(argv[i], NULL, 10);
@@ -628,16 +656,20 @@ static void innerMain(int argc, const char* argv[], LogSet& log, MemoryLog& memo
         check_dir("graphics"     , log);
         check_dir("sound"        , log);
         check_dir("client_stats" , log);
+        check_dir("roomcache"    , log);
 
         if (memoryErrorLog.size() != acceptedErrorCount)  // no point in continuing if there were errors
             return;
 
         // run client
-        clientCfg.statusOutput = newRedirectToFun1(statusOutputWindow);
+        if (clientCfg.benchmarkReplay.empty())
+            clientCfg.statusOutput = newRedirectToFun1(statusOutputWindow);
+        else    // there's no window
+            clientCfg.statusOutput = newRedirectToFun1(statusOutputText);
         serverCfg.statusOutput = newRedirectToFun1(statusOutputWindow);
         log("See clientlog.txt for client's log messages");
         FileLog clientLog(wheregamedir + "log" + directory_separator + "clientlog.txt", true);
-        if (!language_loaded) {
+        if (!language_loaded && clientCfg.benchmarkReplay.empty()) {
             ClientInterface* gameclient = ClientInterface::newClient(clientCfg, serverCfg, clientLog, memoryErrorLog);
             gameclient->language_selection_start(&g_exitFlag);
             delete gameclient;
@@ -647,7 +679,10 @@ static void innerMain(int argc, const char* argv[], LogSet& log, MemoryLog& memo
         }
         ClientInterface* gameclient = ClientInterface::newClient(clientCfg, serverCfg, clientLog, memoryErrorLog);
         if (gameclient->start()) {
-            gameclient->loop(&g_exitFlag, showFirstTimeSplash);
+            if (!clientCfg.benchmarkReplay.empty())
+                gameclient->benchmark(&g_exitFlag);
+            else
+                gameclient->loop(&g_exitFlag, showFirstTimeSplash);
             gameclient->stop();
         }
         else
@@ -656,5 +691,13 @@ static void innerMain(int argc, const char* argv[], LogSet& log, MemoryLog& memo
     }
     #endif
 
+    if (g_lockProfiling) {
+        vector<string> lines;
+        lockProfileReport(lines);
+        for (vector<string>::const_iterator li = lines.begin(); li != lines.end(); ++li)
+            log("%s", li->c_str());
+        g_lockProfiling = false;    // g_systemTimer is deleted by platUninit, but Mutexes may still be locked
+    }
+
     log("Exiting");
 }
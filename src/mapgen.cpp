@@ -43,20 +43,21 @@ using std::pair;
 using std::string;
 using std::vector;
 
-void MapGenerator::generate(int w, int h, bool allow_over_edge) throw () {
+void MapGenerator::generate(int w, int h, bool allow_over_edge, unsigned seed) throw () {
+    randomState = seed;
     over_edge = allow_over_edge;
     room.clear();
     room.resize(w);
     for (vector<vector<SimpleRoom> >::iterator vi = room.begin(); vi != room.end(); vi++)
         *vi = vector<SimpleRoom>(h, true);
 
-    if (rand() % 4)
+    if (random(4))
         symmetry = rotational;
     else do
-        symmetry = Symmetry(rand() % 3 + 1);
+        symmetry = Symmetry(random(3) + 1);
     while (symmetry == vertical && h == 1 && w > 1 || symmetry == horizontal && w == 1 && h > 1);
 
-    int rx = rand() % width(), ry = rand() % height();
+    int rx = random(width()), ry = random(height());
     room[rx][ry].visited = true;
     int visited_rooms = 1;
     while (visited_rooms < width() * height()) {
@@ -67,15 +68,15 @@ void MapGenerator::generate(int w, int h, bool allow_over_edge) throw () {
               (!over_edge && rx == width() - 1 || room[(rx + 1) % width()][ry].visited)) {
             current_room.checked_through = true;
             while (1) {
-                rx = rand() % width();
-                ry = rand() % height();
+                rx = random(width());
+                ry = random(height());
                 if (room[rx][ry].visited && !room[rx][ry].checked_through)
                     break;
             }
             continue;
         }
         while (1) {
-            const int dir = rand() % 4;
+            const int dir = random(4);
             int dx = 0, dy = 0;
             switch (dir) {
             /*break;*/ case up:    dy = -1;
@@ -188,7 +189,7 @@ pair<int, int> MapGenerator::max_distance() throw () {
             ++di;
     nAssert(!distances.empty());
     //cout << "Maximum " << max_dist << '\n';
-    const Dist& selected = distances[rand() % distances.size()];
+    const Dist& selected = distances[random(distances.size())];
     //cout << "Selected " << selected.dist << '\n';
     return selected.coords;
 }
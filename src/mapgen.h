@@ -49,7 +49,8 @@ class MapGenerator {
     struct Dist { std::pair<int, int> coords; int dist; };
 
 public:
-    void generate(int w, int h, bool allow_over_edge = false) throw ();
+    /// The map depends only on the arguments, so that it can be generated in another thread than where seed is chosen.
+    void generate(int w, int h, bool allow_over_edge, unsigned seed) throw ();
     void draw(std::ostream& out) const throw ();
     void save_map(std::ostream& out, const std::string& title, const std::string& author) const throw ();
 
@@ -60,6 +61,11 @@ private:
     int distance(int sx, int sy, int gx, int gy) throw ();
     const std::pair<int, int>& find_best(const std::vector<std::vector<Node> >& node, const std::vector<std::pair<int, int> >& open) throw ();
 
+    int random(int n) throw () {   // 0 to n - 1
+        randomState = randomState * 1664525u + 1013904223u;
+        return (randomState >> 8) % n;
+    }
+
     int width() const throw () { return room.size(); }
     int height() const throw () { return room.front().size(); }
 
@@ -67,4 +73,5 @@ private:
     Symmetry symmetry;
     bool over_edge;
     int flags;
+    unsigned randomState;
 };
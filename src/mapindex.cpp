@@ -0,0 +1,238 @@
+/*
+ *  mapindex.cpp
+ *
+ *  Copyright (C) 2008 - Niko Ritari
+ *
+ *  This file is part of Outgun.
+ *
+ *  Outgun is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Outgun is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Outgun; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <fstream>
+#include <iterator>
+
+#include "binaryaccess.h"
+#include "commont.h"
+#include "function_utility.h"
+#include "platform.h"
+#include "thread.h"
+#include "world.h"
+
+#include "mapindex.h"
+
+using std::ifstream;
+using std::ios;
+using std::map;
+using std::ofstream;
+using std::string;
+using std::vector;
+
+static const string indexIdentification = "OUTGUNMAPINDEX";
+static const uint32_t indexVersion = 1;
+
+static const int maxScannerThreads = 4;
+static const unsigned mapsPerScannerThread = 8;  // fewer stale maps than this per thread aren't worth starting threads for
+
+/// Parses a list of maps with several threads.
+class MapIndex::Scanner : private NoCopying {
+public:
+    struct Job {
+        string name;
+        uint32_t mtime, size;
+        Entry result;
+    };
+
+    Scanner(vector<Job>& jobs_) throw () : jobs(jobs_), next(0), mutex("MapIndex::Scanner::mutex") { }
+
+    void run(int threadPriority) throw () {
+        const int nThreads = std::min<int>(maxScannerThreads, jobs.size() / mapsPerScannerThread);
+        Thread threads[maxScannerThreads];
+        for (int i = 0; i < nThreads; ++i)
+            threads[i].start_assert("MapIndex::Scanner::threadMain", RedirectToMemFun0<Scanner, void>(this, &Scanner::threadMain), threadPriority);
+        threadMain();   // help with the work rather than just wait
+        for (int i = 0; i < nThreads; ++i)
+            threads[i].join();
+    }
+
+private:
+    void threadMain() throw () {
+        LogSet noLog(0, 0, 0);  // the errors are reported by lookup() for the maps that are used
+        for (;;) {
+            Job* job;
+            {
+                Lock ml(mutex);
+                if (next == jobs.size())
+                    return;
+                job = &jobs[next++];
+            }
+            job->result = parse(noLog, job->name, job->mtime, job->size);
+        }
+    }
+
+    vector<Job>& jobs;
+    unsigned next;  // the first job not yet taken
+    Mutex mutex;
+};
+
+string MapIndex::mapFileName(const string& mapName) throw () {
+    return wheregamedir + SERVER_MAPS_DIR + directory_separator + mapName + ".txt";
+}
+
+string MapIndex::indexFileName() throw () {
+    return wheregamedir + "config" + directory_separator + "mapindex.bin";
+}
+
+MapIndex::Entry MapIndex::parse(LogSet& log, const string& mapName, uint32_t mtime, uint32_t size) throw () {
+    Entry e;
+    e.mtime = mtime;
+    e.size = size;
+    Map map;
+    if (map.load(log, SERVER_MAPS_DIR, mapName)) {
+        e.valid = true;
+        e.crc = map.crc;
+        e.width = map.w;
+        e.height = map.h;
+        e.title = map.title;
+        e.author = map.author;
+    }
+    return e;
+}
+
+void MapIndex::refresh(LogSet& log, int threadPriority) throw () {
+    Lock ml(mutex);
+    loadIndex();
+
+    vector<Scanner::Job> jobs;
+    map<string, Entry> current;
+    FileFinder* mapFiles = platMakeFileFinder(wheregamedir + SERVER_MAPS_DIR, ".txt", false);
+    while (mapFiles->hasNext()) {
+        const string mapName = FileName(mapFiles->next()).getBaseName();
+        Scanner::Job job;
+        if (!platFileStat(mapFileName(mapName), job.mtime, job.size))
+            continue;
+        const map<string, Entry>::const_iterator ei = entries.find(mapName);
+        if (ei != entries.end() && ei->second.mtime == job.mtime && ei->second.size == job.size)
+            current.insert(*ei);
+        else {
+            job.name = mapName;
+            jobs.push_back(job);
+        }
+    }
+    delete mapFiles;
+
+    // entries that lookup() has added for maps in subdirectories are kept as long as the files exist
+    for (map<string, Entry>::const_iterator ei = entries.begin(); ei != entries.end(); ++ei) {
+        uint32_t mtime, size;
+        if (!current.count(ei->first) && ei->first.find_first_of("/\\") != string::npos && platFileStat(mapFileName(ei->first), mtime, size))
+            current.insert(*ei);
+    }
+
+    if (!jobs.empty()) {
+        log("Indexing %u new or changed maps.", static_cast<unsigned>(jobs.size()));
+        Scanner(jobs).run(threadPriority);
+        for (vector<Scanner::Job>::const_iterator ji = jobs.begin(); ji != jobs.end(); ++ji)
+            current[ji->name] = ji->result;
+    }
+    if (!jobs.empty() || current.size() != entries.size())
+        changed = true;
+    entries.swap(current);
+    if (changed)
+        saveIndex();
+}
+
+bool MapIndex::lookup(LogSet& log, const string& mapName, Entry& entry) throw () {
+    uint32_t mtime, size;
+    if (!platFileStat(mapFileName(mapName), mtime, size)) {
+        log("Can't find mapfile '%s'!", mapFileName(mapName).c_str());
+        return false;
+    }
+    {
+        Lock ml(mutex);
+        loadIndex();
+        const map<string, Entry>::const_iterator ei = entries.find(mapName);
+        if (ei != entries.end() && ei->second.mtime == mtime && ei->second.size == size && ei->second.valid) {
+            entry = ei->second;
+            return true;
+        }
+    }
+    entry = parse(log, mapName, mtime, size);   // also to report the errors of a map known to be invalid
+    Lock ml(mutex);
+    entries[mapName] = entry;
+    changed = true;
+    return entry.valid;
+}
+
+void MapIndex::save() throw () {
+    Lock ml(mutex);
+    if (changed)
+        saveIndex();
+}
+
+void MapIndex::loadIndex() throw () {
+    if (loaded)
+        return;
+    loaded = true;
+    ifstream in(indexFileName().c_str(), ios::binary);
+    if (!in)
+        return;
+    const string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    BinaryDataBlockReader read(data.data(), data.length());
+    try {
+        if (read.constLengthStr(indexIdentification.length()) != indexIdentification || read.U32() != indexVersion)
+            return;
+        for (uint32_t n = read.U32(); n > 0; --n) {
+            const string name = read.str();
+            Entry e;
+            e.mtime = read.U32();
+            e.size = read.U32();
+            e.valid = read.U8() != 0;
+            if (e.valid) {
+                e.crc = read.U16();
+                e.width = read.U16();
+                e.height = read.U16();
+                e.title = read.str();
+                e.author = read.str();
+            }
+            entries[name] = e;
+        }
+    } catch (BinaryReader::ReadOutside&) {
+        entries.clear();    // a truncated index is rebuilt
+    }
+}
+
+void MapIndex::saveIndex() throw () {
+    ExpandingBinaryBuffer data;
+    data.constLengthStr(indexIdentification, indexIdentification.length());
+    data.U32(indexVersion);
+    data.U32(entries.size());
+    for (map<string, Entry>::const_iterator ei = entries.begin(); ei != entries.end(); ++ei) {
+        const Entry& e = ei->second;
+        data.str(ei->first);
+        data.U32(e.mtime);
+        data.U32(e.size);
+        data.U8(e.valid);
+        if (e.valid) {
+            data.U16(e.crc);
+            data.U16(e.width);
+            data.U16(e.height);
+            data.str(e.title);
+            data.str(e.author);
+        }
+    }
+    ofstream out(indexFileName().c_str(), ios::binary);
+    out << data;
+    changed = !out;
+}
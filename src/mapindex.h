@@ -0,0 +1,84 @@
+/*
+ *  mapindex.h
+ *
+ *  Copyright (C) 2008 - Niko Ritari
+ *
+ *  This file is part of Outgun.
+ *
+ *  Outgun is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Outgun is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Outgun; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef MAPINDEX_H_INC
+#define MAPINDEX_H_INC
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "mutex.h"
+#include "utility.h"
+
+/** Cache of the header fields of the server maps, so that building the map rotation doesn't require parsing every map.
+ * The index is kept in config/mapindex.bin. An entry is valid as long as the modification time and size of the map
+ * file match those recorded; otherwise the map is parsed again. Maps that fail to load are recorded too, and parsed
+ * again only when they're asked for, to report the errors.
+ */
+class MapIndex : private NoCopying {
+public:
+    struct Entry {
+        uint32_t mtime, size;   // of the map file when it was parsed
+        bool valid;             // the rest are only meaningful if the map could be loaded
+        uint16_t crc;
+        int width, height;
+        std::string title, author;
+
+        Entry() throw () : mtime(0), size(0), valid(false), crc(0), width(0), height(0) { }
+    };
+
+    MapIndex() throw () : mutex("MapIndex::mutex"), loaded(false), changed(false) { }   // inline so that the tools linking globals.o don't need mapindex.o
+
+    /** Bring the index up to date with the map directory, and save it if anything changed.
+     * New and changed maps are parsed by several threads with the given priority.
+     */
+    void refresh(LogSet& log, int threadPriority) throw ();
+
+    /** Get the header of mapName (relative to SERVER_MAPS_DIR, without the extension), parsing the map if the index
+     * isn't current on it. Returns false if the map can't be loaded; the reason is written to log.
+     */
+    bool lookup(LogSet& log, const std::string& mapName, Entry& entry) throw ();
+
+    /// Write the index file if lookup() has changed it since the last save.
+    void save() throw ();
+
+private:
+    class Scanner;
+
+    static std::string mapFileName(const std::string& mapName) throw ();
+    static std::string indexFileName() throw ();
+    static Entry parse(LogSet& log, const std::string& mapName, uint32_t mtime, uint32_t size) throw ();
+
+    void loadIndex() throw ();  // call with mutex locked
+    void saveIndex() throw ();  // call with mutex locked
+
+    Mutex mutex;
+    std::map<std::string, Entry> entries;
+    bool loaded;    // the index file has been read
+    bool changed;   // entries differ from the index file
+};
+
+extern MapIndex g_serverMapIndex;   // defined in globals.cpp
+
+#endif
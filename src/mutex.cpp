@@ -21,14 +21,20 @@
  *
  */
 
+#include <algorithm>
+
 #include "debug.h"
 #include "mutex.h"
+#include "platform.h"
+#include "timer.h"
 
 #if DEBUG_SYNCHRONIZATION == 0
 
 bool ConditionVariable::timedWait(Mutex& mutex, const struct timespec& abstime) throw () {
+    mutex.profile.holdEnds();
     const int val = pthread_cond_timedwait(&cond, &mutex.mutex, &abstime);
     nAssert(val == 0 || val == ETIMEDOUT);
+    mutex.profile.holdStarts();
     return val == ETIMEDOUT;
 }
 
@@ -38,7 +44,7 @@ Mutex::Mutex(LoggingDisabler) throw () : logging(false), locked(false), nWaiters
     nAssert(0 == pthread_mutex_init(&mutex, 0));
 }
 
-Mutex::Mutex(const char* identifier, bool logging_) throw () : logging(logging_), locked(false), nWaiters(0) {
+Mutex::Mutex(const char* identifier, bool logging_) throw () : logging(logging_), locked(false), nWaiters(0), profile(identifier) {
     Lock ml(g_threadLogMutex);
     nAssert(identifier);
     logId(identifier);
@@ -60,7 +66,10 @@ void Mutex::lock() throw () {
         nAssert(!locked || owner != pthread_self());
         ++nWaiters;
     }
-    nAssert(0 == pthread_mutex_lock(&mutex));
+    if (profile.active())
+        profile.lock(mutex);
+    else
+        nAssert(0 == pthread_mutex_lock(&mutex));
     {
         Lock ml(g_threadLogMutex);
         --nWaiters;
@@ -78,6 +87,7 @@ void Mutex::unlock() throw () {
         nAssert(locked && owner == pthread_self());
         locked = false;
     }
+    profile.unlocking();
     nAssert(0 == pthread_mutex_unlock(&mutex));
 }
 
@@ -121,14 +131,18 @@ ConditionVariable::~ConditionVariable() throw () {
 
 void ConditionVariable::wait(Mutex& mutex) throw () {
     debugPreWait(mutex);
+    mutex.profile.holdEnds();
     nAssert(0 == pthread_cond_wait(&cond, &mutex.mutex));
+    mutex.profile.holdStarts();
     debugPostWait(mutex);
 }
 
 bool ConditionVariable::timedWait(Mutex& mutex, const struct timespec& abstime) throw () {
     debugPreWait(mutex);
+    mutex.profile.holdEnds();
     const int val = pthread_cond_timedwait(&cond, &mutex.mutex, &abstime);
     nAssert(val == 0 || val == ETIMEDOUT);
+    mutex.profile.holdStarts();
     debugPostWait(mutex);
     return val == ETIMEDOUT;
 }
@@ -195,6 +209,195 @@ void ConditionVariable::logAction(char operation) throw () {
 
 #endif
 
+#ifdef LOCK_PROFILING
+
+/* The profiler keeps its own state with plain pthread primitives, because Mutexes are constructed during static
+ * initialization in any order. Everything here is POD and statically initialized for the same reason.
+ */
+
+namespace {
+
+const int maxProfileSites = 64;
+const int waitBuckets = 10; // bucket i counts waits shorter than 4^(i + 1) microseconds; the last one also longer waits
+
+struct SiteCounters {
+    uint32_t locks, waits;
+    uint32_t waitHistogram[waitBuckets];
+    double totalWait, maxWait, maxHold;
+
+    void add(const SiteCounters& o) throw () {
+        locks += o.locks;
+        waits += o.waits;
+        for (int i = 0; i < waitBuckets; ++i)
+            waitHistogram[i] += o.waitHistogram[i];
+        totalWait += o.totalWait;
+        maxWait = std::max(maxWait, o.maxWait);
+        maxHold = std::max(maxHold, o.maxHold);
+    }
+};
+
+struct ThreadCounters {
+    SiteCounters site[maxProfileSites];
+    ThreadCounters* next;
+};
+
+pthread_mutex_t profileMutex = PTHREAD_MUTEX_INITIALIZER;   // protects all of the below except the contents of live ThreadCounters
+const char* siteName[maxProfileSites];
+int nSites;
+ThreadCounters* liveThreads;    // counters of running threads; only the owner thread writes them
+ThreadCounters exitedThreads;   // sum of the counters of threads that have exited
+bool siteTableFull;
+
+pthread_once_t counterKeyOnce = PTHREAD_ONCE_INIT;
+pthread_key_t counterKey;
+
+void retireThreadCounters(void* data) throw () {
+    ThreadCounters* tc = static_cast<ThreadCounters*>(data);
+    nAssert(0 == pthread_mutex_lock(&profileMutex));
+    for (int s = 0; s < nSites; ++s)
+        exitedThreads.site[s].add(tc->site[s]);
+    for (ThreadCounters** pp = &liveThreads; *pp; pp = &(*pp)->next)
+        if (*pp == tc) {
+            *pp = tc->next;
+            break;
+        }
+    nAssert(0 == pthread_mutex_unlock(&profileMutex));
+    delete tc;
+}
+
+extern "C" void retireThreadCountersC(void* data) { retireThreadCounters(data); }
+
+void createCounterKey() throw () {
+    nAssert(0 == pthread_key_create(&counterKey, retireThreadCountersC));
+}
+
+extern "C" void createCounterKeyC() { createCounterKey(); }
+
+SiteCounters& threadSiteCounters(int site) throw () {
+    nAssert(0 == pthread_once(&counterKeyOnce, createCounterKeyC));
+    ThreadCounters* tc = static_cast<ThreadCounters*>(pthread_getspecific(counterKey));
+    if (!tc) {
+        tc = new ThreadCounters();  // value-initialized to zeros
+        nAssert(0 == pthread_mutex_lock(&profileMutex));
+        tc->next = liveThreads;
+        liveThreads = tc;
+        nAssert(0 == pthread_mutex_unlock(&profileMutex));
+        nAssert(0 == pthread_setspecific(counterKey, tc));
+    }
+    return tc->site[site];
+}
+
+std::string formatTime(double seconds) throw () {
+    char buf[32];
+    if (seconds < .001)
+        platSnprintf(buf, sizeof(buf), "%.0f us", seconds * 1e6);
+    else
+        platSnprintf(buf, sizeof(buf), "%.1f ms", seconds * 1e3);
+    return buf;
+}
+
+} // anonymous namespace
+
+LockProfileState::LockProfileState(const char* identifier) throw () : site(-1), timed(false) {
+    nAssert(0 == pthread_mutex_lock(&profileMutex));
+    for (int s = 0; s < nSites; ++s)
+        if (!strcmp(siteName[s], identifier)) {
+            site = s;
+            break;
+        }
+    if (site == -1) {
+        if (nSites < maxProfileSites) {
+            site = nSites++;
+            siteName[site] = identifier;
+        }
+        else
+            siteTableFull = true;
+    }
+    nAssert(0 == pthread_mutex_unlock(&profileMutex));
+}
+
+void LockProfileState::lock(pthread_mutex_t& mutex) throw () {
+    SiteCounters& c = threadSiteCounters(site);
+    ++c.locks;
+    const int val = pthread_mutex_trylock(&mutex);
+    if (val == EBUSY) {
+        const double start = g_systemTimer->read();
+        nAssert(0 == pthread_mutex_lock(&mutex));
+        holdStart = g_systemTimer->read();
+        const double wait = holdStart - start;
+        ++c.waits;
+        c.totalWait += wait;
+        c.maxWait = std::max(c.maxWait, wait);
+        int bucket = 0;
+        for (double limit = 4e-6; bucket < waitBuckets - 1 && wait >= limit; limit *= 4)
+            ++bucket;
+        ++c.waitHistogram[bucket];
+    }
+    else {
+        nAssert(val == 0);
+        holdStart = g_systemTimer->read();
+    }
+    timed = true;
+}
+
+void LockProfileState::startHold() throw () {
+    if (g_systemTimer)  // a lock timed before the profiling ended may be held until after platUninit
+        holdStart = g_systemTimer->read();
+}
+
+void LockProfileState::endHold() throw () {
+    if (!g_systemTimer)
+        return;
+    SiteCounters& c = threadSiteCounters(site);
+    c.maxHold = std::max(c.maxHold, g_systemTimer->read() - holdStart);
+}
+
+void lockProfileReport(std::vector<std::string>& lines) throw () {
+    if (!g_lockProfiling) {
+        lines.push_back("Lock profiling is disabled; start with -lockprofile to enable it.");
+        return;
+    }
+    // the counters of running threads are read without synchronization, so the figures may be slightly inconsistent
+    std::vector<SiteCounters> total;
+    std::vector<std::pair<double, int> > order;
+    nAssert(0 == pthread_mutex_lock(&profileMutex));
+    total.assign(exitedThreads.site, exitedThreads.site + nSites);
+    for (const ThreadCounters* tc = liveThreads; tc; tc = tc->next)
+        for (int s = 0; s < nSites; ++s)
+            total[s].add(tc->site[s]);
+    std::vector<std::string> names(siteName, siteName + nSites);
+    const bool incomplete = siteTableFull;
+    nAssert(0 == pthread_mutex_unlock(&profileMutex));
+
+    for (int s = 0; s < static_cast<int>(total.size()); ++s)
+        if (total[s].locks)
+            order.push_back(std::make_pair(-total[s].totalWait, s));
+    std::sort(order.begin(), order.end());  // most total wait first
+
+    lines.push_back("Lock profile: locks, waits, total wait, max wait, max hold; waits < 4 us, 16 us, 64 us, 256 us, 1 ms, 4 ms, 16 ms, 66 ms, 262 ms, longer");
+    for (std::vector<std::pair<double, int> >::const_iterator oi = order.begin(); oi != order.end(); ++oi) {
+        const SiteCounters& c = total[oi->second];
+        char buf[32];
+        platSnprintf(buf, sizeof(buf), "%u, %u, ", c.locks, c.waits);
+        std::string line = names[oi->second] + ": " + buf + formatTime(c.totalWait) + ", " + formatTime(c.maxWait) + ", " + formatTime(c.maxHold) + ";";
+        for (int i = 0; i < waitBuckets; ++i) {
+            platSnprintf(buf, sizeof(buf), " %u", c.waitHistogram[i]);
+            line += buf;
+        }
+        lines.push_back(line);
+    }
+    if (incomplete)
+        lines.push_back("Some Mutexes aren't profiled: increase maxProfileSites in mutex.cpp.");
+}
+
+#else
+
+void lockProfileReport(std::vector<std::string>& lines) throw () {
+    lines.push_back("Lock profiling is not compiled in (LOCK_PROFILING in debugconfig.h).");
+}
+
+#endif // LOCK_PROFILING
+
 #ifdef EXTRA_DEBUG
 
 void AssertMutex::lock() throw () {
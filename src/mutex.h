@@ -25,8 +25,10 @@
 #define MUTEX_H_INC
 
 #include <errno.h>
+#include <string>
+#include <vector>
 #include "incpthread.h"
-#include "debugconfig.h" // for DEBUG_SYNCHRONIZATION
+#include "debugconfig.h" // for DEBUG_SYNCHRONIZATION and LOCK_PROFILING
 #include "utility.h"
 #include "nassert.h"
 
@@ -48,9 +50,78 @@ public:
     void unlock() throw () { nAssert(0 == pthread_mutex_unlock(&mutex)); }
 };
 
+#ifdef LOCK_PROFILING
+
+/** Lock contention profiler.
+ * Named Mutexes are grouped into profiling sites by their identifier, so that e.g. the station mutexes of all
+ * clients show up as one site. While g_lockProfiling is set, every lock of a site counts an acquisition, and if
+ * the Mutex was already locked, the time spent waiting for it is added to a histogram. The longest time the
+ * Mutex is held is recorded too; time spent waiting on a ConditionVariable doesn't count as holding.
+ * The counters are kept per thread so that profiling doesn't add contention of its own.
+ */
+class LockProfileState {
+public:
+    LockProfileState() throw () : site(-1), timed(false) { }
+    LockProfileState(const char* identifier) throw ();
+
+    bool active() const throw () { return site >= 0 && g_lockProfiling; }
+    void lock(pthread_mutex_t& mutex) throw (); // lock the mutex, timing it; only when active()
+    void unlocking() throw () { if (timed) { endHold(); timed = false; } }
+    // around ConditionVariable waits
+    void holdEnds() throw () { if (timed) endHold(); }
+    void holdStarts() throw () { if (timed) startHold(); }
+
+private:
+    int site;           // -1 if not profiled
+    bool timed;         // the current lock was timed; access only while locked
+    double holdStart;   // if timed
+
+    void startHold() throw ();
+    void endHold() throw ();
+};
+
+#else
+
+class LockProfileState {
+public:
+    LockProfileState() throw () { }
+    LockProfileState(const char*) throw () { }
+
+    bool active() const throw () { return false; }
+    void lock(pthread_mutex_t&) throw () { }
+    void unlocking() throw () { }
+    void holdEnds() throw () { }
+    void holdStarts() throw () { }
+};
+
+#endif // LOCK_PROFILING
+
+/// Append a human readable summary of the lock profile to lines, one line per entry.
+void lockProfileReport(std::vector<std::string>& lines) throw ();
+
 #if DEBUG_SYNCHRONIZATION == 0
 
-typedef BareMutex Mutex;
+class Mutex : private NoCopying, public Lockable {
+public:
+    enum LoggingDisabler { NoLogging };
+    Mutex(LoggingDisabler) throw ()                                          { nAssert(0 == pthread_mutex_init(&mutex, 0)); }
+    Mutex(const char* identifier, bool = true) throw () : profile(identifier) { nAssert(0 == pthread_mutex_init(&mutex, 0)); nAssert(identifier); }
+    ~Mutex() throw () { nAssert(0 == pthread_mutex_destroy(&mutex)); }
+
+    void lock() throw () {
+        if (profile.active())
+            profile.lock(mutex);
+        else
+            nAssert(0 == pthread_mutex_lock(&mutex));
+    }
+    void unlock() throw () { profile.unlocking(); nAssert(0 == pthread_mutex_unlock(&mutex)); }
+
+private:
+    pthread_mutex_t mutex;
+    LockProfileState profile;
+
+    friend class ConditionVariable;
+};
 
 #elif DEBUG_SYNCHRONIZATION == 1
 
@@ -72,6 +143,7 @@ private:
     bool locked;
     pthread_t owner; // only if locked
     int nWaiters;
+    LockProfileState profile;
 
     void logId(const char* identifier) throw ();
     void logAction(char operation) throw ();
@@ -123,7 +195,7 @@ public:
     ConditionVariable(const char* identifier, bool = true) throw () { nAssert(0 == pthread_cond_init(&cond, 0)); nAssert(identifier); }
     ~ConditionVariable() throw () { nAssert(0 == pthread_cond_destroy(&cond)); }
 
-    void wait(Mutex& mutex) throw () { nAssert(0 == pthread_cond_wait(&cond, &mutex.mutex)); }
+    void wait(Mutex& mutex) throw () { mutex.profile.holdEnds(); nAssert(0 == pthread_cond_wait(&cond, &mutex.mutex)); mutex.profile.holdStarts(); }
     bool timedWait(Mutex& mutex, const struct timespec& abstime) throw ();
 
     void signal   () throw () { nAssert(0 == pthread_cond_signal   (&cond)); }
@@ -192,4 +264,65 @@ public:
     const ObjT& access() const throw () { return obj; }  // use obj only between lock() and unlock()
 };
 
+/** Holder of the latest published version of an immutable object.
+ * The writer replaces the object as a whole with publish(); readers take a Reader, which keeps the version that
+ * was current at its creation alive until the Reader is destroyed. The mutex is held only to copy a pointer and
+ * adjust a reference count, so neither side waits for the other to finish using its copy.
+ */
+template<class ObjT> class Published : private NoCopying {
+    struct Version {
+        ObjT obj;
+        int refs;
+        Version(const ObjT& o) throw () : obj(o), refs(1) { }
+    };
+
+    mutable Mutex mutex;
+    Version* current;   // 0 until the first publish()
+
+    void release(Version* v) const throw () {
+        if (!v)
+            return;
+        bool last;
+        {
+            Lock ml(mutex);
+            last = --v->refs == 0;
+        }
+        if (last)
+            delete v;
+    }
+
+public:
+    class Reader : private NoCopying {
+        const Published& source;
+        Version* version;
+
+    public:
+        Reader(const Published& src) throw () : source(src) {
+            Lock ml(source.mutex);
+            version = source.current;
+            if (version)
+                ++version->refs;
+        }
+        ~Reader() throw () { source.release(version); }
+
+        bool valid() const throw () { return version != 0; }  // false if nothing has been published yet
+        const ObjT& operator*() const throw () { nAssert(version); return version->obj; }
+        const ObjT* operator->() const throw () { nAssert(version); return &version->obj; }
+    };
+
+    Published(const char* identifier) throw () : mutex(identifier), current(0) { }
+    ~Published() throw () { release(current); }   // there must be no Readers left
+
+    void publish(const ObjT& obj) throw () {
+        Version* const v = new Version(obj);
+        Version* old;
+        {
+            Lock ml(mutex);
+            old = current;
+            current = v;
+        }
+        release(old);
+    }
+};
+
 #endif
@@ -0,0 +1,93 @@
+/*
+ *  phasetimer.cpp
+ *
+ *  Copyright (C) 2008 - Niko Ritari
+ *
+ *  This file is part of Outgun.
+ *
+ *  Outgun is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Outgun is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Outgun; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+
+#include <algorithm>
+
+#include "nassert.h"
+#include "timer.h"
+
+#include "phasetimer.h"
+
+using std::string;
+using std::vector;
+
+PhaseTimer::PhaseTimer(const vector<string>& phaseNames) throw () :
+    names(phaseNames),
+    phaseTimes(phaseNames.size()),
+    current(phaseNames.size(), 0.),
+    currentPhase(-1),
+    phaseStart(0),
+    frameStart(0)
+{ }
+
+void PhaseTimer::startFrame(int firstPhase) throw () {
+    numAssert(firstPhase >= 0 && firstPhase < (int)names.size(), firstPhase);
+    std::fill(current.begin(), current.end(), 0.);
+    frameStart = phaseStart = g_systemTimer->read();
+    currentPhase = firstPhase;
+}
+
+void PhaseTimer::phase(int p) throw () {
+    numAssert(p >= 0 && p < (int)names.size(), p);
+    if (currentPhase != -1)
+        switchPhase(p);
+}
+
+void PhaseTimer::endFrame() throw () {
+    nAssert(currentPhase != -1);
+    switchPhase(-1);
+    frameTimes.push_back(phaseStart - frameStart);
+    for (unsigned i = 0; i < names.size(); ++i)
+        phaseTimes[i].push_back(current[i]);
+}
+
+void PhaseTimer::switchPhase(int p) throw () {
+    const double now = g_systemTimer->read();
+    current[currentPhase] += now - phaseStart;
+    phaseStart = now;
+    currentPhase = p;
+}
+
+static double percentile(const vector<double>& sorted, double fraction) throw () {   // nearest rank
+    if (sorted.empty())
+        return 0;
+    const unsigned rank = static_cast<unsigned>(fraction * (sorted.size() - 1) + .5);
+    return sorted[rank];
+}
+
+static void reportLine(LogSet& log, const string& name, vector<double> times) throw () {
+    std::sort(times.begin(), times.end());
+    double total = 0;
+    for (vector<double>::const_iterator ti = times.begin(); ti != times.end(); ++ti)
+        total += *ti;
+    log("%-12s mean %7.3f  p50 %7.3f  p90 %7.3f  p99 %7.3f  max %7.3f", name.c_str(), times.empty() ? 0. : total * 1000 / times.size(),
+        percentile(times, .5) * 1000, percentile(times, .9) * 1000, percentile(times, .99) * 1000, times.empty() ? 0. : times.back() * 1000);
+}
+
+void PhaseTimer::report(LogSet& log) const throw () {
+    log("%u frames, times in ms:", static_cast<unsigned>(frameTimes.size()));
+    reportLine(log, "frame", frameTimes);
+    for (unsigned i = 0; i < names.size(); ++i)
+        reportLine(log, names[i], phaseTimes[i]);
+}
@@ -0,0 +1,58 @@
+/*
+ *  phasetimer.h
+ *
+ *  Copyright (C) 2008 - Niko Ritari
+ *
+ *  This file is part of Outgun.
+ *
+ *  Outgun is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Outgun is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Outgun; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+
+#ifndef PHASETIMER_H_INC
+#define PHASETIMER_H_INC
+
+#include <string>
+#include <vector>
+
+#include "utility.h"
+
+/** Measures how the time of repeated frames is divided between phases, and reports percentiles of the frame and
+ * phase times. Time spent in the same phase several times during a frame is added up.
+ */
+class PhaseTimer : private NoCopying {
+public:
+    PhaseTimer(const std::vector<std::string>& phaseNames) throw ();
+
+    void startFrame(int firstPhase) throw ();
+    void phase(int p) throw ();     // ends the current phase and starts p; ignored outside a frame
+    void endFrame() throw ();
+
+    unsigned frames() const throw () { return frameTimes.size(); }
+    void report(LogSet& log) const throw ();    // frame and phase time percentiles in milliseconds
+
+private:
+    void switchPhase(int p) throw ();
+
+    std::vector<std::string> names;
+    std::vector< std::vector<double> > phaseTimes;  // [phase][frame]
+    std::vector<double> frameTimes;
+    std::vector<double> current;    // of each phase in the current frame
+    int currentPhase;               // -1 outside a frame
+    double phaseStart, frameStart;
+};
+
+#endif
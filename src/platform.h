@@ -61,6 +61,23 @@ int platMkdir(const std::string& path) throw ();
 
 bool platIsFile(const std::string& name) throw (); // returns true if name exists and is not a directory
 bool platIsDirectory(const std::string& name) throw ();
+bool platFileStat(const std::string& name, uint32_t& mtime, uint32_t& size) throw (); // returns false if name doesn't exist
+
+/// A file mapped into memory; the mapping is released when the object is destroyed.
+class MappedFile {
+public:
+    virtual ~MappedFile() throw () { }
+    virtual DataBlockRef data() throw () = 0;           // only write to the data if the mapping is writable
+    virtual ConstDataBlockRef data() const throw () = 0;
+};
+
+/** Map a file into memory.
+ * @param name      the file to map
+ * @param size      the number of bytes to map; 0 maps the whole file (only when not writable)
+ * @param writable  if true, the file is created if necessary and resized to size, and changes to the data are written to the file
+ * @return          a null pointer if the file couldn't be mapped
+ */
+ControlledPtr<MappedFile> platMapFile(const std::string& name, unsigned size, bool writable) throw ();
 
 void platInit() throw (); // perform platform specific initializations; called very early in the program
 void platInitAfterAllegro() throw (); // second stage initializations, when Allegro is running (or won't be at all)
@@ -27,6 +27,8 @@
 #include <cstring>
 
 #include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
@@ -146,6 +148,50 @@ bool platIsDirectory(const string& name) throw () {
     return S_ISDIR(s.st_mode);
 }
 
+bool platFileStat(const string& name, uint32_t& mtime, uint32_t& size) throw () {
+    struct stat s;
+    if (stat(name.c_str(), &s) != 0)
+        return false;
+    mtime = static_cast<uint32_t>(s.st_mtime);
+    size = static_cast<uint32_t>(s.st_size);
+    return true;
+}
+
+class LinuxMappedFile : public MappedFile, private NoCopying {
+    void* ptr;
+    unsigned sz;
+
+public:
+    LinuxMappedFile(void* ptr_, unsigned size) throw () : ptr(ptr_), sz(size) { }
+    ~LinuxMappedFile() throw () { munmap(ptr, sz); }
+
+    DataBlockRef data() throw () { return DataBlockRef(ptr, sz); }
+    ConstDataBlockRef data() const throw () { return ConstDataBlockRef(ptr, sz); }
+};
+
+ControlledPtr<MappedFile> platMapFile(const string& name, unsigned size, bool writable) throw () {
+    nAssert(size != 0 || !writable);
+    const int fd = open(name.c_str(), writable ? O_RDWR | O_CREAT : O_RDONLY, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd == -1)
+        return give_control<MappedFile>(0);
+    bool ok = true;
+    if (writable)
+        ok = ftruncate(fd, size) == 0;
+    else if (size == 0) {
+        struct stat s;
+        ok = fstat(fd, &s) == 0 && s.st_size > 0;
+        if (ok)
+            size = s.st_size;
+    }
+    void* ptr = MAP_FAILED;
+    if (ok)
+        ptr = mmap(0, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // the mapping stays valid without the descriptor
+    if (ptr == MAP_FAILED)
+        return give_control<MappedFile>(0);
+    return give_control<MappedFile>(new LinuxMappedFile(ptr, size));
+}
+
 void platInit() throw () {
     directory_separator = '/';
     g_systemTimer = new LinuxTimer();
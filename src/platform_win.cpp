@@ -26,6 +26,7 @@
 
 #include <direct.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 
 #include "commont.h"
 #include "platform.h"
@@ -156,6 +157,49 @@ int platMkdir(const string& path) throw () {
 }
 #endif // DEDICATED_SERVER_ONLY
 
+bool platFileStat(const string& name, uint32_t& mtime, uint32_t& size) throw () {
+    struct stat s;
+    if (stat(name.c_str(), &s) != 0)
+        return false;
+    mtime = static_cast<uint32_t>(s.st_mtime);
+    size = static_cast<uint32_t>(s.st_size);
+    return true;
+}
+
+class WindowsMappedFile : public MappedFile, private NoCopying {
+    HANDLE mapping;
+    void* ptr;
+    unsigned sz;
+
+public:
+    WindowsMappedFile(HANDLE mapping_, void* ptr_, unsigned size) throw () : mapping(mapping_), ptr(ptr_), sz(size) { }
+    ~WindowsMappedFile() throw () { UnmapViewOfFile(ptr); CloseHandle(mapping); }
+
+    DataBlockRef data() throw () { return DataBlockRef(ptr, sz); }
+    ConstDataBlockRef data() const throw () { return ConstDataBlockRef(ptr, sz); }
+};
+
+ControlledPtr<MappedFile> platMapFile(const string& name, unsigned size, bool writable) throw () {
+    nAssert(size != 0 || !writable);
+    const HANDLE file = CreateFile(name.c_str(), writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ, NULL,
+                                   writable ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return give_control<MappedFile>(0);
+    if (size == 0)
+        size = GetFileSize(file, NULL);
+    // with a writable mapping, CreateFileMapping extends the file if needed; shrinking is not needed for our purposes
+    const HANDLE mapping = size == 0 || size == INVALID_FILE_SIZE ? NULL : CreateFileMapping(file, NULL, writable ? PAGE_READWRITE : PAGE_READONLY, 0, size, NULL);
+    CloseHandle(file); // the mapping keeps the file open
+    if (mapping == NULL)
+        return give_control<MappedFile>(0);
+    void* ptr = MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size);
+    if (!ptr) {
+        CloseHandle(mapping);
+        return give_control<MappedFile>(0);
+    }
+    return give_control<MappedFile>(new WindowsMappedFile(mapping, ptr, size));
+}
+
 static UINT g_timerResolution;
 
 void platInit() throw () {
@@ -31,10 +31,15 @@
 
 extern const std::string GAME_STRING;
 extern const std::string GAME_PROTOCOL;
-static const int PROTOCOL_EXTENSIONS_VERSION = 0;
+static const int PROTOCOL_EXTENSIONS_VERSION = 2;
 
 extern const std::string REPLAY_IDENTIFICATION;
-static const unsigned REPLAY_VERSION = 0; // increase when the replay structure changes
+static const unsigned REPLAY_VERSION = 2; // increase when the replay structure changes
+static const unsigned REPLAY_ENCODING_VERSION = 2; // first version with the stream encoding (Replay_encoding) after the map name in the header
+static const unsigned REPLAY_STREAM_VERSION = 0; // relayed streams have no keyframes or index, so they are readable by version 0 clients
+static const unsigned REPLAY_KEYFRAME_INTERVAL = 300; // frames between full state keyframes in replay files
+static const unsigned REPLAY_KEYFRAME_FLAG = 0x80000000; // set in the length field of keyframe records in replay files
+static const unsigned REPLAY_INDEX_MARKER = 0x58444E49; // last U32 of a replay file that ends in a keyframe index
 static const unsigned RELAY_PROTOCOL = 0;
 static const unsigned RELAY_PROTOCOL_EXTENSIONS_VERSION = 0;
 
@@ -126,6 +131,8 @@ enum Network_data_code {
     data_extension_advantage,
     data_waiting_time,
     data_flag_modes,
+    // available from negotiated extensions level 2:
+    data_frame_baseline_missing,    // client to server: a delta coded frame referred to a baseline frame the client doesn't have
     data_negotiated_third_party_extensions_first = 200 // from here on, codes are guaranteed to not be used by official versions present or future, and can be used after successful negotiation with data_negotiate_third_party_extensions
 };
 
@@ -145,9 +152,16 @@ enum Connect_rejection_reason {
     reject_last = reject_wrong_server_password
 };
 
+enum Replay_encoding {
+    replay_encoding_raw,
+    replay_encoding_deflate,    // each record's data is a flushed piece of a deflate stream (see Compressor); keyframes are compressed separately
+    replay_encoding_last = replay_encoding_deflate
+};
+
 enum Relay_data_code {
     relay_data_frame,
-    relay_data_game_start
+    relay_data_game_start,
+    relay_data_position     // from relay to relay: session and archive frame number of the following frame
 };
 
 #endif
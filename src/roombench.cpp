@@ -0,0 +1,74 @@
+/*
+ *  roombench.cpp
+ *
+ *  Copyright (C) 2008 - Niko Ritari
+ *
+ *  This file is part of Outgun.
+ *
+ *  Outgun is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Outgun is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Outgun; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+
+#include "commont.h"
+#include "graphics.h"
+#include "language.h"
+#include "platform.h"
+#include "world.h"
+
+#include "roombench.h"
+
+using std::string;
+
+static const int benchWidth = 640, benchHeight = 480;   // a typical room size on screen
+static const int benchThreads = 4;
+
+bool RoomBench::run(const string& theme) throw () {
+    set_color_depth(16);
+    Graphics graphics(log);
+    graphics.setColors();
+    if (!theme.empty())
+        graphics.select_theme(theme, _("<no background>"), false, string() + '<' + _("default") + '>', false);
+
+    log("Room rendering benchmark: %d%d rooms, %d threads.", benchWidth, benchHeight, benchThreads);
+    bool same = true;
+    int totalRooms = 0;
+    double totalSerial = 0, totalBanded = 0;
+    FileFinder* mapFiles = platMakeFileFinder(wheregamedir + SERVER_MAPS_DIR, ".txt", false);
+    while (mapFiles->hasNext()) {
+        const string name = FileName(mapFiles->next()).getBaseName();
+        Map map;
+        if (!map.load(log, SERVER_MAPS_DIR, name)) {
+            log.error(_("Room rendering benchmark: Map '$1' is not a valid map file.", name));
+            continue;
+        }
+        double serial = 0, banded = 0;
+        if (!graphics.benchmark_room_rendering(map, benchWidth, benchHeight, benchThreads, serial, banded)) {
+            log.error(_("Room rendering benchmark: The rooms of map '$1' are drawn differently in bands.", name));
+            same = false;
+        }
+        const int rooms = map.w * map.h;
+        log("%-24s %3d rooms  %7.2f ms/room serial  %7.2f ms/room banded  %5.2f", name.c_str(), rooms,
+            serial * 1000 / rooms, banded * 1000 / rooms, banded > 0 ? serial / banded : 0.);
+        totalRooms += rooms;
+        totalSerial += serial;
+        totalBanded += banded;
+    }
+    delete mapFiles;
+    if (totalRooms)
+        log("Room rendering benchmark: %d rooms, %.2f ms/room serial, %.2f ms/room banded.", totalRooms,
+            totalSerial * 1000 / totalRooms, totalBanded * 1000 / totalRooms);
+    return same;
+}
@@ -0,0 +1,46 @@
+/*
+ *  roombench.h
+ *
+ *  Copyright (C) 2008 - Niko Ritari
+ *
+ *  This file is part of Outgun.
+ *
+ *  Outgun is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Outgun is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Outgun; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+
+#ifndef ROOMBENCH_H_INC
+#define ROOMBENCH_H_INC
+
+#include <string>
+
+#include "utility.h"
+
+/** Benchmark of the antialiased room rendering: draws every room of the server maps with one thread and in parallel
+ * row bands, logging the time per room and checking that the results are identical.
+ */
+class RoomBench {
+public:
+    RoomBench(LogSet logs) throw () : log(logs) { }
+
+    /// Returns false if the banded rendering of any room differed from the single-threaded one.
+    bool run(const std::string& theme) throw ();   // theme is a directory in graphics, or empty for none
+
+private:
+    mutable LogSet log;
+};
+
+#endif // ROOMBENCH_H_INC
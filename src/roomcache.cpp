@@ -0,0 +1,213 @@
+/*
+ *  roomcache.cpp
+ *
+ *  Copyright (C) 2008 - Niko Ritari
+ *
+ *  This file is part of Outgun.
+ *
+ *  Outgun is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Outgun is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Outgun; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+
+#include "binaryaccess.h"
+#include "commont.h"
+#include "platform.h"
+
+#include "roomcache.h"
+
+using std::ifstream;
+using std::ios;
+using std::map;
+using std::ofstream;
+using std::string;
+
+static const string roomIdentification = "OUTGUNROOM";
+static const string indexIdentification = "OUTGUNROOMINDEX";
+static const uint32_t fileVersion = 1;
+static const unsigned roomHeaderSize = 10 + 4 + 8 + 2 + 2 + 1;  // identification, version, key, width, height, depth
+
+static unsigned bytesPerPixel(BITMAP* b) throw () {
+    return (bitmap_color_depth(b) + 7) / 8;
+}
+
+RoomKeyHasher& RoomKeyHasher::add(BITMAP* b) throw () {
+    if (!b)
+        return add(uint32_t(0));
+    nAssert(is_memory_bitmap(b));
+    add(b->w).add(b->h).add(bitmap_color_depth(b));
+    for (int y = 0; y < b->h; ++y)
+        add(b->line[y], b->w * bytesPerPixel(b));
+    return *this;
+}
+
+RoomDiskCache::~RoomDiskCache() throw () {
+    Lock ml(mutex);
+    if (changed)
+        saveIndex();
+}
+
+string RoomDiskCache::fileName(uint64_t key) const throw () {
+    char name[17];
+    platSnprintf(name, sizeof(name), "%08X%08X", static_cast<unsigned>(key >> 32), static_cast<unsigned>(key));
+    return dir + directory_separator + name + ".room";
+}
+
+string RoomDiskCache::indexFileName() const throw () {
+    return dir + directory_separator + "index.bin";
+}
+
+bool RoomDiskCache::load(uint64_t key, BITMAP* target) throw () {
+    nAssert(is_memory_bitmap(target));
+    Lock ml(mutex);
+    scan();
+    const map<uint64_t, Entry>::iterator ei = entries.find(key);
+    if (ei == entries.end())
+        return false;
+
+    const unsigned rowBytes = target->w * bytesPerPixel(target);
+    ifstream in(fileName(key).c_str(), ios::binary);
+    char header[roomHeaderSize];
+    bool ok = in.read(header, roomHeaderSize) && ei->second.size == roomHeaderSize + target->h * rowBytes;
+    if (ok) {
+        BinaryDataBlockReader read(header, roomHeaderSize);
+        ok = read.constLengthStr(roomIdentification.length()) == roomIdentification && read.U32() == fileVersion && read.U64() == key &&
+             read.U16() == target->w && read.U16() == target->h && read.U8() == bitmap_color_depth(target);
+    }
+    for (int y = 0; ok && y < target->h; ++y)
+        ok = in.read(reinterpret_cast<char*>(target->line[y]), rowBytes);
+    in.close();
+
+    if (!ok) {  // a different size or depth with the same key is unlikely, so rather the file is damaged
+        remove(fileName(key).c_str());
+        totalBytes -= ei->second.size;
+        entries.erase(ei);
+        changed = true;
+        return false;
+    }
+    ei->second.lastUse = ++clock;
+    changed = true;
+    return true;
+}
+
+void RoomDiskCache::store(uint64_t key, BITMAP* source) throw () {
+    nAssert(is_memory_bitmap(source));
+    Lock ml(mutex);
+    scan();
+    const unsigned rowBytes = source->w * bytesPerPixel(source);
+    BinaryBuffer<roomHeaderSize> header;
+    header.constLengthStr(roomIdentification, roomIdentification.length());
+    header.U32(fileVersion);
+    header.U64(key);
+    header.U16(source->w);
+    header.U16(source->h);
+    header.U8(bitmap_color_depth(source));
+    ofstream out(fileName(key).c_str(), ios::binary);
+    out << header;
+    for (int y = 0; y < source->h; ++y)
+        out.write(reinterpret_cast<const char*>(source->line[y]), rowBytes);
+    out.close();
+    if (!out) {
+        remove(fileName(key).c_str());
+        return;
+    }
+    Entry& e = entries[key];
+    totalBytes += roomHeaderSize + source->h * rowBytes - e.size;
+    e.size = roomHeaderSize + source->h * rowBytes;
+    e.lastUse = ++clock;
+    changed = true;
+    evict();
+}
+
+void RoomDiskCache::scan() throw () {
+    if (scanned)
+        return;
+    scanned = true;
+
+    map<uint64_t, uint32_t> lastUse;
+    ifstream in(indexFileName().c_str(), ios::binary);
+    if (in) {
+        const string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        BinaryDataBlockReader read(data.data(), data.length());
+        try {
+            if (read.constLengthStr(indexIdentification.length()) == indexIdentification && read.U32() == fileVersion) {
+                clock = read.U32();
+                for (uint32_t n = read.U32(); n > 0; --n) {
+                    const uint64_t key = read.U64();
+                    lastUse[key] = read.U32();
+                }
+            }
+        } catch (BinaryReader::ReadOutside&) {
+            lastUse.clear();    // those not found are simply the first to go
+        }
+    }
+
+    FileFinder* files = platMakeFileFinder(dir, ".room", false);
+    while (files->hasNext()) {
+        const string name = FileName(files->next()).getBaseName();
+        uint64_t key = 0;
+        if (name.length() != 16 || name.find_first_not_of("0123456789ABCDEF") != string::npos)
+            continue;
+        for (string::const_iterator ci = name.begin(); ci != name.end(); ++ci)
+            key = key << 4 | (*ci <= '9' ? *ci - '0' : *ci - 'A' + 10);
+        Entry e;
+        uint32_t mtime;
+        if (!platFileStat(fileName(key), mtime, e.size))
+            continue;
+        const map<uint64_t, uint32_t>::const_iterator li = lastUse.find(key);
+        if (li != lastUse.end())
+            e.lastUse = li->second;
+        else
+            changed = true;
+        entries[key] = e;
+        totalBytes += e.size;
+    }
+    delete files;
+    if (entries.size() != lastUse.size())
+        changed = true;
+    evict();
+}
+
+void RoomDiskCache::evict() throw () {
+    while (totalBytes > sizeLimit && !entries.empty()) {
+        map<uint64_t, Entry>::iterator oldest = entries.begin();
+        for (map<uint64_t, Entry>::iterator ei = entries.begin(); ei != entries.end(); ++ei)
+            if (ei->second.lastUse < oldest->second.lastUse)
+                oldest = ei;
+        remove(fileName(oldest->first).c_str());
+        totalBytes -= oldest->second.size;
+        entries.erase(oldest);
+        changed = true;
+    }
+}
+
+void RoomDiskCache::saveIndex() throw () {
+    ExpandingBinaryBuffer data;
+    data.constLengthStr(indexIdentification, indexIdentification.length());
+    data.U32(fileVersion);
+    data.U32(clock);
+    data.U32(entries.size());
+    for (map<uint64_t, Entry>::const_iterator ei = entries.begin(); ei != entries.end(); ++ei) {
+        data.U64(ei->first);
+        data.U32(ei->second.lastUse);
+    }
+    ofstream out(indexFileName().c_str(), ios::binary);
+    out << data;
+    changed = !out;
+}
@@ -0,0 +1,96 @@
+/*
+ *  roomcache.h
+ *
+ *  Copyright (C) 2008 - Niko Ritari
+ *
+ *  This file is part of Outgun.
+ *
+ *  Outgun is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Outgun is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Outgun; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+
+#ifndef ROOMCACHE_H_INC
+#define ROOMCACHE_H_INC
+
+#include <map>
+#include <string>
+
+#include "incalleg.h"
+#include "mutex.h"
+#include "utility.h"
+
+/// 64-bit FNV-1a hash, for building the keys of RoomDiskCache.
+class RoomKeyHasher {
+public:
+    RoomKeyHasher() throw () : h(0xCBF29CE484222325ull) { }
+
+    RoomKeyHasher& add(const void* data, unsigned size) throw () {
+        for (const uint8_t* p = static_cast<const uint8_t*>(data); size; --size, ++p)
+            h = (h ^ *p) * 0x100000001B3ull;
+        return *this;
+    }
+    RoomKeyHasher& add(uint32_t value) throw () { return add(&value, sizeof(value)); }
+    RoomKeyHasher& add(const std::string& str) throw () { return add(str.length()).add(str.data(), str.length()); }
+    RoomKeyHasher& add(BITMAP* b) throw ();    // the dimensions and pixels of a memory bitmap; 0 is hashed as a bitmap too
+
+    uint64_t value() const throw () { return h; }
+
+private:
+    uint64_t h;
+};
+
+/** Disk cache of rendered room backgrounds, so that the antialiased rooms of a known map needn't be rendered again.
+ * The caller builds a key that covers everything the picture depends on (the map, textures, colours, size and pixel
+ * format); each room is stored as the raw pixels of a memory bitmap in its own file under the cache directory. When
+ * the files exceed the size limit, the least recently used ones are deleted. The use order is kept in an index file
+ * that is written when the cache is destroyed; files missing from it are taken as the least recently used.
+ * All the methods may be called from several threads.
+ */
+class RoomDiskCache : private NoCopying {
+public:
+    RoomDiskCache(const std::string& directory, uint32_t maxBytes) throw () : dir(directory), sizeLimit(maxBytes), mutex("RoomDiskCache::mutex"), scanned(false), changed(false), totalBytes(0), clock(0) { }
+    ~RoomDiskCache() throw ();
+
+    /// Fill the memory bitmap target with the room stored under key; returns false if there's no room of the same dimensions and depth.
+    bool load(uint64_t key, BITMAP* target) throw ();
+    /// Store the memory bitmap source under key.
+    void store(uint64_t key, BITMAP* source) throw ();
+
+private:
+    struct Entry {
+        uint32_t size;
+        uint32_t lastUse;   // value of clock
+
+        Entry() throw () : size(0), lastUse(0) { }
+    };
+
+    std::string fileName(uint64_t key) const throw ();
+    std::string indexFileName() const throw ();
+    void scan() throw ();   // call with mutex locked
+    void evict() throw ();  // call with mutex locked
+    void saveIndex() throw ();  // call with mutex locked
+
+    const std::string dir;
+    const uint32_t sizeLimit;
+    Mutex mutex;
+    bool scanned;   // the directory has been read
+    bool changed;   // entries differ from the index file
+    std::map<uint64_t, Entry> entries;
+    uint32_t totalBytes;
+    uint32_t clock; // increased by every use
+};
+
+#endif
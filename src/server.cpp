@@ -27,6 +27,8 @@
 #include <iomanip>
 #include <iostream>
 #include <climits>
+#include <cstdio>
+#include <ctime>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -35,6 +37,8 @@
 #include "function_utility.h"
 #include "incalleg.h"
 #include "language.h"
+#include "mapgen.h"
+#include "mapindex.h"
 #include "names.h"
 #include "nassert.h"
 #include "platform.h"
@@ -81,8 +85,12 @@ Server::Server(LogSet& hostLogs, const ServerExternalSettings& config, Log& exte
     world(this, &network, log),
     network(this, settings, world, log, threadLock, threadLockMutex),
     settings(*this, config),
+    mapPreparer(log),
+    statsExporter(log),
+    preparedMap(-1),
     authorizations(log),
     recording_started(false),
+    record_compressed(false),
     end_game_human_count(0)
 {
     hostLogs("See serverlog.txt for server's log messages");
@@ -489,27 +497,335 @@ void Server::score_neg(int p, int amount, bool forTournament) throw () {
     }
 }
 
-//load a map from the rotation list
-bool Server::load_rotation_map(int pos) throw () {
-    record_map.clear();
-    string file_name;
-    string dir;
-    if (maprot[pos].random) {
-        //const string map_title = finnish_name(10);
-        //maprot[pos].title = map_title;
-        dir = string() + SERVER_MAPS_DIR + directory_separator + "generated";
-        file_name = "mapgen_" + itoa(rand());
-        maprot[pos].file = file_name;
-        world.generate_map(dir, file_name, maprot[pos].width, maprot[pos].height, maprot[pos].over_edge, maprot[pos].title, "Outgun");
+Server::MapPreparer::MapPreparer(LogSet logs) throw () :
+    quitFlag(false),
+    jobPending(false),
+    workingMap(-1),
+    serial(0),
+    resultReady(false),
+    wakeup("Server::MapPreparer::wakeup"),
+    finished("Server::MapPreparer::finished"),
+    mutex("Server::MapPreparer::mutex"),
+    log(logs)
+{ }
+
+void Server::MapPreparer::start(int priority) throw () {
+    quitFlag = false;
+    thread.start_assert("Server::MapPreparer::threadMain",
+                        RedirectToMemFun0<Server::MapPreparer, void>(this, &Server::MapPreparer::threadMain),
+                        priority);
+}
+
+void Server::MapPreparer::stop() throw () {
+    {
+        Lock ml(mutex);
+        quitFlag = true;
+        wakeup.signal();
+    }
+    thread.join();
+    jobPending = resultReady = false;
+}
+
+void Server::MapPreparer::threadMain() throw () {
+    Lock ml(mutex);
+    for (;;) {
+        while (!quitFlag && !jobPending && statsQueue.empty())
+            wakeup.wait(mutex);
+        if (!statsQueue.empty()) {
+            const StatsWrite sw = statsQueue.front();
+            statsQueue.pop();
+            Unlock mu(mutex);
+            WorldBase::append_stats(sw.dir, sw.date_time, sw.html);
+            continue;
+        }
+        if (quitFlag)
+            break;
+        const Job j = job;
+        const unsigned jobSerial = serial;
+        jobPending = false;
+        workingMap = j.mapNr;
+        Result r;
+        {
+            Unlock mu(mutex);
+            prepare(log, j, r);
+        }
+        workingMap = -1;
+        if (serial == jobSerial) {
+            result = r;
+            resultReady = true;
+        }
+        finished.broadcast();
+    }
+}
+
+void Server::MapPreparer::request(const Job& j) throw () {
+    Lock ml(mutex);
+    job = j;
+    jobPending = true;
+    ++serial;
+    resultReady = false;
+    wakeup.signal();
+}
+
+void Server::MapPreparer::cancel() throw () {
+    Lock ml(mutex);
+    jobPending = false;
+    ++serial;
+    resultReady = false;
+}
+
+bool Server::MapPreparer::take(int mapNr, Result& r) throw () {
+    Lock ml(mutex);
+    if (!thread.isRunning())
+        return false;
+    while ((jobPending && job.mapNr == mapNr) || (!jobPending && workingMap == mapNr))
+        finished.wait(mutex);
+    if (!resultReady || result.mapNr != mapNr)
+        return false;
+    r = result;
+    result = Result();
+    resultReady = false;
+    return true;
+}
+
+void Server::MapPreparer::appendStats(const string& dir, const string& date_time, const string& html) throw () {
+    StatsWrite sw;
+    sw.dir = dir;
+    sw.date_time = date_time;
+    sw.html = html;
+    Lock ml(mutex);
+    if (!thread.isRunning()) {
+        Unlock mu(mutex);
+        WorldBase::append_stats(dir, date_time, html);
+        return;
+    }
+    statsQueue.push(sw);
+    wakeup.signal();
+}
+
+void Server::MapPreparer::prepare(LogSet& log, const Job& j, Result& r) throw () {
+    r.mapNr = j.mapNr;
+    r.file = j.file;
+    r.dir = j.dir;
+    r.generated = j.random;
+    if (!j.random) {
+        r.ok = r.map.load(log, j.dir, j.file, &r.data);
+        return;
+    }
+    MapGenerator generator;
+    generator.generate(j.width, j.height, j.over_edge, j.seed);
+    ostringstream text;
+    generator.save_map(text, j.title, "Outgun");
+    r.data = text.str();
+    istringstream in(r.data);
+    r.ok = r.map.parse_file(log, in);
+    if (!r.ok)
+        log.error(_("Can't load: error in map '$1'.", j.file));
+}
+
+Server::StatsExporter::StatsExporter(LogSet logs) throw () :
+    quitFlag(false),
+    wakeup("Server::StatsExporter::wakeup"),
+    mutex("Server::StatsExporter::mutex"),
+    log(logs),
+    fileDay(0),
+    periodStart(0),
+    periodFrames(0),
+    tickTotal(0),
+    tickMax(0)
+{ }
+
+void Server::StatsExporter::start(int priority) throw () {
+    quitFlag = false;
+    thread.start_assert("Server::StatsExporter::threadMain",
+                        RedirectToMemFun0<Server::StatsExporter, void>(this, &Server::StatsExporter::threadMain),
+                        priority);
+}
+
+void Server::StatsExporter::stop() throw () {
+    {
+        Lock ml(mutex);
+        quitFlag = true;
+        wakeup.signal();
+    }
+    thread.join();
+    file.close();
+}
+
+void Server::StatsExporter::threadMain() throw () {
+    Lock ml(mutex);
+    for (;;) {
+        while (!quitFlag && queue.empty())
+            wakeup.wait(mutex);
+        if (queue.empty())
+            break;
+        const Record r = queue.front();
+        queue.pop();
+        Unlock mu(mutex);
+        write(r);
+    }
+}
+
+void Server::StatsExporter::write(const Record& r) throw () {
+    if (!file.is_open() || r.day != fileDay) {
+        file.close();
+        file.clear();
+        const string dir = wheregamedir + "server_stats" + directory_separator + "stream";
+        if (!platIsDirectory(dir))
+            platMkdir(dir);
+        const string name = dir + directory_separator + StatsStream::fileName(r.day);
+        uint32_t mtime, size;
+        bool exists = platFileStat(name, mtime, size) && size > 0;
+        if (exists && !StatsStream::fileHasHeader(name)) {   // written by another version; records can't be appended to it
+            const string moved = name + ".old";
+            remove(moved.c_str());
+            if (rename(name.c_str(), moved.c_str()) != 0) {
+                log.error(_("Can't rename '$1' to '$2'.", name, moved));
+                return;
+            }
+            log("Moved the statistics stream file of another version to %s.", moved.c_str());
+            exists = false;
+        }
+        file.open(name.c_str(), ios::binary | ios::app);
+        if (!file) {
+            log.error(_("Can't write '$1'.", name));
+            return;
+        }
+        if (!exists) {
+            ExpandingBinaryBuffer header;
+            StatsStream::writeHeader(header);
+            file << header;
+        }
+        fileDay = r.day;
+        removeOldFiles(r.day, r.keepDays);
+    }
+    file << r.data;
+    file.flush();   // readers only see whole records, barring a crash
+}
+
+void Server::StatsExporter::removeOldFiles(uint32_t today, int keepDays) throw () {
+    if (keepDays <= 0)
+        return;
+    const string dir = wheregamedir + "server_stats" + directory_separator + "stream";
+    FileFinder* files = platMakeFileFinder(dir, ".bin", false);
+    while (files->hasNext()) {
+        const string name = files->next();
+        uint32_t day;
+        if (StatsStream::parseDay(FileName(name).getBaseName(), day) && day + keepDays <= today)
+            remove((dir + directory_separator + name).c_str());
+    }
+    delete files;
+}
+
+void Server::StatsExporter::skipPeriod(double time) throw () {
+    periodStart = time;
+    periodFrames = 0;
+    tickTotal = tickMax = 0;
+}
+
+void Server::StatsExporter::sample(const ServerWorld& world, int maxplayers, const string& mapTitle, int humans, int bots, double time, int keepDays) throw () {
+    StatsStream::Sample s;
+    s.time = static_cast<uint32_t>(::time(0));
+    s.seconds = static_cast<uint16_t>(bound(time - periodStart + .5, 0., 65535.));
+    s.humans = humans;
+    s.bots = bots;
+    s.frames = periodFrames;
+    if (periodFrames) {
+        s.tickMeanUs = static_cast<uint32_t>(tickTotal / periodFrames * 1e6 + .5);
+        s.tickMaxUs = static_cast<uint32_t>(tickMax * 1e6 + .5);
+    }
+    s.map = mapTitle;
+    std::map<unsigned, StatsStream::PlayerSample> current;
+    for (int i = 0; i < maxplayers; ++i) {
+        const ServerPlayer& pl = world.player[i];
+        if (!pl.used)
+            continue;
+        const Statistics& st = pl.stats();
+        StatsStream::PlayerSample& cur = current[pl.uniqueId];
+        cur.name = pl.name;
+        cur.team = static_cast<uint8_t>(pl.team());
+        uint32_t* c = cur.counter;
+        c[StatsStream::C_frags] = static_cast<uint32_t>(st.frags());
+        c[StatsStream::C_kills] = st.kills();
+        c[StatsStream::C_deaths] = st.deaths();
+        c[StatsStream::C_suicides] = st.suicides();
+        c[StatsStream::C_captures] = st.captures();
+        c[StatsStream::C_flags_taken] = st.flags_taken();
+        c[StatsStream::C_flags_dropped] = st.flags_dropped();
+        c[StatsStream::C_flags_returned] = st.flags_returned();
+        c[StatsStream::C_carriers_killed] = st.carriers_killed();
+        c[StatsStream::C_shots] = st.shots();
+        c[StatsStream::C_hits] = st.hits();
+        c[StatsStream::C_shots_taken] = st.shots_taken();
+        c[StatsStream::C_movement] = static_cast<uint32_t>(st.movement());  // differences of the rounded totals don't accumulate errors
+
+        StatsStream::PlayerSample delta = cur;
+        const std::map<unsigned, StatsStream::PlayerSample>::const_iterator prev = previous.find(pl.uniqueId);
+        if (prev != previous.end())
+            for (int k = 0; k < StatsStream::C_count; ++k)
+                if (StatsStream::isSigned(k) || delta.counter[k] >= prev->second.counter[k])  // otherwise the counter has been cleared
+                    delta.counter[k] -= prev->second.counter[k];    // the signed ones wrap around to the right value
+        s.players.push_back(delta);
+    }
+    previous.swap(current);
+    skipPeriod(time);
+
+    Record r;
+    r.day = s.time / (24 * 3600);
+    r.keepDays = keepDays;
+    StatsStream::writeRecord(r.data, s);
+    Lock ml(mutex);
+    if (!thread.isRunning()) // not started yet or already stopped
+        return;
+    queue.push(r);
+    wakeup.signal();
+}
+
+void Server::export_stats() throw () {
+    if (settings.get_stats_export_interval() > 0)
+        statsExporter.sample(world, maxplayers, current_map().title, network.get_human_count(), network.get_bot_count(), get_time(), settings.get_stats_export_days());
+    else
+        statsExporter.skipPeriod(get_time());
+}
+
+Server::MapPreparer::Job Server::rotation_map_job(int pos) throw () {
+    const MapInfo& mi = maprot[pos];
+    MapPreparer::Job job;
+    job.mapNr = pos;
+    job.random = mi.random;
+    if (mi.random) {
+        job.dir = string() + SERVER_MAPS_DIR + directory_separator + "generated";
+        job.file = "mapgen_" + itoa(rand());
+        job.width = mi.width;
+        job.height = mi.height;
+        job.over_edge = rand() % 1000 < 1000 * mi.over_edge;
+        job.seed = rand();
+        job.title = mi.title;
     }
     else {
-        dir = SERVER_MAPS_DIR;
-        file_name = maprot[pos].file;
+        job.dir = SERVER_MAPS_DIR;
+        job.file = mi.file;
     }
-    const bool ok = world.load_map(dir, file_name,
-                                   settings.get_recording() || network.is_relay_used() ? &record_map : 0);
-    if (!ok)
+    return job;
+}
+
+//load a map from the rotation list
+bool Server::load_rotation_map(int pos) throw () {
+    record_map.clear();
+    MapPreparer::Result prepared;
+    if (preparedMap != pos || !mapPreparer.take(pos, prepared))
+        MapPreparer::prepare(log, rotation_map_job(pos), prepared);
+    preparedMap = -1;
+    maprot[pos].file = prepared.file;
+    if (!prepared.ok)
         return false;
+    if (prepared.generated) {   // the file is only needed for clients to download the map
+        ofstream out((wheregamedir + prepared.dir + directory_separator + prepared.file + ".txt").c_str(), ios::binary);
+        out << prepared.data;
+    }
+    world.set_map(prepared.map);
+    if (settings.get_recording() || network.is_relay_used())
+        record_map.swap(prepared.data);
     log("Map number %i: '%s'", pos, maprot[pos].file.c_str());
     maprot[pos].update(world.map);   // In case the map file has been modified since the map list loading.
     if (world.getConfig().random_wild_flag) {
@@ -543,8 +859,16 @@ bool Server::server_next_map(int reason, const string& currmap_title_override) t
     for (int i = 0; i < maxplayers; ++i)
         world.player[i].stats().finish_stats(get_time());
 
-    if (settings.get_save_stats() && !gameover && network.get_human_count() >= settings.get_save_stats())    // !gameover: Don't save stats for the game that didn't start.
-        world.save_stats("server_stats", currmap_title_override.empty() ? current_map().title : currmap_title_override);
+    if (!gameover)
+        export_stats();
+    statsExporter.newMap();
+
+    if (settings.get_save_stats() && !gameover && network.get_human_count() >= settings.get_save_stats()) {  // !gameover: Don't save stats for the game that didn't start.
+        const string date_time = date_and_time();
+        ostringstream html;
+        world.write_stats(html, date_time, currmap_title_override.empty() ? current_map().title : currmap_title_override);
+        mapPreparer.appendStats("server_stats", date_time, html.str());
+    }
 
     // broadcast stats to all players for stats saving
     for (int i = 0; i < maxplayers; ++i) {
@@ -559,35 +883,11 @@ bool Server::server_next_map(int reason, const string& currmap_title_override) t
     }
     network.broadcast_stats_ready();
 
-    vector<int> winners;
-    int maxVotes = 0;
-    uint32_t longest_time = world.frame;
-    for (int m = 0; m < static_cast<int>(maprot.size()); ++m) {
-        if (maprot[m].votes < maxVotes)
-            continue;
-        if (maprot[m].votes > maxVotes) {
-            maxVotes = maprot[m].votes;
-            winners.clear();
-            longest_time = maprot[m].last_game;
-        }
-        if (maprot[m].last_game > longest_time)
-            continue;
-        if (maprot[m].last_game < longest_time) {
-            winners.clear();
-            longest_time = maprot[m].last_game;
-        }
-        winners.push_back(m);
-    }
-    if (maxVotes == 0)
-        currmap = (currmap + 1) % maprot.size();
-    else {
-        if (winners.size() > 1) {
-            vector<int>::iterator it = find(winners.begin(), winners.end(), currmap);
-            if (it != winners.end())
-                winners.erase(it);
-        }
+    const vector<int> winners = next_map_candidates();
+    if (find(winners.begin(), winners.end(), preparedMap) != winners.end())
+        currmap = preparedMap;  // as good a choice as any other, and ready
+    else
         currmap = winners[rand() % winners.size()];
-    }
     // clear votes for the current map
     for (int p = 0; p < maxplayers; ++p) {
         world.player[p].want_map_exit = false;
@@ -611,9 +911,50 @@ bool Server::server_next_map(int reason, const string& currmap_title_override) t
 
     ctf_game_restart();
 
+    prepare_next_map();
     return true;
 }
 
+vector<int> Server::next_map_candidates() const throw () {
+    nAssert(!maprot.empty());
+    vector<int> winners;
+    int maxVotes = 0;
+    uint32_t longest_time = world.frame;
+    for (int m = 0; m < static_cast<int>(maprot.size()); ++m) {
+        if (maprot[m].votes < maxVotes)
+            continue;
+        if (maprot[m].votes > maxVotes) {
+            maxVotes = maprot[m].votes;
+            winners.clear();
+            longest_time = maprot[m].last_game;
+        }
+        if (maprot[m].last_game > longest_time)
+            continue;
+        if (maprot[m].last_game < longest_time) {
+            winners.clear();
+            longest_time = maprot[m].last_game;
+        }
+        winners.push_back(m);
+    }
+    if (maxVotes == 0)
+        return vector<int>(1, (currmap + 1) % maprot.size());
+    if (winners.size() > 1) {
+        vector<int>::iterator it = find(winners.begin(), winners.end(), currmap);
+        if (it != winners.end())
+            winners.erase(it);
+    }
+    return winners;
+}
+
+// Have the map that would be chosen by server_next_map prepared in the background, unless it already is.
+void Server::prepare_next_map() throw () {
+    const vector<int> candidates = next_map_candidates();
+    if (find(candidates.begin(), candidates.end(), preparedMap) != candidates.end())
+        return;
+    preparedMap = candidates[rand() % candidates.size()];
+    mapPreparer.request(rotation_map_job(preparedMap));
+}
+
 bool Server::recording_active() const throw () {
     return record || network.is_relay_active();
 }
@@ -624,6 +965,7 @@ void Server::start_recording() throw () {
 
     record_start_frame = world.frame;
     record_messages.clear();
+    record_keyframes.clear();
 
     ExpandingBinaryBuffer data;
     data.constLengthStr(REPLAY_IDENTIFICATION, REPLAY_IDENTIFICATION.length());
@@ -647,10 +989,20 @@ void Server::start_recording() throw () {
         else
             log("Could not create record file %s.", record_filename.c_str());
 
-        record << data;
+        record_compressed = settings.get_compress_replays();
+        record_compressor.reset();
+        BinaryBuffer<1> encoding;
+        encoding.U8(record_compressed ? replay_encoding_deflate : replay_encoding_raw);
+        record << data << encoding;
     }
 
     record_init_data();
+    {   // the relayed stream has no keyframes
+        const unsigned pos = data.getPosition();
+        data.setPosition(REPLAY_IDENTIFICATION.length());
+        data.U32(REPLAY_STREAM_VERSION);
+        data.setPosition(pos);
+    }
     data.U32(settings.get_spectating_delay());
     network.send_first_relay_data(data);
 
@@ -663,6 +1015,19 @@ void Server::stop_recording() throw () {
     if (record) {
         if (gameover && end_game_human_count >= settings.get_recording() ||
                 !gameover && network.get_human_count() >= settings.get_recording()) {
+            // write the keyframe index after the frames
+            {
+                const uint32_t indexPos = record.tellp();
+                ExpandingBinaryBuffer index;
+                index.U32(record_keyframes.size());
+                for (vector<pair<uint32_t, uint32_t> >::const_iterator ki = record_keyframes.begin(); ki != record_keyframes.end(); ++ki) {
+                    index.U32(ki->first);
+                    index.U32(ki->second);
+                }
+                index.U32(indexPos);
+                index.U32(REPLAY_INDEX_MARKER);
+                record << index;
+            }
             // write the length of the record
             record.seekp(16);
             {
@@ -725,6 +1090,8 @@ void Server::check_map_exit() throw () {
 
     if (num_for > num_against && (world.getMapTime() >= settings.get_vote_block_time() || num_against == 0))
         server_next_map(NEXTMAP_VOTE_EXIT); // ignore return value
+    else
+        prepare_next_map();
 }
 
 //----- THE REST  ----------------
@@ -744,9 +1111,14 @@ bool Server::reset_settings(bool reload) throw () {  // set reload if reset_sett
 
     world.physics = PhysicalSettings(); // default values
     maprot.clear();
+    mapPreparer.cancel();
+    preparedMap = -1;
     settings.reset();
     currmap = 0;
 
+    // the maps of the rotation are looked up from the index
+    g_serverMapIndex.refresh(log, settings.lowerPriority());
+
     // load server configuration from gamemod.txt
     settings.loadGamemod(reload);
 
@@ -768,6 +1140,7 @@ bool Server::reset_settings(bool reload) throw () {  // set reload if reset_sett
         delete mapFiles;
         sort(maprot.begin(), maprot.end());
     }
+    g_serverMapIndex.save();
 
     if (maprot.empty()) {
         log.error(_("No maps for rotation."));
@@ -807,6 +1180,7 @@ bool Server::reset_settings(bool reload) throw () {  // set reload if reset_sett
         // what is left are players whose voted map was erased from the list
         for (list< pair<int, string> >::iterator vi = oldVotes.begin(); vi != oldVotes.end(); ++vi)
             world.player[vi->first].mapVote = -1;   // the client knows this because of broadcast_reset_map_list above
+        prepare_next_map();
     }
     else if (settings.get_random_first_map())
         currmap = rand() % maprot.size();
@@ -933,6 +1307,11 @@ bool Server::start(int target_maxplayers) throw () {
 
     network.update_serverinfo();
 
+    mapPreparer.start(settings.lowerPriority());
+    prepare_next_map();
+    statsExporter.start(settings.lowerPriority());
+    statsExporter.skipPeriod(get_time());
+
     if (threadLock)
         threadLockMutex.unlock();
 
@@ -1597,13 +1976,52 @@ void Server::simulate_and_broadcast_frame() throw () {
             recordFrame.setPosition(pos);
         }
 
-        if (record)
-            record << recordFrame;
+        const bool keyframe = (world.frame - record_start_frame) % REPLAY_KEYFRAME_INTERVAL == 0;
+        if (record) {
+            if (record_compressed) {
+                ExpandingBinaryBuffer encoded;
+                encoded.U32(0); // leave space for the length
+                record_compressor.compress(ConstDataBlockRef(recordFrame.ref()).tail(4), encoded, keyframe);    // decoding must be able to restart after a keyframe
+                const unsigned pos = encoded.getPosition();
+                encoded.setPosition(0);
+                encoded.U32(pos - 4);
+                encoded.setPosition(pos);
+                record << encoded;
+            }
+            else
+                record << recordFrame;
+        }
         network.send_relay_data(recordFrame);
         record_messages.clear();
+
+        if (record && keyframe)
+            record_keyframe();
     }
 }
 
+// Write the full game state after the current frame, so that a viewer can start playback from the next frame.
+void Server::record_keyframe() throw () {
+    network.record_keyframe();
+
+    ExpandingBinaryBuffer keyframe;
+    keyframe.U32(0); // leave space for the length
+    keyframe.U32(world.frame);  // never compressed so that the keyframes can be found by scanning the file
+    if (record_compressed)
+        Compressor().compress(record_messages, keyframe);   // keyframes are decoded independently of the frames
+    else
+        keyframe.block(record_messages);
+    {
+        const unsigned pos = keyframe.getPosition();
+        keyframe.setPosition(0);
+        keyframe.U32((pos - 4) | REPLAY_KEYFRAME_FLAG);
+        keyframe.setPosition(pos);
+    }
+
+    record_keyframes.push_back(pair<uint32_t, uint32_t>(world.frame, static_cast<uint32_t>(record.tellp())));
+    record << keyframe;
+    record_messages.clear();
+}
+
 //run something after simulate_and_broadcast
 void Server::server_think_after_broadcast() throw () {
     int tc[2] = { 0, 0 };
@@ -1662,6 +2080,8 @@ void Server::loop(volatile bool *quitFlag, bool quitOnEsc) throw () {
     double nextFrameTime = get_time() + .1;
 
     while (!*quitFlag && !abortFlag) {
+        const double tickStart = g_systemTimer->read();
+
         // generate and send frame
         simulate_and_broadcast_frame();
 
@@ -1671,15 +2091,19 @@ void Server::loop(volatile bool *quitFlag, bool quitOnEsc) throw () {
         //update wintitle
         if (world.frame % 10 == 0) {
             //update bar
-            ostringstream status;
+            string status;
             const int errors = errorLog.numLines();
-            if (errors && settings.showErrorCount())
-                status << _("ERRORS:$1", itoa(errors)) << "  ";
-            status << _("$1/$2p $3k/s v$4 port:$5",
-                        itoa(network.get_human_count()), itoa(maxplayers), fcvt(network.getTraffic() / 1024, 1), getVersionString(false), itoa(settings.get_port()));
-            if (quitOnEsc)
-                status << ' ' << _("Esc:quit");
-            settings.statusOutput()(status.str());
+            if (errors && settings.showErrorCount()) {
+                append_translation(status, "ERRORS:$1", itoa(errors));
+                status += "  ";
+            }
+            append_translation(status, "$1/$2p $3k/s v$4 port:$5",
+                               itoa(network.get_human_count()), itoa(maxplayers), fcvt(network.getTraffic() / 1024, 1), getVersionString(false), itoa(settings.get_port()));
+            if (quitOnEsc) {
+                status += ' ';
+                append_translation(status, "Esc:quit");
+            }
+            settings.statusOutput()(status);
             #ifndef DEDICATED_SERVER_ONLY
             // update (re-clear) window too, if there's the possibility it has been corrupted
             if (settings.ownScreen() && GlobalDisplaySwitchHook::readAndClear())
@@ -1689,6 +2113,11 @@ void Server::loop(volatile bool *quitFlag, bool quitOnEsc) throw () {
 
         // executa algo para todos os players
         server_think_after_broadcast();
+        network.publishStatus();
+
+        statsExporter.tick(g_systemTimer->read() - tickStart);
+        if (statsExporter.due(get_time(), settings.get_stats_export_interval()))
+            export_stats();
 
         if (threadLock)
             threadLockMutex.unlock();
@@ -1722,6 +2151,9 @@ void Server::stop() throw () {
 
     network.stop();
 
+    mapPreparer.stop();
+    statsExporter.stop();
+
     quit_bots = true;
     settings.statusOutput()(_("Shutdown: bot thread"));
     botthread.join();
@@ -26,12 +26,19 @@
 #ifndef SERVER_H_INC
 #define SERVER_H_INC
 
+#include <fstream>
+#include <map>
+#include <queue>
+
 #include "binaryaccess.h"
+#include "compress.h"
 #include "world.h"
 #include "gameserver_interface.h"
 #include "log.h"
 #include "auth.h"
 #include "servnet.h"
+#include "statsstream.h"
+#include "thread.h"
 #include "utility.h"
 
 class ClientInterface; // bots are Clients
@@ -158,11 +165,14 @@ class Server : private NoCopying {
         std::string     bot_name_lang;
         bool            tournament;
         int             save_stats;
+        int             stats_export_interval;  // seconds, 0 to disable
+        int             stats_export_days;      // 0 to keep forever
         bool            random_maprot;
         bool            random_first_map;
         std::string     server_website_url; // the URL of the server website to be sent to master server
         int             srvmonit_port;
         int             recording;
+        bool            compress_replays;
         unsigned        spectating_delay;
         int             minimap_send_limit;
 
@@ -279,6 +289,8 @@ class Server : private NoCopying {
 
         bool get_tournament() const throw () { return tournament; }
         int  get_save_stats() const throw () { return save_stats; }
+        int  get_stats_export_interval() const throw () { return stats_export_interval; }
+        int  get_stats_export_days() const throw () { return stats_export_days; }
 
         bool get_random_maprot() const throw () { return random_maprot; }
         bool get_random_first_map() const throw () { return random_first_map; }
@@ -286,6 +298,7 @@ class Server : private NoCopying {
         const std::string& get_server_website_url() const throw () { return server_website_url; }
 
         int  get_recording() const throw () { return recording; }
+        bool get_compress_replays() const throw () { return compress_replays; }
         unsigned get_spectating_delay() const throw () { return spectating_delay; }
 
         bool get_log_player_chat() const throw () { return log_player_chat; }
@@ -305,8 +318,120 @@ class Server : private NoCopying {
 
     SettingManager settings;
 
+    /** Background preparation of the next rotation map and writing of the stats files.
+     * While a game runs, the map most likely to be played next is generated (if random) and read, parsed and validated
+     * in a low priority thread, so that changing the map only needs swapping in the ready Map. The random choices are
+     * made when the Job is created, and a generated map is only saved by load_rotation_map when it's actually played.
+     */
+    class MapPreparer {
+    public:
+        struct Job {
+            int mapNr;
+            bool random;
+            std::string dir, file;  // file is the generated name for random maps
+            int width, height;      // the rest are only for random maps
+            bool over_edge;
+            unsigned seed;
+            std::string title;
+        };
+
+        struct Result {
+            int mapNr;
+            bool ok;
+            std::string dir, file;
+            Map map;
+            std::string data;   // the map file contents, for recording
+            bool generated;     // data has to be saved for clients to download the map
+        };
+
+    private:
+        struct StatsWrite {
+            std::string dir, date_time, html;
+        };
+
+        Thread thread;
+        bool quitFlag;
+        Job job;
+        bool jobPending;
+        int workingMap;     // -1 if not working on a map
+        unsigned serial;    // increased by every request and cancel; a result is discarded if the serial changes during its preparation
+        Result result;
+        bool resultReady;
+        std::queue<StatsWrite> statsQueue;
+        ConditionVariable wakeup, finished;
+        Mutex mutex;
+        mutable LogSet log;
+
+        void threadMain() throw ();
+
+    public:
+        MapPreparer(LogSet logs) throw ();
+
+        void start(int priority) throw ();
+        void stop() throw (); // finishes writing queued stats files
+
+        void request(const Job& j) throw ();   // replaces any earlier request
+        void cancel() throw ();
+        /// Get the prepared map if it's mapNr, waiting for its preparation to finish if necessary. Returns false if mapNr hasn't been requested.
+        bool take(int mapNr, Result& r) throw ();
+
+        void appendStats(const std::string& dir, const std::string& date_time, const std::string& html) throw ();
+
+        /// Prepare a map synchronously; this is what the thread does for requests.
+        static void prepare(LogSet& log, const Job& j, Result& r) throw ();
+    };
+
+    /** Streaming export of the statistics for following trends; see statsstream.h for the format.
+     * The server thread samples the players' counters, the player counts and the frame times every
+     * stats_export_interval seconds and at the end of each map, and a low priority thread appends the records to the
+     * file of the day in server_stats/stream, deleting the files older than stats_export_days.
+     */
+    class StatsExporter {
+        struct Record {
+            uint32_t day;
+            int keepDays;
+            ExpandingBinaryBuffer data;
+        };
+
+        Thread thread;
+        bool quitFlag;
+        std::queue<Record> queue;
+        ConditionVariable wakeup;
+        Mutex mutex;
+        mutable LogSet log;
+
+        // used by the thread only
+        std::ofstream file;
+        uint32_t fileDay;   // of the open file
+
+        // used by the server thread only
+        std::map<unsigned, StatsStream::PlayerSample> previous;    // counters at the previous sample, by ServerPlayer::uniqueId
+        double periodStart;
+        uint32_t periodFrames;
+        double tickTotal, tickMax;
+
+        void threadMain() throw ();
+        void write(const Record& record) throw ();
+        void removeOldFiles(uint32_t today, int keepDays) throw ();
+
+    public:
+        StatsExporter(LogSet logs) throw ();
+
+        void start(int priority) throw ();
+        void stop() throw (); // finishes writing queued records
+
+        void tick(double seconds) throw () { ++periodFrames; tickTotal += seconds; if (seconds > tickMax) tickMax = seconds; }
+        bool due(double time, int interval) const throw () { return interval > 0 && time >= periodStart + interval; }
+        void skipPeriod(double time) throw ();  // start a new period without a record
+        void newMap() throw () { previous.clear(); }    // the players' counters are cleared
+        void sample(const ServerWorld& world, int maxplayers, const std::string& mapTitle, int humans, int bots, double time, int keepDays) throw ();
+    };
+
     std::vector<MapInfo> maprot;
     int currmap;        // current map in maprot
+    MapPreparer mapPreparer;
+    StatsExporter statsExporter;
+    int preparedMap;    // the map of the latest request to mapPreparer, -1 if none
     AuthorizationDatabase authorizations;
 
     // recording
@@ -315,6 +440,9 @@ class Server : private NoCopying {
     mutable std::ofstream record;
     mutable ExpandingBinaryBuffer record_messages;
     uint32_t record_start_frame;
+    std::vector<std::pair<uint32_t, uint32_t> > record_keyframes; // frame number, file offset
+    bool record_compressed;
+    Compressor record_compressor;
     std::string record_map;
     int end_game_human_count;  // used for deciding whether to keep the record file
 
@@ -332,6 +460,7 @@ class Server : private NoCopying {
     void stop_recording() throw ();
     void delete_recording() throw ();
     void record_init_data() throw ();
+    void record_keyframe() throw ();
 
 public:
     Server(LogSet& hostLogs, const ServerExternalSettings& config, Log& externalErrorLog, const std::string& errorPrefix) throw ();  // externalErrorLog must outlive the Server object
@@ -388,7 +517,11 @@ public:
     bool isAdmin(int pid) const throw ();
 
     bool load_rotation_map(int pos) throw ();
+    MapPreparer::Job rotation_map_job(int pos) throw ();
+    std::vector<int> next_map_candidates() const throw ();  // the maps server_next_map would choose from, if nothing changes before that
+    void prepare_next_map() throw ();
     bool server_next_map(int reason, const std::string& currmap_title_override = std::string()) throw ();
+    void export_stats() throw ();   // a record to statsExporter if enabled
     const MapInfo& current_map() const throw () { return maprot[currmap]; }
     int current_map_nr() const throw () { return currmap; }
     const std::string& getCurrentMapFile() const throw () { return maprot[currmap].file; }
@@ -189,6 +189,8 @@ void Server::SettingManager::build(bool reload) throw () {
     cat.add(new GS_String    ("server_password",             &server_password));
     cat.add(new GS_Boolean   ("tournament",                  &tournament));
     cat.add(new GS_Int       ("save_stats",                  &save_stats, 0, MAX_PLAYERS));
+    cat.add(new GS_Int       ("stats_export_interval",       &stats_export_interval, 0, 3600));
+    cat.add(new GS_Int       ("stats_export_days",           &stats_export_days, 0, GS_Int::lim::max()));
     cat.add(new GS_Int       ("idlekick_time",               &idlekick_time, 10, GS_Int::lim::max(), 10, 0, true));  // convert seconds to frames; special setting: allow 0 that is outside the normal range
     cat.add(new GS_Int       ("idlekick_playerlimit",        &idlekick_playerlimit, 1, MAX_PLAYERS));
     cat.add(portSetting);
@@ -199,6 +201,7 @@ void Server::SettingManager::build(bool reload) throw () {
     cat.add(new GS_String    ("join_limit_message",          &join_limit_message));
     cat.add(srvmonitSetting);
     cat.add(new GS_Int       ("recording",                   &recording, 0, MAX_PLAYERS));
+    cat.add(new GS_Boolean   ("compress_replays",            &compress_replays));
     cat.add(new GS_ForwardStr("relay_server",                setRelayServer, getRelayServer));
     cat.add(new GS_IntT<unsigned>("spectating_delay",        &spectating_delay, 0, GS_IntT<unsigned>::lim::max()));
     cat.add(new GS_Boolean   ("log_player_chat",             &log_player_chat));
@@ -444,8 +447,11 @@ void Server::SettingManager::reset() throw () {
 
     tournament = false;
     save_stats = 0;
+    stats_export_interval = 0;
+    stats_export_days = 62;
 
     recording = 0;
+    compress_replays = true;
     spectating_delay = 120;
 
     log_player_chat = false;
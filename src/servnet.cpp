@@ -39,6 +39,8 @@
 #include "binaryaccess.h"
 #include "debug.h"
 #include "debugconfig.h"    // for LOG_MESSAGE_TRAFFIC
+#include "fastbinary.h"
+#include "framecodec.h"
 #include "function_utility.h"
 #include "language.h"
 #include "nassert.h"
@@ -93,6 +95,7 @@ ServerNetworking::ServerNetworking(Server* hostp, const Settings& settings_, Ser
     accelerationModeMask(0),
     flagModeMask(0),
     maplist_revision(0),
+    statusSnapshot("ServerNetworking::statusSnapshot"),
     relayThread(logs, file_threads_quit),
     playerSlotReservationTime(get_time()),
     reservedPlayerSlots(0)
@@ -189,10 +192,30 @@ void ServerNetworking::record_message(ConstDataBlockRef data) const throw () {
     }
 }
 
+void ServerNetworking::multicast_message(uint32_t pidMask, ConstDataBlockRef data) const throw () {
+    uint32_t cidMask = 0;
+    for (int i = 0; i < maxplayers; ++i)
+        if ((pidMask & (uint32_t(1) << i)) && world.player[i].used)
+            cidMask |= uint32_t(1) << world.player[i].cid;
+    server->multicast_message(cidMask, data);
+}
+
 void ServerNetworking::broadcast_message(ConstDataBlockRef data) const throw () {
+    multicast_message(0xFFFFFFFF, data);
+}
+
+uint32_t ServerNetworking::extendedPlayers() const throw () {
+    uint32_t mask = 0;
     for (int i = 0; i < maxplayers; ++i)
-        if (world.player[i].used)
-            server->send_message(world.player[i].cid, data);
+        if (world.player[i].used && world.player[i].protocolExtensionsLevel >= 0)
+            mask |= uint32_t(1) << i;
+    return mask;
+}
+
+void ServerNetworking::broadcast_message(ConstDataBlockRef extData, ConstDataBlockRef oldData) const throw () {
+    const uint32_t extMask = extendedPlayers();
+    multicast_message(extMask, extData);
+    multicast_message(~extMask, oldData);
 }
 
 void ServerNetworking::send_simple_message(Network_data_code code, int pid) const throw () {
@@ -294,12 +317,12 @@ void ServerNetworking::send_acceleration_modes(int pid) const throw () {
     BinaryBuffer<10> msg;
     msg.U8(data_acceleration_modes);
     msg.U32(accelerationModeMask);
-    if (pid != pid_all)
+    if (pid == pid_record)
+        record_message(msg);
+    else if (pid != pid_all)
         server->send_message(world.player[pid].cid, msg);
     else {
-        for (int i = 0; i < maxplayers; ++i)
-            if (world.player[i].used && world.player[i].protocolExtensionsLevel >= 0)
-                server->send_message(world.player[i].cid, msg);
+        multicast_message(extendedPlayers(), msg);
         record_message(msg);
     }
 }
@@ -308,12 +331,12 @@ void ServerNetworking::send_flag_modes(int pid) const throw () {
     BinaryBuffer<10> msg;
     msg.U8(data_flag_modes);
     msg.U8(flagModeMask);
-    if (pid != pid_all)
+    if (pid == pid_record)
+        record_message(msg);
+    else if (pid != pid_all)
         server->send_message(world.player[pid].cid, msg);
     else {
-        for (int i = 0; i < maxplayers; ++i)
-            if (world.player[i].used && world.player[i].protocolExtensionsLevel >= 0)
-                server->send_message(world.player[i].cid, msg);
+        multicast_message(extendedPlayers(), msg);
         record_message(msg);
     }
 }
@@ -585,6 +608,36 @@ void ServerNetworking::record_players_present() const throw () {
     record_message(msg);
 }
 
+// Record everything a replay viewer needs to continue from the current frame without the preceding ones, except the map.
+void ServerNetworking::record_keyframe() throw () {
+    send_server_settings(pid_record);
+    send_acceleration_modes(pid_record);
+    send_flag_modes(pid_record);
+    record_players_present();
+    for (int i = 0; i < maxplayers; i++)
+        if (world.player[i].used) {
+            send_player_crap_update(pid_record, i);
+            send_player_name_update(pid_record, i);
+            send_stats(world.player[i], pid_record);
+        }
+    for (int t = 0; t < 2; ++t) {
+        BinaryBuffer<64> msg;
+        msg.U8(data_score_update);
+        msg.U8(t);
+        msg.U32dyn8(world.teams[t].score());
+        record_message(msg);
+    }
+    for (int t = 0; t < 3; ++t)
+        ctf_net_flag_status(pid_record, t);
+    for (int i = 0; i < MAX_POWERUPS; ++i)
+        if (world.item[i].kind <= Powerup::pup_last_real)
+            sendPowerupVisible(pid_record, i, world.item[i]);
+    for (int i = 0; i < MAX_ROCKETS; ++i)
+        if (world.rock[i].owner != -1)
+            sendOldRocketVisible(pid_record, i, world.rock[i]);
+    send_map_time(pid_record);
+}
+
 void ServerNetworking::broadcast_new_player(const ServerPlayer& player) const throw () {
     BinaryBuffer<64> msg;
     msg.U8(data_new_player);
@@ -635,9 +688,7 @@ void ServerNetworking::broadcast_movements_and_shots(const ServerPlayer& player)
     ext_msg.U32dyn16(stats.shots());
     ext_msg.U32dyn16(stats.hits());
     ext_msg.U32dyn16(stats.shots_taken());
-    for (int i = 0; i < maxplayers; i++)
-        if (world.player[i].used)
-            server->send_message(world.player[i].cid, world.player[i].protocolExtensionsLevel >= 0 ? ext_msg : old_msg);
+    broadcast_message(ext_msg, old_msg);
     record_message(ext_msg);
 }
 
@@ -782,6 +833,8 @@ void ServerNetworking::send_map_time(int cid) const throw () {
         broadcast_message(msg);
         record_message(msg);
     }
+    else if (cid == pid_record)
+        record_message(msg);
     else
         server->send_message(cid, msg);
 }
@@ -880,12 +933,12 @@ void ServerNetworking::broadcast_team_message(int team, const string& text) cons
     const ConstDataBlockRef oldProtocolMsg = msg;
     msg.S8(team);
 
+    uint32_t extMask = 0, oldMask = 0;
     for (int i = 0; i < maxplayers; i++)
         if (world.player[i].used && i / TSIZE == team)  // only to teammates
-            if (world.player[i].protocolExtensionsLevel >= 0)
-                server->send_message(world.player[i].cid, msg);
-            else
-                server->send_message(world.player[i].cid, oldProtocolMsg);
+            (world.player[i].protocolExtensionsLevel >= 0 ? extMask : oldMask) |= uint32_t(1) << i;
+    multicast_message(extMask, msg);
+    multicast_message(oldMask, oldProtocolMsg);
 
     record_message(msg);
 
@@ -901,9 +954,11 @@ void ServerNetworking::broadcast_team_message(int team, const string& text) cons
 
 //broadcast message to all players in one screen
 void ServerNetworking::broadcast_screen_message(int px, int py, ConstDataBlockRef msg) const throw () {
+    uint32_t mask = 0;
     for (int i = 0; i < maxplayers; i++)
         if (world.player[i].used && world.player[i].roomx == px && world.player[i].roomy == py)
-            server->send_message(world.player[i].cid, msg);
+            mask |= uint32_t(1) << i;
+    multicast_message(mask, msg);
 
     if (host->recording_active()) {
         BinaryWriter& writer = host->recordMessageWriter();
@@ -957,12 +1012,7 @@ void ServerNetworking::player_message(int pid, Message_type type, const string&
             }
         }
         else if (pid == pid_all) {
-            for (int i = 0; i < maxplayers; ++i)
-                if (world.player[i].used)
-                    if (world.player[i].protocolExtensionsLevel >= 0)
-                        server->send_message(world.player[i].cid, msg);
-                    else
-                        server->send_message(world.player[i].cid, oldProtocolMsg); // don't send the possible team info
+            broadcast_message(msg, oldProtocolMsg); // don't send the possible team info to unextended clients
             record_message(msg);
         }
         else if (world.player[pid].protocolExtensionsLevel >= 0)
@@ -1007,9 +1057,7 @@ void ServerNetworking::send_map_change_message(int pid, int reason, const char*
         if (pid == pid_record)
             record_message(ext_msg);
         else if (pid == pid_all) {
-            for (int i = 0; i < maxplayers; i++)
-                if (world.player[i].used)
-                    server->send_message(world.player[i].cid, world.player[i].protocolExtensionsLevel >= 0 ? ext_msg : old_msg);
+            broadcast_message(ext_msg, old_msg);
             record_message(ext_msg);
         }
         else
@@ -1093,9 +1141,7 @@ void ServerNetworking::broadcast_mute_message(int pid, int mode, const string& a
     msg.U8(mode);
     msg.str(admin);
 
-    for (int i = 0; i < maxplayers; i++)
-        if (world.player[i].used && (inform_target || i != pid))
-            server->send_message(world.player[i].cid, msg);
+    multicast_message(inform_target ? 0xFFFFFFFF : ~(uint32_t(1) << pid), msg);
 }
 
 void ServerNetworking::broadcast_kick_message(int pid, int minutes, const string& admin) const throw () {
@@ -1200,6 +1246,8 @@ bool ServerNetworking::start() throw () {
     mjob_exit = false;              //flag for all pending master jobs to quit now
     mjob_fastretry = false;     //flag for all pending master jobs to stop waiting and retry immediately
 
+    publishStatus();    // the threads started below expect a snapshot
+
     //start TCP shell master thread in the port number 500 less than server UDP port
     shellmthread.start_assert("ServerNetworking::run_shellmaster_thread",
                               RedirectToMemFun1<ServerNetworking, void, int>(this, &ServerNetworking::run_shellmaster_thread), settings.get_srvmonit_port(),
@@ -1290,6 +1338,8 @@ int ServerNetworking::client_connected(int id, int customStoredData) throw () {
     nAssert(myself != -1);
     const int cid = id;
     ctop[cid] = myself;
+    nAssert(cid < MAX_PLAYERS);
+    sentFrames[cid].release();  // the packet ids of the new connection start over
 
     // send players_present before "myself" is present, so new_player can be broadcast to "myself" too
     uint32_t players_present = 0;
@@ -1453,6 +1503,7 @@ void ServerNetworking::client_disconnected(int id) throw () {
     freedUniqueIds.push(make_pair(world.player[pid].uniqueId, get_time() + 5 * 60.));
 
     fileTransfer[id].reset();
+    sentFrames[id].release();
     host->game_remove_player(pid, true);
     --player_count;
     if (was_bot)
@@ -1668,6 +1719,8 @@ bool ServerNetworking::processMessage(int pid, ConstDataBlockRef data) throw ()
     }
     break; case data_set_minimap_player_bandwidth:
         sender.minimapPlayersPerFrame = msg.U8();
+    break; case data_frame_baseline_missing:
+        sentFrames[sender.cid].clear();    // send full frames until one of them is acknowledged
     break; default:
         if (code < data_reserved_range_first || code > data_reserved_range_last) {
             log("Invalid message code: %i, length %i.", code, data.size());
@@ -1760,12 +1813,68 @@ void ServerNetworking::sendStartGame() const throw () {
     send_map_time(pid_all);
 }
 
-void ServerNetworking::writeMinimapPlayerPosition(BinaryWriter& writer, int pid) const throw () {
+void ServerNetworking::minimapPlayerPosition(int pid, uint8_t& x, uint8_t& y) const throw () {
     nAssert(world.player[pid].used);
     const int xmul = 255 / world.map.w;
     const int ymul = 255 / world.map.h;
-    writer.U8(world.player[pid].roomx * xmul + static_cast<uint8_t>(xmul * (world.player[pid].lx - 1e-5) / plw));
-    writer.U8(world.player[pid].roomy * ymul + static_cast<uint8_t>(ymul * (world.player[pid].ly - 1e-5) / plh));
+    x = world.player[pid].roomx * xmul + static_cast<uint8_t>(xmul * (world.player[pid].lx - 1e-5) / plw);
+    y = world.player[pid].roomy * ymul + static_cast<uint8_t>(ymul * (world.player[pid].ly - 1e-5) / plh);
+}
+
+void ServerNetworking::writeMinimapPlayerPosition(FastBinaryWriter<false>& writer, int pid) const throw () {
+    uint8_t x, y;
+    minimapPlayerPosition(pid, x, y);
+    writer.U8(x);
+    writer.U8(y);
+}
+
+uint32_t ServerNetworking::chooseMinimapPlayers(ServerPlayer& recipient, uint32_t P, int& sendBoundary, int& bits) const throw () {
+    for (int pi = 0; pi < maxplayers; ++pi)
+        if (world.player[pi].roomx == recipient.roomx && world.player[pi].roomy == recipient.roomy)
+            P &= ~(uint32_t(1) << pi);
+    const unsigned maxPlayers = min(settings.minimapSendLimit(), recipient.minimapPlayersPerFrame);
+    sendBoundary = bits = 0;
+    if (P == 0 || maxPlayers == 0)
+        return 0;
+    int nextPlayer = recipient.nextMinimapPlayer;
+    while ((P & (uint32_t(1) << nextPlayer)) == 0)
+        nextPlayer = (nextPlayer + 1) % MAX_PLAYERS;
+    sendBoundary = nextPlayer & ~3;
+    const uint32_t rotP = rotateRight(P, sendBoundary);
+    nextPlayer -= sendBoundary; // now nextPlayer is relative to rotP
+    uint32_t chosen = 0;
+    unsigned nChosen = 0;
+    for (bits = nextPlayer; bits < 32 && nChosen < maxPlayers; ++bits) {
+        if (rotP >> bits == 0)
+            break;
+        if ((rotP >> bits) & 1) {
+            chosen |= uint32_t(1) << (bits + sendBoundary) % 32;
+            ++nChosen;
+        }
+    }
+    recipient.nextMinimapPlayer = (sendBoundary + bits) % 32;
+    return chosen;
+}
+
+void ServerNetworking::makeFramePlayerRecord(FramePlayerRecord& r, const ServerPlayer& h, bool preciseGundir) const throw () {
+    typedef SignedByteFloat<3, -2> SpeedType;
+    r.lx = h.lx;
+    r.ly = h.ly;
+    r.dead = h.dead;
+    r.deathbringer = h.item_deathbringer;
+    r.deathbringerAffected = h.deathbringer_end > get_time();
+    r.shield = h.item_shield;
+    r.turbo = h.item_turbo;
+    r.power = h.item_power;
+    r.preciseGundir = preciseGundir;
+    r.gundir = preciseGundir ? h.gundir.toNetworkLongForm() : h.gundir.toNetworkShortForm();
+    if (h.dead)
+        return; // speed, controls and visibility are left at the defaults, like the client decodes them
+    r.speedX = SpeedType::toByte(h.sx);
+    r.speedY = SpeedType::toByte(h.sy);
+    r.controls = h.controls.toNetwork(true);
+    const bool safeAfterSpawn = world.frame < h.start_take_damage_frame;
+    r.visibility = safeAfterSpawn ? (world.frame & 2 ? 128 : 220) : h.visibility;
 }
 
 //simulate and broadcast frame
@@ -1863,6 +1972,8 @@ void ServerNetworking::broadcast_frame(bool gameRunning) throw () {
     }
 
     const unsigned commonDataSize = frame.size();
+    // the maximum amount of data per recipient: prediction sync, xtra, room, players_onscreen, 10 bytes per player, minimap, health, energy, ping
+    const unsigned maxRecipientData = 3 + 2 + 4 + MAX_PLAYERS * 10 + 5 + MAX_PLAYERS * 2 + 2 + 2;
 
     // ==================================================================
     //   BUILD AND SEND EVERY DAMN PACKET
@@ -1875,13 +1986,17 @@ void ServerNetworking::broadcast_frame(bool gameRunning) throw () {
 
         // start writing at end of common data
         frame.setPosition(commonDataSize);
+        FastBinaryWriter<false> out(frame); // the maximum size of the rest is reserved here, so no per-field checks are needed
+        out.reserve(maxRecipientData);
 
         // first send client prediction synchronization data
-        frame.U8(recipient.lastClientFrame);
+        out.U8(recipient.lastClientFrame);
 
-        frame.U8(static_cast<uint8_t>(bound<double>(recipient.frameOffset, 0., .999) * 256.));
+        out.U8(static_cast<uint8_t>(bound<double>(recipient.frameOffset, 0., .999) * 256.));
 
         const bool skip_frame = recipient.awaiting_client_readies || !gameRunning;
+        FrameBody fb;   // filled in for clients at protocol extensions level 1 and up
+        bool deltaBody = false; // fb is stored as a baseline after sending
 
         // first byte: player ID, tob bits of health and energy and a bit telling if the rest of the frame is skipped
         uint8_t xtra = i << 3;
@@ -1891,201 +2006,212 @@ void ServerNetworking::broadcast_frame(bool gameRunning) throw () {
             xtra |= 2;
         if (skip_frame)
             xtra |= 4;
-        frame.U8(xtra);
+        out.U8(xtra);
 
         // send almost empty frame if client not ready (leave bandwidth for data transfer) or if server showing gameover plaque
         if (!skip_frame) {
             // 2 bytes with the screen of self
-            frame.U8(recipient.roomx);
-            frame.U8(recipient.roomy);
-
-            // player data field to indicate which players are on screen (and therefore sent on the frame)
-            uint32_t players_onscreen = 0;
-
-            // players_onscreen will be written here in the end
-            const unsigned players_onscreen_position = frame.getPosition();
-            frame.U32(0);
-
-            for (int j = 0; j < maxplayers; j++) {
-                const ServerPlayer& h = world.player[j];
-                // player j exists, in same room, visible or in same team or has a flag
-                if (h.used && h.roomx == recipient.roomx && h.roomy == recipient.roomy && (h.visibility > 0 || i / TSIZE == j / TSIZE || h.stats().has_flag())) {
-                    players_onscreen |= (1 << j);
-
-                    // position in 3 bytes
-                    uint8_t xy;
-                    uint16_t hx, hy;
-                    hx = static_cast<uint16_t>(h.lx * (double(0xFFF) / plw) + .5);
-                    hy = static_cast<uint16_t>(h.ly * (double(0xFFF) / plh) + .5);
-                    xy = static_cast<uint8_t>(hx & 0x0FF);
-                    frame.U8(xy);
-                    xy = static_cast<uint8_t>(hy & 0x0FF);
-                    frame.U8(xy);
-                    xy = static_cast<uint8_t>( ((hx & 0xF00) >> 8) | ((hy & 0xF00) >> 4) );
-                    frame.U8(xy);
-
-                    if (recipient.protocolExtensionsLevel < 0) {
-                        // speed in 2 bytes
-                        typedef SignedByteFloat<3, -2> SpeedType;   // exponent from -2 to +6, with 4 significant bits -> epsilon = .25, max representable 32 * 31 = enough :)
-                        frame.U8(SpeedType::toByte(h.sx));
-                        frame.U8(SpeedType::toByte(h.sy));
-                    }
+            out.U8(recipient.roomx);
+            out.U8(recipient.roomy);
 
-                    // flags in 1 byte : dead, has deathbringer, deathbringer-affected, has shield, has turbo, has power
-                    uint8_t extra = 0;
-                    if (h.dead)
-                        extra |= 1;
-                    if (h.item_deathbringer)
-                        extra |= 2;
-                    if (h.deathbringer_end > get_time())
-                        extra |= 4;
-                    if (h.item_shield)
-                        extra |= 8;
-                    if (h.item_turbo)
-                        extra |= 16;
-                    if (h.item_power)
-                        extra |= 32;
-                    const bool preciseGundir = recipient.protocolExtensionsLevel >= 0 && world.physics.allowFreeTurning;
-                    if (preciseGundir)
-                        extra |= 64;
-                    frame.U8(extra);
-
-                    if (!h.dead && recipient.protocolExtensionsLevel >= 0) { // for unextended clients, speed was sent before the extra byte
-                        // speed in 2 bytes
-                        typedef SignedByteFloat<3, -2> SpeedType;   // exponent from -2 to +6, with 4 significant bits -> epsilon = .25, max representable 32 * 31 = enough :)
-                        frame.U8(SpeedType::toByte(h.sx));
-                        frame.U8(SpeedType::toByte(h.sy));
-                    }
+            const bool preciseGundir = recipient.protocolExtensionsLevel >= 0 && world.physics.allowFreeTurning;
 
-                    // controls and gundirection in 1 byte
-                    uint8_t ccb;
-                    if (!h.dead) // if dead player, don't send keys
-                        ccb = h.controls.toNetwork(true);
-                    else
-                        ccb = ClientControls().toNetwork(true);
-                    if (preciseGundir) {
-                        const uint16_t gundir = h.gundir.toNetworkLongForm();
-                        ccb |= (gundir >> 8) << 5;
-                        frame.U8(ccb);
-                        ccb = gundir & 0xFF;
-                        frame.U8(ccb);
-                    }
-                    else {
-                        ccb |= h.gundir.toNetworkShortForm() << 5;
-                        frame.U8(ccb);
+            if (recipient.protocolExtensionsLevel >= 1) { // the rest of the frame is bit-packed as described in framecodec.h
+                for (int j = 0; j < maxplayers; j++) {
+                    const ServerPlayer& h = world.player[j];
+                    if (h.used && h.roomx == recipient.roomx && h.roomy == recipient.roomy && (h.visibility > 0 || i / TSIZE == j / TSIZE || h.stats().has_flag())) {
+                        fb.playersOnscreen |= uint32_t(1) << j;
+                        makeFramePlayerRecord(fb.player[j], h, preciseGundir);
                     }
-
-                    if (!h.dead || recipient.protocolExtensionsLevel < 0) {
-                        // visibility in 1 byte
-                        const bool safeAfterSpawn = world.frame < h.start_take_damage_frame;
-                        if (safeAfterSpawn)
-                            frame.U8(world.frame & 2 ? 128 : 220);
+                }
+                int sendBoundary, bits;
+                fb.minimap.players = chooseMinimapPlayers(recipient, (recipient.item_shadow() ? shadowView : normalView)[i / TSIZE], sendBoundary, bits);
+                for (int j = 0; j < maxplayers; ++j)
+                    if (fb.minimap.players & (uint32_t(1) << j))
+                        minimapPlayerPosition(j, fb.minimap.x[j], fb.minimap.y[j]);
+                nAssert(recipient.health >= 0);
+                nAssert((recipient.health == 0) == recipient.dead);
+                nAssert(recipient.energy >= 0);
+                fb.health8 = iround(recipient.health) & 255;
+                fb.energy8 = iround(recipient.energy) & 255;
+                fb.pingSent = world.player[world.frame % maxplayers].used;
+                fb.ping = static_cast<uint16_t>(world.player[world.frame % maxplayers].ping);
+                const FrameBody* baseline = 0;
+                if (recipient.protocolExtensionsLevel >= 2) {
+                    // delta code against the newest frame the client is known to have received, if it's recent enough
+                    uint32_t baselineFrame;
+                    baseline = sentFrames[recipient.cid].findPacket(server->get_client_acked_packet(recipient.cid), baselineFrame);
+                    if (baseline && (baselineFrame >= world.frame || world.frame - baselineFrame >= FrameHistory::size))
+                        baseline = 0;
+                    out.U8(baseline ? world.frame - baselineFrame : 0);
+                    deltaBody = true;
+                }
+                BitEncoder<FastBinaryWriter<false> > enc(out);
+                codeFrameBody(enc, static_cast<const FrameBody&>(fb), maxplayers, baseline);
+            }
+            else {
+                // player data field to indicate which players are on screen (and therefore sent on the frame)
+                uint32_t players_onscreen = 0;
+
+                // players_onscreen will be written here in the end
+                const unsigned players_onscreen_position = out.getPosition();
+                out.U32(0);
+
+                for (int j = 0; j < maxplayers; j++) {
+                    const ServerPlayer& h = world.player[j];
+                    // player j exists, in same room, visible or in same team or has a flag
+                    if (h.used && h.roomx == recipient.roomx && h.roomy == recipient.roomy && (h.visibility > 0 || i / TSIZE == j / TSIZE || h.stats().has_flag())) {
+                        players_onscreen |= (1 << j);
+
+                        // position in 3 bytes
+                        uint8_t xy;
+                        uint16_t hx, hy;
+                        hx = static_cast<uint16_t>(h.lx * (double(0xFFF) / plw) + .5);
+                        hy = static_cast<uint16_t>(h.ly * (double(0xFFF) / plh) + .5);
+                        xy = static_cast<uint8_t>(hx & 0x0FF);
+                        out.U8(xy);
+                        xy = static_cast<uint8_t>(hy & 0x0FF);
+                        out.U8(xy);
+                        xy = static_cast<uint8_t>( ((hx & 0xF00) >> 8) | ((hy & 0xF00) >> 4) );
+                        out.U8(xy);
+
+                        if (recipient.protocolExtensionsLevel < 0) {
+                            // speed in 2 bytes
+                            typedef SignedByteFloat<3, -2> SpeedType;   // exponent from -2 to +6, with 4 significant bits -> epsilon = .25, max representable 32 * 31 = enough :)
+                            out.U8(SpeedType::toByte(h.sx));
+                            out.U8(SpeedType::toByte(h.sy));
+                        }
+
+                        // flags in 1 byte : dead, has deathbringer, deathbringer-affected, has shield, has turbo, has power
+                        uint8_t extra = 0;
+                        if (h.dead)
+                            extra |= 1;
+                        if (h.item_deathbringer)
+                            extra |= 2;
+                        if (h.deathbringer_end > get_time())
+                            extra |= 4;
+                        if (h.item_shield)
+                            extra |= 8;
+                        if (h.item_turbo)
+                            extra |= 16;
+                        if (h.item_power)
+                            extra |= 32;
+                        if (preciseGundir)
+                            extra |= 64;
+                        out.U8(extra);
+
+                        if (!h.dead && recipient.protocolExtensionsLevel >= 0) { // for unextended clients, speed was sent before the extra byte
+                            // speed in 2 bytes
+                            typedef SignedByteFloat<3, -2> SpeedType;   // exponent from -2 to +6, with 4 significant bits -> epsilon = .25, max representable 32 * 31 = enough :)
+                            out.U8(SpeedType::toByte(h.sx));
+                            out.U8(SpeedType::toByte(h.sy));
+                        }
+
+                        // controls and gundirection in 1 byte
+                        uint8_t ccb;
+                        if (!h.dead) // if dead player, don't send keys
+                            ccb = h.controls.toNetwork(true);
                         else
-                            frame.U8(h.visibility);
+                            ccb = ClientControls().toNetwork(true);
+                        if (preciseGundir) {
+                            const uint16_t gundir = h.gundir.toNetworkLongForm();
+                            ccb |= (gundir >> 8) << 5;
+                            out.U8(ccb);
+                            ccb = gundir & 0xFF;
+                            out.U8(ccb);
+                        }
+                        else {
+                            ccb |= h.gundir.toNetworkShortForm() << 5;
+                            out.U8(ccb);
+                        }
+
+                        if (!h.dead || recipient.protocolExtensionsLevel < 0) {
+                            // visibility in 1 byte
+                            const bool safeAfterSpawn = world.frame < h.start_take_damage_frame;
+                            if (safeAfterSpawn)
+                                out.U8(world.frame & 2 ? 128 : 220);
+                            else
+                                out.U8(h.visibility);
+                        }
                     }
                 }
-            }
 
-            // write players_onscreen in its place (reserved before the above loop)
-            {
-                const unsigned pos = frame.getPosition();
-                frame.setPosition(players_onscreen_position);
-                frame.U32(players_onscreen);
-                frame.setPosition(pos);
-            }
-
-            /* minimap player position protocol:
-             * old protocol:
-             *  2 * {
-             *        byte1 = 255 -> no info
-             *        byte1 in [0, 31] ->
-             *          byte2,
-             *          byte3 = coords of player byte1
-             *  }
-             * extended protocol:
-             *  P = bitmask indicating visible players (32 bits long)
-             *  to use the minimum amount of bytes, we use
-             *   - 3 bits to indicate which 4-bit boundary the sent data begins from
-             *   - 2 bits to tell how many extra bytes of mask are sent (1..4)
-             *  this leaves us with free 3 bits in byte1 which we use to start the mask with
-             *
-             *  byte1 & 0xE0 == 4-bit boundary of P to start from
-             *  byte1 & 0x18 == extra byte count - 1
-             *  byte1 & 0x07 == first 3 bits of P
-             *  extra byte count *
-             *    byte == next 8 bits of P
-             *  for each sent bit of P that's set {
-             *    byte1,
-             *    byte2 = coords of the player
-             *  }
-             */
-            if (recipient.protocolExtensionsLevel >= 0) {
-                uint32_t P = (recipient.item_shadow() ? shadowView : normalView)[i / TSIZE];
-                for (int pi = 0; pi < maxplayers; ++pi)
-                    if (world.player[pi].roomx == recipient.roomx && world.player[pi].roomy == recipient.roomy)
-                        P &= ~(uint32_t(1) << pi);
-                const unsigned maxPlayers = min(settings.minimapSendLimit(), recipient.minimapPlayersPerFrame);
-                if (P == 0 || maxPlayers == 0) {
-                    frame.U8(0x00); // start from bit 0 (irrelevant), only 1 (mandatory) extra byte
-                    frame.U8(0x00);
+                // write players_onscreen in its place (reserved before the above loop)
+                {
+                    const unsigned pos = out.getPosition();
+                    out.setPosition(players_onscreen_position);
+                    out.U32(players_onscreen);
+                    out.setPosition(pos);
                 }
-                else {
-                    int nextPlayer = recipient.nextMinimapPlayer;
-                    while ((P & (uint32_t(1) << nextPlayer)) == 0)
-                        nextPlayer = (nextPlayer + 1) % MAX_PLAYERS;
-                    const int sendBoundary = nextPlayer & ~3;
-                    uint32_t rotP = rotateRight(P, sendBoundary);
-                    nextPlayer -= sendBoundary; // now nextPlayer is relative to rotP
-                    rotP &= ~uint32_t(0) << nextPlayer;
-                    vector<int> players;
-                    players.reserve(maxPlayers);
-                    int bits;
-                    for (bits = nextPlayer; bits < 32 && players.size() < maxPlayers; ++bits) {
-                        if (rotP >> bits == 0)
-                            break;
-                        if ((rotP >> bits) & 1)
-                            players.push_back((bits + sendBoundary) % 32);
-                    }
-                    recipient.nextMinimapPlayer = (sendBoundary + bits) % 32;
-                    rotP &= ~uint32_t(0) >> (32 - bits);
+
+                /* minimap player position protocol:
+                 * old protocol:
+                 *  2 * {
+                 *        byte1 = 255 -> no info
+                 *        byte1 in [0, 31] ->
+                 *          byte2,
+                 *          byte3 = coords of player byte1
+                 *  }
+                 * extended protocol, level 0 (level 1 sends P and the coords bit-packed, see framecodec.h):
+                 *  P = bitmask indicating visible players (32 bits long)
+                 *  to use the minimum amount of bytes, we use
+                 *   - 3 bits to indicate which 4-bit boundary the sent data begins from
+                 *   - 2 bits to tell how many extra bytes of mask are sent (1..4)
+                 *  this leaves us with free 3 bits in byte1 which we use to start the mask with
+                 *
+                 *  byte1 & 0xE0 == 4-bit boundary of P to start from
+                 *  byte1 & 0x18 == extra byte count - 1
+                 *  byte1 & 0x07 == first 3 bits of P
+                 *  extra byte count *
+                 *    byte == next 8 bits of P
+                 *  for each sent bit of P that's set {
+                 *    byte1,
+                 *    byte2 = coords of the player
+                 *  }
+                 */
+                if (recipient.protocolExtensionsLevel >= 0) {
+                    int sendBoundary, bits;
+                    const uint32_t chosen = chooseMinimapPlayers(recipient, (recipient.item_shadow() ? shadowView : normalView)[i / TSIZE], sendBoundary, bits);
+                    uint32_t rotP = rotateRight(chosen, sendBoundary);
                     const int extraBytes = max(1, (bits - 3 + 7) / 8);
-                    frame.U8(((sendBoundary / 4) << 5) | ((extraBytes - 1) << 3) | (rotP & 7));
-                    rotP >>= 3;
-                    for (int eb = 0; eb < extraBytes; ++eb) {
-                        frame.U8(rotP & 0xFF);
-                        rotP >>= 8;
-                    }
-                    for (vector<int>::const_iterator pi = players.begin(); pi != players.end(); ++pi)
-                        writeMinimapPlayerPosition(frame, *pi);
+                    out.U8(((sendBoundary / 4) << 5) | ((extraBytes - 1) << 3) | (rotP & 7));
+                    for (int eb = 0, shift = 3; eb < extraBytes; ++eb, shift += 8)
+                        out.U8((rotP >> shift) & 0xFF);
+                    for (int pi = sendBoundary; rotP; pi = (pi + 1) % 32, rotP >>= 1)
+                        if (rotP & 1)
+                            writeMinimapPlayerPosition(out, pi);
                 }
-            }
-            else
-                for (int round = 0; round < 2; ++round) {
-                    const int who = (recipient.item_shadow() ? shadowIters : normalIters)[i / TSIZE][round];
-                    if (who == -1)
-                        frame.U8(255);
-                    else {
-                        frame.U8(who);
-                        writeMinimapPlayerPosition(frame, who);
+                else
+                    for (int round = 0; round < 2; ++round) {
+                        const int who = (recipient.item_shadow() ? shadowIters : normalIters)[i / TSIZE][round];
+                        if (who == -1)
+                            out.U8(255);
+                        else {
+                            out.U8(who);
+                            writeMinimapPlayerPosition(out, who);
+                        }
                     }
-                }
 
-            // send 8 bits of player's health
-            nAssert(recipient.health >= 0);
-            nAssert((recipient.health == 0) == recipient.dead);
-            frame.U8(iround(recipient.health) & 255);
+                // send 8 bits of player's health
+                nAssert(recipient.health >= 0);
+                nAssert((recipient.health == 0) == recipient.dead);
+                out.U8(iround(recipient.health) & 255);
 
-            // send 8 bits of player's energy
-            nAssert(recipient.energy >= 0);
-            frame.U8(iround(recipient.energy) & 255);
+                // send 8 bits of player's energy
+                nAssert(recipient.energy >= 0);
+                out.U8(iround(recipient.energy) & 255);
 
-            // ping of player frame# % maxplayers
-            if (recipient.protocolExtensionsLevel < 0 || world.player[world.frame % maxplayers].used)
-                frame.U16(static_cast<uint16_t>(world.player[world.frame % maxplayers].ping));
+                // ping of player frame# % maxplayers
+                if (recipient.protocolExtensionsLevel < 0 || world.player[world.frame % maxplayers].used)
+                    out.U16(static_cast<uint16_t>(world.player[world.frame % maxplayers].ping));
+            }
         }
+        out.commit();
 
         //send the packet
-        server->send_frame(recipient.cid, frame);
+        const uint32_t packetId = server->send_frame(recipient.cid, frame);
+        if (deltaBody)
+            sentFrames[recipient.cid].store(world.frame, packetId, fb);
 
         //send server map list if not sent yet
         if (recipient.current_map_list_item < host->maplist().size() && world.frame % 2 == 0) {
@@ -2119,6 +2245,42 @@ void ServerNetworking::broadcast_frame(bool gameRunning) throw () {
     frameSentTime = get_time();
 }
 
+int ServerNetworking::StatusSnapshot::pidOfCid(uint32_t cid) const throw () {
+    for (int i = 0; i < MAX_PLAYERS; ++i)
+        if (player[i].used && player[i].cid == static_cast<int>(cid))
+            return i;
+    return -1;
+}
+
+void ServerNetworking::publishStatus() throw () {
+    StatusSnapshot status;
+    for (int i = 0; i < maxplayers; ++i) {
+        const ServerPlayer& h = world.player[i];
+        if (!h.used)
+            continue;
+        StatusSnapshot::Player& p = status.player[i];
+        p.used = true;
+        p.cid = h.cid;
+        p.name = h.name;
+        p.ping = h.ping;
+        p.frags = h.stats().frags();
+        p.kills = h.stats().kills();
+        p.deaths = h.stats().deaths();
+        p.captures = h.stats().captures();
+        p.startTime = h.stats().start_time();
+    }
+    status.humans = get_human_count();
+    status.bots = bot_count;
+    status.frame = world.frame;
+    status.mapTitle = host->current_map().title;
+    status.mapFile = host->getCurrentMapFile();
+    status.freeTurning = world.physics.allowFreeTurning;
+    status.friendlyFire = world.physics.friendly_fire > 0;
+    status.powerups = world.getPupConfig().pups_min > 0;
+    status.relayActive = is_relay_active();
+    statusSnapshot.publish(status);
+}
+
 double ServerNetworking::getTraffic() const throw () {
     return server->get_socket_stat(Network::Socket::Stat_AvgBytesReceived) + server->get_socket_stat(Network::Socket::Stat_AvgBytesSent);
 }
@@ -2464,9 +2626,10 @@ map<string, string> ServerNetworking::master_parameters(const string& address, b
     if (quitting)
         parameters["quit"] = "1";
     else {
+        const Published<StatusSnapshot>::Reader status(statusSnapshot);
         parameters["name"] = settings.get_hostname();
-        parameters["players"] = itoa(get_human_count());
-        parameters["bots"] = itoa(bot_count);
+        parameters["players"] = itoa(status->humans);
+        parameters["bots"] = itoa(status->bots);
         if (settings.dedicated())
             parameters["dedicated"] = "1";
         parameters["max_players"] = itoa(maxplayers);
@@ -2475,18 +2638,18 @@ map<string, string> ServerNetworking::master_parameters(const string& address, b
         if (longVersion != parameters["version"])
             parameters["long_version"] = longVersion;
         parameters["protocol"] = GAME_PROTOCOL;
-        parameters["uptime"] = itoa(world.frame / 10);
-        parameters["map"] = host->current_map().title;
+        parameters["uptime"] = itoa(status->frame / 10);
+        parameters["map"] = status->mapTitle;
         parameters["link"] = host->server_website();
         if (!settings.get_server_password().empty())
             parameters["password"] = "1";
-        if (world.physics.allowFreeTurning)
+        if (status->freeTurning)
             parameters["free_turning"] = "1";
-        if (world.physics.friendly_fire > 0)
+        if (status->friendlyFire)
             parameters["friendly_fire"] = "1";
-        if (world.getPupConfig().pups_min > 0)
+        if (status->powerups)
             parameters["powerups"] = "1";
-        if (is_relay_active())
+        if (status->relayActive)
             parameters["spectator"] = "1";
     }
     parameters["id"] = server_identification;
@@ -2494,12 +2657,13 @@ map<string, string> ServerNetworking::master_parameters(const string& address, b
 }
 
 map<string, string> ServerNetworking::website_parameters(const string& address) const throw () {
+    const Published<StatusSnapshot>::Reader status(statusSnapshot);
     map<string, string> parameters;
     parameters["name"] = settings.get_hostname();
     parameters["ip"] = address;
     parameters["port"] = itoa(settings.get_port());
-    parameters["players"] = itoa(get_human_count());
-    parameters["bots"] = itoa(bot_count);
+    parameters["players"] = itoa(status->humans);
+    parameters["bots"] = itoa(status->bots);
     if (settings.dedicated())
         parameters["dedicated"] = "1";
     parameters["max_players"] = itoa(maxplayers);
@@ -2507,25 +2671,25 @@ map<string, string> ServerNetworking::website_parameters(const string& address)
     const string longVersion = getVersionString();
     if (longVersion != parameters["version"])
         parameters["long_version"] = longVersion;
-    parameters["uptime"] = itoa(world.frame / 10);
-    parameters["map"] = host->current_map().title;
-    parameters["mapfile"] = host->getCurrentMapFile();
+    parameters["uptime"] = itoa(status->frame / 10);
+    parameters["map"] = status->mapTitle;
+    parameters["mapfile"] = status->mapFile;
     if (!settings.get_server_password().empty())
         parameters["password"] = "1";
-    if (world.physics.allowFreeTurning)
+    if (status->freeTurning)
         parameters["free_turning"] = "1";
-    if (world.physics.friendly_fire > 0)
+    if (status->friendlyFire)
         parameters["friendly_fire"] = "1";
-    if (world.getPupConfig().pups_min > 0)
+    if (status->powerups)
         parameters["powerups"] = "1";
-    if (is_relay_active())
+    if (status->relayActive)
         parameters["spectator"] = "1";
     string players;
-    for (int i = 0; i < maxplayers; i++)
-        if (world.player[i].used) {
+    for (int i = 0; i < MAX_PLAYERS; i++)
+        if (status->player[i].used) {
             if (!players.empty())
                 players += '\n';
-            players += world.player[i].name + '\t' + itoa(i / TSIZE) + '\t' + itoa(world.player[i].ping);
+            players += status->player[i].name + '\t' + itoa(i / TSIZE) + '\t' + itoa(status->player[i].ping);
         }
     parameters["playerlist"] = players;
     return parameters;
@@ -2541,6 +2705,15 @@ string ServerNetworking::website_maplist() const throw () {
     return maps.str();
 }
 
+string ServerNetworking::queryStatsText() const throw () {
+    const ServerQueryStats stats = server->get_query_stats();
+    ostringstream text;
+    text << stats.serverinfoReplies << " serverinfo replies, " << stats.rateLimited << " dropped by rate limits, "
+         << stats.slotsAllocated << " connection slots allocated, " << stats.cookiesSent << " cookie challenges sent, "
+         << stats.cookiesRejected << " bad cookies";
+    return text.str();
+}
+
 // read a string from a TCP stream, one char at a time; it doesn't tolerate breaks and is very slow but the admin shell system doesn't need more reliability
 bool ServerNetworking::read_string_from_TCP(Network::TCPSocket& sock, string& resultStr) throw (Network::ReadWriteError) {
     for (;;) {
@@ -2570,25 +2743,27 @@ void ServerNetworking::handleNewAdminShell(Thread& slaveThread, volatile bool& s
     log("Admin shell connection accepted");
 
     // tell about the current situation
+    const Published<StatusSnapshot>::Reader status(statusSnapshot);
     BinaryBuffer<4096> msg;
-    for (int i = 0; i < maxplayers; i++)
-        if (world.player[i].used) {
+    for (int i = 0; i < MAX_PLAYERS; i++)
+        if (status->player[i].used) {
+            const StatusSnapshot::Player& p = status->player[i];
             msg.U32(STA_PLAYER_CONNECTED);
-            msg.U32(world.player[i].cid);
+            msg.U32(p.cid);
 
             msg.U32(STA_PLAYER_NAME_UPDATE);
-            msg.U32(world.player[i].cid);
-            msg.str(world.player[i].name);
+            msg.U32(p.cid);
+            msg.str(p.name);
 
             msg.U32(STA_PLAYER_IP);
-            msg.U32(world.player[i].cid);
-            Network::Address addr = get_client_address(world.player[i].cid);
+            msg.U32(p.cid);
+            Network::Address addr = get_client_address(p.cid);
             addr.setPort(0);
             msg.str(addr.toString());
 
             msg.U32(STA_PLAYER_FRAGS);
-            msg.U32(world.player[i].cid);
-            msg.U32(world.player[i].stats().frags());
+            msg.U32(p.cid);
+            msg.U32(p.frags);
         }
     writeToAdminShell(msg);
 
@@ -2643,49 +2818,72 @@ void ServerNetworking::run_shellmaster_thread(int port) throw () {
 
 
 void ServerNetworking::executeAdminCommand(uint32_t code, uint32_t cid, int pid, uint32_t dwArg, BinaryWriter& answer) throw (Network::Error) {
-    Lock ml(threadLockMutex);
+    // queries are answered from the status snapshot without disturbing the game
+    const Published<StatusSnapshot>::Reader status(statusSnapshot);
+    if (pid != -1 && (!status->player[pid].used || status->player[pid].cid != static_cast<int>(cid)))    // a newer snapshot than the one pid was found in, without the player
+        return;
     switch (code) {
     /*break;*/ case ATS_GET_PLAYER_FRAGS:
             answer.U32(STA_PLAYER_FRAGS);
             answer.U32(cid);
-            answer.U32(world.player[pid].stats().frags());
-        break; case ATS_GET_PLAYER_TOTAL_TIME:
+            answer.U32(status->player[pid].frags);
+        return; case ATS_GET_PLAYER_TOTAL_TIME:
             answer.U32(STA_PLAYER_TOTAL_TIME);
             answer.U32(cid);
-            answer.U32(static_cast<unsigned>(get_time() - world.player[pid].stats().start_time()));
-        break; case ATS_GET_PLAYER_TOTAL_KILLS:
+            answer.U32(static_cast<unsigned>(get_time() - status->player[pid].startTime));
+        return; case ATS_GET_PLAYER_TOTAL_KILLS:
             answer.U32(STA_PLAYER_TOTAL_KILLS);
             answer.U32(cid);
-            answer.U32(world.player[pid].stats().kills());
-        break; case ATS_GET_PLAYER_TOTAL_DEATHS:
+            answer.U32(status->player[pid].kills);
+        return; case ATS_GET_PLAYER_TOTAL_DEATHS:
             answer.U32(STA_PLAYER_TOTAL_DEATHS);
             answer.U32(cid);
-            answer.U32(world.player[pid].stats().deaths());
-        break; case ATS_GET_PLAYER_TOTAL_CAPTURES:
+            answer.U32(status->player[pid].deaths);
+        return; case ATS_GET_PLAYER_TOTAL_CAPTURES:
             answer.U32(STA_PLAYER_TOTAL_CAPTURES);
             answer.U32(cid);
-            answer.U32(world.player[pid].stats().captures());
-        break; case ATS_SERVER_CHAT: {
-            string str;
-            read_string_from_TCP(shellssock, str);
-            if (str.empty())
-                break;
-            if (find_nonprintable_char(str))
+            answer.U32(status->player[pid].captures);
+        return; case ATS_GET_PINGS:
+            for (int p = 0; p < MAX_PLAYERS; ++p)
+                if (status->player[p].used) {
+                    answer.U32(STA_PLAYER_PING);
+                    answer.U32(status->player[p].cid);
+                    answer.U32(status->player[p].ping);
+                }
+        return; case ATS_GET_NET_STATS:
+            answer.U32(STA_NET_STATS);
+            answer.str(queryStatsText());
+        return; case ATS_GET_LOCK_PROFILE: {
+            vector<string> lines;
+            lockProfileReport(lines);
+            for (vector<string>::const_iterator li = lines.begin(); li != lines.end(); ++li) {
+                answer.U32(STA_LOCK_PROFILE);
+                answer.str(*li);
+            }
+        }
+        return; default: ;
+    }
+
+    string chat;
+    if (code == ATS_SERVER_CHAT) {
+        read_string_from_TCP(shellssock, chat);
+        if (chat.empty())
+            return;
+    }
+
+    Lock ml(threadLockMutex);
+    if (pid != -1 && (ctop[cid] != pid || !world.player[pid].used))   // the player has left since the snapshot
+        return;
+    switch (code) {
+    /*break;*/ case ATS_SERVER_CHAT:
+            if (find_nonprintable_char(chat))
                 log.error(_("Admin shell: unprintable characters, message ignored."));
-            else if (str[0] == '/')
-                host->chat(shell_pid, str);
+            else if (chat[0] == '/')
+                host->chat(shell_pid, chat);
             else {
-                bprintf(msg_normal, "ADMIN: %s", str.c_str());
-                host->logChat(shell_pid, str);
+                bprintf(msg_normal, "ADMIN: %s", chat.c_str());
+                host->logChat(shell_pid, chat);
             }
-        }
-        break; case ATS_GET_PINGS:
-            for (int p = 0; p < maxplayers; ++p)
-                if (world.player[p].used) {
-                    answer.U32(STA_PLAYER_PING);
-                    answer.U32(world.player[p].cid);
-                    answer.U32(world.player[p].ping);
-                }
         break; case ATS_MUTE_PLAYER:
             host->mutePlayer(pid, dwArg, shell_pid);
         break; case ATS_KICK_PLAYER:
@@ -2731,11 +2929,11 @@ bool ServerNetworking::handleAdminCommand() throw (Network::Error) {
     }
 
     uint32_t cid = 0;
-    int pid = 0;    // pid and cid set if argPid[code]
+    int pid = -1;   // pid and cid set if argPid[code]
     uint32_t dwArg = 0;  // set if argDw[code]
-    //                                      noop, get-functions,ch,qu,pi,kckbanmte,reset
-    static const int argPid[NUMBER_OF_ATS] = { 0, 1, 1, 1, 1, 1, 0, 0, 0, 1, 1, 1, 0 };
-    static const int argDw [NUMBER_OF_ATS] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0 };
+    //                                      noop, get-functions,ch,qu,pi,kckbanmte,reset,locks
+    static const int argPid[NUMBER_OF_ATS] = { 0, 1, 1, 1, 1, 1, 0, 0, 0, 1, 1, 1, 0, 0, 0 };
+    static const int argDw [NUMBER_OF_ATS] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0 };
     const int argsLen = (argPid[code] + argDw[code]) * 4;
 
     if (argsLen) {
@@ -2751,8 +2949,8 @@ bool ServerNetworking::handleAdminCommand() throw (Network::Error) {
                 log.error("Admin shell: bad client id");
                 return false;
             }
-            pid = ctop[cid];
-            if (pid == -1 || !world.player[pid].used)   // player not in the game; just ignore the command
+            pid = Published<StatusSnapshot>::Reader(statusSnapshot)->pidOfCid(cid);
+            if (pid == -1)  // player not in the game; just ignore the command
                 return true;
         }
         if (argDw[code])
@@ -2885,8 +3083,10 @@ void ServerNetworking::stop() throw () {
 
     settings.statusOutput()(_("Shutdown: net server"));
 
-    if (server)
+    if (server) {
+        log("Connectionless packets: %s", queryStatsText().c_str());
         server->stop(3);
+    }
     else
         nAssert(0);
 
@@ -2960,9 +3160,8 @@ void ServerNetworking::sendRocketMessage(int shots, GunDirection gundir, uint8_t
         msg.S16(x);
         msg.S16(y);
 
-        for (int i = 0; i < maxplayers; i++)
-            if ((vislist & (1 << i)) && ((iProto == 0) == (world.player[i].protocolExtensionsLevel == -1)))
-                server->send_message(world.player[i].cid, msg);
+        const uint32_t protoPlayers = iProto == 0 ? ~extendedPlayers() : extendedPlayers();
+        multicast_message(vislist & protoPlayers, msg);
 
         if (iProto == 1)
             record_message(msg);
@@ -2970,7 +3169,7 @@ void ServerNetworking::sendRocketMessage(int shots, GunDirection gundir, uint8_t
 }
 
 void ServerNetworking::sendOldRocketVisible(int pid, int rid, const Rocket& rocket) const throw () {
-    const bool preciseGundir = world.player[pid].protocolExtensionsLevel >= 0 && world.physics.allowFreeTurning;
+    const bool preciseGundir = (pid == pid_record || world.player[pid].protocolExtensionsLevel >= 0) && world.physics.allowFreeTurning;
     BinaryBuffer<256> msg;
     const uint8_t shotType = (rocket.team << 1) | rocket.power;
     msg.U8(data_old_rocket_visible);
@@ -2989,7 +3188,10 @@ void ServerNetworking::sendOldRocketVisible(int pid, int rid, const Rocket& rock
     msg.S16(static_cast<int>(rocket.x));
     msg.S16(static_cast<int>(rocket.y));
 
-    server->send_message(world.player[pid].cid, msg);
+    if (pid == pid_record)
+        record_message(msg);
+    else
+        server->send_message(world.player[pid].cid, msg);
 }
 
 void ServerNetworking::sendRocketDeletion(uint32_t plymask, int rid, int16_t hitx, int16_t hity, int targ) const throw () {
@@ -3003,9 +3205,7 @@ void ServerNetworking::sendRocketDeletion(uint32_t plymask, int rid, int16_t hit
     msg.S16(hity);
 
     //send message to players that received the rocket
-    for (int i = 0; i < maxplayers; i++)
-        if (world.player[i].used && (plymask & (1 << i)))
-            server->send_message(world.player[i].cid, msg);
+    multicast_message(plymask, msg);
 
     record_message(msg);
 }
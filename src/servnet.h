@@ -29,12 +29,14 @@
 #include <map>
 #include <queue>
 
+#include "framecodec.h"
 #include "mutex.h"
 #include "network.h"    // for NetworkResult
 #include "protocol.h"
 #include "thread.h"
 #include "utility.h"
 
+template<bool Checked> class FastBinaryWriter;
 class GunDirection;
 class MasterQuery;
 class Powerup;
@@ -146,6 +148,7 @@ private:
     std::string     server_identification;
     int             ping_send_client;
     int             ctop[256];          // client id-to-player id index
+    FrameHistory    sentFrames[MAX_PLAYERS]; // by client id: frame bodies sent to clients using delta coding
     int             player_count;       // number of players including bots
     int             bot_count;
     std::vector< std::pair<Network::Address, int> > distinctRemotePlayers;
@@ -159,6 +162,29 @@ private:
 
     int             maplist_revision;   // used by website thread to determine when to resend maplist
 
+    /// Summary of the game state for the admin shell, master talker and website threads, so that they needn't touch the game state.
+    struct StatusSnapshot {
+        struct Player {
+            bool used;
+            int cid;
+            std::string name;
+            int ping;
+            int frags, kills, deaths, captures;
+            double startTime;
+            Player() throw () : used(false), cid(-1), ping(0), frags(0), kills(0), deaths(0), captures(0), startTime(0) { }
+        };
+
+        Player player[MAX_PLAYERS];
+        int humans, bots;
+        unsigned frame;
+        std::string mapTitle, mapFile;
+        bool freeTurning, friendlyFire, powerups, relayActive;
+
+        int pidOfCid(uint32_t cid) const throw (); // -1 if not in the game
+    };
+
+    Published<StatusSnapshot> statusSnapshot;   // updated every frame by publishStatus()
+
     class RelayThread {
         struct RelayData {
             RelayData(int t, ConstDataBlockRef d) throw () : time(t), data(d) { }
@@ -217,6 +243,7 @@ private:
     void send_master_quit(const std::string& localAddress) const throw ();
 
     bool writeToAdminShell(ConstDataBlockRef data) const throw ();
+    std::string queryStatsText() const throw ();   // the leetnet server's ServerQueryStats for the admin shell and the log
 
     bool read_string_from_TCP(Network::TCPSocket& sock, std::string& resultStr) throw (Network::ReadWriteError);
     void handleNewAdminShell(Thread& slaveThread, volatile bool& slaveRunning) throw (Network::Error);
@@ -228,13 +255,25 @@ private:
     void run_website_thread() throw ();
 
     void broadcast_message(ConstDataBlockRef data) const throw ();
+    /// Send extData to players with protocol extensions and oldData to the rest. Each is queued as one copy shared by the recipients.
+    void broadcast_message(ConstDataBlockRef extData, ConstDataBlockRef oldData) const throw ();
+    uint32_t extendedPlayers() const throw (); // mask of players with protocol extensions
+    /// Send data to the players whose bits are set in pidMask, queuing one copy shared by them.
+    void multicast_message(uint32_t pidMask, ConstDataBlockRef data) const throw ();
     void send_simple_message(Network_data_code code, int pid) const throw ();
     void broadcast_simple_message(Network_data_code code) const throw ();
     void broadcast_screen_message(int px, int py, ConstDataBlockRef msg) const throw ();
 
     void record_message(ConstDataBlockRef data) const throw ();
 
-    void writeMinimapPlayerPosition(BinaryWriter& writer, int pid) const throw ();
+    void minimapPlayerPosition(int pid, uint8_t& x, uint8_t& y) const throw ();
+    void writeMinimapPlayerPosition(FastBinaryWriter<false>& writer, int pid) const throw ();
+    /** Choose the players whose minimap position is sent to recipient this frame, out of visible, continuing from recipient.nextMinimapPlayer.
+     * Returns the mask of chosen players. sendBoundary is the 4-bit boundary they start from and bits the length of the mask,
+     * when rotated right by sendBoundary, that covers them.
+     */
+    uint32_t chooseMinimapPlayers(ServerPlayer& recipient, uint32_t visible, int& sendBoundary, int& bits) const throw ();
+    void makeFramePlayerRecord(FramePlayerRecord& r, const ServerPlayer& h, bool preciseGundir) const throw ();
 
 public:
 
@@ -246,6 +285,7 @@ public:
     void stop() throw ();
 
     void update_serverinfo() throw ();
+    void publishStatus() throw (); // call once per frame
     double getTraffic() const throw ();
 
     void removePlayer(int pid) throw (); // call only when moving players around; this actually does close to nothing
@@ -335,6 +375,7 @@ public:
     void player_message(int pid, Message_type type, const std::string& text) const throw ();
     void broadcast_text(Message_type type, const std::string& text) const throw ();
     void record_players_present() const throw ();
+    void record_keyframe() throw ();
 
     void set_relay_server(const std::string& address) throw ();
     std::string get_relay_server() const throw ();
@@ -0,0 +1,148 @@
+/*
+ *  statsstream.cpp
+ *
+ *  Copyright (C) 2008 - Niko Ritari
+ *
+ *  This file is part of Outgun.
+ *
+ *  Outgun is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Outgun is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Outgun; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+
+#include <cstdio>
+#include <fstream>
+
+#include "statsstream.h"
+
+using std::string;
+
+namespace StatsStream {
+
+const string identification = "OUTGUNSTATSTREAM";
+
+const char* const counterNames[C_count] = {
+    "frags", "kills", "deaths", "suicides", "captures",
+    "flags_taken", "flags_dropped", "flags_returned", "carriers_killed",
+    "shots", "hits", "shots_taken",
+    "movement"
+};
+
+// zigzag encoding maps small negative values to small unsigned values too: 0, -1, 1, -2... to 0, 1, 2, 3...
+static uint32_t zigzag(uint32_t value) throw () { return value << 1 ^ (0u - (value >> 31)); }
+static uint32_t unzigzag(uint32_t value) throw () { return value >> 1 ^ (0u - (value & 1)); }
+
+void writeRecord(BinaryWriter& out, const Sample& s) throw () {
+    ExpandingBinaryBuffer body;
+    body.U32(s.time);
+    body.U16(s.seconds);
+    body.U8(s.humans);
+    body.U8(s.bots);
+    body.U32dyn8(s.frames);
+    body.U32dyn8(s.tickMeanUs);
+    body.U32dyn8(s.tickMaxUs);
+    body.str(s.map);
+    body.U8(s.players.size());
+    for (std::vector<PlayerSample>::const_iterator pi = s.players.begin(); pi != s.players.end(); ++pi) {
+        body.str(pi->name);
+        body.U8(pi->team);
+        body.U8(C_count);
+        for (int c = 0; c < C_count; ++c)
+            body.U32dyn8(isSigned(c) ? zigzag(pi->counter[c]) : pi->counter[c]);
+    }
+    out.U32dyn8(body.size());
+    out.block(body);
+}
+
+bool readRecord(BinaryReader& in, Sample& s) throw () {
+    try {
+        if (!in.hasMore())
+            return false;
+        const uint32_t length = in.U32dyn8();
+        BinaryDataBlockReader body(in.block(length));
+        s.time = body.U32();
+        s.seconds = body.U16();
+        s.humans = body.U8();
+        s.bots = body.U8();
+        s.frames = body.U32dyn8();
+        s.tickMeanUs = body.U32dyn8();
+        s.tickMaxUs = body.U32dyn8();
+        s.map = body.str();
+        s.players.resize(body.U8());
+        for (std::vector<PlayerSample>::iterator pi = s.players.begin(); pi != s.players.end(); ++pi) {
+            pi->name = body.str();
+            pi->team = body.U8();
+            const int counters = body.U8();
+            for (int c = 0; c < counters; ++c) {
+                const uint32_t value = body.U32dyn8();
+                if (c < C_count)    // counters added by later versions are skipped
+                    pi->counter[c] = isSigned(c) ? unzigzag(value) : value;
+            }
+            for (int c = counters; c < C_count; ++c)
+                pi->counter[c] = 0;
+        }
+        return true;
+    } catch (BinaryReader::ReadOutside&) {
+        return false;
+    }
+}
+
+void writeHeader(BinaryWriter& out) throw () {
+    out.constLengthStr(identification, identification.length());
+    out.U32(version);
+}
+
+bool readHeader(BinaryReader& in) throw () {
+    try {
+        return in.constLengthStr(identification.length()) == identification && in.U32() == version;
+    } catch (BinaryReader::ReadOutside&) {
+        return false;
+    }
+}
+
+bool fileHasHeader(const string& name) throw () {
+    std::ifstream in(name.c_str(), std::ios::binary);
+    char buf[64];
+    const unsigned length = identification.length() + 4;
+    if (length > sizeof(buf) || !in.read(buf, length))
+        return false;
+    BinaryDataBlockReader read(buf, length);
+    return readHeader(read);
+}
+
+// conversions between days since 1970-01-01 and the proleptic Gregorian calendar, with eras of 400 years
+
+string fileName(uint32_t day) throw () {
+    const uint32_t z = day + 719468, era = z / 146097, doe = z - era * 146097;
+    const uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100), mp = (5 * doy + 2) / 153;
+    const uint32_t d = doy - (153 * mp + 2) / 5 + 1, m = mp < 10 ? mp + 3 : mp - 9, y = yoe + era * 400 + (m <= 2);
+    char buf[16];
+    sprintf(buf, "%04u-%02u-%02u", y, m, d);
+    return string(buf) + ".bin";
+}
+
+bool parseDay(const string& date, uint32_t& day) throw () {
+    unsigned y, m, d;
+    char tail;
+    if (sscanf(date.c_str(), "%4u-%2u-%2u%c", &y, &m, &d, &tail) != 3 || y < 1970 || m < 1 || m > 12 || d < 1 || d > 31)
+        return false;
+    const uint32_t yy = y - (m <= 2), era = yy / 400, yoe = yy - era * 400;
+    const uint32_t doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1, doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    day = era * 146097 + doe - 719468;
+    return fileName(day) == date + ".bin";  // rejects days past the end of the month
+}
+
+} // namespace StatsStream
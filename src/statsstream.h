@@ -0,0 +1,97 @@
+/*
+ *  statsstream.h
+ *
+ *  Copyright (C) 2008 - Niko Ritari
+ *
+ *  This file is part of Outgun.
+ *
+ *  Outgun is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Outgun is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Outgun; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+
+#ifndef STATSSTREAM_H_INC
+#define STATSSTREAM_H_INC
+
+#include <string>
+#include <vector>
+
+#include "binaryaccess.h"
+
+/* Format of the streamed server statistics, written by the server (Server::StatsExporter) and read by statsquery.
+ *
+ * There's a file per day (UTC), named YYYY-MM-DD.bin, beginning with the identification string and the version.
+ * The rest of the file is a sequence of records, each preceded by its length as U32dyn8, so that a partly written
+ * record at the end of the file can be recognized and ignored. The counters of the players are the changes since
+ * the previous record, so that summing the records gives the totals of any period. Frags can decrease, so their
+ * change is signed, and written zigzag-encoded.
+ */
+
+namespace StatsStream {
+
+extern const std::string identification;
+static const uint32_t version = 2;
+
+enum Counter {
+    C_frags, C_kills, C_deaths, C_suicides, C_captures,
+    C_flags_taken, C_flags_dropped, C_flags_returned, C_carriers_killed,
+    C_shots, C_hits, C_shots_taken,
+    C_movement,     // in whole Outgun units
+    C_count
+};
+
+extern const char* const counterNames[C_count];
+
+inline bool isSigned(int counter) throw () { return counter == C_frags; }
+
+struct PlayerSample {
+    std::string name;
+    uint8_t team;
+    uint32_t counter[C_count];  // the signed counters hold int32_t values converted to uint32_t
+
+    PlayerSample() throw () : team(0) { for (int i = 0; i < C_count; ++i) counter[i] = 0; }
+    double value(int c) const throw () { return isSigned(c) ? double(static_cast<int32_t>(counter[c])) : double(counter[c]); }
+};
+
+struct Sample {
+    uint32_t time;          // UTC seconds since the epoch at the end of the period
+    uint16_t seconds;       // length of the period
+    uint8_t humans, bots;
+    uint32_t frames;        // simulated in the period
+    uint32_t tickMeanUs, tickMaxUs; // time taken by a frame's simulation and broadcast, in microseconds
+    std::string map;        // title of the map being played
+    std::vector<PlayerSample> players;
+
+    Sample() throw () : time(0), seconds(0), humans(0), bots(0), frames(0), tickMeanUs(0), tickMaxUs(0) { }
+};
+
+/// The record of sample, with its length prefix.
+void writeRecord(BinaryWriter& out, const Sample& sample) throw ();
+/// Read the next record; returns false at the end of the data or at a truncated or unreadable record.
+bool readRecord(BinaryReader& in, Sample& sample) throw ();
+
+void writeHeader(BinaryWriter& out) throw ();
+bool readHeader(BinaryReader& in) throw ();
+/// Whether the file name begins with the header of this version.
+bool fileHasHeader(const std::string& name) throw ();
+
+/// Name of the file of the given day, which is UTC seconds since the epoch / (24 * 3600).
+std::string fileName(uint32_t day) throw ();
+/// Parse a YYYY-MM-DD date to a day; returns false if it isn't a valid date.
+bool parseDay(const std::string& date, uint32_t& day) throw ();
+
+} // namespace StatsStream
+
+#endif
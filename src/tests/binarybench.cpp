@@ -0,0 +1,148 @@
+/*
+ *  tests/binarybench.cpp
+ *
+ *  Copyright (C) 2008 - Niko Ritari
+ *
+ *  This file is part of Outgun.
+ *
+ *  Outgun is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Outgun is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Outgun; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* Micro-benchmarks of BinaryWriter/BinaryDataBlockReader against FastBinaryWriter/FastBinaryReader.
+ * The workload imitates a frame: a header and 32 player records of byte-sized fields.
+ * As part of the test suite, only a few frames are run to check that the implementations agree, and nothing is
+ * printed. Run with -bench to get the timings, optionally followed by the amount of repetitions (default 20000 frames).
+ */
+
+#include <iostream>
+
+#include "../binaryaccess.h"
+#include "../fastbinary.h"
+
+#include "tests.h"
+
+using namespace std;
+
+static const int players = 32;
+static const unsigned maxFrameSize = 4 + 3 + 4 + players * 10 + 2;
+
+template<class Writer> void writeFrame(Writer& w, uint32_t frame) throw () {
+    w.U32(frame);
+    w.U8(frame & 0xFF);
+    w.U8(0x80);
+    w.U8(3 << 3);
+    w.U32(0xFFFFFFFF);
+    for (int i = 0; i < players; ++i) {
+        w.U8((frame + i) & 0xFF);
+        w.U8((frame * 3 + i) & 0xFF);
+        w.U8(i);
+        w.U8(0x10);
+        w.U8(0x21);
+        w.U8(0x42);
+        w.U8(0x40 | i);
+        w.U8(i * 7 & 0xFF);
+        w.U8(255);
+    }
+    w.U16(frame & 0xFFFF);
+}
+
+template<class Reader> uint32_t readFrame(Reader& r) throw () {
+    uint32_t sum = r.U32();
+    sum += r.U8();
+    sum += r.U8();
+    sum += r.U8();
+    const uint32_t onscreen = r.U32();
+    for (int i = 0; i < players; ++i)
+        if (onscreen & (1 << i))
+            for (int f = 0; f < 9; ++f)
+                sum += r.U8();
+    return sum + r.U16();
+}
+
+static void report(const char* what, double ns) throw () {
+    reportTime(what, ns, "field");
+}
+
+void binaryBenchmark(unsigned frames) throw () {
+    const unsigned fieldsPerFrame = 5 + players * 9 + 1;
+    const unsigned fields = frames * fieldsPerFrame;
+    BinaryBuffer<maxFrameSize> b1, b2, b3;
+
+    {
+        Stopwatch sw;
+        for (unsigned f = 0; f < frames; ++f) {
+            b1.clear();
+            writeFrame(b1, f);
+        }
+        report("BinaryWriter", sw.nsPerOp(fields));
+    }
+    {
+        Stopwatch sw;
+        for (unsigned f = 0; f < frames; ++f) {
+            b2.clear();
+            FastBinaryWriter<true> w(b2);
+            writeFrame(w, f);
+        }
+        report("FastBinaryWriter<true>", sw.nsPerOp(fields));
+    }
+    {
+        Stopwatch sw;
+        for (unsigned f = 0; f < frames; ++f) {
+            b3.clear();
+            FastBinaryWriter<false> w(b3);
+            w.reserve(maxFrameSize);
+            writeFrame(w, f);
+        }
+        report("FastBinaryWriter<false>", sw.nsPerOp(fields));
+    }
+    nAssert(b1.size() == b2.size() && b1.size() == b3.size());
+    nAssert(memcmp(b1.accessData(), b2.accessData(), b1.size()) == 0 && memcmp(b1.accessData(), b3.accessData(), b1.size()) == 0);
+
+    uint32_t sums[3] = { 0, 0, 0 };
+    {
+        Stopwatch sw;
+        for (unsigned f = 0; f < frames; ++f) {
+            BinaryDataBlockReader r(b1);
+            sums[0] += readFrame(r);
+        }
+        report("BinaryDataBlockReader", sw.nsPerOp(fields));
+    }
+    {
+        Stopwatch sw;
+        for (unsigned f = 0; f < frames; ++f) {
+            FastBinaryReader<true> r(b1);
+            sums[1] += readFrame(r);
+        }
+        report("FastBinaryReader<true>", sw.nsPerOp(fields));
+    }
+    {
+        Stopwatch sw;
+        for (unsigned f = 0; f < frames; ++f) {
+            FastBinaryReader<false> r(b1);
+            r.require(b1.size());
+            sums[2] += readFrame(r);
+        }
+        report("FastBinaryReader<false>", sw.nsPerOp(fields));
+    }
+    nAssert(sums[0] == sums[1] && sums[0] == sums[2]);
+    if (benchmarkTimed)
+        cout << "(checksum " << sums[0] << ")\n";
+}
+
+int main(int argc, const char* argv[]) {
+    binaryBenchmark(benchmarkRepetitions(argc, argv, 100, 20000));
+    return 0;
+}
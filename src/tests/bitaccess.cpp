@@ -0,0 +1,231 @@
+/*
+ *  tests/bitaccess.cpp
+ *
+ *  Copyright (C) 2008 - Niko Ritari
+ *
+ *  This file is part of Outgun.
+ *
+ *  Outgun is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Outgun is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Outgun; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <cmath>
+
+#include "../binaryaccess.h"
+#include "../bitaccess.h"
+#include "../framecodec.h"
+
+#include "tests.h"
+
+using namespace std;
+
+static const unsigned widths[] = { 1, 3, 8, 5, 32, 11, 16, 7, 2, 24, 1 };
+static const unsigned nWidths = sizeof(widths) / sizeof(widths[0]);
+
+static uint32_t testValue(unsigned i) throw () {
+    const uint32_t pattern = 0x9E3779B9u * (i + 1);
+    return widths[i] == 32 ? pattern : pattern >> (32 - widths[i]);
+}
+
+void bitStreamTest() throw () {
+    ExpandingBinaryBuffer buf;
+    unsigned totalBits = 0;
+    {
+        BitWriter<ExpandingBinaryBuffer> w(buf);
+        for (unsigned i = 0; i < nWidths; ++i) {
+            w.write(testValue(i), widths[i]);
+            totalBits += widths[i];
+        }
+        w.flush();
+    }
+    nAssert(buf.size() == (totalBits + 7) / 8);
+
+    BitReader r(buf);
+    for (unsigned i = 0; i < nWidths; ++i)
+        nAssert(r.read(widths[i]) == testValue(i));
+    nAssert(r.bytesUsed() == buf.size());
+    r.read((8 - totalBits % 8) % 8);    // the padding
+    try {
+        r.read(1);
+        nAssert(0);
+    } catch (BinaryReader::ReadOutside) { }
+}
+
+void frameBodyTest() throw () {
+    const int maxplayers = 16;
+    FrameBody fb;
+    fb.playersOnscreen = 0x8005;
+    FramePlayerRecord& p0 = fb.player[0];
+    p0.lx = 100.3;
+    p0.ly = plh;
+    p0.shield = true;
+    p0.preciseGundir = true;
+    p0.speedX = 0x83;
+    p0.speedY = 0x12;
+    p0.controls = 21;
+    p0.gundir = 0x5AB;
+    p0.visibility = 128;
+    FramePlayerRecord& p2 = fb.player[2];
+    p2.lx = -1;    // out of range values are bounded
+    p2.ly = 3.;
+    p2.dead = true;
+    p2.gundir = 5;
+    FramePlayerRecord& p15 = fb.player[15];
+    p15.lx = plw;
+    p15.turbo = p15.power = true;
+    p15.visibility = 0;
+    fb.minimap.players = 0x0102;
+    fb.minimap.x[1] = 17;
+    fb.minimap.y[1] = 254;
+    fb.minimap.x[8] = 0;
+    fb.minimap.y[8] = 99;
+    fb.health8 = 255;
+    fb.energy8 = 1;
+    fb.pingSent = true;
+    fb.ping = 0xFFFE;
+
+    ExpandingBinaryBuffer buf;
+    {
+        BitEncoder<ExpandingBinaryBuffer> enc(buf);
+        codeFrameBody(enc, static_cast<const FrameBody&>(fb), maxplayers);
+    }
+
+    FrameBody d;
+    BitDecoder dec(buf);
+    codeFrameBody(dec, d, maxplayers);
+    nAssert(dec.bytesUsed() == buf.size());
+
+    const double xStep = double(plw) / 0xFFF, yStep = double(plh) / 0xFFF;
+    nAssert(d.playersOnscreen == fb.playersOnscreen);
+    for (int i = 0; i < maxplayers; ++i) {
+        if (!(fb.playersOnscreen & (1 << i)))
+            continue;
+        const FramePlayerRecord& a = fb.player[i], & b = d.player[i];
+        nAssert(fabs(bound<double>(a.lx, 0, plw) - b.lx) <= xStep / 2 + 1e-9);
+        nAssert(fabs(bound<double>(a.ly, 0, plh) - b.ly) <= yStep / 2 + 1e-9);
+        nAssert(a.dead == b.dead && a.deathbringer == b.deathbringer && a.deathbringerAffected == b.deathbringerAffected);
+        nAssert(a.shield == b.shield && a.turbo == b.turbo && a.power == b.power && a.preciseGundir == b.preciseGundir);
+        nAssert(a.gundir == b.gundir);
+        if (a.dead)
+            nAssert(b.speedX == 0 && b.speedY == 0 && b.controls == 0 && b.visibility == 255);   // not sent: defaults
+        else
+            nAssert(a.speedX == b.speedX && a.speedY == b.speedY && a.controls == b.controls && a.visibility == b.visibility);
+    }
+    nAssert(d.player[15].lx == plw && d.player[2].lx == 0 && d.player[0].ly == plh);
+    nAssert(d.minimap.players == fb.minimap.players);
+    nAssert(d.minimap.x[1] == 17 && d.minimap.y[1] == 254 && d.minimap.x[8] == 0 && d.minimap.y[8] == 99);
+    nAssert(d.health8 == 255 && d.energy8 == 1 && d.pingSent && d.ping == 0xFFFE);
+
+    // truncated data
+    try {
+        FrameBody t;
+        BitDecoder truncated(ConstDataBlockRef(buf.accessData(), buf.size() - 1));
+        codeFrameBody(truncated, t, maxplayers);
+        nAssert(0);
+    } catch (BinaryReader::ReadOutside) { }
+}
+
+static void encode(ExpandingBinaryBuffer& buf, const FrameBody& body, int maxplayers, const FrameBody* base) throw () {
+    BitEncoder<ExpandingBinaryBuffer> enc(buf);
+    codeFrameBody(enc, body, maxplayers, base);
+}
+
+static void decode(ConstDataBlockRef data, FrameBody& body, int maxplayers, const FrameBody* base) throw () {
+    BitDecoder dec(data);
+    codeFrameBody(dec, body, maxplayers, base);
+}
+
+static bool samePlayer(const FramePlayerRecord& a, const FramePlayerRecord& b) throw () {
+    return a.lx == b.lx && a.ly == b.ly && a.dead == b.dead && a.deathbringer == b.deathbringer && a.deathbringerAffected == b.deathbringerAffected &&
+           a.shield == b.shield && a.turbo == b.turbo && a.power == b.power && a.preciseGundir == b.preciseGundir &&
+           a.speedX == b.speedX && a.speedY == b.speedY && a.controls == b.controls && a.gundir == b.gundir && a.visibility == b.visibility;
+}
+
+void deltaTest() throw () {
+    const int maxplayers = 32;
+    FrameBody first;
+    first.playersOnscreen = 0xF000000F;
+    for (int i = 0; i < maxplayers; ++i) {
+        FramePlayerRecord& p = first.player[i];
+        p.lx = 10. * i + .37;
+        p.ly = 7. * i;
+        p.speedX = i;
+        p.controls = i % 32;
+        p.visibility = 200;
+        p.preciseGundir = true;
+        p.gundir = 60 * i; // 11 bits
+    }
+
+    // the baselines are what the client has decoded, and what the server has sent
+    ExpandingBinaryBuffer firstData;
+    encode(firstData, first, maxplayers, 0);
+    FrameBody clientBase;
+    decode(firstData, clientBase, maxplayers, 0);
+    FrameHistory serverHistory, clientHistory;
+    serverHistory.store(100, 7, first);
+    clientHistory.store(100, 0, clientBase);
+
+    FrameBody second = first;
+    second.playersOnscreen = 0xF00000F1;    // players 1..3 left, 4..7 entered
+    second.player[0].lx += 30.;
+    second.player[28].dead = true;
+    second.player[28].speedX = second.player[28].controls = 0;
+    second.player[28].visibility = 255;
+    second.player[29].gundir = 5;
+    second.player[30].visibility = 10;
+    second.pingSent = true;
+    second.ping = 321;
+
+    uint32_t baseFrame = 0;
+    const FrameBody* serverBase = serverHistory.findPacket(7, baseFrame);
+    nAssert(serverBase && baseFrame == 100);
+    nAssert(!serverHistory.findPacket(8, baseFrame));
+    const FrameBody* clientBaseFound = clientHistory.findFrame(100);
+    nAssert(clientBaseFound && !clientHistory.findFrame(100 + FrameHistory::size));
+
+    ExpandingBinaryBuffer fullData, deltaData;
+    encode(fullData, second, maxplayers, 0);
+    encode(deltaData, second, maxplayers, serverBase);
+    nAssert(deltaData.size() < fullData.size());
+
+    FrameBody full, delta;
+    decode(fullData, full, maxplayers, 0);
+    decode(deltaData, delta, maxplayers, clientBaseFound);
+    nAssert(full.playersOnscreen == delta.playersOnscreen);
+    for (int i = 0; i < maxplayers; ++i)
+        if (full.playersOnscreen & (1 << i))
+            nAssert(samePlayer(full.player[i], delta.player[i]));
+    nAssert(delta.pingSent && delta.ping == 321);
+
+    // an unchanged player costs a flag per field group
+    FrameBody one;
+    one.playersOnscreen = 1;
+    one.player[0] = first.player[0];
+    ExpandingBinaryBuffer oneFull, oneDelta;
+    encode(oneFull, one, 1, 0);
+    encode(oneDelta, one, 1, &one);
+    nAssert(oneDelta.size() == 3);  // on-screen mask, 5 group flags, minimap mask, health, energy, ping flag: 1 + 5 + 1 + 16 + 1 = 24 bits
+    nAssert(oneFull.size() > oneDelta.size());
+
+    serverHistory.clear();
+    nAssert(!serverHistory.findPacket(7, baseFrame));
+}
+
+int main() {
+    bitStreamTest();
+    frameBodyTest();
+    deltaTest();
+    return 0;
+}
@@ -0,0 +1,209 @@
+/*
+ *  tests/blend.cpp
+ *
+ *  Copyright (C) 2008 - Niko Ritari
+ *
+ *  This file is part of Outgun.
+ *
+ *  Outgun is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Outgun is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Outgun; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <vector>
+
+#include "../blend.h"
+
+#include "tests.h"
+
+using namespace std;
+
+/* The blenders of Allegro 4.2 (src/colblend.c), verbatim but for the helper macros, as the reference the kernels must
+ * match to the bit. The 16-bit pixels are RGB 5:6:5 and the 32-bit ones ARGB 8:8:8:8.
+ */
+
+static unsigned long blender_trans16(unsigned long x, unsigned long y, unsigned long n) {
+    unsigned long result;
+    if (n)
+        n = (n + 1) / 8;
+    x = ((x & 0xFFFF) | (x << 16)) & 0x7E0F81F;
+    y = ((y & 0xFFFF) | (y << 16)) & 0x7E0F81F;
+    result = ((x - y) * n / 32 + y) & 0x7E0F81F;
+    return ((result & 0xFFFF) | (result >> 16));
+}
+
+static unsigned long blender_trans24(unsigned long x, unsigned long y, unsigned long n) {
+    unsigned long res, g;
+    if (n)
+        n++;
+    res = ((x & 0xFF00FF) - (y & 0xFF00FF)) * n / 256 + y;
+    y &= 0xFF00;
+    x &= 0xFF00;
+    g = (x - y) * n / 256 + y;
+    res &= 0xFF00FF;
+    g &= 0xFF00;
+    return res | g;
+}
+
+static unsigned long blender_alpha16(unsigned long x, unsigned long y, unsigned long) {
+    unsigned long result;
+    unsigned long n = x >> 24;
+    if (n)
+        n = (n + 1) / 8;
+    x = ((x >> 19) & 31) << 11 | ((x >> 10) & 63) << 5 | ((x >> 3) & 31);  // makecol16(getr32(x), getg32(x), getb32(x))
+    x = (x | (x << 16)) & 0x7E0F81F;
+    y = ((y & 0xFFFF) | (y << 16)) & 0x7E0F81F;
+    result = ((x - y) * n / 32 + y) & 0x7E0F81F;
+    return ((result & 0xFFFF) | (result >> 16));
+}
+
+static unsigned long blender_alpha32(unsigned long x, unsigned long y, unsigned long) {
+    unsigned long res, g;
+    unsigned long n = x >> 24;
+    if (n)
+        n++;
+    res = ((x & 0xFF00FF) - (y & 0xFF00FF)) * n / 256 + y;
+    y &= 0xFF00;
+    x &= 0xFF00;
+    g = (x - y) * n / 256 + y;
+    res &= 0xFF00FF;
+    g &= 0xFF00;
+    return res | g;
+}
+
+static uint32_t randomState = 12345;
+
+static uint32_t random32() throw () {
+    randomState = randomState * 1664525u + 1013904223u;
+    return randomState ^ randomState >> 16;
+}
+
+static uint8_t randomAlpha() throw () {    // emphasize the special values
+    switch (random32() % 8) {
+    /*break;*/ case 0: return 0;
+        break; case 1: return 255;
+        break; case 2: return static_cast<uint8_t>(random32() % 16);
+        break; default: return static_cast<uint8_t>(random32());
+    }
+}
+
+static uint32_t randomSourcePixel() throw () {
+    return random32() % 8 == 0 ? 0xFF00FF : uint32_t(randomAlpha()) << 24 | (random32() & 0xFFFFFF);
+}
+
+static const unsigned maxSpan = 70;     // long enough for all vector widths with every tail length
+static const unsigned rounds = 3000;
+
+// each span starts at a varying offset into the buffers so that unaligned access gets tested
+
+void overlay16Test() throw () {
+    vector<uint16_t> dst(maxSpan + 8), ref(maxSpan + 8);
+    vector<uint8_t> alpha(maxSpan + 8);
+    for (unsigned round = 0; round < rounds; ++round) {
+        const unsigned n = round % maxSpan, offset = round % 7;
+        const uint16_t color = static_cast<uint16_t>(random32());
+        for (unsigned i = 0; i < dst.size(); ++i) {
+            dst[i] = ref[i] = static_cast<uint16_t>(random32());
+            alpha[i] = randomAlpha();
+        }
+        overlaySpan16(&dst[offset], &alpha[offset], n, color);
+        for (unsigned i = offset; i < offset + n; ++i)
+            if (alpha[i])
+                ref[i] = static_cast<uint16_t>(blender_trans16(color, ref[i], alpha[i]));
+        nAssert(dst == ref);
+    }
+}
+
+void overlay32Test() throw () {
+    vector<uint32_t> dst(maxSpan + 8), ref(maxSpan + 8);
+    vector<uint8_t> alpha(maxSpan + 8);
+    for (unsigned round = 0; round < rounds; ++round) {
+        const unsigned n = round % maxSpan, offset = round % 7;
+        const uint32_t color = random32();
+        for (unsigned i = 0; i < dst.size(); ++i) {
+            dst[i] = ref[i] = random32();
+            alpha[i] = randomAlpha();
+        }
+        overlaySpan32(&dst[offset], &alpha[offset], n, color);
+        for (unsigned i = offset; i < offset + n; ++i)
+            if (alpha[i])
+                ref[i] = static_cast<uint32_t>(blender_trans24(color, ref[i], alpha[i]));
+        nAssert(dst == ref);
+    }
+}
+
+void alpha16Test() throw () {
+    vector<uint16_t> dst(maxSpan + 8), ref(maxSpan + 8);
+    vector<uint32_t> src(maxSpan + 8);
+    for (unsigned round = 0; round < rounds; ++round) {
+        const unsigned n = round % maxSpan, offset = round % 7;
+        for (unsigned i = 0; i < dst.size(); ++i) {
+            dst[i] = ref[i] = static_cast<uint16_t>(random32());
+            src[i] = randomSourcePixel();
+        }
+        alphaSpan16(&dst[offset], &src[offset], n);
+        for (unsigned i = offset; i < offset + n; ++i)
+            if (src[i] != 0xFF00FF)
+                ref[i] = static_cast<uint16_t>(blender_alpha16(src[i], ref[i], 0));
+        nAssert(dst == ref);
+    }
+}
+
+void alpha32Test() throw () {
+    vector<uint32_t> dst(maxSpan + 8), ref(maxSpan + 8), src(maxSpan + 8);
+    for (unsigned round = 0; round < rounds; ++round) {
+        const unsigned n = round % maxSpan, offset = round % 7;
+        for (unsigned i = 0; i < dst.size(); ++i) {
+            dst[i] = ref[i] = random32();
+            src[i] = randomSourcePixel();
+        }
+        alphaSpan32(&dst[offset], &src[offset], n);
+        for (unsigned i = offset; i < offset + n; ++i)
+            if (src[i] != 0xFF00FF)
+                ref[i] = static_cast<uint32_t>(blender_alpha32(src[i], ref[i], 0));
+        nAssert(dst == ref);
+    }
+}
+
+/// All weights against all channel values, once per pixel format.
+void exhaustiveTest() throw () {
+    vector<uint32_t> dst32(256);
+    vector<uint16_t> dst16(256);
+    vector<uint8_t> alpha(256);
+    for (unsigned a = 0; a < 256; ++a)
+        alpha[a] = static_cast<uint8_t>(a);
+    for (unsigned v = 0; v < 256; ++v) {
+        const uint32_t color32 = v * 0x010101u, dstValue32 = (255 - v) * 0x01010101u ^ 0x00FF0000u;
+        const uint16_t color16 = static_cast<uint16_t>(v * 0x0101u), dstValue16 = static_cast<uint16_t>(~color16 ^ 0x0F0F);
+        for (unsigned i = 0; i < 256; ++i) {
+            dst32[i] = dstValue32;
+            dst16[i] = dstValue16;
+        }
+        overlaySpan32(&dst32[0], &alpha[0], 256, color32);
+        overlaySpan16(&dst16[0], &alpha[0], 256, color16);
+        for (unsigned a = 1; a < 256; ++a) {
+            nAssert(dst32[a] == blender_trans24(color32, dstValue32, a));
+            nAssert(dst16[a] == blender_trans16(color16, dstValue16, a));
+        }
+    }
+}
+
+int main() {
+    overlay16Test();
+    overlay32Test();
+    alpha16Test();
+    alpha32Test();
+    exhaustiveTest();
+    return 0;
+}
@@ -0,0 +1,151 @@
+/*
+ *  tests/effectsbench.cpp
+ *
+ *  Copyright (C) 2008 - Niko Ritari
+ *
+ *  This file is part of Outgun.
+ *
+ *  Outgun is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Outgun is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Outgun; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+
+/* Stress benchmark of EffectPool against the std::list the effects were kept in before.
+ * Each simulated frame spawns a burst of effects, expires the old ones and reads through the live ones, like
+ * Graphics::draw_effects. The bursts exceed the pool capacity so that the overflow policy is exercised too.
+ * As part of the test suite, the pool is checked against the list on a few hundred frames and nothing is printed.
+ * Run with -bench to get the timings, optionally followed by the amount of frames (default 20000).
+ */
+
+#include <iostream>
+#include <list>
+
+#include "../effectpool.h"
+
+#include "tests.h"
+
+using namespace std;
+
+struct Effect {
+    int px, py;
+    double x, y;
+    int team;
+};
+
+struct TimedEffect {
+    double time;
+    Effect e;
+};
+
+static const unsigned capacity = 1024;
+static const double lifetime = .4;
+static const double frameTime = .01;
+
+static void report(const char* what, double ns) throw () {
+    reportTime(what, ns, "effect");
+}
+
+// about 800 alive at once, with a spike of 400 every 100 frames
+static unsigned burstSize(unsigned frame) throw () { return frame % 100 == 99 ? 400 : 4 + frame % 32; }
+
+static void fill(Effect& e, unsigned frame, unsigned i) throw () {
+    e.px = frame % 8;
+    e.py = i % 8;
+    e.x = i;
+    e.y = frame;
+    e.team = i & 1;
+}
+
+static void testOverflow() throw () {
+    EffectPool<Effect, 4> pool;
+    for (int i = 0; i < 6; ++i)
+        pool.add(i).team = i;
+    nAssert(pool.size() == 4);
+    nAssert(pool[0].team == 2 && pool[3].team == 5);   // the oldest ones were dropped
+    nAssert(pool.counters().created == 6 && pool.counters().dropped == 2 && pool.counters().peak == 4);
+    pool.expire(6.5, 2);    // removes those started at 2, 3 and 4
+    nAssert(pool.size() == 1 && pool[0].team == 5 && pool.time(0) == 5);
+    nAssert(pool.counters().expired == 3);
+    pool.clear();
+    nAssert(pool.size() == 0);
+}
+
+static void testOutOfOrder() throw () {
+    EffectPool<Effect, 4> pool;
+    pool.add(5).team = 0;
+    pool.add(4.9).team = 1;    // can't be started before the one above, or it would outlive its time behind it
+    nAssert(pool.time(1) == 5);
+    pool.add(6).team = 2;
+    pool.expire(7.5, 2);
+    nAssert(pool.size() == 1 && pool[0].team == 2);
+}
+
+void effectsBenchmark(unsigned frames) throw () {
+    unsigned spawned = 0;
+    for (unsigned f = 0; f < frames; ++f)
+        spawned += burstSize(f);
+
+    long sums[2] = { 0, 0 };
+    {
+        EffectPool<Effect, capacity>* pool = new EffectPool<Effect, capacity>;
+        Stopwatch sw;
+        for (unsigned f = 0; f < frames; ++f) {
+            const double now = f * frameTime;
+            for (unsigned i = 0; i < burstSize(f); ++i)
+                fill(pool->add(now), f, i);
+            pool->expire(now, lifetime);
+            for (unsigned i = 0; i < pool->size(); ++i)
+                sums[0] += (*pool)[i].team + (*pool)[i].px;
+        }
+        report("EffectPool", sw.nsPerOp(spawned));
+        const EffectPoolCounters& c = pool->counters();
+        if (benchmarkTimed)
+            cout << "(" << c.created << " created, " << c.dropped << " dropped, " << c.expired << " expired, peak " << c.peak << ")\n";
+        nAssert(c.created == spawned && c.peak == capacity);
+        delete pool;
+    }
+    {
+        list<TimedEffect> effects;
+        Stopwatch sw;
+        for (unsigned f = 0; f < frames; ++f) {
+            const double now = f * frameTime;
+            for (unsigned i = 0; i < burstSize(f); ++i) {
+                if (effects.size() == capacity)    // same policy, to compare equal work
+                    effects.pop_front();
+                effects.push_back(TimedEffect());
+                effects.back().time = now;
+                fill(effects.back().e, f, i);
+            }
+            for (list<TimedEffect>::iterator ei = effects.begin(); ei != effects.end(); )
+                if (now - ei->time > lifetime)
+                    ei = effects.erase(ei);
+                else {
+                    sums[1] += ei->e.team + ei->e.px;
+                    ++ei;
+                }
+        }
+        report("std::list", sw.nsPerOp(spawned));
+    }
+    nAssert(sums[0] == sums[1]);
+    if (benchmarkTimed)
+        cout << "(checksum " << sums[0] << ")\n";
+}
+
+int main(int argc, const char* argv[]) {
+    testOverflow();
+    testOutOfOrder();
+    effectsBenchmark(benchmarkRepetitions(argc, argv, 300, 20000));
+    return 0;
+}
@@ -0,0 +1,154 @@
+/*
+ *  tests/fastbinary.cpp
+ *
+ *  Copyright (C) 2008 - Niko Ritari
+ *
+ *  This file is part of Outgun.
+ *
+ *  Outgun is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Outgun is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Outgun; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "../binaryaccess.h"
+#include "../fastbinary.h"
+
+#include "tests.h"
+
+using namespace std;
+
+static const uint32_t dynTests[] = { 0, 1, 239, 240, 3071, 3072, 128*1024-1, 128*1024, 48*1024-1, 48*1024, 2*1024*1024, 496*1024*1024, 16*1024*1024-1, 16*1024*1024, 0xFFFFFFFF };
+static const unsigned nDynTests = sizeof(dynTests) / sizeof(dynTests[0]);
+
+template<class Writer> void writeAll(Writer& w) throw () {
+    w.U8(200);
+    w.S8(-100);
+    w.U16(65535);
+    w.S16(-1);
+    w.U24(0xABCDEF);
+    w.S24(-5);
+    w.U32(0x89ABCDEF);
+    w.S32(-4);
+    w.U64(uint64_t(0x01020304) << 32 | 0x05060708);
+    w.flt(1.5f);
+    w.dbl(.123456789123456789);
+    for (unsigned i = 0; i < nDynTests; ++i) {
+        w.U32dyn8(dynTests[i]);
+        w.U32dyn16(dynTests[i]);
+        w.S32dyn8(static_cast<int32_t>(dynTests[i]));
+        w.S32dyn16(-static_cast<int32_t>(dynTests[i] / 2));
+    }
+    w.str("st");
+}
+
+template<class Reader> void readAll(Reader& r) throw () {
+    nAssert(r.U8(200, 200) == 200);
+    nAssert(r.S8() == -100);
+    nAssert(r.U16() == 65535);
+    nAssert(r.S16() == -1);
+    nAssert(r.U24() == 0xABCDEF);
+    nAssert(r.S24() == -5);
+    nAssert(r.U32() == 0x89ABCDEF);
+    nAssert(r.S32() == -4);
+    nAssert(r.U64() == (uint64_t(0x01020304) << 32 | 0x05060708));
+    nAssert(r.flt() == 1.5f);
+    nAssert(r.dbl() == .123456789123456789);
+    for (unsigned i = 0; i < nDynTests; ++i) {
+        nAssert(r.U32dyn8() == dynTests[i]);
+        nAssert(r.U32dyn16() == dynTests[i]);
+        nAssert(r.S32dyn8() == static_cast<int32_t>(dynTests[i]));
+        nAssert(r.S32dyn16() == -static_cast<int32_t>(dynTests[i] / 2));
+    }
+    nAssert(r.str() == "st");
+    nAssert(!r.hasMore());
+}
+
+void reserveTooMuch() throw () {
+    BinaryBuffer<20> b;
+    FastBinaryWriter<false> w(b);
+    w.reserve(21);
+}
+
+void fastBinaryTest() throw () {
+    // the fast classes must produce and accept exactly the same data as the regular ones
+    ExpandingBinaryBuffer regular, checked, unchecked;
+    writeAll(regular);
+    {
+        FastBinaryWriter<true> w(checked);
+        writeAll(w);
+    }
+    {
+        FastBinaryWriter<false> w(unchecked);
+        w.reserve(regular.size());
+        writeAll(w);
+    }
+    nAssert(checked.size() == regular.size() && unchecked.size() == regular.size());
+    nAssert(memcmp(checked.accessData(), regular.accessData(), regular.size()) == 0);
+    nAssert(memcmp(unchecked.accessData(), regular.accessData(), regular.size()) == 0);
+
+    BinaryDataBlockReader r1(regular);
+    readAll(r1);
+    FastBinaryReader<true> r2(regular);
+    readAll(r2);
+    FastBinaryReader<false> r3(regular);
+    r3.require(regular.size());
+    readAll(r3);
+
+    // reading outside
+    FastBinaryReader<true> r4(regular.accessData(), 3);
+    nAssert(r4.U16() == (200 << 8 | 0x9C));
+    try {
+        r4.U16();
+        nAssert(0);
+    } catch (BinaryReader::ReadOutside) { }
+    try {
+        r4.require(2);
+        nAssert(0);
+    } catch (BinaryReader::ReadOutside) { }
+    try {
+        r4.U8(0, 100);
+        nAssert(0);
+    } catch (BinaryReader::DataOutOfRange) { }
+    try {
+        FastBinaryReader<false> r5(regular.accessData(), 5); // no terminator in range
+        r5.str();
+        nAssert(0);
+    } catch (BinaryReader::ReadOutside) { }
+
+    // patching an earlier position like broadcast_frame does
+    BinaryBuffer<20> b;
+    {
+        FastBinaryWriter<false> w(b);
+        w.reserve(10);
+        w.U8(1);
+        const unsigned mark = w.getPosition();
+        w.U32(0);
+        w.U8(2);
+        const unsigned end = w.getPosition();
+        w.setPosition(mark);
+        w.U32(0x11223344);
+        w.setPosition(end);
+    }
+    nAssert(b.size() == 6);
+    BinaryDataBlockReader r6(b);
+    nAssert(r6.U8() == 1 && r6.U32() == 0x11223344 && r6.U8() == 2);
+
+    // a fixed size buffer can't be reserved beyond its capacity
+    testAssertion(reserveTooMuch);
+}
+
+int main() {
+    fastBinaryTest();
+    return 0;
+}
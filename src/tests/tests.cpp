@@ -21,7 +21,10 @@
  *
  */
 
+#include <cstdlib>
+#include <iomanip>
 #include <iostream>
+#include <string>
 
 #include "tests.h"
 #include "../nassert.h"
@@ -47,3 +50,16 @@ void nAssertFail(const char* expr, ARGP, ARGP, ARGP, ARGP, const char* file, int
 #undef ARGP
 
 uint32_t* stackGuardHackPtr;
+
+bool benchmarkTimed = false;
+
+int benchmarkRepetitions(int argc, const char* argv[], int testRepetitions, int defaultBenchRepetitions) throw () {
+    benchmarkTimed = argc > 1 && string(argv[1]) == "-bench";
+    const int reps = !benchmarkTimed ? testRepetitions : argc > 2 ? atoi(argv[2]) : defaultBenchRepetitions;
+    return reps > 0 ? reps : 1;
+}
+
+void reportTime(const char* what, double ns, const char* unit) throw () {
+    if (benchmarkTimed)
+        cout << setw(32) << left << what << fixed << setprecision(2) << ns << " ns/" << unit << '\n';
+}
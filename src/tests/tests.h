@@ -24,6 +24,8 @@
 #ifndef TESTS_TESTS_H
 #define TESTS_TESTS_H
 
+#include <ctime>
+
 #include "../incpthread.h"
 
 #include "../nassert.h"
@@ -79,4 +81,23 @@ public:
     }
 };
 
+/* Benchmarks in the test suite run only a short workload, to check that the implementations agree, and print nothing.
+ * Run with -bench to get the timings, optionally followed by the amount of repetitions.
+ */
+
+class Stopwatch {
+    clock_t start;
+
+public:
+    Stopwatch() throw () : start(clock()) { }
+    double nsPerOp(unsigned ops) const throw () { return double(clock() - start) / CLOCKS_PER_SEC * 1e9 / ops; }
+};
+
+extern bool benchmarkTimed;    // run with -bench
+
+/// Parse the command line of a benchmark, setting benchmarkTimed; returns the amount of repetitions to run.
+int benchmarkRepetitions(int argc, const char* argv[], int testRepetitions, int defaultBenchRepetitions) throw ();
+/// Print the time per operation if benchmarkTimed.
+void reportTime(const char* what, double ns, const char* unit) throw ();
+
 #endif
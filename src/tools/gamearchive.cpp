@@ -0,0 +1,187 @@
+/*
+ *  gamearchive.cpp
+ *
+ *  Copyright (C) 2008 - Niko Ritari
+ *
+ *  This file is part of Outgun.
+ *
+ *  Outgun is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Outgun is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Outgun; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include "../commont.h"
+#include "../platform.h"
+
+#include "gamearchive.h"
+
+using std::string;
+
+GameArchive::GameArchive(const string& dir, unsigned segmentSize_, unsigned maxMappedSegments) throw () :
+    directory(dir),
+    filePrefix("relay_segment_"),
+    segmentSize(segmentSize_),
+    maxMapped(maxMappedSegments),
+    firstSegmentNr(0),
+    firstFrameNr(0),
+    useCounter(0)
+{
+    nAssert(maxMapped >= 1);
+}
+
+GameArchive::~GameArchive() throw () {
+    while (!games.empty())
+        removeOldestGame();
+}
+
+string GameArchive::segmentFileName(unsigned segment) const throw () {
+    const bool separated = !directory.empty() && (directory[directory.length() - 1] == '/' || directory[directory.length() - 1] == directory_separator);
+    return directory + (separated ? "" : string(1, directory_separator)) + filePrefix + itoa(segment) + ".bin";
+}
+
+void GameArchive::startGame() throw () {
+    if (!games.empty())
+        games.back().finished = true;
+    games.push_back(Game(firstSegmentNr + segments.size()));
+}
+
+unsigned GameArchive::gameStartFrame(unsigned game) const throw () {
+    nAssert(game <= games.size());
+    unsigned frame = firstFrameNr;
+    for (unsigned i = 0; i < game; ++i)
+        frame += games[i].frames.size();
+    return frame;
+}
+
+bool GameArchive::gameStartsAt(unsigned frameNr) const throw () {
+    unsigned frame = firstFrameNr;
+    for (std::deque<Game>::const_iterator gi = games.begin(); gi != games.end() && frame <= frameNr; ++gi) {
+        if (frame == frameNr && !gi->frames.empty())
+            return true;
+        frame += gi->frames.size();
+    }
+    return false;
+}
+
+bool GameArchive::newSegment(unsigned minSize) throw () {
+    if (!segments.empty() && segments.back().map && segments.back().writable)
+        unmapSegment(segments.back()); // finished segments are only mapped for reading
+    segments.push_back(Segment(std::max(segmentSize, minSize)));
+    const unsigned segNr = firstSegmentNr + segments.size() - 1;
+    Segment& seg = segments.back();
+    seg.map = platMapFile(segmentFileName(segNr), seg.size, true);
+    if (!seg.map) {
+        segments.pop_back();
+        return false;
+    }
+    seg.lastUse = ++useCounter;
+    limitMappings();
+    return true;
+}
+
+bool GameArchive::addFrame(ConstDataBlockRef data, double time) throw () {
+    if (games.empty())
+        startGame();
+    Game& game = games.back();
+    nAssert(!game.finished);
+    const bool ownSegment = !segments.empty() && firstSegmentNr + segments.size() - 1 >= game.firstSegment;
+    if (!ownSegment || segments.back().used + data.size() > segments.back().size)
+        if (!newSegment(data.size()))
+            return false;
+    const unsigned segNr = firstSegmentNr + segments.size() - 1;
+    Segment& seg = segments.back();
+    if (!seg.map && !mapSegment(segNr))
+        return false;
+    nAssert(seg.writable);
+    memcpy(static_cast<uint8_t*>(seg.map->data().data()) + seg.used, data.data(), data.size());
+    game.frames.push_back(FrameLocation(segNr, seg.used, time));
+    seg.used += data.size();
+    return true;
+}
+
+bool GameArchive::getFrame(unsigned frameNr, ConstDataBlockRef& data, double& time, bool& gameFinished) throw () {
+    if (frameNr < firstFrameNr)
+        return false;
+    unsigned frame = frameNr - firstFrameNr;
+    for (std::deque<Game>::const_iterator gi = games.begin(); gi != games.end(); ++gi) {
+        if (frame >= gi->frames.size()) {
+            frame -= gi->frames.size();
+            continue;
+        }
+        const FrameLocation& loc = gi->frames[frame];
+        if (!mapSegment(loc.segment))
+            return false;
+        Segment& seg = segment(loc.segment);
+        const unsigned end = frame + 1 < gi->frames.size() && gi->frames[frame + 1].segment == loc.segment ? gi->frames[frame + 1].offset : seg.used;
+        data = ConstDataBlockRef(seg.map->data()).tail(loc.offset);
+        data = ConstDataBlockRef(data.data(), end - loc.offset);
+        time = loc.time;
+        gameFinished = gi->finished;
+        return true;
+    }
+    return false;
+}
+
+bool GameArchive::mapSegment(unsigned segmentNr) throw () {
+    Segment& seg = segment(segmentNr);
+    seg.lastUse = ++useCounter;
+    if (seg.map)
+        return true;
+    seg.writable = segmentNr == firstSegmentNr + segments.size() - 1 && segmentNr >= games.back().firstSegment && !games.back().finished;
+    seg.map = platMapFile(segmentFileName(segmentNr), seg.size, seg.writable);
+    if (!seg.map)
+        return false;
+    limitMappings();
+    return true;
+}
+
+void GameArchive::unmapSegment(Segment& seg) throw () {
+    delete seg.map;
+    seg.map = 0;
+}
+
+void GameArchive::limitMappings() throw () {
+    while (mappedSegments() > maxMapped) {
+        Segment* oldest = 0;
+        for (std::deque<Segment>::iterator si = segments.begin(); si != segments.end(); ++si)
+            if (si->map && (!oldest || si->lastUse < oldest->lastUse))
+                oldest = &*si;
+        nAssert(oldest);
+        unmapSegment(*oldest);
+    }
+}
+
+unsigned GameArchive::mappedSegments() const throw () {
+    unsigned n = 0;
+    for (std::deque<Segment>::const_iterator si = segments.begin(); si != segments.end(); ++si)
+        if (si->map)
+            ++n;
+    return n;
+}
+
+void GameArchive::removeOldestGame() throw () {
+    nAssert(!games.empty());
+    const unsigned segmentEnd = games.size() > 1 ? games[1].firstSegment : firstSegmentNr + segments.size();
+    while (firstSegmentNr < segmentEnd) {
+        unmapSegment(segments.front());
+        remove(segmentFileName(firstSegmentNr).c_str());
+        segments.pop_front();
+        ++firstSegmentNr;
+    }
+    firstFrameNr += games.front().frames.size();
+    games.pop_front();
+}
@@ -0,0 +1,117 @@
+/*
+ *  gamearchive.h
+ *
+ *  Copyright (C) 2008 - Niko Ritari
+ *
+ *  This file is part of Outgun.
+ *
+ *  Outgun is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Outgun is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Outgun; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef GAMEARCHIVE_H_INC
+#define GAMEARCHIVE_H_INC
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "../utility.h"
+
+class MappedFile;
+
+/** Disk-backed store of relayed games.
+ * Frames are appended to segment files in the archive directory and memory mapped when they're written or served.
+ * Each game starts a new segment, so that removing a game removes whole segments. Only a small index
+ * (16 bytes per frame) and a limited number of segment mappings are kept in memory, independently of how
+ * many games are retained.
+ * Frames are numbered consecutively from the start of the relay; numbers of removed frames are not reused.
+ */
+class GameArchive : private NoCopying {
+public:
+    GameArchive(const std::string& directory, unsigned segmentSize, unsigned maxMappedSegments) throw ();
+    ~GameArchive() throw (); // removes all segment files
+
+    void setDirectory(const std::string& dir) throw () { directory = dir; }
+    /// Set the start of the segment file names; must be unique among the archives sharing the directory.
+    void setFilePrefix(const std::string& prefix) throw () { filePrefix = prefix; }
+
+    /// Finish the current game if any, and start a new one.
+    void startGame() throw ();
+    /// Append a complete frame to the current game. Returns false if the data couldn't be stored.
+    bool addFrame(ConstDataBlockRef data, double time) throw ();
+
+    unsigned numGames() const throw () { return games.size(); }
+    unsigned numFinishedGames() const throw () { return games.empty() || games.back().finished ? games.size() : games.size() - 1; }
+    bool gameFinished(unsigned game) const throw () { return games[game].finished; }
+    unsigned gameFrames(unsigned game) const throw () { return games[game].frames.size(); }
+    unsigned gameStartFrame(unsigned game) const throw (); // game may be numGames() for the frame number following the last game
+    unsigned firstFrame() const throw () { return firstFrameNr; }
+    bool gameStartsAt(unsigned frameNr) const throw (); // true if frameNr is the first frame of a game
+
+    /** Access a stored frame.
+     * The data reference is valid until the next non-const call. Returns false if the frame is not (or no longer) stored.
+     */
+    bool getFrame(unsigned frameNr, ConstDataBlockRef& data, double& time, bool& gameFinished) throw ();
+
+    /// Remove the oldest game and its segment files.
+    void removeOldestGame() throw ();
+
+    unsigned mappedSegments() const throw ();
+
+private:
+    struct FrameLocation {
+        uint32_t segment;   // absolute segment number
+        uint32_t offset;
+        double time;
+        FrameLocation(uint32_t seg, uint32_t off, double t) throw () : segment(seg), offset(off), time(t) { }
+    };
+
+    struct Game {
+        std::vector<FrameLocation> frames;
+        uint32_t firstSegment; // segments from this up to the next game's firstSegment belong to this game
+        bool finished;
+        Game(uint32_t firstSeg) throw () : firstSegment(firstSeg), finished(false) { }
+    };
+
+    struct Segment {
+        unsigned size;
+        unsigned used;
+        bool writable;
+        MappedFile* map;    // owned; 0 if not currently mapped
+        unsigned lastUse;
+        Segment(unsigned size_) throw () : size(size_), used(0), writable(true), map(0), lastUse(0) { }
+    };
+
+    std::string segmentFileName(unsigned segment) const throw ();
+    Segment& segment(unsigned segmentNr) throw () { return segments[segmentNr - firstSegmentNr]; }
+    bool newSegment(unsigned minSize) throw ();
+    bool mapSegment(unsigned segmentNr) throw ();
+    void unmapSegment(Segment& seg) throw ();
+    void limitMappings() throw ();
+
+    std::string directory;
+    std::string filePrefix;
+    const unsigned segmentSize;
+    const unsigned maxMapped;
+
+    std::deque<Game> games;
+    std::deque<Segment> segments;
+    unsigned firstSegmentNr;
+    unsigned firstFrameNr;
+    unsigned useCounter;
+};
+
+#endif
@@ -32,7 +32,7 @@ int main(int argc, const char* argv[]) {
         srand(time(0));
         cout << "Width " << atoi(argv[1]) << ", height " << atoi(argv[2]) << '\n';
         MapGenerator generator;
-        generator.generate(atoi(argv[1]), atoi(argv[2]), false);
+        generator.generate(atoi(argv[1]), atoi(argv[2]), false, rand());
         generator.draw(cout);
     }
 }
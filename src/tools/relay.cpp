@@ -22,6 +22,7 @@
  *
  */
 
+#include <ctime>
 #include <iostream>
 #include <map>
 #include <string>
@@ -39,7 +40,6 @@
 
 using std::cin;
 using std::cout;
-using std::deque;
 using std::ios;
 using std::ifstream;
 using std::istream;
@@ -78,17 +78,24 @@ int main(int argc, const char* argv[]) {
     }
     catch (Relay::ArgumentException ex) {
         cout << ex.message() << '\n';
-        cout << "Usage: relay -p port [-b bandwidth_limit (B/s)] [-s spectator_limit] [-d delay (s)]\n";
+        cout << "Usage: relay -p port [-b bandwidth_limit (B/s)] [-s spectator_limit] [-d delay (s)] [-g retained_games] [-a archive_directory] [-u upstream_relay:port]\n";
     }
 }
 
 Relay::Relay() throw () :
     listen_port(0),
+    upstream_retry_time(0),
+    upstream_session(0),
+    upstream_next_frame(0),
+    session(static_cast<uint32_t>(time(0))),
     bandwidth_limit(20000),
     spectator_limit(16),
     game_delay(120),
+    server_delay(0),
+    retained_games(0),
+    archive(wheregamedir, 4 * 1024 * 1024, 16),
+    incoming_length(0),
     first_buffer(-1, string(), 0),
-    buffer_first_frame(0),
     master_talk_time(0)
 { }
 
@@ -118,6 +125,7 @@ void Relay::run() throw () {
 
     while (!g_exitFlag) {
         g_timeCounter.refresh();
+        connect_upstream();
         listen();
         check_new_connections();
         get_server_data();
@@ -152,6 +160,20 @@ void Relay::load_settings(const vector<string>& parameters) throw (Relay::Argume
             if (!ist || !ist.eof())
                 throw ArgumentException("Game delay must be an integer and at least 0.");
         }
+        else if (option == "-g") {
+            ist >> retained_games;
+            if (!ist || !ist.eof())
+                throw ArgumentException("Retained games must be an integer and at least 0.");
+        }
+        else if (option == "-a") {
+            if (!platIsDirectory(value))
+                throw ArgumentException("Archive directory " + value + " doesn't exist.");
+            archive.setDirectory(value);
+        }
+        else if (option == "-u") {
+            if (!upstream_address.tryResolve(value) || upstream_address.getPort() == 0)
+                throw ArgumentException("Upstream relay must be given as address:port.");
+        }
         else if (option == "-p") {
             ist >> listen_port;
             if (!ist || listen_port == 0 || !ist.eof())
@@ -162,6 +184,7 @@ void Relay::load_settings(const vector<string>& parameters) throw (Relay::Argume
     }
     if (listen_port == 0)
         throw ArgumentException("Port must be defined.");
+    archive.setFilePrefix("relay_" + itoa(listen_port) + "_segment_");   // relays on one host have distinct ports
 }
 
 // FIX: getline_skip_comments
@@ -177,6 +200,43 @@ void Relay::load_master_settings() throw () {
         master_submit = "/outgun/servers/submit.php";
 }
 
+void Relay::connect_upstream() throw () {
+    if (!upstream_address.valid() || server_socket.isOpen() || get_time() < upstream_retry_time)
+        return;
+    for (PointerVector<Peer>::iterator pi = peers.begin(); pi != peers.end(); ++pi)
+        if (pi->address == upstream_address) // still waiting for the reply
+            return;
+    upstream_retry_time = get_time() + 10.;
+
+    Network::TCPSocket socket;
+    try {
+        socket.open(Network::NonBlocking, 0);
+        socket.connect(upstream_address);
+
+        BinaryBuffer<256> request;
+        request.str(GAME_STRING);
+        request.U32dyn8(RELAY_PROTOCOL);
+        request.U32dyn8(RELAY_PROTOCOL_EXTENSIONS_VERSION);
+        request.str("RELAY");
+        // ask to continue after the last frame received in an earlier subscription, so that the games aren't archived twice
+        BinaryBuffer<32> extensions;
+        extensions.U32dyn8(0);  // games back
+        extensions.U8(0);       // encodings
+        extensions.U32(upstream_session);
+        extensions.U32dyn8(upstream_next_frame);
+        request.U32dyn8(extensions.size());
+        request.block(extensions);
+        socket.persistentWrite(request, 500, 5);
+    } catch (const Network::Error& e) {
+        cout << "Upstream relay: " << e.str() << '\n';
+        socket.closeIfOpen();
+        return;
+    }
+    // The upstream relay replies like a game server connecting, so handle it as any new connection.
+    peers.push_back(give_control(new Peer(upstream_address, trashable_ref(socket))));
+    cout << "Subscribed to the upstream relay " << upstream_address.toString() << ".\n";
+}
+
 void Relay::listen() throw () {
     while (listen_socket.isOpen()) {
         Network::TCPSocket new_socket;
@@ -223,14 +283,21 @@ bool Relay::check_new_connection(Peer& p) throw () {
         }
         const uint32_t relayProtocolExtensionLevel = read.U32dyn8();
         const string type = read.str();
-        if (type == "SPECTATOR") {
+        if (type == "SPECTATOR" || type == "RELAY") {
+            const bool relay = type == "RELAY";
             if (spectators.size() >= static_cast<unsigned>(spectator_limit)) {
                 cout << "New spectator couldn't join because spectator limit already reached.\n";
                 return true;
             }
-            read.U32dyn8(); // ignore replay version
-            read.str(); // ignore username
-            read.str(); // ignore password
+            if (relay && relayProtocolExtensionLevel != RELAY_PROTOCOL_EXTENSIONS_VERSION) {
+                cout << "Attempt to connect from a relay of unsupported version blocked.\n";
+                return true;
+            }
+            if (!relay) {
+                read.U32dyn8(); // ignore replay version
+                read.str(); // ignore username
+                read.str(); // ignore password
+            }
             // TODO: Check username and password.
             #if 0
             if (!check_user()) {
@@ -239,11 +306,33 @@ bool Relay::check_new_connection(Peer& p) throw () {
             }
             #endif
 
+            // Known extensions: the number of games to go back from the current one, if the spectator wants to see an archived game,
+            // and a mask of the accepted stream encodings. Relays add the session and frame number to resume from.
             const uint32_t extensionsSize = read.U32dyn8();
-            read.block(extensionsSize); // just ignore since we know no extensions
+            unsigned games_back = 0, encodings = 0, resume_frame = 0;
+            uint32_t resume_session = 0;
+            bool resumable = false;
+            if (extensionsSize > 0) {
+                BinaryDataBlockReader extensions(read.block(extensionsSize));
+                try {
+                    games_back = extensions.U32dyn8();
+                    encodings = extensions.U8();
+                    if (relay) {
+                        resume_session = extensions.U32();
+                        resume_frame = extensions.U32dyn8();
+                        resumable = true;
+                    }
+                } catch (BinaryReader::ReadOutside) { }
+            }
 
-            spectators.push_back(give_control(new Spectator(p.address, trashable_ref(p.socket))));
-            cout << "Spectator connected.\n";
+            spectators.push_back(give_control(new Spectator(p.address, trashable_ref(p.socket), relay)));
+            spectators.back().games_back = games_back;
+            spectators.back().position_pending = resumable;
+            spectators.back().resume_session = resume_session;
+            spectators.back().resume_frame = resume_frame;
+            if (!relay && (encodings & (1 << replay_encoding_deflate)))
+                spectators.back().compressor = new Compressor();
+            cout << (relay ? "Downstream relay connected.\n" : "Spectator connected.\n");
             return true;
         }
         else if (type == "SERVER") {
@@ -256,24 +345,47 @@ bool Relay::check_new_connection(Peer& p) throw () {
                 return true;
             }
             read.U32dyn8(); // ignore total packet length
-            ExpandingBinaryBuffer data;
+            ExpandingBinaryBuffer data, init;
             data.U8(RELAY_PROTOCOL_EXTENSIONS_VERSION); // limit to U8 because the current client code can't handle receiving this data in two separate reads
-            data.block(read.constLengthStr(REPLAY_IDENTIFICATION.length()));
-            data.U32(read.U32()); // version
-            data.U32(read.U32()); // replay length
-            data.str(hostname = read.str());
-            data.U32(read.U32()); // maxplayers
-            read.str(); data.str(string()); // Store empty map name because the server sent only the map name of the first game.
+            init.block(read.constLengthStr(REPLAY_IDENTIFICATION.length()));
+            const uint32_t version = read.U32();
+            init.U32(version);
+            init.U32(read.U32()); // replay length
+            init.str(hostname = read.str());
+            init.U32(read.U32()); // maxplayers
+            read.str(); init.str(string()); // Store empty map name because the server sent only the map name of the first game.
+            data.block(init);
             server_delay = read.U32();
+            init.U32(std::max(server_delay, game_delay)); // the total delay applied when the data reaches downstream relays
 
             first_buffer = Frame(data.size(), data, get_time());
 
+            compressed_first_buffer.clear();
+            compressed_first_buffer.block(data);
+            compressed_first_buffer.setPosition(1 + REPLAY_IDENTIFICATION.length());
+            compressed_first_buffer.U32(std::max(version, REPLAY_ENCODING_VERSION));
+            compressed_first_buffer.setPosition(data.size());
+            compressed_first_buffer.U8(replay_encoding_deflate);
+
+            relay_header.clear();
+            relay_header.str(GAME_STRING);
+            relay_header.U32dyn8(RELAY_PROTOCOL);
+            relay_header.U32dyn8(RELAY_PROTOCOL_EXTENSIONS_VERSION);
+            relay_header.str("SERVER");
+            relay_header.U32dyn8(init.size());
+            relay_header.block(init);
+
+            // an upstream relay sends game data right after the header
+            const string rest = p.buffer.str().substr(read.getPosition());
+            waiting_data.clear();
+            waiting_data.block(rest);
+            incoming_frame.clear(); // a frame left unfinished by the previous connection is lost
+            incoming_length = 0;
+            if (p.address != upstream_address)
+                upstream_session = 0;
+
             server_socket = trashable_ref(p.socket);
-            cout << "Server connected: " << hostname << '\n';
-            return true;
-        }
-        else if (type == "RELAY") {
-            cout << "Subrelay connected. Just dropped it as there is no support for subrelays.\n";
+            cout << (p.address == upstream_address ? "Upstream relay connected: " : "Server connected: ") << hostname << '\n';
             return true;
         }
         else {
@@ -335,40 +447,51 @@ void Relay::get_server_data() throw () {
 }
 
 bool Relay::add_data(SeekableBinaryReader& reader) throw () {
-    if (games.empty())
-        games.push_back(Game());
-    vector<Frame>* data_buffer = &games.back().buffer();
-    if (!data_buffer->empty() && !data_buffer->back().full()) {
-        ConstDataBlockRef data = reader.blockUpTo(data_buffer->back().remaining());
-        data_buffer->back().add(data, get_time());
-        //cout << "Frame " << data_buffer->size() - 1 << ", " << data.size() << " bytes.\n";
+    if (incoming_length != 0) {
+        incoming_frame.block(reader.blockUpTo(incoming_length - incoming_frame.size()));
+        if (incoming_frame.size() == incoming_length)
+            store_incoming_frame();
+        return true;
     }
-    else {
-        const istream::pos_type startPos = reader.getPosition();
-        try {
-            const uint8_t data_code = reader.U8();
-            const uint32_t length = reader.U32();
-            switch (data_code) {
-            /*break;*/ case relay_data_game_start:
-                    games.back().finish();
-                    // TODO: Reload the init data, at least the server_delay setting
-                    games.push_back(Game());
-                    data_buffer = &games.back().buffer();
-                    cout << "New game started.\n";
-                break; case relay_data_frame:
-                break; default: nAssert(0); //#fix
-            }
-            ConstDataBlockRef data = reader.blockUpTo(length);
-            data_buffer->push_back(Frame(length, data, get_time()));
-            //cout << "Frame " << data_buffer->size() - 1 << ", " << data.size() << " bytes of " << length << ".\n";
-        } catch (BinaryReader::ReadOutside) {
-            reader.setPosition(startPos);
-            return false;
+    const unsigned startPos = reader.getPosition();
+    try {
+        const uint8_t data_code = reader.U8();
+        const uint32_t length = reader.U32();
+        if (data_code == relay_data_position) {
+            BinaryDataBlockReader position(reader.block(length));
+            upstream_session = position.U32();
+            upstream_next_frame = position.U32();
+            return true;
         }
+        switch (data_code) {
+        /*break;*/ case relay_data_game_start:
+                // TODO: Reload the init data, at least the server_delay setting
+                archive.startGame();
+                cout << "New game started.\n";
+            break; case relay_data_frame:
+            break; default: nAssert(0); //#fix
+        }
+        incoming_frame.clear();
+        incoming_frame.U32(length);
+        incoming_length = length + 4;
+        incoming_frame.block(reader.blockUpTo(length));
+        if (incoming_frame.size() == incoming_length)
+            store_incoming_frame();
+    } catch (BinaryReader::ReadOutside) {
+        reader.setPosition(startPos);
+        return false;
     }
     return true;
 }
 
+void Relay::store_incoming_frame() throw () {
+    if (!archive.addFrame(incoming_frame, get_time()))
+        cout << "Could not store a frame to the archive.\n";
+    ++upstream_next_frame;
+    incoming_length = 0;
+    incoming_frame.clear();
+}
+
 void Relay::send_data() throw () {
     for (PointerVector<Spectator>::iterator si = spectators.begin(); si != spectators.end(); ) {
         try {
@@ -391,15 +514,27 @@ void Relay::send_data() throw () {
         }
         if (!si->local) {           // Limit data sending rate for spectators
             const unsigned bpsout = si->socket.getStat(Network::Socket::Stat_AvgBytesSent);
-            if (bpsout > bandwidth_limit / spectators.size())
+            if (bpsout > bandwidth_limit / spectators.size()) {
+                ++si;
                 continue;
+            }
         }
-        ExpandingBinaryBuffer chunk;
+        ConstDataBlockRef chunk(0, 0);
+        ExpandingBinaryBuffer relay_frame;
         if (!si->first_buffer_sent)
-            chunk.block(first_buffer.data().tail(si->bytes_sent));
+            chunk = (si->relay ? ConstDataBlockRef(relay_header.ref()) : si->compressor ? ConstDataBlockRef(compressed_first_buffer.ref()) : first_buffer.data()).tail(si->bytes_sent);
+        else if (si->relay) {
+            if (relay_frame_data(relay_frame, si->next_frame, si->position_pending))
+                chunk = ConstDataBlockRef(relay_frame.ref()).tail(si->bytes_sent);
+        }
+        else if (si->compressor) {
+            if (si->encoded_frame.empty())
+                encoded_frame_data(si->encoded_frame, *si->compressor, si->next_frame);
+            chunk = ConstDataBlockRef(si->encoded_frame.ref()).tail(si->bytes_sent);
+        }
         else
             frame_data(chunk, si->next_frame, si->bytes_sent);
-        if (chunk.empty()) {    // Nothing to send yet
+        if (chunk.size() == 0) {    // Nothing to send yet
             ++si;
             continue;
         }
@@ -411,17 +546,23 @@ void Relay::send_data() throw () {
         si->bytes_sent += result;
         if (static_cast<unsigned>(result) == chunk.size()) { // A frame has entirely been sent
             si->bytes_sent = 0;
-            if (!si->first_buffer_sent) {   // Send next the last game available
+            si->encoded_frame.clear();
+            if (!si->first_buffer_sent) {   // Send next the current game or the requested archived game
                 cout << "Init data sent to a client.\n";
-                unsigned game_start_buffer = buffer_first_frame;
-                for (deque<Game>::iterator gi = games.begin(); gi != games.end(); gi++)
-                    if (gi->finished())
-                        game_start_buffer += gi->size();
-                si->next_frame = game_start_buffer;
+                const unsigned current_game = archive.numFinishedGames();
+                if (si->relay) { // downstream relays get every retained game they don't have yet, so that they can serve late joiners too
+                    si->next_frame = archive.firstFrame();
+                    if (si->resume_session == session)
+                        si->next_frame = std::max(si->next_frame, std::min(si->resume_frame, archive.gameStartFrame(archive.numGames())));
+                }
+                else
+                    si->next_frame = archive.gameStartFrame(current_game - std::min(si->games_back, current_game));
                 si->first_buffer_sent = true;
             }
-            else
+            else {
                 si->next_frame++;
+                si->position_pending = false;
+            }
         }
         ++si;
     }
@@ -447,63 +588,51 @@ int Relay::send_data(Network::TCPSocket& socket, ConstDataBlockRef data) const t
 }
 
 void Relay::remove_oldest_game() throw () {
-    if (!games.front().finished())
+    if (archive.numFinishedGames() <= retained_games)
         return;
-    bool transmissions_needed = false;
+    const unsigned oldest_game_end = archive.firstFrame() + archive.gameFrames(0);
     for (PointerVector<Spectator>::iterator si = spectators.begin(); si != spectators.end(); si++)
-        if (si->next_frame <= buffer_first_frame + games.front().size()) {
-            transmissions_needed = true;
-            break;
-        }
-    if (!transmissions_needed) {
-        buffer_first_frame += games.front().size();
-        games.pop_front();
-    }
-}
-
-const Frame* Relay::get_frame(unsigned frame_nr) const throw () {
-    const Frame* frame = 0;
-    unsigned game_start_buffer = buffer_first_frame;
-    for (deque<Game>::const_iterator gi = games.begin(); gi != games.end(); gi++) {
-        if (game_start_buffer + gi->size() > frame_nr) {
-            frame = &gi->frame(frame_nr - game_start_buffer);
-            break;
-        }
-        game_start_buffer += gi->size();
-    }
-    return frame;
+        if (si->first_buffer_sent && si->next_frame <= oldest_game_end)
+            return;
+    archive.removeOldestGame();
 }
 
-bool Relay::frame_data(BinaryWriter& target, unsigned frame_nr, unsigned pos) const throw () {
-    const Frame* frame = 0;
-    unsigned game_start_buffer = buffer_first_frame;
-    bool current_game_finished = false;
-    for (deque<Game>::const_iterator gi = games.begin(); gi != games.end(); gi++) {
-        if (game_start_buffer + gi->size() > frame_nr) {
-            frame = &gi->frame(frame_nr - game_start_buffer);
-            current_game_finished = gi->finished();
-            break;
-        }
-        game_start_buffer += gi->size();
-    }
-    if (!frame || !frame->full())
+bool Relay::frame_data(ConstDataBlockRef& target, unsigned frame_nr, unsigned pos) throw () {
+    ConstDataBlockRef frame(0, 0);
+    double time;
+    bool current_game_finished;
+    if (!archive.getFrame(frame_nr, frame, time, current_game_finished))
         return false;
     // Do not send too recent frames if the game is still going on.
-    if (!current_game_finished && frame->time() + game_delay > get_time() + server_delay)
+    if (!current_game_finished && time + game_delay > get_time() + server_delay)
         return false;
-    if (pos < 4) {
-        if (pos == 0)
-            target.U32(frame->length());
-        else {
-            BinaryBuffer<4> lengthData;
-            lengthData.U32(frame->length());
-            target.block(lengthData.ref().tail(pos));
-        }
-        pos = 0;
+    target = frame.tail(pos); // the stored frame includes the length
+    return true;
+}
+
+bool Relay::relay_frame_data(BinaryWriter& target, unsigned frame_nr, bool position) throw () {
+    ConstDataBlockRef frame(0, 0);
+    if (!frame_data(frame, frame_nr, 0))
+        return false;
+    if (position) {
+        target.U8(relay_data_position);
+        target.U32(8);
+        target.U32(session);
+        target.U32(frame_nr);
     }
-    else
-        pos -= 4;
-    target.block(frame->data().tail(pos));
+    target.U8(archive.gameStartsAt(frame_nr) ? relay_data_game_start : relay_data_frame);
+    target.block(frame);
+    return true;
+}
+
+bool Relay::encoded_frame_data(BinaryWriter& target, Compressor& compressor, unsigned frame_nr) throw () {
+    ConstDataBlockRef frame(0, 0);
+    if (!frame_data(frame, frame_nr, 0))
+        return false;
+    ExpandingBinaryBuffer encoded;
+    compressor.compress(frame.tail(4), encoded);    // the stored frame starts with its length
+    target.U32(encoded.size());
+    target.block(encoded);
     return true;
 }
 
@@ -26,13 +26,15 @@
 #define RELAY_H_INC
 
 #include <fstream>
-#include <deque>
 #include <sstream>
 #include <vector>
 
+#include "../compress.h"
 #include "../network.h"
 #include "../pointervector.h"
 
+#include "gamearchive.h"
+
 class Peer : private NoCopying {
 public:
     Peer(const Network::Address& addr, TrashableRef<Network::TCPSocket> sock) throw () : address(addr), socket(sock) { }
@@ -44,21 +46,35 @@ public:
 
 class Spectator : private NoCopying {
 public:
-    Spectator(const Network::Address& addr, TrashableRef<Network::TCPSocket> sock) throw () :
+    Spectator(const Network::Address& addr, TrashableRef<Network::TCPSocket> sock, bool relay_) throw () :
         address(addr),
         socket(sock),
         local(isLocalIP(addr)),
+        relay(relay_),
         next_frame(0),
         bytes_sent(0),
-        first_buffer_sent(false)
+        first_buffer_sent(false),
+        games_back(0),
+        compressor(0),
+        position_pending(false),
+        resume_session(0),
+        resume_frame(0)
     { }
+    ~Spectator() throw () { delete compressor; }
 
     Network::Address address;
     Network::TCPSocket socket;
     bool local;
+    bool relay;             /// A downstream relay that is sent the game data in the server format
     unsigned  next_frame;
     unsigned  bytes_sent;
     bool first_buffer_sent;
+    unsigned  games_back;   /// How many games before the current one the spectator wants to start from
+    Compressor* compressor; /// Owned; set if the spectator is sent deflate encoded frames
+    ExpandingBinaryBuffer encoded_frame;    /// The frame being sent, if encoded
+    bool position_pending;  /// A resumable downstream relay that hasn't yet been told the position of the frames sent
+    uint32_t resume_session;    /// The session and frame number that a downstream relay wants to continue from; session 0 if none
+    unsigned resume_frame;
 };
 
 class Frame {
@@ -80,25 +96,6 @@ private:
     double      time_;
 };
 
-class Game {
-public:
-    Game() throw () : finished_(false) { }
-
-    void add(const Frame& f) throw () { frames.push_back(f); }
-    void finish() throw () { finished_ = true; }
-
-    unsigned size() const throw () { return frames.size(); }
-
-    const Frame& frame(unsigned i) const throw () { return frames[i]; }
-    std::vector<Frame>& buffer() throw () { return frames; }
-
-    bool finished() const throw () { return finished_; }
-
-private:
-    std::vector<Frame> frames;
-    bool finished_;
-};
-
 class Relay {
 public:
     class ArgumentException {
@@ -122,6 +119,9 @@ private:
     /// Listen for new connections
     void listen() throw ();
 
+    /// Subscribe to the upstream relay if it's not connected
+    void connect_upstream() throw ();
+
     /// Handle connections just opened
     void check_new_connections() throw ();
     bool check_new_connection(Peer& p) throw (); // returns true if the peer was handled and can be removed
@@ -129,8 +129,9 @@ private:
     /// Read game data from the Outgun server
     void get_server_data() throw ();
 
-    /// Add game data to buffer
+    /// Add game data to the archive
     bool add_data(SeekableBinaryReader& reader) throw ();
+    void store_incoming_frame() throw ();
 
     /// Send data to every spectator
     void send_data() throw ();
@@ -138,11 +139,12 @@ private:
     /// Send data to the socket
     int send_data(Network::TCPSocket& socket, ConstDataBlockRef data) const throw ();
 
-    /// Remove the oldest game if it is not needed anymore
+    /// Remove the oldest game if it is not retained or needed anymore
     void remove_oldest_game() throw ();
 
-    const Frame* get_frame(unsigned frame_nr) const throw ();
-    bool frame_data(BinaryWriter& target, unsigned frame_nr, unsigned pos) const throw ();
+    bool frame_data(ConstDataBlockRef& target, unsigned frame_nr, unsigned pos) throw ();
+    bool relay_frame_data(BinaryWriter& target, unsigned frame_nr, bool position) throw (); // the whole frame in the server format, preceded by its position if asked
+    bool encoded_frame_data(BinaryWriter& target, Compressor& compressor, unsigned frame_nr) throw (); // the whole frame deflate encoded for a spectator
 
     void load_master_settings() throw ();
     void send_master_server() throw ();
@@ -151,22 +153,31 @@ private:
     unsigned short listen_port;       /// Port for all incoming connections
 
     Network::Address server_address;  /// Game server address
-    Network::TCPSocket server_socket; /// Game server socket
+    Network::TCPSocket server_socket; /// Game server or upstream relay socket
+    Network::Address upstream_address; /// Upstream relay address, if this relay is fed by another relay
+    double upstream_retry_time;
+    uint32_t upstream_session;      /// Session of the upstream relay, 0 if unknown
+    unsigned upstream_next_frame;   /// Upstream archive number of the next frame to be received
+    const uint32_t session;     /// Identifies this run of the relay to resuming downstream relays
     std::string hostname;
 
     unsigned bandwidth_limit;   /// Total bandwidth limit, bytes per second
     unsigned spectator_limit;   /// Maximum number of spectators for this relay
     unsigned game_delay;        /// Delay from the live game in seconds
     unsigned server_delay;      /// Delay from the live game on the game server, in seconds
+    unsigned retained_games;    /// Number of finished games kept in the archive for late joiners
 
     PointerVector<Spectator> spectators;
     PointerVector<Peer> peers;  /// Just connected "things"
-    std::deque<Game> games;     /// Game data
+    GameArchive archive;        /// Game data
 
     ExpandingBinaryBuffer waiting_data;
+    ExpandingBinaryBuffer incoming_frame; /// Frame being received from the server, with its length prefix
+    unsigned incoming_length;   /// Total length of incoming_frame, including the length prefix; 0 if no frame is being received
 
     Frame first_buffer;          /// Initial buffer that basically has the same data as in the start of the replay
-    unsigned buffer_first_frame; /// Frame number of the start frame of the first game in list
+    ExpandingBinaryBuffer compressed_first_buffer; /// first_buffer for spectators receiving deflate encoded frames
+    ExpandingBinaryBuffer relay_header; /// Server connection message for downstream relays
 
     std::string master_name;
     std::string master_submit;
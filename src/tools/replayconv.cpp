@@ -0,0 +1,241 @@
+/*
+ *  replayconv.cpp
+ *
+ *  Copyright (C) 2008 - Niko Ritari
+ *
+ *  This file is part of Outgun.
+ *
+ *  Outgun is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Outgun is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Outgun; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../binaryaccess.h"
+#include "../compress.h"
+#include "../protocol.h"
+#include "../version.h"
+
+using std::cout;
+using std::ifstream;
+using std::ios;
+using std::ofstream;
+using std::pair;
+using std::string;
+using std::vector;
+
+/// One record of a replay, decoded
+class Record {
+public:
+    bool keyframe;
+    uint32_t frame;     // only for keyframes
+    ExpandingBinaryBuffer data;
+
+    Record() throw () : keyframe(false), frame(0) { }
+};
+
+class ReplayConverter {
+public:
+    ReplayConverter(std::istream& in_, std::ostream& out_, bool compress_) throw () : in(in_), out(out_), read(in_), compress(compress_) { }
+
+    bool convert() throw (); // returns false and prints the reason on failure
+
+private:
+    bool readRecord(Record& rec) throw (); // returns false at the end of the frames
+    void writeRecord(const Record& rec, bool restartPoint) throw ();
+
+    std::istream& in;
+    std::ostream& out;
+    BinaryStreamReader read;
+    const bool compress;
+
+    unsigned encoding, dataEnd;
+    Decompressor decoder;
+    Compressor encoder;
+    vector<pair<uint32_t, uint32_t> > keyframes;    // frame number, file offset
+    unsigned frames;
+};
+
+bool ReplayConverter::readRecord(Record& rec) throw () {
+    const unsigned pos = read.getPosition();
+    if (dataEnd != 0 && pos >= dataEnd)
+        return false;
+    try {
+        const uint32_t length = read.U32();
+        rec.keyframe = (length & REPLAY_KEYFRAME_FLAG) != 0;
+        rec.data.clear();
+        if (rec.keyframe) {
+            rec.frame = read.U32();
+            const ConstDataBlockRef data = read.block((length & ~REPLAY_KEYFRAME_FLAG) - 4);
+            if (encoding == replay_encoding_raw)
+                rec.data.block(data);
+            else if (!Decompressor().decompress(data, rec.data))
+                throw BinaryReader::ReadOutside();
+        }
+        else {
+            const ConstDataBlockRef data = read.block(length);
+            if (encoding == replay_encoding_raw)
+                rec.data.block(data);
+            else if (!decoder.decompress(data, rec.data))
+                throw BinaryReader::ReadOutside();
+        }
+    } catch (BinaryReader::ReadOutside) {
+        if (!in.eof())
+            cout << "Stopping at a broken record at offset " << pos << ".\n";
+        return false;
+    }
+    return true;
+}
+
+void ReplayConverter::writeRecord(const Record& rec, bool restartPoint) throw () {
+    ExpandingBinaryBuffer buf;
+    buf.U32(0); // leave space for the length
+    if (rec.keyframe) {
+        keyframes.push_back(pair<uint32_t, uint32_t>(rec.frame, static_cast<uint32_t>(out.tellp())));
+        buf.U32(rec.frame);
+        if (compress)
+            Compressor().compress(rec.data, buf);
+        else
+            buf.block(rec.data);
+    }
+    else {
+        ++frames;
+        if (compress)
+            encoder.compress(rec.data, buf, restartPoint);
+        else
+            buf.block(rec.data);
+    }
+    const unsigned pos = buf.getPosition();
+    buf.setPosition(0);
+    buf.U32((pos - 4) | (rec.keyframe ? REPLAY_KEYFRAME_FLAG : 0));
+    buf.setPosition(pos);
+    out << buf;
+}
+
+bool ReplayConverter::convert() throw () {
+    ExpandingBinaryBuffer header;
+    unsigned version;
+    try {
+        if (read.constLengthStr(REPLAY_IDENTIFICATION.length()) != REPLAY_IDENTIFICATION) {
+            cout << "This is not an Outgun replay.\n";
+            return false;
+        }
+        version = read.U32();
+        if (version > REPLAY_VERSION) {
+            cout << "This is a newer replay version (" << version << ").\n";
+            return false;
+        }
+        header.constLengthStr(REPLAY_IDENTIFICATION, REPLAY_IDENTIFICATION.length());
+        header.U32(REPLAY_VERSION);
+        header.U32(read.U32()); // frame count
+        header.str(read.str()); // host name
+        header.U32(read.U32()); // maxplayers
+        header.str(read.str()); // map name
+        encoding = version >= REPLAY_ENCODING_VERSION ? read.U8() : static_cast<unsigned>(replay_encoding_raw);
+        if (encoding > replay_encoding_last) {
+            cout << "Unknown replay encoding (" << encoding << ").\n";
+            return false;
+        }
+        header.U8(compress ? replay_encoding_deflate : replay_encoding_raw);
+    } catch (BinaryReader::ReadOutside) {
+        cout << "The replay header is incomplete.\n";
+        return false;
+    }
+
+    // don't read the index of a version 1+ replay as frames
+    dataEnd = 0;
+    const unsigned framesStart = read.getPosition();
+    if (version >= 1)
+        try {
+            in.seekg(-8, ios::end);
+            const uint32_t indexPos = read.U32();
+            if (read.U32() == REPLAY_INDEX_MARKER)
+                dataEnd = indexPos;
+        } catch (BinaryReader::ReadOutside) { }
+    read.setPosition(framesStart);
+
+    out << header;
+    frames = 0;
+    Record records[2];
+    Record* current = &records[0], * next = &records[1];
+    bool haveCurrent = readRecord(*current);
+    while (haveCurrent) {
+        const bool haveNext = readRecord(*next);
+        writeRecord(*current, haveNext && next->keyframe);  // decoding must be able to restart after each keyframe
+        std::swap(current, next);
+        haveCurrent = haveNext;
+    }
+
+    ExpandingBinaryBuffer index;
+    const uint32_t indexPos = out.tellp();
+    index.U32(keyframes.size());
+    for (vector<pair<uint32_t, uint32_t> >::const_iterator ki = keyframes.begin(); ki != keyframes.end(); ++ki) {
+        index.U32(ki->first);
+        index.U32(ki->second);
+    }
+    index.U32(indexPos);
+    index.U32(REPLAY_INDEX_MARKER);
+    out << index;
+
+    cout << frames << " frames and " << keyframes.size() << " keyframes converted.\n";
+    return true;
+}
+
+int main(int argc, const char* argv[]) {
+    cout << "Outgun replay converter " << getVersionString() << '\n';
+
+    bool compress = true;
+    int argi = 1;
+    if (argi < argc && string(argv[argi]) == "-d") {
+        compress = false;
+        ++argi;
+    }
+    if (argc - argi != 2) {
+        cout << "Usage: replayconv [-d] input.replay output.replay\n"
+                "Converts a replay to the current format, compressed unless -d is given.\n";
+        return 1;
+    }
+    const string inName = argv[argi], outName = argv[argi + 1];
+    if (inName == outName) {
+        cout << "The output file must be different from the input.\n";
+        return 1;
+    }
+    ifstream in(inName.c_str(), ios::binary);
+    if (!in) {
+        cout << "Can't open " << inName << ".\n";
+        return 1;
+    }
+    ofstream out(outName.c_str(), ios::binary);
+    if (!out) {
+        cout << "Can't create " << outName << ".\n";
+        return 1;
+    }
+    ReplayConverter converter(in, out, compress);
+    if (!converter.convert())
+        return 1;
+    out.close();
+    if (!out) {
+        cout << "Error writing " << outName << ".\n";
+        return 1;
+    }
+    in.seekg(0, ios::end);
+    ifstream written(outName.c_str(), ios::binary | ios::ate);
+    cout << inName << ": " << in.tellg() << " bytes, " << outName << ": " << written.tellg() << " bytes.\n";
+    return 0;
+}
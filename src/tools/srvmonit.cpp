@@ -259,6 +259,16 @@ public:
                 else
                     printf("aborted\n");
             }
+            else if (toupper(key) == 'L') {
+                BinaryBuffer<32> msg;
+                msg.U32(ATS_GET_LOCK_PROFILE);
+                send(sock, msg);
+            }
+            else if (toupper(key) == 'N') {
+                BinaryBuffer<32> msg;
+                msg.U32(ATS_GET_NET_STATS);
+                send(sock, msg);
+            }
             else if (toupper(key) == 'Q') {
                 *messageBoxSetting = !*messageBoxSetting;
                 printf("Sayadmin message boxes %s\n", *messageBoxSetting ? "enabled" : "disabled");
@@ -346,8 +356,8 @@ bool runMonitor(int port, bool messageBoxes) throw () {
                 printf("<Invalid STA code: %u>", val);
                 continue;
             }
-            static const int ints[NUMBER_OF_STA] = { 0, 1, 1, 1, 1, 1, 1, 0, 2, 2, 2, 2, 2, 0, 0, 2, 1, 1 };
-            static const int strs[NUMBER_OF_STA] = { 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 1, 1 };
+            static const int ints[NUMBER_OF_STA] = { 0, 1, 1, 1, 1, 1, 1, 0, 2, 2, 2, 2, 2, 0, 0, 2, 1, 1, 0, 0 };
+            static const int strs[NUMBER_OF_STA] = { 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 1, 1, 1, 1 };
             unsigned ival[2];
             const int strBufLen = 1024;
             char strBuf[strBufLen + 1];
@@ -385,6 +395,8 @@ bool runMonitor(int port, bool messageBoxes) throw () {
                 break; case STA_QUIT:                  dualprintf("| Quit received\n"); sock.close(); return true;
                 break; case STA_PLAYER_PING:           dualprintf("| %s has ping %u\n", plyName(ival[0]), ival[1]);
                 break; case STA_PLAYER_IP:             dualprintf("| %s has IP %s\n", plyName(ival[0]), strBuf);
+                break; case STA_LOCK_PROFILE:          dualprintf("| %s\n", strBuf);
+                break; case STA_NET_STATS:             dualprintf("| Connectionless packets: %s\n", strBuf);
                 break; case STA_ADMIN_MESSAGE: {
                     char cap[strBufLen + 100];
                     platSnprintf(cap, strBufLen + 100, "Sayadmin message from %s", plyNames[ival[0]].c_str());
@@ -0,0 +1,223 @@
+/*
+ *  tools/statsquery.cpp
+ *
+ *  Copyright (C) 2008 - Niko Ritari
+ *
+ *  This file is part of Outgun.
+ *
+ *  Outgun is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Outgun is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Outgun; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../binaryaccess.h"
+#include "../commont.h"
+#include "../function_utility.h"
+#include "../platform.h"
+#include "../statsstream.h"
+#include "../utility.h"
+#include "../version.h"
+
+using std::cout;
+using std::ifstream;
+using std::ios;
+using std::map;
+using std::setw;
+using std::string;
+using std::vector;
+
+using namespace StatsStream;
+
+/// Sums of the records falling in one group.
+struct Totals {
+    unsigned records;
+    double seconds;
+    double humanSeconds, botSeconds;    // players weighted by the length of the record
+    double frames, tickTotalUs;
+    uint32_t tickMaxUs;
+    double counter[C_count];
+
+    Totals() throw () : records(0), seconds(0), humanSeconds(0), botSeconds(0), frames(0), tickTotalUs(0), tickMaxUs(0) {
+        for (int c = 0; c < C_count; ++c)
+            counter[c] = 0;
+    }
+    void addRecord(const Sample& s) throw () {
+        ++records;
+        seconds += s.seconds;
+        humanSeconds += double(s.humans) * s.seconds;
+        botSeconds += double(s.bots) * s.seconds;
+        frames += s.frames;
+        tickTotalUs += double(s.tickMeanUs) * s.frames;
+        tickMaxUs = std::max(tickMaxUs, s.tickMaxUs);
+    }
+    void addPlayer(const PlayerSample& p) throw () {
+        for (int c = 0; c < C_count; ++c)
+            counter[c] += p.value(c);
+    }
+};
+
+enum Grouping { G_hour, G_day, G_map, G_player };
+
+class Query {
+public:
+    Query(Grouping grouping_) throw () : grouping(grouping_), files(0), records(0), bytes(0) { }
+
+    void readFile(const string& name) throw ();
+    void print() const throw ();
+
+private:
+    void add(const Sample& s) throw ();
+
+    Grouping grouping;
+    map<string, Totals> groups;
+    unsigned files, records;
+    double bytes;
+};
+
+void Query::readFile(const string& name) throw () {
+    ifstream in(name.c_str(), ios::binary);
+    if (!in)
+        return;
+    const string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    BinaryDataBlockReader read(data.data(), data.length());
+    if (!readHeader(read)) {
+        cout << name << " is not a statistics stream file.\n";
+        return;
+    }
+    ++files;
+    bytes += data.length();
+    Sample s;
+    while (readRecord(read, s)) {
+        ++records;
+        add(s);
+    }
+}
+
+void Query::add(const Sample& s) throw () {
+    if (grouping == G_player) {
+        for (vector<PlayerSample>::const_iterator pi = s.players.begin(); pi != s.players.end(); ++pi) {
+            Totals& t = groups[pi->name];
+            ++t.records;
+            t.seconds += s.seconds;
+            t.addPlayer(*pi);
+        }
+        return;
+    }
+    string key;
+    if (grouping == G_map)
+        key = s.map;
+    else {
+        key = fileName(s.time / (24 * 3600)).substr(0, 10);
+        if (grouping == G_hour) {
+            const unsigned hour = s.time % (24 * 3600) / 3600;
+            key += (hour < 10 ? " 0" : " ") + itoa(hour) + ":00";
+        }
+    }
+    Totals& t = groups[key];
+    t.addRecord(s);
+    for (vector<PlayerSample>::const_iterator pi = s.players.begin(); pi != s.players.end(); ++pi)
+        for (int c = 0; c < C_count; ++c)
+            t.counter[c] += pi->value(c);
+}
+
+void Query::print() const throw () {
+    cout << files << " files, " << records << " records, " << std::fixed << std::setprecision(1) << bytes / 1024 << " kB\n\n";
+    if (groups.empty())
+        return;
+    if (grouping == G_player) {
+        vector<std::pair<double, string> > order;  // by frags, descending
+        for (map<string, Totals>::const_iterator gi = groups.begin(); gi != groups.end(); ++gi)
+            order.push_back(std::make_pair(-gi->second.counter[C_frags], gi->first));
+        std::sort(order.begin(), order.end());
+        cout << std::left << setw(24) << "player" << std::right << setw(10) << "minutes" << setw(8) << "frags" << setw(8) << "kills"
+             << setw(8) << "deaths" << setw(8) << "caps" << setw(10) << "shots" << setw(8) << "acc %" << '\n';
+        for (vector<std::pair<double, string> >::const_iterator oi = order.begin(); oi != order.end(); ++oi) {
+            const Totals& t = groups.find(oi->second)->second;
+            const double* c = t.counter;
+            cout << std::left << setw(24) << oi->second << std::right << std::setprecision(1) << setw(10) << t.seconds / 60 << std::setprecision(0)
+                 << setw(8) << c[C_frags] << setw(8) << c[C_kills] << setw(8) << c[C_deaths] << setw(8) << c[C_captures] << setw(10) << c[C_shots]
+                 << std::setprecision(1) << setw(8) << (c[C_shots] ? 100 * c[C_hits] / c[C_shots] : 0.) << '\n';
+        }
+        return;
+    }
+    cout << std::left << setw(grouping == G_map ? 24 : 17) << (grouping == G_map ? "map" : "period") << std::right
+         << setw(10) << "minutes" << setw(8) << "humans" << setw(8) << "bots" << setw(10) << "tick ms" << setw(10) << "max ms"
+         << setw(8) << "kills" << setw(8) << "caps" << setw(10) << "shots" << '\n';
+    for (map<string, Totals>::const_iterator gi = groups.begin(); gi != groups.end(); ++gi) {
+        const Totals& t = gi->second;
+        const double secs = t.seconds ? t.seconds : 1;
+        cout << std::left << setw(grouping == G_map ? 24 : 17) << gi->first << std::right << std::setprecision(1)
+             << setw(10) << t.seconds / 60 << setw(8) << t.humanSeconds / secs << setw(8) << t.botSeconds / secs
+             << std::setprecision(3) << setw(10) << (t.frames ? t.tickTotalUs / t.frames / 1000 : 0.) << setw(10) << t.tickMaxUs / 1000.
+             << std::setprecision(0) << setw(8) << t.counter[C_kills] << setw(8) << t.counter[C_captures] << setw(10) << t.counter[C_shots] << '\n';
+    }
+}
+
+int main(int argc, const char* argv[]) {
+    platInit();
+    platInitAfterAllegro();
+    AtScopeExit autoPlatformCleanup(newRedirectToFun0(platUninit));
+
+    const uint32_t today = static_cast<uint32_t>(time(0) / (24 * 3600));
+    uint32_t from = today - 30, to = today;
+    Grouping grouping = G_day;
+    string dir = string("server_stats") + directory_separator + "stream";
+    bool ok = true;
+    for (int i = 1; i < argc && ok; ++i) {
+        const string arg = argv[i];
+        if ((arg == "-from" || arg == "-to") && i + 1 < argc)
+            ok = parseDay(argv[++i], arg == "-from" ? from : to);
+        else if (arg == "-by" && i + 1 < argc) {
+            const string g = argv[++i];
+            if (g == "hour")
+                grouping = G_hour;
+            else if (g == "day")
+                grouping = G_day;
+            else if (g == "map")
+                grouping = G_map;
+            else if (g == "player")
+                grouping = G_player;
+            else
+                ok = false;
+        }
+        else if (i == argc - 1 && arg[0] != '-')
+            dir = arg;
+        else
+            ok = false;
+    }
+    if (!ok || from > to) {
+        cout << "Outgun statistics stream query " << getVersionString() << "\n"
+                "Usage: statsquery [-from YYYY-MM-DD] [-to YYYY-MM-DD] [-by hour|day|map|player] [directory]\n"
+                "Sums the statistics records of the server in the given days (default: the last 30 days, UTC),\n"
+                "grouped as asked (default: by day). The directory defaults to server_stats/stream.\n";
+        return 1;
+    }
+    Query query(grouping);
+    for (uint32_t day = from; day <= to; ++day)
+        query.readFile(dir + directory_separator + fileName(day));
+    query.print();
+    return 0;
+}
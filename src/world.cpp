@@ -34,7 +34,7 @@
 
 #include "binaryaccess.h"
 #include "language.h"
-#include "mapgen.h"
+#include "mapindex.h"
 #include "network.h"    // for safeReadFloat, safeWriteFloat
 #include "platform.h"   // for FileFinder
 #include "timer.h"
@@ -775,15 +775,14 @@ bool Map::parse_line(LogSet& log, const string& line, const vector<pair<string,
 MapInfo::MapInfo() throw () : random(false), over_edge(false), votes(0), sentVotes(0), last_game(0), highlight(false) { }
 
 bool MapInfo::load(LogSet& log, const string& mapName) throw () {
-    Map map;
-    const bool ok = map.load(log, SERVER_MAPS_DIR, mapName);
-    if (!ok)
+    MapIndex::Entry map;
+    if (!g_serverMapIndex.lookup(log, mapName, map))
         return false;
     file = mapName;
     title = map.title;
     author = map.author;
-    width = map.w;
-    height = map.h;
+    width = map.width;
+    height = map.height;
     random = false;
     over_edge = false;
     votes = sentVotes = 0;
@@ -1606,6 +1605,10 @@ void ServerWorld::reset() throw () {
     teams[1].clear_stats();
 
     WorldBase::reset();
+    if (rocketSlots.peak() > 0)
+        log("Rockets: at most %d of %d slots used, %u overwritten.", rocketSlots.peak(), MAX_ROCKETS, rocketSlots.overwrites());
+    rocketSlots.reset();
+    rocketSlots.resetCounters();
 
     for (int i = 0; i < maxplayers; i++)
         if (player[i].used) {
@@ -1660,16 +1663,9 @@ void ServerWorld::printTimeStatus(LineReceiver& printer) throw () {
     printer(map_time.str());
 }
 
-void ServerWorld::generate_map(const string& mapdir, const string& file_name, int width, int height, float over_edge, const string& title, const string& author) throw () {
-    MapGenerator generator;
-    generator.generate(width, height, rand() % 1000 < 1000 * over_edge);
-    ofstream out((mapdir + directory_separator + file_name + ".txt").c_str(), ios::binary);
-    generator.save_map(out, title, author);
-}
-
-bool ServerWorld::load_map(const string& mapdir, const string& mapname, string* buffer) throw () {
+void ServerWorld::set_map(const Map& newMap) throw () {
     map_start_time = frame;
-    const bool success = WorldBase::load_map(log, mapdir, mapname, buffer);
+    map = newMap;
     for (int t = 0; t < 2; t++) {
         teams[t].remove_flags();
         for (vector<WorldCoords>::const_iterator pi = map.tinfo[t].flags.begin(); pi != map.tinfo[t].flags.end(); ++pi)
@@ -1678,7 +1674,6 @@ bool ServerWorld::load_map(const string& mapdir, const string& mapname, string*
     wild_flags.clear();
     for (vector<WorldCoords>::const_iterator pi = map.wild_flags.begin(); pi != map.wild_flags.end(); ++pi)
         wild_flags.push_back(*pi);
-    return success;
 }
 
 void ServerWorld::returnAllFlags() throw () {
@@ -2141,8 +2136,10 @@ void ServerWorld::game_player_screen_change(int p) throw () {
                 net->sendPowerupVisible(p, i, item[i]);
     }
     // check for rockets visible to the new room
+    updateVisibility();
+    visibility.place(p, player[p].roomx, player[p].roomy, player[p].protocolExtensionsLevel < 0);
     for (int i = 0; i < MAX_ROCKETS; ++i)
-        if (rock[i].owner != -1 && !(rock[i].vislist & (1u << p)) && doesPlayerSeeRocket(player[p], rock[i].px, rock[i].py)) {
+        if (rock[i].owner != -1 && !(rock[i].vislist & (1u << p)) && visibility.sees(p, rock[i].px, rock[i].py)) {
             rock[i].vislist |= (1u << p);
             net->sendOldRocketVisible(p, i, rock[i]);
         }
@@ -2308,6 +2305,7 @@ void ServerWorld::removePlayer(int pid) throw () {
 
     dropFlagIfAny(pid, true);
 
+    visibility.remove(pid);
     player[pid].used = false;
 }
 
@@ -2329,28 +2327,162 @@ void ServerWorld::suicide(int pid) throw () {
     killPlayer(pid, true);
 }
 
+void RocketSlots::reset() throw () {
+    for (int i = 0; i < MAX_ROCKETS; ++i) {
+        inUse[i] = false;
+        freeSlot[i] = static_cast<uint8_t>(MAX_ROCKETS - 1 - i);    // the lowest slots are taken first
+    }
+    nFree = MAX_ROCKETS;
+    nUsed = 0;
+    oldest = newest = -1;
+}
+
+int RocketSlots::take(bool& overwrite) throw () {
+    int slot;
+    overwrite = (nFree == 0);
+    if (overwrite) {
+        slot = oldest;  // unlink it to be linked again as the newest
+        oldest = next[slot];
+        if (oldest == -1)
+            newest = -1;
+        else
+            prev[oldest] = -1;
+        ++nOverwrites;
+    }
+    else {
+        slot = freeSlot[--nFree];
+        inUse[slot] = true;
+        if (++nUsed > peakUsed)
+            peakUsed = nUsed;
+    }
+    prev[slot] = static_cast<int16_t>(newest);
+    next[slot] = -1;
+    if (newest == -1)
+        oldest = slot;
+    else
+        next[newest] = static_cast<int16_t>(slot);
+    newest = slot;
+    return slot;
+}
+
+void RocketSlots::release(int slot) throw () {
+    numAssert(slot >= 0 && slot < MAX_ROCKETS, slot);
+    if (!inUse[slot])
+        return;
+    if (prev[slot] == -1)
+        oldest = next[slot];
+    else
+        next[prev[slot]] = next[slot];
+    if (next[slot] == -1)
+        newest = prev[slot];
+    else
+        prev[next[slot]] = prev[slot];
+    inUse[slot] = false;
+    freeSlot[nFree++] = static_cast<uint8_t>(slot);
+    --nUsed;
+}
+
 uint8_t ServerWorld::getFreeRocket() throw () {
-    for (int i = 0; i < MAX_ROCKETS; i++)
-        if (rock[i].owner == -1) {
-            rock[i].owner = 0;
-            return i;
-        }
-    log("Rocket overwrite!");
-    const int i = rand() % MAX_ROCKETS;
+    bool overwrite;
+    const int i = rocketSlots.take(overwrite);
+    if (overwrite)  // the clients that see the old rocket must forget it
+        net->sendRocketDeletion(rock[i].vislist, i, 0, 0, 255);
     rock[i].owner = 0;
     return i;
 }
 
-bool ServerWorld::doesPlayerSeeRocket(ServerPlayer& pl, int roomx, int roomy) const throw () {
-    if (pl.protocolExtensionsLevel < 0) // older clients can't show other rooms anyway, and will play some sounds for all rockets
-        return pl.roomx == roomx && pl.roomy == roomy;
-    int dx = positiveModulo(pl.roomx - roomx, map.w),
-        dy = positiveModulo(pl.roomy - roomy, map.h);
-    if (dx > map.w / 2)
-        dx = map.w - dx;
-    if (dy > map.h / 2)
-        dy = map.h - dy;
-    return dx + dy <= config.see_rockets_distance;
+void RoomVisibility::setMap(int mapW, int mapH, int seeDistance) throw () {
+    if (mapW == w && mapH == h && seeDistance == distance)
+        return;
+    if (mapW != w || mapH != h)
+        clearPlayers();
+    w = mapW;
+    h = mapH;
+    distance = seeDistance;
+    seen.assign(w * h, false);
+    for (int dy = 0; dy < h; ++dy)
+        for (int dx = 0; dx < w; ++dx)
+            seen[dy * w + dx] = min(dx, w - dx) + min(dy, h - dy) <= distance;
+}
+
+void RoomVisibility::clearPlayers() throw () {
+    occupied.clear();
+    for (int i = 0; i < MAX_PLAYERS; ++i)
+        placement[i].placed = false;
+}
+
+void RoomVisibility::place(int pid, int roomx, int roomy, bool legacy) throw () {
+    remove(pid);
+    vector<Occupied>::iterator oi = occupied.begin();
+    while (oi != occupied.end() && (oi->x != roomx || oi->y != roomy))
+        ++oi;
+    if (oi == occupied.end()) {
+        const Occupied room = { roomx, roomy, 0, 0 };
+        oi = occupied.insert(oi, room);
+    }
+    oi->players |= 1u << pid;
+    if (legacy)
+        oi->legacy |= 1u << pid;
+    Placement& p = placement[pid];
+    p.placed = true;
+    p.x = roomx;
+    p.y = roomy;
+    p.legacy = legacy;
+}
+
+void RoomVisibility::remove(int pid) throw () {
+    Placement& p = placement[pid];
+    if (!p.placed)
+        return;
+    p.placed = false;
+    for (vector<Occupied>::iterator oi = occupied.begin(); oi != occupied.end(); ++oi)
+        if (oi->x == p.x && oi->y == p.y) {
+            oi->players &= ~(1u << pid);
+            oi->legacy &= ~(1u << pid);
+            if (!oi->players) {
+                *oi = occupied.back();
+                occupied.pop_back();
+            }
+            return;
+        }
+    nAssert(0);
+}
+
+void RoomVisibility::movePlayer(int source, int target) throw () {
+    const Placement p = placement[source];
+    remove(source);
+    remove(target);
+    if (p.placed)
+        place(target, p.x, p.y, p.legacy);
+}
+
+void RoomVisibility::swapPlayers(int a, int b) throw () {
+    const Placement pa = placement[a], pb = placement[b];
+    remove(a);
+    remove(b);
+    if (pb.placed)
+        place(a, pb.x, pb.y, pb.legacy);
+    if (pa.placed)
+        place(b, pa.x, pa.y, pa.legacy);
+}
+
+uint32_t RoomVisibility::viewers(int roomx, int roomy) const throw () {
+    uint32_t mask = 0;
+    for (vector<Occupied>::const_iterator oi = occupied.begin(); oi != occupied.end(); ++oi)
+        if (oi->x == roomx && oi->y == roomy)
+            mask |= oi->players;
+        else if (visible(oi->x, oi->y, roomx, roomy))
+            mask |= oi->players & ~oi->legacy;
+    return mask;
+}
+
+bool RoomVisibility::sees(int pid, int roomx, int roomy) const throw () {
+    const Placement& p = placement[pid];
+    if (!p.placed)
+        return false;
+    if (p.x == roomx && p.y == roomy)
+        return true;
+    return !p.legacy && visible(p.x, p.y, roomx, roomy);    // older clients can't show other rooms anyway, and will play some sounds for all rockets
 }
 
 void ServerWorld::shootRockets(int pid, int shots) throw () {
@@ -2367,11 +2499,8 @@ void ServerWorld::shootRockets(int pid, int shots) throw () {
     WorldBase::shootRockets(cb, pid, shots, player[pid].attackGunDir, sid, 0, pid/TSIZE, player[pid].item_power, px, py, x, y);
 
     //build people-that-know DOUBLE WORD (32bits == 32players max)
-    //send message to players on the same screen
-    uint32_t vislist = 0;
-    for (int p = 0; p < maxplayers; p++)
-        if (player[p].used && doesPlayerSeeRocket(player[p], px, py))
-            vislist |= (1u << p);
+    updateVisibility();
+    const uint32_t vislist = visibility.viewers(px, py);
 
     //mark all created rockets with the vislist
     for (int k = 0; k < shots; k++)
@@ -2383,10 +2512,11 @@ void ServerWorld::shootRockets(int pid, int shots) throw () {
 void ServerWorld::deleteRocket(int rid, int16_t hitx, int16_t hity, int targ) throw () {
     Rocket& r = rock[rid];
     net->sendRocketDeletion(r.vislist, rid, hitx, hity, targ);
-    r.owner = -1;
+    freeRocket(rid);
 }
 
 void ServerWorld::changeEmbeddedPids(int source, int target) throw () {
+    visibility.movePlayer(source, target);
     for (int i = 0; i < MAX_ROCKETS; i++) {
         if (rock[i].owner == source)
             rock[i].owner = target;
@@ -2402,6 +2532,7 @@ void ServerWorld::changeEmbeddedPids(int source, int target) throw () {
 }
 
 void ServerWorld::swapEmbeddedPids(int a, int b) throw () {
+    visibility.swapPlayers(a, b);
     for (int i = 0; i < MAX_ROCKETS; i++) {
         if (rock[i].owner == a)
             rock[i].owner = b;
@@ -2434,7 +2565,7 @@ void ServerWorld::playerScreenChangeCallback(int pid) throw () {
 }
 
 void ServerWorld::rocketHitWallCallback(int rid) throw () {
-    rock[rid].owner = -1;
+    freeRocket(rid);
 }
 
 bool ServerWorld::rocketHitPlayerCallback(int rid, int pid) throw () {
@@ -2599,7 +2730,7 @@ PhysicsCallbacksBase::PlayerHitResult ServerWorld::playerHitPlayerCallback(int p
 }
 
 void ServerWorld::rocketOutOfBoundsCallback(int rid) throw () {
-    rock[rid].owner = -1;
+    freeRocket(rid);
 }
 
 bool ServerWorld::shouldApplyPhysicsToPlayerCallback(int pid) throw () {
@@ -3525,8 +3656,13 @@ void ClientWorld::extrapolate(ClientWorld& source, PhysicsCallbacksBase& physCal
 // Save stats in HTML file.
 void WorldBase::save_stats(const string& dir, const string& map_name) const throw () {
     const string date_time = date_and_time();
+    ostringstream html;
+    write_stats(html, date_time, map_name);
+    append_stats(dir, date_time, html.str());
+}
+
+void WorldBase::append_stats(const string& dir, const string& date_time, const string& html) throw () {
     const string date = date_time.substr(0, date_time.find(' '));
-    const string time = date_time.substr(date_time.find(' ') + 1);
     const string filename = wheregamedir + dir + directory_separator + date + ".html";
     // Check if the stats file exists.
     ifstream in(filename.c_str());
@@ -3546,6 +3682,12 @@ void WorldBase::save_stats(const string& dir, const string& map_name) const thro
         out << "<LINK REL=\"stylesheet\" HREF=\"stats.css\" TYPE=\"text/css\" TITLE=\"Outgun statistics style\">\n\n";
         out << "<H1>Outgun statistics " << date << "</H1>\n\n";
     }
+    out << html;
+}
+
+void WorldBase::write_stats(ostream& out, const string& date_time, const string& map_name) const throw () {
+    const string date = date_time.substr(0, date_time.find(' '));
+    const string time = date_time.substr(date_time.find(' ') + 1);
     out << "<H2 ID=\"d" << date << 'T' << time << "\">" << time << ' ' << escape_for_html(map_name) << "</H2>\n\n";
 
     out << "<H3>Team stats</H3>\n\n";
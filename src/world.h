@@ -851,6 +851,10 @@ public:
     virtual void stealFlag(int team, int flag, int carrier) throw ();
 
     void save_stats(const std::string& dir, const std::string& map_name) const throw ();
+    /// Render the stats of the game as HTML, to be passed to append_stats.
+    void write_stats(std::ostream& out, const std::string& date_time, const std::string& map_name) const throw ();
+    /// Append HTML from write_stats to the stats file of the day. Doesn't access any world, so it can be called from any thread.
+    static void append_stats(const std::string& dir, const std::string& date_time, const std::string& html) throw ();
 
     void addDeathbringerExplosion(const DeathbringerExplosion& db) throw () { dbExplosions.push_back(db); }
     void cleanOldDeathbringerExplosions() throw ();
@@ -984,6 +988,80 @@ public:
 class ServerNetworking;
 class Server;   //#fix: get rid of non-networking callbacks?
 
+/** Which players see the rockets in each room, for the server.
+ * Whether a room is seen from another depends only on their offset on the torus map, so the visibility table has an
+ * entry per offset, built when the map size or the seeing distance changes. The players are kept in masks of the
+ * occupied rooms, updated as they change rooms, so that finding who sees a room takes a mask per occupied room.
+ * Players with older clients only see their own room.
+ */
+class RoomVisibility {
+public:
+    RoomVisibility() throw () : w(0), h(0), distance(-1) { clearPlayers(); }
+
+    /// Rebuild the table if the parameters have changed; the players are removed if the map size has.
+    void setMap(int mapW, int mapH, int seeDistance) throw ();
+
+    void clearPlayers() throw ();
+    void place(int pid, int roomx, int roomy, bool legacy) throw ();  // add the player or move it to another room
+    void remove(int pid) throw ();                                      // does nothing if the player isn't placed
+    void movePlayer(int source, int target) throw ();   // the player has got a new id
+    void swapPlayers(int a, int b) throw ();
+
+    uint32_t viewers(int roomx, int roomy) const throw ();  // mask of the players that see the room
+    bool sees(int pid, int roomx, int roomy) const throw ();
+
+private:
+    struct Occupied {
+        int x, y;
+        uint32_t players;   // all those in the room
+        uint32_t legacy;    // those of players that only see this room
+    };
+    struct Placement {
+        bool placed;
+        int x, y;
+        bool legacy;
+    };
+
+    bool visible(int fromX, int fromY, int toX, int toY) const throw () {
+        const int dx = fromX >= toX ? fromX - toX : fromX - toX + w, dy = fromY >= toY ? fromY - toY : fromY - toY + h;
+        return seen[dy * w + dx];
+    }
+
+    int w, h, distance;
+    std::vector<bool> seen;     // [dy * w + dx] for the offsets in [0, w)  [0, h)
+    std::vector<Occupied> occupied;
+    Placement placement[MAX_PLAYERS];
+};
+
+/** Constant time allocator of the server's rocket table slots.
+ * Free slots are kept in a stack and the used ones in a list in the order they were taken, so that when the table
+ * is full, the oldest rocket can be overwritten.
+ */
+class RocketSlots {
+public:
+    RocketSlots() throw () { reset(); resetCounters(); }
+
+    void reset() throw ();          // free all slots
+    void resetCounters() throw () { peakUsed = nUsed; nOverwrites = 0; }
+
+    /// Take a free slot, or if there are none, the oldest used one, which is counted as an overwrite.
+    int take(bool& overwrite) throw ();
+    void release(int slot) throw ();    // does nothing if the slot is free
+
+    int used() const throw () { return nUsed; }
+    int peak() const throw () { return peakUsed; }   // since resetCounters()
+    unsigned overwrites() const throw () { return nOverwrites; }
+
+private:
+    int16_t prev[MAX_ROCKETS], next[MAX_ROCKETS];   // links of the used slots from oldest to newest, -1 ending
+    bool inUse[MAX_ROCKETS];
+    uint8_t freeSlot[MAX_ROCKETS];  // stack of the free slots, the first nFree of them
+    int nFree, nUsed;
+    int oldest, newest;             // -1 if no slots are used
+    int peakUsed;
+    unsigned nOverwrites;
+};
+
 class ServerWorld : public WorldBase {
     Server* host;
     ServerNetworking* net;
@@ -991,8 +1069,13 @@ class ServerWorld : public WorldBase {
     WorldSettings config;
     LogSet log;
 
-    uint8_t getFreeRocket() throw ();    // may give an existing rocket to overwrite if the table is full
-    bool doesPlayerSeeRocket(ServerPlayer& pl, int roomx, int roomy) const throw ();
+    RocketSlots rocketSlots;
+    RoomVisibility visibility;  // of the rooms to players, for sending rockets
+
+    void updateVisibility() throw () { visibility.setMap(map.w, map.h, config.see_rockets_distance); }
+
+    uint8_t getFreeRocket() throw ();    // overwrites the oldest rocket if the table is full
+    void freeRocket(int rid) throw () { rock[rid].owner = -1; rocketSlots.release(rid); }
     void drop_powerup(const ServerPlayer& player) throw ();
     void drop_worst_powerup(ServerPlayer& player) throw ();
 
@@ -1025,8 +1108,7 @@ public:
 
     // common (virtual in base) extended functions
     void reset() throw ();
-    void generate_map(const std::string& mapdir, const std::string& file_name, int width, int height, float over_edge, const std::string& title, const std::string& author) throw ();
-    bool load_map(const std::string& mapdir, const std::string& mapname, std::string* buffer) throw ();
+    void set_map(const Map& newMap) throw ();
     void returnAllFlags() throw ();
     void returnFlag(int team, int flag) throw ();
     void dropFlag(int team, int flag, int roomx, int roomy, double lx, double ly) throw ();